@@ -0,0 +1,609 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <appendlogdb.h>
+
+#include <crypto/common.h>
+#include <crypto/siphash.h>
+#include <memusage.h>
+#include <util/system.h>
+
+#include <leveldb/iterator.h>
+#include <leveldb/write_batch.h>
+
+#include <errno.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+const char* const CAppendLogDB::FILENAME = "appendlog.dat";
+
+//! Size of the header of a log record: payload size and checksum
+static const size_t RECORD_HEADER_SIZE = 8;
+//! Maximum size of the payload of a record, and so of a write batch
+static const uint32_t MAX_RECORD_SIZE = 1 << 30;
+//! Maximum size of the payload of a record written when the log is rewritten
+static const size_t REWRITE_RECORD_SIZE = 1 << 20;
+//! The log is only rewritten once it is at least this large
+static const uint64_t MIN_REWRITE_LOG_SIZE = 64 << 20;
+
+static const unsigned char OP_PUT = 1;
+static const unsigned char OP_DELETE = 2;
+
+struct CAppendLogDB::LogFile {
+    //! Serializes appends, and on Windows reads too
+    std::mutex mutex;
+    FILE* file;
+
+    explicit LogFile(FILE* file_in) : file(file_in) {}
+    ~LogFile() { fclose(file); }
+};
+
+static bool SeekFile(FILE* file, uint64_t pos)
+{
+#ifdef WIN32
+    return _fseeki64(file, pos, SEEK_SET) == 0;
+#else
+    return fseeko(file, pos, SEEK_SET) == 0;
+#endif
+}
+
+static bool TruncateLog(FILE* file, uint64_t length)
+{
+#ifdef WIN32
+    return _chsize_s(_fileno(file), length) == 0;
+#else
+    return ftruncate(fileno(file), length) == 0;
+#endif
+}
+
+static uint32_t Checksum(const std::string& payload)
+{
+    return CSipHasher(0, 0).Write(reinterpret_cast<const unsigned char*>(payload.data()), payload.size()).Finalize();
+}
+
+static void AppendLE32(std::string& str, uint32_t x)
+{
+    unsigned char buf[4];
+    WriteLE32(buf, x);
+    str.append(reinterpret_cast<const char*>(buf), sizeof(buf));
+}
+
+static void AppendPut(std::string& payload, const leveldb::Slice& key, const leveldb::Slice& value)
+{
+    payload.push_back(OP_PUT);
+    AppendLE32(payload, key.size());
+    AppendLE32(payload, value.size());
+    payload.append(key.data(), key.size());
+    payload.append(value.data(), value.size());
+}
+
+static leveldb::Status ReadAt(CAppendLogDB::LogFile& log, uint64_t offset, uint32_t size, std::string& value)
+{
+    value.resize(size);
+#ifdef WIN32
+    std::lock_guard<std::mutex> lock(log.mutex);
+    if (!SeekFile(log.file, offset) || (size > 0 && fread(&value[0], 1, size, log.file) != size)) {
+        return leveldb::Status::IOError("Failed to read from the append log");
+    }
+#else
+    // Reads at a position leave the file offset alone, so they run concurrently with each other and with appends.
+    const int fd = fileno(log.file);
+    for (size_t done = 0; done < size; ) {
+        const ssize_t n = pread(fd, &value[done], size - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return leveldb::Status::IOError("Failed to read from the append log");
+        }
+        done += n;
+    }
+#endif
+    return leveldb::Status::OK();
+}
+
+//! The entry of a key as of a write batch, or nullptr if the key did not exist then
+static const CAppendLogDB::Entry* Visible(const CAppendLogDB::Versions& versions, uint64_t seq)
+{
+    const CAppendLogDB::Entry* entry = nullptr;
+    if (versions.latest.seq <= seq) {
+        entry = &versions.latest;
+    } else {
+        for (auto it = versions.older.rbegin(); it != versions.older.rend(); ++it) {
+            if (it->seq <= seq) {
+                entry = &*it;
+                break;
+            }
+        }
+    }
+    return entry && !entry->erased ? entry : nullptr;
+}
+
+namespace {
+
+/** Serializes a write batch into the payload of a log record */
+class PayloadBuilder : public leveldb::WriteBatch::Handler
+{
+public:
+    std::string payload;
+
+    void Put(const leveldb::Slice& key, const leveldb::Slice& value) override
+    {
+        AppendPut(payload, key, value);
+    }
+
+    void Delete(const leveldb::Slice& key) override
+    {
+        payload.push_back(OP_DELETE);
+        AppendLE32(payload, key.size());
+        payload.append(key.data(), key.size());
+    }
+};
+
+class AppendLogSnapshot : public leveldb::Snapshot
+{
+public:
+    //! Sequence number of the last write batch the snapshot sees
+    const uint64_t seq;
+
+    explicit AppendLogSnapshot(uint64_t seq_in) : seq(seq_in) {}
+};
+
+} // namespace
+
+class CAppendLogDB::Iterator : public leveldb::Iterator
+{
+private:
+    CAppendLogDB& m_db;
+    const uint64_t m_seq;
+    const std::shared_ptr<LogFile> m_file;
+    //! Position in the index. The key it points to is not removed while the iterator is open.
+    Index::const_iterator m_it;
+    //! Entry of the current key as of m_seq
+    Entry m_entry;
+    //! Value of the current entry, read from the log on first access
+    mutable std::string m_value;
+    mutable bool m_value_read;
+    mutable leveldb::Status m_status;
+
+    //! Whether the key at m_it existed as of m_seq, loading its entry if so. The
+    //! positioning functions below require the database's m_mutex.
+    bool Load()
+    {
+        const Entry* entry = Visible(m_it->second, m_seq);
+        if (entry) m_entry = *entry;
+        return entry != nullptr;
+    }
+
+    //! Move from m_it in either direction to the first key that existed as of m_seq
+    void SkipForward()
+    {
+        while (m_it != m_db.m_index.end() && !Load()) ++m_it;
+        m_value_read = false;
+    }
+
+    void SkipBackward()
+    {
+        while (m_it != m_db.m_index.end() && !Load()) {
+            m_it = m_it == m_db.m_index.begin() ? m_db.m_index.end() : std::prev(m_it);
+        }
+        m_value_read = false;
+    }
+
+public:
+    //! Requires the database's m_mutex
+    Iterator(CAppendLogDB& db, uint64_t seq) :
+        m_db(db), m_seq(seq), m_file(db.m_file), m_it(db.m_index.end()), m_value_read(false)
+    {
+        m_db.AddReader(m_seq);
+    }
+
+    ~Iterator()
+    {
+        std::lock_guard<std::mutex> lock(m_db.m_mutex);
+        m_db.RemoveReader(m_seq);
+    }
+
+    bool Valid() const override { return m_it != m_db.m_index.end(); }
+
+    void SeekToFirst() override
+    {
+        std::lock_guard<std::mutex> lock(m_db.m_mutex);
+        m_it = m_db.m_index.begin();
+        SkipForward();
+    }
+
+    void SeekToLast() override
+    {
+        std::lock_guard<std::mutex> lock(m_db.m_mutex);
+        m_it = m_db.m_index.empty() ? m_db.m_index.end() : std::prev(m_db.m_index.end());
+        SkipBackward();
+    }
+
+    void Seek(const leveldb::Slice& target) override
+    {
+        std::lock_guard<std::mutex> lock(m_db.m_mutex);
+        m_it = m_db.m_index.lower_bound(target.ToString());
+        SkipForward();
+    }
+
+    void Next() override
+    {
+        std::lock_guard<std::mutex> lock(m_db.m_mutex);
+        ++m_it;
+        SkipForward();
+    }
+
+    void Prev() override
+    {
+        std::lock_guard<std::mutex> lock(m_db.m_mutex);
+        m_it = m_it == m_db.m_index.begin() ? m_db.m_index.end() : std::prev(m_it);
+        SkipBackward();
+    }
+
+    leveldb::Slice key() const override { return m_it->first; }
+
+    leveldb::Slice value() const override
+    {
+        if (!m_value_read) {
+            leveldb::Status status = ReadAt(*m_file, m_entry.offset, m_entry.size, m_value);
+            if (!status.ok()) {
+                m_status = status;
+                m_value.clear();
+            }
+            m_value_read = true;
+        }
+        return m_value;
+    }
+
+    leveldb::Status status() const override { return m_status; }
+};
+
+CAppendLogDB::CAppendLogDB(const fs::path& path) :
+    m_path(path), m_seq(0), m_log_size(0), m_live_bytes(0), m_key_bytes(0) {}
+
+CAppendLogDB::~CAppendLogDB() {}
+
+leveldb::Status CAppendLogDB::Open(const fs::path& path, leveldb::DB** dbptr)
+{
+    *dbptr = nullptr;
+    const fs::path log_path = path / FILENAME;
+    FILE* file = fsbridge::fopen(log_path, "r+b");
+    if (!file) file = fsbridge::fopen(log_path, "w+b");
+    if (!file) {
+        return leveldb::Status::IOError("Failed to open " + log_path.string());
+    }
+    std::unique_ptr<CAppendLogDB> db(new CAppendLogDB(path));
+    db->m_file = std::make_shared<LogFile>(file);
+    leveldb::Status status = db->Replay();
+    if (!status.ok()) return status;
+    *dbptr = db.release();
+    return leveldb::Status::OK();
+}
+
+leveldb::Status CAppendLogDB::Destroy(const fs::path& path)
+{
+    try {
+        fs::remove(path / FILENAME);
+    } catch (const fs::filesystem_error& e) {
+        return leveldb::Status::IOError(e.what());
+    }
+    return leveldb::Status::OK();
+}
+
+bool CAppendLogDB::ApplyPayload(const std::string& payload, uint64_t payload_offset)
+{
+    const uint64_t seq = ++m_seq;
+    size_t pos = 0;
+    while (pos < payload.size()) {
+        const unsigned char op = payload[pos];
+        const size_t header_size = op == OP_PUT ? 9 : 5;
+        if ((op != OP_PUT && op != OP_DELETE) || payload.size() - pos < header_size) return false;
+        const uint32_t key_size = ReadLE32(reinterpret_cast<const unsigned char*>(&payload[pos + 1]));
+        const uint32_t value_size = op == OP_PUT ? ReadLE32(reinterpret_cast<const unsigned char*>(&payload[pos + 5])) : 0;
+        pos += header_size;
+        if (payload.size() - pos < (uint64_t)key_size + value_size) return false;
+        std::string key = payload.substr(pos, key_size);
+        pos += key_size;
+        const Entry entry{payload_offset + pos, value_size, seq, op == OP_DELETE};
+        pos += value_size;
+
+        auto it = m_index.find(key);
+        if (it == m_index.end()) {
+            if (entry.erased) continue;
+            m_key_bytes += key.size();
+            it = m_index.emplace(std::move(key), Versions{entry, {}}).first;
+        } else {
+            Versions& versions = it->second;
+            if (!versions.latest.erased) m_live_bytes -= it->first.size() + versions.latest.size;
+            if (m_readers.empty()) {
+                if (entry.erased) {
+                    m_key_bytes -= it->first.size();
+                    m_index.erase(it);
+                    continue;
+                }
+                versions.latest = entry;
+            } else {
+                // Keep what snapshots and iterators see, and the key itself, until they are released.
+                if (versions.older.empty() && !versions.latest.erased) m_versioned_keys.push_back(it->first);
+                versions.older.push_back(versions.latest);
+                versions.latest = entry;
+                PruneVersions(versions);
+            }
+        }
+        if (!entry.erased) m_live_bytes += it->first.size() + entry.size;
+    }
+    return true;
+}
+
+void CAppendLogDB::PruneVersions(Versions& versions) const
+{
+    // An entry is seen as of its own write batch until the one that replaced it.
+    size_t kept = 0;
+    for (size_t i = 0; i < versions.older.size(); ++i) {
+        const uint64_t replaced = i + 1 < versions.older.size() ? versions.older[i + 1].seq : versions.latest.seq;
+        const auto reader = m_readers.lower_bound(versions.older[i].seq);
+        if (reader != m_readers.end() && *reader < replaced) {
+            versions.older[kept++] = versions.older[i];
+        }
+    }
+    versions.older.resize(kept);
+}
+
+void CAppendLogDB::AddReader(uint64_t seq)
+{
+    m_readers.insert(seq);
+}
+
+void CAppendLogDB::RemoveReader(uint64_t seq)
+{
+    m_readers.erase(m_readers.find(seq));
+    if (!m_readers.empty()) return;
+    for (const std::string& key : m_versioned_keys) {
+        auto it = m_index.find(key);
+        if (it == m_index.end()) continue;
+        std::vector<Entry>().swap(it->second.older);
+        if (it->second.latest.erased) {
+            m_key_bytes -= it->first.size();
+            m_index.erase(it);
+        }
+    }
+    std::vector<std::string>().swap(m_versioned_keys);
+}
+
+leveldb::Status CAppendLogDB::Replay()
+{
+    const fs::path log_path = m_path / FILENAME;
+    uint64_t file_size;
+    try {
+        file_size = fs::file_size(log_path);
+    } catch (const fs::filesystem_error& e) {
+        return leveldb::Status::IOError(e.what());
+    }
+    FILE* file = m_file->file;
+    uint64_t pos = 0;
+    std::string payload;
+    while (pos < file_size) {
+        // Only a record that does not fit in the rest of the log is the result of an interrupted write.
+        unsigned char header[RECORD_HEADER_SIZE];
+        bool torn = file_size - pos < RECORD_HEADER_SIZE;
+        if (!torn) {
+            if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+                return leveldb::Status::IOError("Failed to read " + log_path.string());
+            }
+            if (ReadLE32(header) > MAX_RECORD_SIZE) {
+                return leveldb::Status::Corruption(strprintf("Oversized record at offset %u of %s", pos, log_path.string()));
+            }
+            torn = file_size - pos - RECORD_HEADER_SIZE < ReadLE32(header);
+        }
+        if (torn) {
+            LogPrintf("%s: Dropping an incomplete record at the end of %s\n", __func__, log_path.string());
+            if (!TruncateLog(file, pos)) {
+                return leveldb::Status::IOError("Failed to truncate " + log_path.string());
+            }
+            break;
+        }
+        const uint32_t size = ReadLE32(header);
+        payload.resize(size);
+        if (size > 0 && fread(&payload[0], 1, size, file) != size) {
+            return leveldb::Status::IOError("Failed to read " + log_path.string());
+        }
+        if (Checksum(payload) != ReadLE32(header + 4) || !ApplyPayload(payload, pos + RECORD_HEADER_SIZE)) {
+            return leveldb::Status::Corruption(strprintf("Bad record at offset %u of %s", pos, log_path.string()));
+        }
+        pos += RECORD_HEADER_SIZE + size;
+    }
+    m_log_size = pos;
+    LogPrintf("Replayed %s: %u entries, %u of %u bytes live\n", log_path.string(), m_index.size(), m_live_bytes, m_log_size);
+    return leveldb::Status::OK();
+}
+
+leveldb::Status CAppendLogDB::Append(const std::string& payload, bool sync, uint64_t& payload_offset)
+{
+    std::string header;
+    AppendLE32(header, payload.size());
+    AppendLE32(header, Checksum(payload));
+
+    std::lock_guard<std::mutex> lock(m_file->mutex);
+    FILE* file = m_file->file;
+    if (!SeekFile(file, m_log_size) ||
+        fwrite(header.data(), 1, header.size(), file) != header.size() ||
+        fwrite(payload.data(), 1, payload.size(), file) != payload.size() ||
+        fflush(file) != 0 ||
+        (sync && !FileCommit(file))) {
+        return leveldb::Status::IOError("Failed to write to " + (m_path / FILENAME).string());
+    }
+    payload_offset = m_log_size + RECORD_HEADER_SIZE;
+    m_log_size += RECORD_HEADER_SIZE + payload.size();
+    return leveldb::Status::OK();
+}
+
+leveldb::Status CAppendLogDB::Rewrite()
+{
+    // Snapshots and iterators read values at their positions in the current log.
+    if (!m_readers.empty()) return leveldb::Status::OK();
+
+    const fs::path log_path = m_path / FILENAME;
+    const fs::path new_path = m_path / (std::string(FILENAME) + ".new");
+    FILE* new_file = fsbridge::fopen(new_path, "w+b");
+    if (!new_file) {
+        return leveldb::Status::IOError("Failed to create " + new_path.string());
+    }
+    std::shared_ptr<LogFile> old_file = m_file;
+    const uint64_t old_log_size = m_log_size;
+    m_file = std::make_shared<LogFile>(new_file);
+    m_log_size = 0;
+
+    // Copy the live entries into records of a bounded size.
+    Index index;
+    std::string payload;
+    std::vector<std::pair<Index::const_iterator, size_t>> positions;
+    std::string value;
+    leveldb::Status status;
+    for (auto it = m_index.cbegin(); status.ok() && it != m_index.cend(); ++it) {
+        status = ReadAt(*old_file, it->second.latest.offset, it->second.latest.size, value);
+        if (!status.ok()) break;
+        positions.emplace_back(it, payload.size() + 9 + it->first.size());
+        AppendPut(payload, it->first, value);
+        if (payload.size() >= REWRITE_RECORD_SIZE || std::next(it) == m_index.cend()) {
+            uint64_t payload_offset;
+            status = Append(payload, false, payload_offset);
+            for (const auto& position : positions) {
+                const Entry& entry = position.first->second.latest;
+                index.emplace(position.first->first, Versions{Entry{payload_offset + position.second, entry.size, entry.seq, false}, {}});
+            }
+            payload.clear();
+            positions.clear();
+        }
+    }
+    if (status.ok() && (!FileCommit(new_file) || !RenameOver(new_path, log_path))) {
+        status = leveldb::Status::IOError("Failed to replace " + log_path.string());
+    }
+    if (!status.ok()) {
+        m_file = old_file;
+        m_log_size = old_log_size;
+        return status;
+    }
+    LogPrint(BCLog::LEVELDB, "Rewrote %s: %u bytes, was %u\n", log_path.string(), m_log_size, old_log_size);
+    m_index.swap(index);
+    return leveldb::Status::OK();
+}
+
+leveldb::Status CAppendLogDB::Put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value)
+{
+    leveldb::WriteBatch batch;
+    batch.Put(key, value);
+    return Write(options, &batch);
+}
+
+leveldb::Status CAppendLogDB::Delete(const leveldb::WriteOptions& options, const leveldb::Slice& key)
+{
+    leveldb::WriteBatch batch;
+    batch.Delete(key);
+    return Write(options, &batch);
+}
+
+leveldb::Status CAppendLogDB::Write(const leveldb::WriteOptions& options, leveldb::WriteBatch* updates)
+{
+    PayloadBuilder builder;
+    leveldb::Status status = updates->Iterate(&builder);
+    if (!status.ok()) return status;
+    if (builder.payload.size() > MAX_RECORD_SIZE) {
+        return leveldb::Status::InvalidArgument("Write batch too large for " + (m_path / FILENAME).string());
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (builder.payload.empty()) {
+        std::lock_guard<std::mutex> file_lock(m_file->mutex);
+        if (options.sync && !FileCommit(m_file->file)) {
+            return leveldb::Status::IOError("Failed to sync " + (m_path / FILENAME).string());
+        }
+        return leveldb::Status::OK();
+    }
+    uint64_t payload_offset;
+    status = Append(builder.payload, options.sync, payload_offset);
+    if (!status.ok()) return status;
+
+    bool applied = ApplyPayload(builder.payload, payload_offset);
+    assert(applied);
+
+    if (m_log_size >= MIN_REWRITE_LOG_SIZE && m_log_size - m_live_bytes > m_live_bytes) {
+        status = Rewrite();
+        if (!status.ok()) {
+            LogPrintf("%s: %s\n", __func__, status.ToString());
+        }
+    }
+    return leveldb::Status::OK();
+}
+
+leveldb::Status CAppendLogDB::Get(const leveldb::ReadOptions& options, const leveldb::Slice& key, std::string* value)
+{
+    Entry entry;
+    std::shared_ptr<LogFile> file;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const AppendLogSnapshot* snapshot = static_cast<const AppendLogSnapshot*>(options.snapshot);
+        auto it = m_index.find(key.ToString());
+        const Entry* found = it == m_index.end() ? nullptr : Visible(it->second, snapshot ? snapshot->seq : m_seq);
+        if (!found) return leveldb::Status::NotFound(leveldb::Slice());
+        entry = *found;
+        file = m_file;
+    }
+    return ReadAt(*file, entry.offset, entry.size, *value);
+}
+
+leveldb::Iterator* CAppendLogDB::NewIterator(const leveldb::ReadOptions& options)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const AppendLogSnapshot* snapshot = static_cast<const AppendLogSnapshot*>(options.snapshot);
+    return new Iterator(*this, snapshot ? snapshot->seq : m_seq);
+}
+
+const leveldb::Snapshot* CAppendLogDB::GetSnapshot()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    AddReader(m_seq);
+    return new AppendLogSnapshot(m_seq);
+}
+
+void CAppendLogDB::ReleaseSnapshot(const leveldb::Snapshot* snapshot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RemoveReader(static_cast<const AppendLogSnapshot*>(snapshot)->seq);
+    delete static_cast<const AppendLogSnapshot*>(snapshot);
+}
+
+bool CAppendLogDB::GetProperty(const leveldb::Slice& property, std::string* value)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (property == "leveldb.approximate-memory-usage") {
+        *value = std::to_string(memusage::DynamicUsage(m_index) + m_key_bytes);
+        return true;
+    }
+    return false;
+}
+
+void CAppendLogDB::GetApproximateSizes(const leveldb::Range* range, int n, uint64_t* sizes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (int i = 0; i < n; ++i) {
+        sizes[i] = 0;
+        const auto end = m_index.lower_bound(range[i].limit.ToString());
+        for (auto it = m_index.lower_bound(range[i].start.ToString()); it != end; ++it) {
+            if (!it->second.latest.erased) sizes[i] += it->first.size() + it->second.latest.size;
+        }
+    }
+}
+
+void CAppendLogDB::CompactRange(const leveldb::Slice* begin, const leveldb::Slice* end)
+{
+    // The log is always rewritten as a whole.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    leveldb::Status status = Rewrite();
+    if (!status.ok()) {
+        LogPrintf("%s: %s\n", __func__, status.ToString());
+    }
+}
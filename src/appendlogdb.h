@@ -0,0 +1,122 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_APPENDLOGDB_H
+#define BITCOIN_APPENDLOGDB_H
+
+#include <fs.h>
+
+#include <leveldb/db.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * A key-value store made of an append-only log and a sorted in-memory index,
+ * behind the leveldb::DB interface so that a CDBWrapper can use it in place
+ * of LevelDB (see -dboption).
+ *
+ * Every write batch is appended to the log as a single checksummed record,
+ * so writes are sequential and a batch is either replayed entirely or not at
+ * all. The index maps every key to the position of its value in the log and
+ * is rebuilt by replaying the log when the database is opened. As all keys
+ * are held in memory, it only suits databases with a modest number of keys;
+ * it is refused for the chainstate. Once the log holds more overwritten and
+ * erased data than live data, it is rewritten with only the live entries.
+ *
+ * Every write batch gets a sequence number. Snapshots and iterators read the
+ * index as of the batch before they were created: while any exists, a write
+ * keeps the values it replaces that they can still see next to the new one,
+ * and erased keys stay in the index as erased entries. Those are dropped once
+ * the last of them is released. The log is not rewritten while they are in
+ * use. Like with LevelDB, they must be released before the database.
+ */
+class CAppendLogDB final : public leveldb::DB
+{
+public:
+    struct Entry {
+        //! Position of the value in the log
+        uint64_t offset;
+        uint32_t size;
+        //! Sequence number of the write batch that stored or erased the value
+        uint64_t seq;
+        //! Whether the write batch erased the key
+        bool erased;
+    };
+    struct Versions {
+        Entry latest;
+        //! Earlier entries of the key that snapshots or iterators can still see, oldest first
+        std::vector<Entry> older;
+    };
+    typedef std::map<std::string, Versions> Index;
+
+    //! An open log file, shared with the reads in progress
+    struct LogFile;
+
+    //! Name of the log file in the database directory
+    static const char* const FILENAME;
+
+    ~CAppendLogDB();
+
+    /** Open the database in the given directory, replaying its log. */
+    static leveldb::Status Open(const fs::path& path, leveldb::DB** dbptr);
+
+    /** Remove the log of the database in the given directory. */
+    static leveldb::Status Destroy(const fs::path& path);
+
+    leveldb::Status Put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value) override;
+    leveldb::Status Delete(const leveldb::WriteOptions& options, const leveldb::Slice& key) override;
+    leveldb::Status Write(const leveldb::WriteOptions& options, leveldb::WriteBatch* updates) override;
+    leveldb::Status Get(const leveldb::ReadOptions& options, const leveldb::Slice& key, std::string* value) override;
+    leveldb::Iterator* NewIterator(const leveldb::ReadOptions& options) override;
+    const leveldb::Snapshot* GetSnapshot() override;
+    void ReleaseSnapshot(const leveldb::Snapshot* snapshot) override;
+    bool GetProperty(const leveldb::Slice& property, std::string* value) override;
+    void GetApproximateSizes(const leveldb::Range* range, int n, uint64_t* sizes) override;
+    void CompactRange(const leveldb::Slice* begin, const leveldb::Slice* end) override;
+
+private:
+    //! Iterator over the index as of a write batch
+    class Iterator;
+
+    explicit CAppendLogDB(const fs::path& path);
+
+    //! Replay the log into the index, dropping a record torn off at its end
+    leveldb::Status Replay();
+    //! Append a record to the log. Returns the position of its payload.
+    leveldb::Status Append(const std::string& payload, bool sync, uint64_t& payload_offset);
+    //! Apply a payload written at payload_offset to the index, as the next write batch
+    bool ApplyPayload(const std::string& payload, uint64_t payload_offset);
+    //! Drop the earlier entries of a key that no snapshot or iterator can see
+    void PruneVersions(Versions& versions) const;
+    //! Register a snapshot or iterator reading as of seq, or release it
+    void AddReader(uint64_t seq);
+    void RemoveReader(uint64_t seq);
+    //! Rewrite the log with only the live entries, if nothing else reads from it
+    leveldb::Status Rewrite();
+
+    const fs::path m_path;
+
+    std::mutex m_mutex;
+    std::shared_ptr<LogFile> m_file;
+    Index m_index;
+    //! Sequence number of the last write batch
+    uint64_t m_seq;
+    //! Sequence numbers the open snapshots and iterators read as of
+    std::multiset<uint64_t> m_readers;
+    //! Keys written to while snapshots or iterators were open
+    std::vector<std::string> m_versioned_keys;
+    //! Size of the log
+    uint64_t m_log_size;
+    //! Bytes of the keys and values that are not erased
+    uint64_t m_live_bytes;
+    //! Bytes of the keys in the index
+    uint64_t m_key_bytes;
+};
+
+#endif // BITCOIN_APPENDLOGDB_H
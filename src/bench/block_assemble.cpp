@@ -11,6 +11,7 @@
 #include <miner.h>
 #include <policy/policy.h>
 #include <pow.h>
+#include <random.h>
 #include <scheduler.h>
 #include <txdb.h>
 #include <txmempool.h>
@@ -23,6 +24,48 @@
 #include <list>
 #include <vector>
 
+// Sets up a regtest chain to assemble blocks on, which is kept for the next
+// benchmark, and runs a scheduler for the validation interface callbacks.
+// Segwit is active on regtest, so witness transactions can be included.
+class ChainSetup
+{
+public:
+    ChainSetup()
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        InitScriptExecutionCache();
+        thread_group.create_thread(std::bind(&CScheduler::serviceQueue, &scheduler));
+        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+
+        {
+            LOCK(cs_main);
+            if (::chainActive.Tip() != nullptr) return;
+            ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+            ::pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+            ::pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+        }
+        const CChainParams& chainparams = Params();
+        LoadGenesisBlock(chainparams);
+        CValidationState state;
+        ActivateBestChain(state, chainparams);
+        assert(::chainActive.Tip() != nullptr);
+        const bool witness_enabled{IsWitnessEnabled(::chainActive.Tip(), chainparams.GetConsensus())};
+        assert(witness_enabled);
+    }
+
+    ~ChainSetup()
+    {
+        thread_group.interrupt_all();
+        thread_group.join_all();
+        GetMainSignals().FlushBackgroundCallbacks();
+        GetMainSignals().UnregisterBackgroundSignalScheduler();
+    }
+
+private:
+    boost::thread_group thread_group;
+    CScheduler scheduler;
+};
+
 static std::shared_ptr<CBlock> PrepareBlock(const CScript& coinbase_scriptPubKey)
 {
     auto block = std::make_shared<CBlock>(
@@ -64,31 +107,7 @@ static void AssembleBlock(benchmark::State& state)
 
     const CScript SCRIPT_PUB{CScript(OP_0) << std::vector<unsigned char>{witness_program.begin(), witness_program.end()}};
 
-    // Switch to regtest so we can mine faster
-    // Also segwit is active, so we can include witness transactions
-    SelectParams(CBaseChainParams::REGTEST);
-
-    InitScriptExecutionCache();
-
-    boost::thread_group thread_group;
-    CScheduler scheduler;
-    {
-        LOCK(cs_main);
-        ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
-        ::pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
-        ::pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
-    }
-    {
-        const CChainParams& chainparams = Params();
-        thread_group.create_thread(std::bind(&CScheduler::serviceQueue, &scheduler));
-        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
-        LoadGenesisBlock(chainparams);
-        CValidationState state;
-        ActivateBestChain(state, chainparams);
-        assert(::chainActive.Tip() != nullptr);
-        const bool witness_enabled{IsWitnessEnabled(::chainActive.Tip(), chainparams.GetConsensus())};
-        assert(witness_enabled);
-    }
+    ChainSetup setup;
 
     // Collect some loose transactions that spend the coinbases of our mined blocks
     constexpr size_t NUM_BLOCKS{200};
@@ -114,11 +133,80 @@ static void AssembleBlock(benchmark::State& state)
     while (state.KeepRunning()) {
         PrepareBlock(SCRIPT_PUB);
     }
+}
+
+static CTransactionRef MakeWitnessTx(FastRandomContext& rng, const COutPoint& prevout)
+{
+    CMutableTransaction tx;
+    tx.vin.emplace_back(prevout);
+    tx.vin[0].scriptWitness.stack = {rng.randbytes(72), rng.randbytes(33)};
+    tx.vout.emplace_back(1337, CScript() << OP_0 << rng.randbytes(20));
+    return MakeTransactionRef(tx);
+}
+
+// Add a transaction paying a random feerate of 1 to 100 sat/vB. A quarter of
+// them spend the output of a transaction added before.
+static void AddRandomTx(FastRandomContext& rng, std::vector<COutPoint>& unspent) EXCLUSIVE_LOCKS_REQUIRED(::cs_main, ::mempool.cs)
+{
+    COutPoint prevout(rng.rand256(), 0);
+    if (!unspent.empty() && rng.randrange(4) == 0) {
+        const size_t pos = rng.randrange(unspent.size());
+        prevout = unspent[pos];
+        unspent[pos] = unspent.back();
+        unspent.pop_back();
+    }
+    CTransactionRef tx = MakeWitnessTx(rng, prevout);
+    const CAmount fee = GetVirtualTransactionSize(*tx) * (1 + rng.randrange(100));
+    LockPoints lp;
+    ::mempool.addUnchecked(CTxMemPoolEntry(tx, fee, 0 /* nTime */, 1 /* nHeight */, false /* spendsCoinbase */, 4 /* sigOpCost */, lp));
+    unspent.emplace_back(tx->GetHash(), 0);
+}
+
+// Measure the latency of block templates for getblocktemplate with a full
+// mempool of the default -maxmempool size, built from scratch or updated by
+// BlockTemplateEngine. The transactions are added to the mempool without
+// being validated; the checks of the templates do not look at their inputs.
+static void AssembleBlockFullMempool(benchmark::State& state, bool incremental)
+{
+    ChainSetup setup;
+    const CScript SCRIPT_PUB{CScript(OP_TRUE)};
+    FastRandomContext rng(true);
+    std::vector<COutPoint> unspent;
+    {
+        LOCK2(::cs_main, ::mempool.cs);
+        while (::mempool.DynamicMemoryUsage() < DEFAULT_MAX_MEMPOOL_SIZE * 1000000) {
+            AddRandomTx(rng, unspent);
+        }
+    }
 
-    thread_group.interrupt_all();
-    thread_group.join_all();
-    GetMainSignals().FlushBackgroundCallbacks();
-    GetMainSignals().UnregisterBackgroundSignalScheduler();
+    BlockTemplateEngine engine(Params());
+    BlockAssembler::Options options;
+    options.fTestBlockValidity = false;
+    if (incremental) {
+        engine.CreateNewBlock(SCRIPT_PUB);
+    }
+    while (state.KeepRunning()) {
+        if (incremental) {
+            // New transactions arrive between the polls of getblocktemplate
+            {
+                LOCK2(::cs_main, ::mempool.cs);
+                for (int i = 0; i < 10; ++i) {
+                    AddRandomTx(rng, unspent);
+                }
+            }
+            engine.CreateNewBlock(SCRIPT_PUB);
+        } else {
+            BlockAssembler(Params(), options).CreateNewBlock(SCRIPT_PUB);
+        }
+    }
+
+    LOCK(::mempool.cs);
+    ::mempool.clear();
 }
 
+static void AssembleBlockFullMempoolFromScratch(benchmark::State& state) { AssembleBlockFullMempool(state, false); }
+static void AssembleBlockFullMempoolIncremental(benchmark::State& state) { AssembleBlockFullMempool(state, true); }
+
 BENCHMARK(AssembleBlock, 700);
+BENCHMARK(AssembleBlockFullMempoolFromScratch, 10);
+BENCHMARK(AssembleBlockFullMempoolIncremental, 100);
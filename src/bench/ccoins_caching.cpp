@@ -3,8 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <chainparams.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
+#include <txdb.h>
 #include <wallet/crypter.h>
 
 #include <vector>
@@ -85,4 +88,76 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// Fill a cache with coins as they would be loaded from the database, and drop
+// them again. Dominated by the cost of allocating and freeing the map nodes.
+static void CCoinsCacheFill(benchmark::State& state)
+{
+    const size_t NUM_COINS = 10000;
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints;
+    for (size_t i = 0; i < NUM_COINS; ++i) {
+        outpoints.emplace_back(rng.rand256(), i);
+    }
+    const CScript script = CScript() << OP_TRUE;
+
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    while (state.KeepRunning()) {
+        for (const COutPoint& outpoint : outpoints) {
+            coins.AddCoin(outpoint, Coin(CTxOut(COIN, script), 1, false), false);
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            coins.SpendCoin(outpoint);
+        }
+        assert(coins.GetCacheSize() == 0);
+    }
+}
+
+// Replays the coins cache access pattern of initial block download: every block
+// spends mostly recent outputs and creates new ones in a view on top of the tip
+// cache, and the tip cache is flushed to the database once it outgrows a small
+// dbcache. One iteration is one block.
+static void CCoinsCacheIBDReplay(benchmark::State& state)
+{
+    const size_t TXS_PER_BLOCK = 250;
+    const size_t RECENT_OUTPUTS = 50000;
+    const size_t CACHE_BYTES = 8 << 20;
+
+    SelectParams(CBaseChainParams::REGTEST);
+    CCoinsViewDB db(1 << 23, true);
+    CCoinsViewCache tip(&db);
+    FastRandomContext rng(true);
+    const CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0) << OP_EQUALVERIFY << OP_CHECKSIG;
+    std::vector<COutPoint> unspent;
+    uint32_t height = 0;
+
+    while (state.KeepRunning()) {
+        ++height;
+        CCoinsViewCache view(&tip);
+        for (size_t t = 0; t < TXS_PER_BLOCK; ++t) {
+            for (size_t i = 0; i < 2 && !unspent.empty(); ++i) {
+                const size_t pos = unspent.size() - 1 - rng.randrange(std::min(unspent.size(), RECENT_OUTPUTS));
+                bool spent = view.SpendCoin(unspent[pos]);
+                assert(spent);
+                unspent[pos] = unspent.back();
+                unspent.pop_back();
+            }
+            const uint256 txid = rng.rand256();
+            for (uint32_t n = 0; n < 3; ++n) {
+                view.AddCoin(COutPoint(txid, n), Coin(CTxOut(COIN, script), height, false), false);
+                unspent.emplace_back(txid, n);
+            }
+        }
+        view.SetBestBlock(rng.rand256());
+        bool flushed = view.Flush();
+        assert(flushed);
+        if (tip.DynamicMemoryUsage() > CACHE_BYTES) {
+            flushed = tip.Flush();
+            assert(flushed);
+        }
+    }
+}
+
 BENCHMARK(CCoinsCaching, 170 * 1000);
+BENCHMARK(CCoinsCacheFill, 100);
+BENCHMARK(CCoinsCacheIBDReplay, 1000);
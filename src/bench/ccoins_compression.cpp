@@ -0,0 +1,75 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <compressor.h>
+#include <random.h>
+#include <streams.h>
+
+#include <vector>
+
+// Outputs with roughly the mix of script types in the UTXO set: mostly P2PKH
+// and P2SH, a growing share of P2WPKH and P2WSH, and a few other scripts.
+static std::vector<CTxOut> MakeOutputs()
+{
+    FastRandomContext rng(true);
+    std::vector<CTxOut> outputs;
+    for (int i = 0; i < 1000; ++i) {
+        const std::vector<unsigned char> hash20 = rng.randbytes(20), hash32 = rng.randbytes(32);
+        const uint32_t type = rng.randrange(100);
+        CScript script;
+        if (type < 55) {
+            script << OP_DUP << OP_HASH160 << hash20 << OP_EQUALVERIFY << OP_CHECKSIG;
+        } else if (type < 80) {
+            script << OP_HASH160 << hash20 << OP_EQUAL;
+        } else if (type < 92) {
+            script << OP_0 << hash20;
+        } else if (type < 97) {
+            script << OP_0 << hash32;
+        } else {
+            script << OP_1 << rng.randbytes(33) << rng.randbytes(33) << OP_2 << OP_CHECKMULTISIG;
+        }
+        outputs.emplace_back(rng.randrange(50 * COIN), script);
+    }
+    return outputs;
+}
+
+static void CompressOutputs(benchmark::State& state, bool extended)
+{
+    std::vector<CTxOut> outputs = MakeOutputs();
+    CDataStream ss(SER_DISK, 0);
+    while (state.KeepRunning()) {
+        ss.clear();
+        for (CTxOut& out : outputs) {
+            ss << CTxOutCompressor(out, extended);
+        }
+    }
+}
+
+static void DecompressOutputs(benchmark::State& state, bool extended)
+{
+    std::vector<CTxOut> outputs = MakeOutputs();
+    CDataStream compressed(SER_DISK, 0);
+    for (CTxOut& out : outputs) {
+        compressed << CTxOutCompressor(out, extended);
+    }
+    while (state.KeepRunning()) {
+        CDataStream ss(compressed);
+        for (CTxOut& out : outputs) {
+            out.SetNull();
+            CTxOutCompressor decompressor(out, extended);
+            ss >> decompressor;
+        }
+    }
+}
+
+static void CoinCompression(benchmark::State& state) { CompressOutputs(state, false); }
+static void CoinCompressionExtended(benchmark::State& state) { CompressOutputs(state, true); }
+static void CoinDecompression(benchmark::State& state) { DecompressOutputs(state, false); }
+static void CoinDecompressionExtended(benchmark::State& state) { DecompressOutputs(state, true); }
+
+BENCHMARK(CoinCompression, 1000);
+BENCHMARK(CoinCompressionExtended, 1000);
+BENCHMARK(CoinDecompression, 1000);
+BENCHMARK(CoinDecompressionExtended, 1000);
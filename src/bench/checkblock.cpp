@@ -4,9 +4,11 @@
 
 #include <bench/bench.h>
 
+#include <blockencodings.h>
 #include <chainparams.h>
 #include <validation.h>
 #include <streams.h>
+#include <consensus/tx_verify.h>
 #include <consensus/validation.h>
 
 namespace block_bench {
@@ -55,5 +57,63 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+// Block-wide size, weight and legacy sigop accounting, as done by CheckBlock,
+// ContextualCheckBlock and the getblock RPC. These are served from the values
+// cached on each transaction rather than by reserializing the block.
+static void BlockSizesAndSigOpsTest(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)block_bench::block413567 + sizeof(block_bench::block413567),
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    while (state.KeepRunning()) {
+        int64_t total = GetBlockWeight(block) + GetBlockStrippedSize(block) + GetBlockTotalSize(block);
+        for (const auto& tx : block.vtx) {
+            total += GetTransactionWeight(*tx) + GetLegacySigOpCount(*tx);
+        }
+        assert(total > 0);
+    }
+}
+
+// Producing the non-witness serialization of a block read from disk, as done
+// when serving it to peers that did not ask for witness data.
+static void BlockToNoWitnessDecodedTest(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)block_bench::block413567 + sizeof(block_bench::block413567),
+            SER_NETWORK, PROTOCOL_VERSION);
+    char a = '\0';
+    stream.write(&a, 1); // Prevent compaction
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        stream >> block;
+        bool rewound = stream.Rewind(sizeof(block_bench::block413567));
+        assert(rewound);
+
+        CDataStream out(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+        out << block;
+        assert(out.size() > 0);
+    }
+}
+
+static void BlockToNoWitnessRawTest(benchmark::State& state)
+{
+    const FlatFileSpan data(std::vector<unsigned char>(block_bench::block413567,
+            block_bench::block413567 + sizeof(block_bench::block413567)));
+
+    while (state.KeepRunning()) {
+        const RawBlock block(data);
+        CDataStream out(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+        out << block;
+        assert(out.size() > 0);
+    }
+}
+
 BENCHMARK(DeserializeBlockTest, 130);
 BENCHMARK(DeserializeAndCheckBlockTest, 160);
+BENCHMARK(BlockSizesAndSigOpsTest, 5000);
+BENCHMARK(BlockToNoWitnessDecodedTest, 130);
+BENCHMARK(BlockToNoWitnessRawTest, 1000);
@@ -6,10 +6,12 @@
 #include <util/system.h>
 #include <validation.h>
 #include <checkqueue.h>
+#include <crypto/sha256.h>
 #include <prevector.h>
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include <random.h>
+#include <uint256.h>
 
 
 static const int MIN_CORES = 2;
@@ -60,3 +62,52 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// Measures how the queue scales with the number of threads (including the
+// master), using checks that each do a small, fixed amount of hashing work.
+static void CCheckQueueScaling(benchmark::State& state, int threads)
+{
+    struct HashJob {
+        uint256 h;
+        bool operator()()
+        {
+            for (int i = 0; i < 64; ++i) {
+                CSHA256().Write(h.begin(), h.size()).Finalize(h.begin());
+            }
+            return true;
+        }
+        void swap(HashJob& x) { std::swap(h, x.h); };
+    };
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < threads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(&queue);
+        std::vector<std::vector<HashJob>> vBatches(BATCHES);
+        for (auto& vChecks : vBatches) {
+            vChecks.resize(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueScaling1(benchmark::State& state) { CCheckQueueScaling(state, 1); }
+static void CCheckQueueScaling2(benchmark::State& state) { CCheckQueueScaling(state, 2); }
+static void CCheckQueueScaling4(benchmark::State& state) { CCheckQueueScaling(state, 4); }
+static void CCheckQueueScaling8(benchmark::State& state) { CCheckQueueScaling(state, 8); }
+static void CCheckQueueScaling16(benchmark::State& state) { CCheckQueueScaling(state, 16); }
+static void CCheckQueueScaling32(benchmark::State& state) { CCheckQueueScaling(state, 32); }
+static void CCheckQueueScaling64(benchmark::State& state) { CCheckQueueScaling(state, 64); }
+
+BENCHMARK(CCheckQueueScaling1, 50);
+BENCHMARK(CCheckQueueScaling2, 50);
+BENCHMARK(CCheckQueueScaling4, 50);
+BENCHMARK(CCheckQueueScaling8, 50);
+BENCHMARK(CCheckQueueScaling16, 50);
+BENCHMARK(CCheckQueueScaling32, 50);
+BENCHMARK(CCheckQueueScaling64, 50);
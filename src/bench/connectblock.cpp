@@ -0,0 +1,104 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <primitives/block.h>
+#include <txdb.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <boost/thread/thread.hpp>
+
+#include <vector>
+
+static const size_t BLOCK_TXS = 1000;
+static const size_t INPUTS_PER_TX = 4;
+static const int MIN_CORES = 2;
+
+// Build a database holding the coins spent by a synthetic block, and the block
+// itself. The block spends every coin once, in an order unrelated to the key
+// order of the coins database.
+static CBlock SetupBlockAndCoins(CCoinsViewDB& db)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+
+    CCoinsViewCache writer(&db);
+    for (size_t i = 0; i < BLOCK_TXS; ++i) {
+        CMutableTransaction funding;
+        funding.vin.resize(1);
+        funding.vin[0].prevout.n = i;
+        funding.vout.resize(INPUTS_PER_TX);
+        for (CTxOut& out : funding.vout) {
+            out.nValue = COIN;
+            out.scriptPubKey = CScript() << OP_TRUE;
+        }
+        const CTransaction funding_tx(funding);
+        AddCoins(writer, funding_tx, 1);
+
+        CMutableTransaction spend;
+        for (size_t j = 0; j < INPUTS_PER_TX; ++j) {
+            spend.vin.emplace_back(COutPoint(funding_tx.GetHash(), j));
+        }
+        spend.vout.resize(1);
+        block.vtx.push_back(MakeTransactionRef(std::move(spend)));
+    }
+    writer.SetBestBlock(uint256S("01"));
+    bool flushed = writer.Flush();
+    assert(flushed);
+    return block;
+}
+
+// Simulates the input handling of ConnectBlock against a cold coins tip cache:
+// every input is resolved and spent in a fresh child view, one transaction at
+// a time.
+static void ConnectBlockInputs(benchmark::State& state, bool prefetch)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    CCoinsViewDB db(1 << 23, true);
+    const CBlock block = SetupBlockAndCoins(db);
+
+    boost::thread_group tg;
+    if (prefetch) {
+        for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()) - 1; ++x) {
+            tg.create_thread(&ThreadCoinsPrefetch);
+        }
+    }
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache tip(&db);
+        if (prefetch) {
+            PrefetchBlockInputs(block, tip, db);
+        }
+        CCoinsViewCache view(&tip);
+        for (size_t i = 1; i < block.vtx.size(); ++i) {
+            for (const CTxIn& txin : block.vtx[i]->vin) {
+                bool spent = view.SpendCoin(txin.prevout);
+                assert(spent);
+            }
+        }
+    }
+
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void ConnectBlockInputsSerial(benchmark::State& state)
+{
+    ConnectBlockInputs(state, false);
+}
+
+static void ConnectBlockInputsPrefetch(benchmark::State& state)
+{
+    ConnectBlockInputs(state, true);
+}
+
+BENCHMARK(ConnectBlockInputsSerial, 20);
+BENCHMARK(ConnectBlockInputsPrefetch, 20);
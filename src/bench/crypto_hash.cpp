@@ -10,6 +10,7 @@
 #include <random.h>
 #include <uint256.h>
 #include <util/time.h>
+#include <crypto/muhash.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
@@ -78,6 +79,29 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+static void MuHash(benchmark::State& state)
+{
+    MuHash3072 acc;
+    unsigned char key[32] = {0};
+    uint32_t i = 0;
+    while (state.KeepRunning()) {
+        key[0] = ++i & 0xFF;
+        acc *= MuHash3072(key, sizeof(key));
+    }
+}
+
+static void MuHashFinalize(benchmark::State& state)
+{
+    MuHash3072 acc;
+    unsigned char key[32] = {0};
+    acc /= MuHash3072(key, sizeof(key));
+    uint256 out;
+    while (state.KeepRunning()) {
+        acc.Finalize(out);
+        acc /= MuHash3072(out.begin(), out.size());
+    }
+}
+
 static void FastRandom_32bit(benchmark::State& state)
 {
     FastRandomContext rng(true);
@@ -102,5 +126,7 @@ BENCHMARK(SHA512, 330);
 BENCHMARK(SHA256_32b, 4700 * 1000);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
 BENCHMARK(SHA256D64_1024, 7400);
+BENCHMARK(MuHash, 5000);
+BENCHMARK(MuHashFinalize, 2);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
@@ -0,0 +1,57 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <dbwrapper.h>
+#include <random.h>
+#include <uint256.h>
+#include <util/system.h>
+
+#include <vector>
+
+static const char DB_COIN = 'C';
+
+// Replays the write pattern of chainstate flushes: every batch adds new coins,
+// erases some coins written by earlier batches, and is followed by lookups
+// of coins that are not cached.
+static void DBBackend(benchmark::State& state, const std::string& backend)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const fs::path path = GetDataDir() / "benchdb";
+    gArgs.ForceSetArg("-dboption", "benchdb:backend=" + backend);
+    {
+        CDBWrapper db(path, 8 << 20, false, true, true);
+        FastRandomContext rng(true);
+        std::vector<uint256> keys;
+        std::vector<unsigned char> value(40);
+        std::vector<unsigned char> read;
+        while (state.KeepRunning()) {
+            CDBBatch batch(db);
+            for (int i = 0; i < 2000; ++i) {
+                keys.push_back(rng.rand256());
+                for (unsigned char& c : value) c = rng.randbits(8);
+                batch.Write(std::make_pair(DB_COIN, keys.back()), value);
+            }
+            for (int i = 0; i < 1000; ++i) {
+                const size_t pos = rng.randrange(keys.size());
+                batch.Erase(std::make_pair(DB_COIN, keys[pos]));
+                keys[pos] = keys.back();
+                keys.pop_back();
+            }
+            db.WriteBatch(batch);
+            for (int i = 0; i < 1000; ++i) {
+                db.Read(std::make_pair(DB_COIN, keys[rng.randrange(keys.size())]), read);
+            }
+        }
+    }
+    fs::remove_all(path);
+    gArgs.ForceSetArg("-dboption", "");
+}
+
+static void DBBackendLevelDB(benchmark::State& state) { DBBackend(state, "leveldb"); }
+static void DBBackendAppendLog(benchmark::State& state) { DBBackend(state, "appendlog"); }
+
+BENCHMARK(DBBackendLevelDB, 20);
+BENCHMARK(DBBackendAppendLog, 20);
@@ -0,0 +1,88 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <policy/policy.h>
+#include <random.h>
+#include <txmempool.h>
+
+#include <vector>
+
+static void AddTx(const CTransactionRef& tx, const CAmount& nFee, CTxMemPool& pool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, pool.cs)
+{
+    int64_t nTime = 0;
+    unsigned int nHeight = 1;
+    bool spendsCoinbase = false;
+    unsigned int sigOpCost = 4;
+    LockPoints lp;
+    pool.addUnchecked(CTxMemPoolEntry(
+                                         tx, nFee, nTime, nHeight,
+                                         spendsCoinbase, sigOpCost, lp));
+}
+
+// Chains of transactions, each spending the first output of the previous
+// one. Every other transaction also has a child spending its second output,
+// which is not part of the chain.
+static std::vector<std::vector<CTransactionRef>> MakeChains(int num_chains, int length)
+{
+    FastRandomContext rng(true);
+    std::vector<std::vector<CTransactionRef>> chains(num_chains);
+    for (std::vector<CTransactionRef>& chain : chains) {
+        COutPoint prevout(rng.rand256(), 0);
+        for (int i = 0; i < length; ++i) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = prevout;
+            tx.vin[0].scriptSig = CScript() << OP_1;
+            tx.vout.resize(2);
+            tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            tx.vout[0].nValue = 10 * COIN;
+            tx.vout[1].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+            tx.vout[1].nValue = 1 * COIN;
+            chain.push_back(MakeTransactionRef(tx));
+            prevout = COutPoint(chain.back()->GetHash(), 0);
+            if (i % 2 == 0) {
+                CMutableTransaction child;
+                child.vin.resize(1);
+                child.vin[0].prevout = COutPoint(chain.back()->GetHash(), 1);
+                child.vin[0].scriptSig = CScript() << OP_2;
+                child.vout.resize(1);
+                child.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+                child.vout[0].nValue = 1 * COIN;
+                chain.push_back(MakeTransactionRef(child));
+            }
+        }
+    }
+    return chains;
+}
+
+// Fills the mempool with chains of transactions and confirms them in blocks
+// that each take the next transactions from the start of every chain, so
+// that every removal updates the ancestor state of the rest of the chain.
+static void MempoolChurn(benchmark::State& state)
+{
+    const std::vector<std::vector<CTransactionRef>> chains = MakeChains(100, 16);
+
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    while (state.KeepRunning()) {
+        for (const std::vector<CTransactionRef>& chain : chains) {
+            for (const CTransactionRef& tx : chain) {
+                AddTx(tx, 1000LL, pool);
+            }
+        }
+        for (size_t i = 0; i < chains[0].size(); i += 4) {
+            std::vector<CTransactionRef> block;
+            for (const std::vector<CTransactionRef>& chain : chains) {
+                for (size_t j = i; j < i + 4 && j < chain.size(); ++j) {
+                    block.push_back(chain[j]);
+                }
+            }
+            pool.removeForBlock(block, 1);
+        }
+        assert(pool.size() == 0);
+    }
+}
+
+BENCHMARK(MempoolChurn, 10);
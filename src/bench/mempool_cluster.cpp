@@ -0,0 +1,168 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <crypto/sha256.h>
+#include <random.h>
+#include <scheduler.h>
+#include <script/sigcache.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+#include <boost/thread.hpp>
+
+#include <set>
+#include <vector>
+
+// Each funding output is spent by a transaction with 8 outputs, each of which
+// is spent by a chain of two transactions. The last transactions of the chains
+// of every two clusters are spent together, which merges the clusters. All
+// outputs are P2WSH outputs of OP_TRUE.
+static std::vector<CTransactionRef> MakeClusters(const std::vector<COutPoint>& funding, CAmount value)
+{
+    const std::vector<unsigned char> op_true{OP_TRUE};
+    uint256 witness_program;
+    CSHA256().Write(&op_true[0], op_true.size()).Finalize(witness_program.begin());
+    const CScript script_pub{CScript(OP_0) << std::vector<unsigned char>{witness_program.begin(), witness_program.end()}};
+
+    FastRandomContext rng(true);
+    std::vector<CTransactionRef> txs;
+    std::vector<CTransactionRef> tails;
+    for (const COutPoint& prevout : funding) {
+        CMutableTransaction root;
+        root.vin.emplace_back(prevout);
+        root.vin[0].scriptWitness.stack.push_back(op_true);
+        const CAmount branch_value = (value - 10000) / 8;
+        for (int i = 0; i < 8; ++i) {
+            root.vout.emplace_back(branch_value, script_pub);
+        }
+        txs.push_back(MakeTransactionRef(root));
+        const CTransactionRef root_tx = txs.back();
+        for (uint32_t i = 0; i < 8; ++i) {
+            COutPoint spend(root_tx->GetHash(), i);
+            CAmount spend_value = branch_value;
+            for (int j = 0; j < 2; ++j) {
+                CMutableTransaction tx;
+                tx.vin.emplace_back(spend);
+                tx.vin[0].scriptWitness.stack.push_back(op_true);
+                spend_value -= 1000 + rng.randrange(10000);
+                tx.vout.emplace_back(spend_value, script_pub);
+                txs.push_back(MakeTransactionRef(tx));
+                spend = COutPoint(txs.back()->GetHash(), 0);
+            }
+        }
+        tails.push_back(txs.back());
+        if (tails.size() == 2) {
+            CMutableTransaction tx;
+            for (const CTransactionRef& tail : tails) {
+                tx.vin.emplace_back(tail->GetHash(), 0);
+                tx.vin.back().scriptWitness.stack.push_back(op_true);
+            }
+            tx.vout.emplace_back(tails[0]->vout[0].nValue + tails[1]->vout[0].nValue - 1000 - rng.randrange(10000), script_pub);
+            txs.push_back(MakeTransactionRef(tx));
+            tails.clear();
+        }
+    }
+    return txs;
+}
+
+// Accept the clusters to the mempool, which looks up their inputs and verifies
+// their scripts, and keeps the linearization of every cluster up to date.
+static void MempoolClusterAccept(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    InitSignatureCache();
+    InitScriptExecutionCache();
+
+    boost::thread_group thread_group;
+    CScheduler scheduler;
+    {
+        LOCK(cs_main);
+        UnloadBlockIndex();
+        ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+        ::pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+        ::pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+    }
+    {
+        const CChainParams& chainparams = Params();
+        thread_group.create_thread(std::bind(&CScheduler::serviceQueue, &scheduler));
+        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+        LoadGenesisBlock(chainparams);
+        CValidationState val_state;
+        ActivateBestChain(val_state, chainparams);
+        assert(::chainActive.Tip() != nullptr);
+    }
+
+    // The funding coins are added to the chainstate directly
+    FastRandomContext rng(true);
+    std::vector<COutPoint> funding;
+    for (int i = 0; i < 40; ++i) {
+        funding.emplace_back(rng.rand256(), 0);
+    }
+    const std::vector<CTransactionRef> txs = MakeClusters(funding, 10 * COIN);
+    {
+        LOCK(cs_main);
+        const CScript& script_pub = txs[0]->vout[0].scriptPubKey;
+        for (const COutPoint& prevout : funding) {
+            pcoinsTip->AddCoin(prevout, Coin(CTxOut(10 * COIN, script_pub), 1 /* nHeight */, false /* fCoinBase */), false /* possible_overwrite */);
+        }
+    }
+
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        for (const CTransactionRef& tx : txs) {
+            CValidationState val_state;
+            bool accepted{::AcceptToMemoryPool(::mempool, val_state, tx, nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
+            assert(accepted);
+        }
+        LOCK(::mempool.cs);
+        ::mempool.clear();
+    }
+
+    thread_group.interrupt_all();
+    thread_group.join_all();
+    GetMainSignals().FlushBackgroundCallbacks();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
+}
+
+// Mine the clusters in two blocks. The first one takes the transaction at the
+// root of every cluster and the first transaction of every chain, which splits
+// what remains of the clusters up.
+static void MempoolClusterRemoveForBlock(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    std::vector<COutPoint> funding;
+    for (int i = 0; i < 100; ++i) {
+        funding.emplace_back(rng.rand256(), 0);
+    }
+    const std::vector<CTransactionRef> txs = MakeClusters(funding, 10 * COIN);
+    std::set<uint256> roots;
+    std::vector<CTransactionRef> first, second;
+    std::vector<CAmount> fees;
+    for (const CTransactionRef& tx : txs) {
+        if (tx->vout.size() > 1) roots.insert(tx->GetHash());
+        const bool mined_first = roots.count(tx->GetHash()) || roots.count(tx->vin[0].prevout.hash);
+        (mined_first ? first : second).push_back(tx);
+        fees.push_back(1000 + rng.randrange(10000));
+    }
+
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < txs.size(); ++i) {
+            LockPoints lp;
+            pool.addUnchecked(CTxMemPoolEntry(txs[i], fees[i], 0 /* nTime */, 1 /* nHeight */, false /* spendsCoinbase */, 4 /* sigOpCost */, lp));
+        }
+        pool.removeForBlock(first, 1);
+        pool.removeForBlock(second, 2);
+        assert(pool.size() == 0);
+    }
+}
+
+BENCHMARK(MempoolClusterAccept, 20);
+BENCHMARK(MempoolClusterRemoveForBlock, 20);
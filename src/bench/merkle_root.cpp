@@ -24,3 +24,41 @@ static void MerkleRoot(benchmark::State& state)
 }
 
 BENCHMARK(MerkleRoot, 800);
+
+// Computes the roots of two trees of the same size (as the transaction and
+// witness trees of a block are), either one after the other or batched.
+static void MerkleRootTwoTrees(benchmark::State& state, bool batched)
+{
+    FastRandomContext rng(true);
+    std::vector<std::vector<uint256>> trees(2);
+    for (auto& leaves : trees) {
+        leaves.resize(9001);
+        for (auto& item : leaves) {
+            item = rng.rand256();
+        }
+    }
+    while (state.KeepRunning()) {
+        if (batched) {
+            std::vector<uint256> roots = ComputeMerkleRoots(trees);
+            trees[0][0] = roots[1];
+        } else {
+            uint256 root = ComputeMerkleRoot(std::vector<uint256>(trees[0]));
+            uint256 witness_root = ComputeMerkleRoot(std::vector<uint256>(trees[1]));
+            trees[0][0] = witness_root;
+            trees[1][0] = root;
+        }
+    }
+}
+
+static void MerkleRootTwoTreesSeparate(benchmark::State& state)
+{
+    MerkleRootTwoTrees(state, false);
+}
+
+static void MerkleRootTwoTreesBatched(benchmark::State& state)
+{
+    MerkleRootTwoTrees(state, true);
+}
+
+BENCHMARK(MerkleRootTwoTreesSeparate, 400);
+BENCHMARK(MerkleRootTwoTreesBatched, 400);
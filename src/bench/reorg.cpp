@@ -0,0 +1,131 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <consensus/merkle.h>
+#include <consensus/validation.h>
+#include <key.h>
+#include <keystore.h>
+#include <miner.h>
+#include <pow.h>
+#include <scheduler.h>
+#include <script/sigcache.h>
+#include <script/sign.h>
+#include <script/standard.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <util/time.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+#include <boost/thread.hpp>
+
+#include <vector>
+
+static CTransactionRef MineBlock(const CScript& coinbase_scriptPubKey)
+{
+    // Space the blocks apart, so that each of them may use the minimum difficulty
+    SetMockTime(GetTime() + 2 * Params().GetConsensus().nPowTargetSpacing + 1);
+    auto block = std::make_shared<CBlock>(
+        BlockAssembler{Params()}
+            .CreateNewBlock(coinbase_scriptPubKey)
+            ->block);
+
+    block->hashMerkleRoot = BlockMerkleRoot(*block);
+
+    while (!CheckProofOfWork(block->GetHash(), block->nBits, Params().GetConsensus())) {
+        ++block->nNonce;
+        assert(block->nNonce);
+    }
+
+    bool processed{ProcessNewBlock(Params(), block, true, nullptr)};
+    assert(processed);
+
+    return block->vtx[0];
+}
+
+// A one block reorg on a node whose mempool held the transactions of the
+// block: the tip is disconnected, which returns its transactions to the
+// mempool, and then connected again.
+static void ReorgOneBlock(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+
+    InitSignatureCache();
+    InitScriptExecutionCache();
+
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    const CScript script_pub = GetScriptForDestination(WitnessV0KeyHash(key.GetPubKey().GetID()));
+
+    boost::thread_group thread_group;
+    CScheduler scheduler;
+    {
+        LOCK(cs_main);
+        UnloadBlockIndex();
+        ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+        ::pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+        ::pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+    }
+    {
+        const CChainParams& chainparams = Params();
+        thread_group.create_thread(std::bind(&CScheduler::serviceQueue, &scheduler));
+        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+        LoadGenesisBlock(chainparams);
+        CValidationState val_state;
+        ActivateBestChain(val_state, chainparams);
+        assert(::chainActive.Tip() != nullptr);
+    }
+
+    // The last block is mined at the current time, so that the node leaves
+    // initial block download
+    constexpr size_t NUM_BLOCKS{200};
+    SetMockTime(GetTime() - (NUM_BLOCKS + 1) * (2 * Params().GetConsensus().nPowTargetSpacing + 1));
+    std::vector<CTransactionRef> coinbases;
+    for (size_t b{0}; b < NUM_BLOCKS; ++b) {
+        coinbases.push_back(MineBlock(script_pub));
+    }
+
+    // Spend the mature coinbases from the mempool, and mine the spends
+    {
+        LOCK(::cs_main);
+        for (size_t i{0}; i < NUM_BLOCKS - COINBASE_MATURITY; ++i) {
+            CMutableTransaction tx;
+            tx.vin.emplace_back(coinbases[i]->GetHash(), 0);
+            tx.vout.emplace_back(coinbases[i]->vout[0].nValue - 1000, script_pub);
+            bool signed_tx{SignSignature(keystore, *coinbases[i], tx, 0, SIGHASH_ALL)};
+            assert(signed_tx);
+            CValidationState val_state;
+            bool accepted{::AcceptToMemoryPool(::mempool, val_state, MakeTransactionRef(std::move(tx)), nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
+            assert(accepted);
+        }
+    }
+    MineBlock(script_pub);
+    assert(::mempool.size() == 0);
+
+    while (state.KeepRunning()) {
+        CValidationState val_state;
+        {
+            LOCK(::cs_main);
+            CBlockIndex* tip = ::chainActive.Tip();
+            bool invalidated{InvalidateBlock(val_state, Params(), tip)};
+            assert(invalidated);
+            assert(::mempool.size() == NUM_BLOCKS - COINBASE_MATURITY);
+            ResetBlockFailureFlags(tip);
+        }
+        bool activated{ActivateBestChain(val_state, Params())};
+        assert(activated);
+    }
+
+    thread_group.interrupt_all();
+    thread_group.join_all();
+    GetMainSignals().FlushBackgroundCallbacks();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
+    SetMockTime(0);
+}
+
+BENCHMARK(ReorgOneBlock, 10);
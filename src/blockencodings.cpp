@@ -8,6 +8,7 @@
 #include <chainparams.h>
 #include <crypto/sha256.h>
 #include <crypto/siphash.h>
+#include <hash.h>
 #include <random.h>
 #include <streams.h>
 #include <txmempool.h>
@@ -28,6 +29,16 @@ CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool f
     }
 }
 
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const RawBlock& block, bool fUseWTXID) :
+        nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+        shorttxids(block.TxCount() - 1), prefilledtxn(1), header(block.GetHeader()) {
+    FillShortTxIDSelector();
+    prefilledtxn[0] = {0, block.GetTransaction(0)};
+    for (size_t i = 1; i < block.TxCount(); i++) {
+        shorttxids[i - 1] = GetShortID(fUseWTXID ? block.GetWitnessHash(i) : block.GetTxHash(i));
+    }
+}
+
 void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << header << nonce;
@@ -44,6 +55,141 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+namespace {
+/** Walks the serialization of a block without decoding it. */
+class RawBlockParser
+{
+private:
+    Span<const unsigned char> m_data;
+    size_t m_pos = 0;
+
+public:
+    explicit RawBlockParser(Span<const unsigned char> data) : m_data(data) {}
+
+    size_t Pos() const { return m_pos; }
+
+    void Skip(uint64_t n)
+    {
+        if (n > m_data.size() - m_pos) {
+            throw std::ios_base::failure("RawBlock: end of data");
+        }
+        m_pos += n;
+    }
+
+    unsigned char Byte()
+    {
+        Skip(1);
+        return m_data[m_pos - 1];
+    }
+
+    uint64_t CompactSize()
+    {
+        SpanReader reader(SER_NETWORK, PROTOCOL_VERSION, m_data.subspan(m_pos));
+        const uint64_t n = ReadCompactSize(reader);
+        m_pos = m_data.size() - reader.size();
+        return n;
+    }
+
+    void SkipInputs(uint64_t count)
+    {
+        for (uint64_t i = 0; i < count; ++i) {
+            Skip(36); // prevout
+            Skip(CompactSize()); // scriptSig
+            Skip(4); // nSequence
+        }
+    }
+
+    void SkipOutputs()
+    {
+        const uint64_t count = CompactSize();
+        for (uint64_t i = 0; i < count; ++i) {
+            Skip(8); // nValue
+            Skip(CompactSize()); // scriptPubKey
+        }
+    }
+};
+} // namespace
+
+RawBlock::RawBlock(FlatFileSpan data) : m_data(std::move(data))
+{
+    SpanReader(SER_NETWORK, PROTOCOL_VERSION, m_data.Get()) >> m_header;
+
+    RawBlockParser parser(m_data.Get());
+    parser.Skip(::GetSerializeSize(m_header, PROTOCOL_VERSION));
+    const uint64_t tx_count = parser.CompactSize();
+    // A serialized transaction takes at least 10 bytes
+    m_txs.reserve(std::min<uint64_t>(tx_count, m_data.size() / 10));
+    for (uint64_t i = 0; i < tx_count; ++i) {
+        // Mirrors UnserializeTransaction
+        TxLayout tx;
+        tx.begin = parser.Pos();
+        parser.Skip(4); // nVersion
+        tx.body_begin = parser.Pos();
+        uint64_t inputs = parser.CompactSize();
+        unsigned char flags = 0;
+        if (inputs == 0) {
+            // A witness marker, or an empty vin followed by an empty vout
+            flags = parser.Byte();
+            if (flags != 0) {
+                tx.body_begin = parser.Pos();
+                inputs = parser.CompactSize();
+                parser.SkipInputs(inputs);
+                parser.SkipOutputs();
+            }
+        } else {
+            parser.SkipInputs(inputs);
+            parser.SkipOutputs();
+        }
+        tx.body_end = parser.Pos();
+        if (flags & 1) {
+            flags ^= 1;
+            bool has_witness = false;
+            for (uint64_t j = 0; j < inputs; ++j) {
+                const uint64_t items = parser.CompactSize();
+                has_witness |= items > 0;
+                for (uint64_t k = 0; k < items; ++k) {
+                    parser.Skip(parser.CompactSize());
+                }
+            }
+            if (!has_witness) {
+                throw std::ios_base::failure("Superfluous witness record");
+            }
+        }
+        if (flags) {
+            throw std::ios_base::failure("Unknown transaction optional data");
+        }
+        tx.lock_time = parser.Pos();
+        parser.Skip(4); // nLockTime
+        m_txs.push_back(tx);
+    }
+    if (parser.Pos() != m_data.size()) {
+        throw std::ios_base::failure("RawBlock: trailing data");
+    }
+}
+
+uint256 RawBlock::GetTxHash(size_t i) const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    SerializeStripped(ss, m_txs[i]);
+    return ss.GetHash();
+}
+
+uint256 RawBlock::GetWitnessHash(size_t i) const
+{
+    if (!HasWitness(i)) {
+        return GetTxHash(i);
+    }
+    const TxLayout& tx = m_txs[i];
+    return Hash(At(tx.begin), At(tx.lock_time + 4));
+}
+
+CTransactionRef RawBlock::GetTransaction(size_t i) const
+{
+    const TxLayout& tx = m_txs[i];
+    SpanReader reader(SER_NETWORK, PROTOCOL_VERSION, m_data.Get().subspan(tx.begin, tx.lock_time + 4 - tx.begin));
+    return std::make_shared<const CTransaction>(deserialize, reader);
+}
+
 
 
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
@@ -5,12 +5,73 @@
 #ifndef BITCOIN_BLOCKENCODINGS_H
 #define BITCOIN_BLOCKENCODINGS_H
 
+#include <flatfilemap.h>
 #include <primitives/block.h>
 
 #include <memory>
 
 class CTxMemPool;
 
+/**
+ * A block in its witness serialization, which is also the format blocks are
+ * stored in on disk, indexed by transaction boundaries. This allows producing
+ * the non-witness serialization, transaction hashes and compact blocks from
+ * the raw bytes without deserializing the whole block into a CBlock.
+ *
+ * Serializing a RawBlock is equivalent to serializing the CBlock it encodes,
+ * including honoring SERIALIZE_TRANSACTION_NO_WITNESS.
+ */
+class RawBlock
+{
+private:
+    struct TxLayout {
+        size_t begin;      //!< Start of the transaction (its version)
+        size_t body_begin; //!< Start of the inputs, after any witness marker and flag
+        size_t body_end;   //!< End of the outputs, start of any witness data
+        size_t lock_time;  //!< Start of the lock time, end of any witness data
+    };
+
+    FlatFileSpan m_data;
+    CBlockHeader m_header;
+    std::vector<TxLayout> m_txs;
+
+    const char* At(size_t pos) const { return CharCast(m_data.data() + pos); }
+
+    template <typename Stream>
+    void SerializeStripped(Stream& s, const TxLayout& tx) const
+    {
+        s.write(At(tx.begin), 4);
+        s.write(At(tx.body_begin), tx.body_end - tx.body_begin);
+        s.write(At(tx.lock_time), 4);
+    }
+
+public:
+    /** Index a witness serialized block. Throws std::ios_base::failure if the data is not one. */
+    explicit RawBlock(FlatFileSpan data);
+
+    const CBlockHeader& GetHeader() const { return m_header; }
+    size_t TxCount() const { return m_txs.size(); }
+    bool HasWitness(size_t i) const { return m_txs[i].body_begin != m_txs[i].begin + 4; }
+    uint256 GetTxHash(size_t i) const;
+    uint256 GetWitnessHash(size_t i) const;
+    CTransactionRef GetTransaction(size_t i) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        if (!(s.GetVersion() & SERIALIZE_TRANSACTION_NO_WITNESS)) {
+            s.write(At(0), m_data.size());
+            return;
+        }
+        // The header and transaction count, then each transaction without its
+        // witness marker, flag and witness data.
+        s.write(At(0), m_txs.empty() ? m_data.size() : m_txs.front().begin);
+        for (const TxLayout& tx : m_txs) {
+            SerializeStripped(s, tx);
+        }
+    }
+};
+
 // Dumb helper to handle CTransaction compression at serialize-time
 struct TransactionCompressor {
 private:
@@ -149,6 +210,7 @@ public:
     CBlockHeaderAndShortTxIDs() {}
 
     CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID);
+    CBlockHeaderAndShortTxIDs(const RawBlock& block, bool fUseWTXID);
 
     uint64_t GetShortID(const uint256& txhash) const;
 
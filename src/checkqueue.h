@@ -6,8 +6,13 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <sync.h>
+#include <util/time.h>
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <limits>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -25,12 +30,37 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Each worker owns a deque of checks, protected by its own mutex. The
+  * master spreads added checks over the deques; workers take batches from
+  * the back of their own deque and, once it is empty, steal from the front
+  * of the other workers' deques. The shared mutex is only taken to go to
+  * sleep when no work is queued anywhere, or to wake sleeping threads.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Number of per-worker deques. Slot 0 belongs to the master; when more
+    //! workers register than there are slots, they share slots.
+    static const unsigned int QUEUE_SLOTS = 64;
+
+    struct WorkerQueue {
+        //! Mutex protecting checks; only held to push or take a batch
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! Per-worker queues of elements to be processed
+    std::unique_ptr<WorkerQueue[]> m_slots;
+
+    //! Number of slots that have been handed out (including the master's)
+    std::atomic<unsigned int> m_slots_used;
+
+    //! Slot that receives the next added check
+    unsigned int m_next_push;
+
+    //! Mutex to protect sleeping and waking up
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,87 +69,121 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
+    //! The number of workers (excluding the master) that are idle.
     int nIdle;
 
-    //! The total number of workers (including the master).
-    int nTotal;
-
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
+
+    //! Number of verifications sitting in the deques, not taken by any thread yet.
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Incremented every time the master returns from Wait()
+    std::atomic<uint64_t> nRound;
+
+    //! Number of threads that executed checks during the current round
+    std::atomic<unsigned int> nThreadsUsed;
+
+    //! Time spent executing checks during the current round, summed over all threads (in microseconds)
+    std::atomic<int64_t> nBusyTime;
+
+    //! Statistics of the last completed round
+    std::atomic<unsigned int> nLastThreadsUsed;
+    std::atomic<int64_t> nLastBusyTime;
+
+    /**
+     * Move up to nBatchSize checks into vChecks, preferring the back of the
+     * given slot and otherwise stealing from the front of the others.
+     */
+    bool TakeBatch(unsigned int slot, std::vector<T>& vChecks)
+    {
+        const unsigned int slots_used = std::min(m_slots_used.load(), QUEUE_SLOTS);
+        for (unsigned int i = 0; i < slots_used; i++) {
+            const bool own = i == 0;
+            WorkerQueue& victim = m_slots[(slot + i) % slots_used];
+            boost::unique_lock<boost::mutex> lock(victim.mutex);
+            if (victim.checks.empty()) continue;
+            // Take half of what is there (but at least one check), so that
+            // whatever remains can still be shared with other threads.
+            const unsigned int nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, victim.checks.size() / 2));
+            vChecks.resize(nNow);
+            for (unsigned int j = 0; j < nNow; j++) {
+                // Swap jobs out of the deque instead of copying them, to keep
+                // the critical section short.
+                if (own) {
+                    vChecks[j].swap(victim.checks.back());
+                    victim.checks.pop_back();
+                } else {
+                    vChecks[j].swap(victim.checks.front());
+                    victim.checks.pop_front();
+                }
+            }
+            nQueued -= nNow;
+            return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        const unsigned int slot = fMaster ? 0 : 1 + (m_slots_used++ - 1) % (QUEUE_SLOTS - 1);
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        uint64_t my_round = std::numeric_limits<uint64_t>::max();
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+            if (TakeBatch(slot, vChecks)) {
+                if (nRound != my_round) {
+                    my_round = nRound;
+                    nThreadsUsed++;
+                }
+                const int64_t nTimeStart = GetTimeMicros();
+                // Check whether we need to do work at all
+                bool fOk = fAllOk;
+                // execute work
+                for (T& check : vChecks)
+                    if (fOk)
+                        fOk = check();
+                const unsigned int nNow = vChecks.size();
+                vChecks.clear();
+                nBusyTime += GetTimeMicros() - nTimeStart;
+                if (!fOk) fAllOk = false;
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                while (nQueued == 0) {
+                    if (nTodo == 0) {
+                        nLastThreadsUsed = nThreadsUsed.exchange(0);
+                        nLastBusyTime = nBusyTime.exchange(0);
+                        nRound++;
+                        // return the current status, and reset it for new work later
+                        return fAllOk.exchange(true);
                     }
+                    condMaster.wait(lock); // wait
+                }
+            } else {
+                while (nQueued == 0) {
                     nIdle++;
-                    cond.wait(lock); // wait
+                    condWorker.wait(lock); // wait
                     nIdle--;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
@@ -128,7 +192,9 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) :
+        m_slots(new WorkerQueue[QUEUE_SLOTS]), m_slots_used(1), m_next_push(0), nIdle(0), fAllOk(true), nQueued(0), nTodo(0), nBatchSize(nBatchSizeIn),
+        nRound(0), nThreadsUsed(0), nBusyTime(0), nLastThreadsUsed(0), nLastBusyTime(0) {}
 
     //! Worker thread
     void Thread()
@@ -142,18 +208,40 @@ public:
         return Loop(true);
     }
 
+    /**
+     * Report the number of threads (including the master) that executed
+     * checks between the last two returns from Wait(), and the time they
+     * spent doing so in microseconds, summed over all of them.
+     */
+    void GetLastRoundStats(unsigned int& threads_used, int64_t& busy_time) const
+    {
+        threads_used = nLastThreadsUsed;
+        busy_time = nLastBusyTime;
+    }
+
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty()) return;
+        // Account for the checks before publishing them, so that a thread
+        // taking one of them can never observe the counters below zero.
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
+        nQueued += vChecks.size();
+        // Spread the checks over the workers' deques in contiguous runs.
+        const unsigned int slots_used = std::min(m_slots_used.load(), QUEUE_SLOTS);
+        const size_t run = std::max<size_t>(1, vChecks.size() / slots_used);
+        for (size_t i = 0; i < vChecks.size(); i += run) {
+            WorkerQueue& target = m_slots[m_next_push++ % slots_used];
+            boost::unique_lock<boost::mutex> lock(target.mutex);
+            for (size_t j = i; j < std::min(vChecks.size(), i + run); j++) {
+                target.checks.emplace_back();
+                vChecks[j].swap(target.checks.back());
+            }
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vChecks.size() == 1 || nIdle == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else if (nIdle > 1)
             condWorker.notify_all();
     }
 
@@ -104,6 +104,7 @@ struct CCoinsCacheEntry
 {
     Coin coin; // The actual cached data.
     unsigned char flags;
+    uint32_t last_used; // Epoch of the owning cache at the last access, see CCoinsViewCache::Trim().
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -115,11 +116,23 @@ struct CCoinsCacheEntry
          */
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+    CCoinsCacheEntry() : flags(0), last_used(0) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0), last_used(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The nodes of a CCoinsMap are taken from a pool. The size of a node is
+ * implementation defined, but it is the cached pair plus a few pointers (the
+ * next node, and possibly a cached hash), so that is the largest block size
+ * the pool serves. The bucket array is allocated from the pool while it is
+ * small, and from the system once it has grown.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                      sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4,
+                      alignof(void*)>
+    CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -164,8 +177,9 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. If erase is false, its entries
+    //! are left in place and their coins are not moved from.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true);
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -190,8 +204,9 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
+    CCoinsView* GetBackend() const { return base; }
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -206,11 +221,15 @@ protected:
      * declared as "const".
      */
     mutable uint256 hashBlock;
+    mutable CCoinsMapMemoryResource m_cache_coins_memory_resource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Incremented on every BatchWrite into this cache, i.e. once per connected block for the chainstate tip. */
+    uint32_t m_epoch;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -224,7 +243,7 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -254,6 +273,14 @@ public:
      */
     void AddCoin(const COutPoint& outpoint, Coin&& coin, bool potential_overwrite);
 
+    /**
+     * Insert a coin that the caller looked up in the backing view itself,
+     * e.g. when prefetching the inputs of a block on other threads. The entry
+     * is not marked as modified. If the outpoint is already present in the
+     * cache (spent or not), this call has no effect.
+     */
+    void InsertFetchedCoin(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call
@@ -268,6 +295,18 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, like Flush(),
+     * but keep the unspent entries in the cache as unmodified entries.
+     */
+    bool Sync();
+
+    /**
+     * Drop the least recently used unmodified entries from the cache until its
+     * memory usage is at most target_usage, or no unmodified entries are left.
+     */
+    void Trim(size_t target_usage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -295,6 +334,9 @@ public:
 
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+
+    //! Give the memory of an empty cache back to the system, by starting over with a new pool.
+    void ReallocateCache();
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
@@ -53,7 +53,12 @@ static bool IsToPubKey(const CScript& script, CPubKey &pubkey)
     return false;
 }
 
-bool CompressScript(const CScript& script, std::vector<unsigned char> &out)
+static bool IsToWitnessProgram(const CScript& script, opcodetype version, unsigned int size)
+{
+    return script.size() == size + 2 && script[0] == version && script[1] == size;
+}
+
+bool CompressScript(const CScript& script, std::vector<unsigned char> &out, bool extended)
 {
     CKeyID keyID;
     if (IsToKeyID(script, keyID)) {
@@ -81,14 +86,27 @@ bool CompressScript(const CScript& script, std::vector<unsigned char> &out)
             return true;
         }
     }
+    if (!extended) return false;
+    if (IsToWitnessProgram(script, OP_0, 20)) {
+        out.resize(21);
+        out[0] = 0x06;
+        memcpy(&out[1], &script[2], 20);
+        return true;
+    }
+    if (IsToWitnessProgram(script, OP_0, 32) || IsToWitnessProgram(script, OP_1, 32)) {
+        out.resize(33);
+        out[0] = script[0] == OP_0 ? 0x07 : 0x08;
+        memcpy(&out[1], &script[2], 32);
+        return true;
+    }
     return false;
 }
 
 unsigned int GetSpecialScriptSize(unsigned int nSize)
 {
-    if (nSize == 0 || nSize == 1)
+    if (nSize == 0 || nSize == 1 || nSize == 6)
         return 20;
-    if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5)
+    if (nSize == 2 || nSize == 3 || nSize == 4 || nSize == 5 || nSize == 7 || nSize == 8)
         return 32;
     return 0;
 }
@@ -121,7 +139,7 @@ bool DecompressScript(CScript& script, unsigned int nSize, const std::vector<uns
         script[34] = OP_CHECKSIG;
         return true;
     case 0x04:
-    case 0x05:
+    case 0x05: {
         unsigned char vch[33] = {};
         vch[0] = nSize - 2;
         memcpy(&vch[1], in.data(), 32);
@@ -135,6 +153,20 @@ bool DecompressScript(CScript& script, unsigned int nSize, const std::vector<uns
         script[66] = OP_CHECKSIG;
         return true;
     }
+    case 0x06:
+        script.resize(22);
+        script[0] = OP_0;
+        script[1] = 20;
+        memcpy(&script[2], in.data(), 20);
+        return true;
+    case 0x07:
+    case 0x08:
+        script.resize(34);
+        script[0] = nSize == 0x07 ? OP_0 : OP_1;
+        script[1] = 32;
+        memcpy(&script[2], in.data(), 32);
+        return true;
+    }
     return false;
 }
 
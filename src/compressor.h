@@ -15,7 +15,7 @@ class CKeyID;
 class CPubKey;
 class CScriptID;
 
-bool CompressScript(const CScript& script, std::vector<unsigned char> &out);
+bool CompressScript(const CScript& script, std::vector<unsigned char> &out, bool extended = false);
 unsigned int GetSpecialScriptSize(unsigned int nSize);
 bool DecompressScript(CScript& script, unsigned int nSize, const std::vector<unsigned char> &out);
 
@@ -32,6 +32,15 @@ uint64_t DecompressAmount(uint64_t nAmount);
  *
  *  Other scripts up to 121 bytes require 1 byte + script length. Above
  *  that, scripts up to 16505 bytes require 2 bytes + script length.
+ *
+ *  The extended encoding, used by the chainstate database, defines 3 more
+ *  special cases:
+ *  * Pay to witness pubkey hash (encoded as 21 bytes)
+ *  * Pay to witness script hash (encoded as 33 bytes)
+ *  * Version 1 witness programs of 32 bytes (encoded as 33 bytes)
+ *
+ *  With it, other scripts up to 118 bytes require 1 byte + script length.
+ *  The two encodings are not compatible.
  */
 class CScriptCompressor
 {
@@ -43,19 +52,23 @@ private:
      * and nHeight of the enclosing transaction.
      */
     static const unsigned int nSpecialScripts = 6;
+    static const unsigned int nExtendedSpecialScripts = 9;
 
     CScript &script;
+    const bool m_extended;
+
+    unsigned int SpecialScripts() const { return m_extended ? nExtendedSpecialScripts : nSpecialScripts; }
 public:
-    explicit CScriptCompressor(CScript &scriptIn) : script(scriptIn) { }
+    explicit CScriptCompressor(CScript &scriptIn, bool extended = false) : script(scriptIn), m_extended(extended) { }
 
     template<typename Stream>
     void Serialize(Stream &s) const {
         std::vector<unsigned char> compr;
-        if (CompressScript(script, compr)) {
+        if (CompressScript(script, compr, m_extended)) {
             s << MakeSpan(compr);
             return;
         }
-        unsigned int nSize = script.size() + nSpecialScripts;
+        unsigned int nSize = script.size() + SpecialScripts();
         s << VARINT(nSize);
         s << MakeSpan(script);
     }
@@ -64,13 +77,13 @@ public:
     void Unserialize(Stream &s) {
         unsigned int nSize = 0;
         s >> VARINT(nSize);
-        if (nSize < nSpecialScripts) {
+        if (nSize < SpecialScripts()) {
             std::vector<unsigned char> vch(GetSpecialScriptSize(nSize), 0x00);
             s >> MakeSpan(vch);
             DecompressScript(script, nSize, vch);
             return;
         }
-        nSize -= nSpecialScripts;
+        nSize -= SpecialScripts();
         if (nSize > MAX_SCRIPT_SIZE) {
             // Overly long script, replace with a short invalid one
             script << OP_RETURN;
@@ -87,9 +100,11 @@ class CTxOutCompressor
 {
 private:
     CTxOut &txout;
+    //! Use the extended script encoding (see CScriptCompressor)
+    const bool m_extended;
 
 public:
-    explicit CTxOutCompressor(CTxOut &txoutIn) : txout(txoutIn) { }
+    explicit CTxOutCompressor(CTxOut &txoutIn, bool extended = false) : txout(txoutIn), m_extended(extended) { }
 
     ADD_SERIALIZE_METHODS;
 
@@ -103,7 +118,7 @@ public:
             READWRITE(VARINT(nVal));
             txout.nValue = DecompressAmount(nVal);
         }
-        CScriptCompressor cscript(REF(txout.scriptPubKey));
+        CScriptCompressor cscript(REF(txout.scriptPubKey), m_extended);
         READWRITE(cscript);
     }
 };
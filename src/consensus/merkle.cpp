@@ -62,6 +62,47 @@ uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
     return hashes[0];
 }
 
+std::vector<uint256> ComputeMerkleRoots(std::vector<std::vector<uint256>> trees, std::vector<bool>* mutated) {
+    std::vector<bool> mutation(trees.size(), false);
+    std::vector<uint256> level;
+    while (true) {
+        // Gather the current level of every tree that is not done yet.
+        level.clear();
+        for (size_t t = 0; t < trees.size(); t++) {
+            std::vector<uint256>& hashes = trees[t];
+            if (hashes.size() <= 1) continue;
+            if (mutated) {
+                for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                    if (hashes[pos] == hashes[pos + 1]) mutation[t] = true;
+                }
+            }
+            if (hashes.size() & 1) {
+                hashes.push_back(hashes.back());
+            }
+            level.insert(level.end(), hashes.begin(), hashes.end());
+        }
+        if (level.empty()) break;
+        // Every tree contributes an even number of nodes, so pairs never
+        // straddle two trees.
+        SHA256D64(level[0].begin(), level[0].begin(), level.size() / 2);
+        size_t pos = 0;
+        for (std::vector<uint256>& hashes : trees) {
+            if (hashes.size() <= 1) continue;
+            const size_t pairs = hashes.size() / 2;
+            std::copy(level.begin() + pos, level.begin() + pos + pairs, hashes.begin());
+            hashes.resize(pairs);
+            pos += pairs;
+        }
+    }
+    if (mutated) *mutated = std::move(mutation);
+    std::vector<uint256> roots;
+    roots.reserve(trees.size());
+    for (const std::vector<uint256>& hashes : trees) {
+        roots.push_back(hashes.empty() ? uint256() : hashes[0]);
+    }
+    return roots;
+}
+
 
 uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
 {
@@ -84,3 +125,19 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
     return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
+uint256 BlockMerkleRoots(const CBlock& block, uint256& witness_root, bool* mutated)
+{
+    std::vector<std::vector<uint256>> trees(2);
+    trees[0].resize(block.vtx.size());
+    trees[1].resize(block.vtx.size());
+    for (size_t s = 0; s < block.vtx.size(); s++) {
+        trees[0][s] = block.vtx[s]->GetHash();
+        // The witness hash of the coinbase is 0.
+        if (s > 0) trees[1][s] = block.vtx[s]->GetWitnessHash();
+    }
+    std::vector<bool> mutation;
+    std::vector<uint256> roots = ComputeMerkleRoots(std::move(trees), mutated ? &mutation : nullptr);
+    if (mutated) *mutated = mutation[0];
+    witness_root = roots[1];
+    return roots[0];
+}
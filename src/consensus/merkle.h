@@ -14,6 +14,15 @@
 
 uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated = nullptr);
 
+/*
+ * Compute the roots of several Merkle trees at once. The nodes of each level
+ * of all trees are hashed in a single SHA256D64 call, so that the multi-lane
+ * transforms stay busy up to the top levels of the trees.
+ * If mutated is not nullptr, it is set to one flag per tree, as in
+ * ComputeMerkleRoot.
+ */
+std::vector<uint256> ComputeMerkleRoots(std::vector<std::vector<uint256>> trees, std::vector<bool>* mutated = nullptr);
+
 /*
  * Compute the Merkle root of the transactions in a block.
  * *mutated is set to true if a duplicated subtree was found.
@@ -26,4 +35,12 @@ uint256 BlockMerkleRoot(const CBlock& block, bool* mutated = nullptr);
  */
 uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated = nullptr);
 
+/*
+ * Compute both the Merkle root and the witness Merkle root of a block, in a
+ * single pass over the two trees.
+ * *mutated is set to true if a duplicated subtree was found in the
+ * transaction tree (see BlockMerkleRoot).
+ */
+uint256 BlockMerkleRoots(const CBlock& block, uint256& witness_root, bool* mutated = nullptr);
+
 #endif // BITCOIN_CONSENSUS_MERKLE_H
@@ -93,13 +93,39 @@ public:
 // using only serialization with and without witness data. As witness_size
 // is equal to total_size - stripped_size, this formula is identical to:
 // weight = (stripped_size * 3) + total_size.
+// Transaction sizes are cached on CTransaction, so block sizes are summed from
+// them instead of serializing the whole block again.
 static inline int64_t GetTransactionWeight(const CTransaction& tx)
 {
-    return ::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * (WITNESS_SCALE_FACTOR - 1) + ::GetSerializeSize(tx, PROTOCOL_VERSION);
+    return tx.GetStrippedSize() * (WITNESS_SCALE_FACTOR - 1) + tx.GetTotalSize();
+}
+static inline int64_t GetBlockHeaderAndCountSize(const CBlock& block)
+{
+    return ::GetSerializeSize(CBlockHeader(block), PROTOCOL_VERSION) + GetSizeOfCompactSize(block.vtx.size());
+}
+static inline int64_t GetBlockStrippedSize(const CBlock& block)
+{
+    int64_t size = GetBlockHeaderAndCountSize(block);
+    for (const auto& tx : block.vtx) {
+        size += tx->GetStrippedSize();
+    }
+    return size;
+}
+static inline int64_t GetBlockTotalSize(const CBlock& block)
+{
+    int64_t size = GetBlockHeaderAndCountSize(block);
+    for (const auto& tx : block.vtx) {
+        size += tx->GetTotalSize();
+    }
+    return size;
 }
 static inline int64_t GetBlockWeight(const CBlock& block)
 {
-    return ::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * (WITNESS_SCALE_FACTOR - 1) + ::GetSerializeSize(block, PROTOCOL_VERSION);
+    int64_t weight = GetBlockHeaderAndCountSize(block) * WITNESS_SCALE_FACTOR;
+    for (const auto& tx : block.vtx) {
+        weight += GetTransactionWeight(*tx);
+    }
+    return weight;
 }
 static inline int64_t GetTransactionInputWeight(const CTxIn& txin)
 {
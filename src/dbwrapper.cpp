@@ -4,8 +4,10 @@
 
 #include <dbwrapper.h>
 
+#include <appendlogdb.h>
 #include <memory>
 #include <random.h>
+#include <sync.h>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -13,6 +15,10 @@
 #include <memenv.h>
 #include <stdint.h>
 #include <algorithm>
+#include <atomic>
+#include <locale>
+#include <set>
+#include <sstream>
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
@@ -72,6 +78,121 @@ public:
     }
 };
 
+/** LevelDB block cache that counts how often lookups find a block */
+class CBitcoinLevelDBCache : public leveldb::Cache {
+private:
+    std::unique_ptr<leveldb::Cache> m_cache;
+
+public:
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+
+    explicit CBitcoinLevelDBCache(size_t capacity) : m_cache(leveldb::NewLRUCache(capacity)) {}
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value)) override {
+        return m_cache->Insert(key, value, charge, deleter);
+    }
+    Handle* Lookup(const leveldb::Slice& key) override {
+        Handle* handle = m_cache->Lookup(key);
+        ++(handle ? m_hits : m_misses);
+        return handle;
+    }
+    void Release(Handle* handle) override { m_cache->Release(handle); }
+    void* Value(Handle* handle) override { return m_cache->Value(handle); }
+    void Erase(const leveldb::Slice& key) override { m_cache->Erase(key); }
+    uint64_t NewId() override { return m_cache->NewId(); }
+    void Prune() override { m_cache->Prune(); }
+    size_t TotalCharge() const override { return m_cache->TotalCharge(); }
+};
+
+bool GetDBOptions(const std::string& db_name, DBOptions& options, std::string& error)
+{
+    for (const std::string& arg : gArgs.GetArgs("-dboption")) {
+        if (arg.empty()) continue;
+        const size_t colon = arg.find(':');
+        const size_t equals = colon == std::string::npos ? std::string::npos : arg.find('=', colon);
+        if (equals == std::string::npos) {
+            error = strprintf("Invalid -dboption '%s', expected <db>:<option>=<value>", arg);
+            return false;
+        }
+        const std::string name = arg.substr(colon + 1, equals - colon - 1);
+        const std::string value = arg.substr(equals + 1);
+        // Settings for other databases are only checked.
+        DBOptions other;
+        DBOptions& target = arg.substr(0, colon) == db_name ? options : other;
+        int32_t n;
+        if (name == "blockcache" || name == "writebuffer") {
+            if (!ParseInt32(value, &n) || n < 0 || n > 100) {
+                error = strprintf("Invalid -dboption '%s', %s is a percentage of the cache size", arg, name);
+                return false;
+            }
+            (name == "blockcache" ? target.block_cache_percent : target.write_buffer_percent) = n;
+        } else if (name == "bloombits") {
+            if (!ParseInt32(value, &n) || n < 0 || n > 64) {
+                error = strprintf("Invalid -dboption '%s', bloombits must be between 0 and 64", arg);
+                return false;
+            }
+            target.bloom_bits = n;
+        } else if (name == "compression") {
+            if (value != "none" && value != "snappy") {
+                error = strprintf("Invalid -dboption '%s', compression must be none or snappy", arg);
+                return false;
+            }
+            target.compression = value == "snappy";
+        } else if (name == "backend") {
+            if (value != "leveldb" && value != "appendlog") {
+                error = strprintf("Invalid -dboption '%s', backend must be leveldb or appendlog", arg);
+                return false;
+            }
+            // The append log keeps every key in memory, which the UTXO set is far too large for.
+            if (value == "appendlog" && arg.compare(0, colon, "chainstate") == 0) {
+                error = strprintf("Invalid -dboption '%s', the appendlog backend is not supported for the chainstate", arg);
+                return false;
+            }
+            target.append_log = value == "appendlog";
+        } else {
+            error = strprintf("Invalid -dboption '%s', unknown option %s", arg, name);
+            return false;
+        }
+    }
+    if (options.block_cache_percent + 2 * options.write_buffer_percent > 100) {
+        error = strprintf("Invalid -dboption settings for %s, the block cache (%d%%) and two write buffers (%d%% each) exceed its cache size",
+            db_name, options.block_cache_percent, options.write_buffer_percent);
+        return false;
+    }
+    return true;
+}
+
+bool CheckDBOptions(const std::vector<std::string>& db_names, std::string& error)
+{
+    for (const std::string& arg : gArgs.GetArgs("-dboption")) {
+        const std::string db_name = arg.substr(0, arg.find(':'));
+        if (!arg.empty() && std::find(db_names.begin(), db_names.end(), db_name) == db_names.end()) {
+            error = strprintf("Invalid -dboption '%s', unknown database %s", arg, db_name);
+            return false;
+        }
+    }
+    for (const std::string& db_name : db_names) {
+        DBOptions options;
+        if (!GetDBOptions(db_name, options, error)) return false;
+    }
+    return true;
+}
+
+//! Open databases, for GetDBStats
+static Mutex g_dbwrappers_mutex;
+static std::set<const CDBWrapper*> g_dbwrappers GUARDED_BY(g_dbwrappers_mutex);
+
+std::vector<DBStats> GetDBStats()
+{
+    LOCK(g_dbwrappers_mutex);
+    std::vector<DBStats> stats;
+    for (const CDBWrapper* db : g_dbwrappers) {
+        stats.push_back(db->GetStats());
+    }
+    return stats;
+}
+
 static void SetMaxOpenFiles(leveldb::Options *options) {
     // On most platforms the default setting of max_open_files (which is 1000)
     // is optimal. On Windows using a large file count is OK because the handles
@@ -97,13 +218,13 @@ static void SetMaxOpenFiles(leveldb::Options *options) {
              options->max_open_files, default_open_files);
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const DBOptions& db_options, leveldb::Cache* block_cache)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
+    options.block_cache = block_cache;
+    options.write_buffer_size = nCacheSize / 100 * db_options.write_buffer_percent; // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = db_options.bloom_bits > 0 ? leveldb::NewBloomFilterPolicy(db_options.bloom_bits) : nullptr;
+    options.compression = db_options.compression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -115,16 +236,23 @@ static leveldb::Options GetOptions(size_t nCacheSize)
 }
 
 CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
-    : m_name(fs::basename(path))
+    : m_name(fs::basename(path)), m_cache_size(nCacheSize)
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    std::string error;
+    if (!GetDBOptions(m_name, m_db_options, error)) {
+        throw dbwrapper_error(error);
+    }
+    m_block_cache = new CBitcoinLevelDBCache(nCacheSize / 100 * m_db_options.block_cache_percent);
+    options = GetOptions(nCacheSize, m_db_options, m_block_cache);
     options.create_if_missing = true;
     if (fMemory) {
+        // The append log is always on disk.
+        m_db_options.append_log = false;
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
         options.env = penv;
     } else {
@@ -132,13 +260,19 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
             LogPrintf("Wiping LevelDB in %s\n", path.string());
             leveldb::Status result = leveldb::DestroyDB(path.string(), options);
             dbwrapper_private::HandleError(result);
+            dbwrapper_private::HandleError(CAppendLogDB::Destroy(path));
         }
         TryCreateDirectories(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
+        // Switching the backend of an existing database requires a -reindex(-chainstate).
+        if (fs::exists(path / (m_db_options.append_log ? "CURRENT" : CAppendLogDB::FILENAME))) {
+            throw dbwrapper_error(strprintf("Database %s was not created with the %s backend", path.string(),
+                                            m_db_options.append_log ? "appendlog" : "leveldb"));
+        }
+        LogPrintf("Opening %s in %s\n", m_db_options.append_log ? "append log" : "LevelDB", path.string());
     }
-    leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
+    leveldb::Status status = m_db_options.append_log ? CAppendLogDB::Open(path, &pdb) : leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    LogPrintf("Opened %s successfully\n", m_db_options.append_log ? "append log" : "LevelDB");
 
     if (gArgs.GetBoolArg("-forcecompactdb", false)) {
         LogPrintf("Starting database compaction of %s\n", path.string());
@@ -164,10 +298,17 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), HexStr(obfuscate_key));
+
+    LOCK(g_dbwrappers_mutex);
+    g_dbwrappers.insert(this);
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    {
+        LOCK(g_dbwrappers_mutex);
+        g_dbwrappers.erase(this);
+    }
     delete pdb;
     pdb = nullptr;
     delete options.filter_policy;
@@ -206,6 +347,36 @@ size_t CDBWrapper::DynamicMemoryUsage() const {
     return stoul(memory);
 }
 
+DBStats CDBWrapper::GetStats() const
+{
+    DBStats stats;
+    stats.name = m_name;
+    stats.options = m_db_options;
+    stats.cache_size = m_cache_size;
+    stats.memory_usage = DynamicMemoryUsage();
+    stats.cache_hits = m_block_cache->m_hits;
+    stats.cache_misses = m_block_cache->m_misses;
+
+    // LevelDB only reports compaction statistics as a table, one row per level:
+    // level, files, size (MB), compaction time (s), compaction read and written (MB).
+    std::string table;
+    if (!pdb->GetProperty("leveldb.stats", &table)) {
+        LogPrint(BCLog::LEVELDB, "Failed to get stats property\n");
+        return stats;
+    }
+    std::istringstream lines(table);
+    std::string line;
+    while (std::getline(lines, line)) {
+        DBStats::Level level;
+        std::istringstream row(line);
+        row.imbue(std::locale::classic());
+        if (row >> level.level >> level.files >> level.size_mb >> level.compaction_time >> level.compaction_read_mb >> level.compaction_write_mb) {
+            stats.levels.push_back(level);
+        }
+    }
+    return stats;
+}
+
 // Prefixed with null character to avoid collisions with other keys
 //
 // We must use a string constructor which specifies length so that we copy
@@ -233,6 +404,9 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+CDBSnapshot::CDBSnapshot(const CDBWrapper &_parent) : parent(_parent), psnapshot(_parent.pdb->GetSnapshot()) {}
+CDBSnapshot::~CDBSnapshot() { parent.pdb->ReleaseSnapshot(psnapshot); }
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() const { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
@@ -26,6 +26,62 @@ public:
 };
 
 class CDBWrapper;
+class CBitcoinLevelDBCache;
+
+/** Settings of a database that can be tuned with -dboption */
+struct DBOptions
+{
+    //! Store the database in an append-only log (see CAppendLogDB) instead of LevelDB
+    bool append_log = false;
+    //! Share of the cache size used for the block cache, in percent
+    int block_cache_percent = 50;
+    //! Share of the cache size used for each write buffer, in percent; up to two write buffers may be held in memory simultaneously
+    int write_buffer_percent = 25;
+    //! Bits per key of the bloom filter, or 0 for no filter
+    int bloom_bits = 10;
+    //! Compress table blocks with Snappy, if LevelDB was built with it
+    bool compression = false;
+};
+
+/**
+ * Apply the -dboption settings for the database with the given name to
+ * options. Returns false and sets error if any -dboption is malformed,
+ * whichever database it is for, or if the resulting block cache and write
+ * buffers exceed the cache size of the database.
+ */
+bool GetDBOptions(const std::string& db_name, DBOptions& options, std::string& error);
+
+/**
+ * Check the -dboption settings at startup: besides being well-formed, they
+ * must name one of db_names, and leave the block cache and write buffers of
+ * each database within its cache size.
+ */
+bool CheckDBOptions(const std::vector<std::string>& db_names, std::string& error);
+
+/** Statistics of an open database, as reported by LevelDB */
+struct DBStats
+{
+    //! Compaction statistics of a level of the database
+    struct Level {
+        int level;
+        int files;
+        double size_mb;
+        double compaction_time;
+        double compaction_read_mb;
+        double compaction_write_mb;
+    };
+
+    std::string name;
+    DBOptions options;
+    size_t cache_size;
+    size_t memory_usage;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    std::vector<Level> levels;
+};
+
+/** Statistics of all open databases */
+std::vector<DBStats> GetDBStats();
 
 /** These should be considered an implementation detail of the specific database.
  */
@@ -173,9 +229,32 @@ public:
 
 };
 
+/**
+ * A consistent, read-only view of a CDBWrapper as of the time it was taken.
+ * Reads and iterators that use it do not see later writes, so several
+ * iterators can walk the same state of the database concurrently. Must not
+ * outlive the CDBWrapper it was taken from.
+ */
+class CDBSnapshot
+{
+private:
+    const CDBWrapper &parent;
+    const leveldb::Snapshot *psnapshot;
+
+    friend class CDBWrapper;
+
+public:
+    explicit CDBSnapshot(const CDBWrapper &_parent);
+    ~CDBSnapshot();
+
+    CDBSnapshot(const CDBSnapshot&) = delete;
+    CDBSnapshot& operator=(const CDBSnapshot&) = delete;
+};
+
 class CDBWrapper
 {
     friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend class CDBSnapshot;
 private:
     //! custom environment this database is using (may be nullptr in case of default environment)
     leveldb::Env* penv;
@@ -201,6 +280,15 @@ private:
     //! the name of this database
     std::string m_name;
 
+    //! the -dboption settings of this database
+    DBOptions m_db_options;
+
+    //! the cache size this database was opened with
+    size_t m_cache_size;
+
+    //! the block cache of the database (owned by options)
+    CBitcoinLevelDBCache* m_block_cache;
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -228,15 +316,19 @@ public:
     CDBWrapper& operator=(const CDBWrapper&) = delete;
 
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool Read(const K& key, V& value, const CDBSnapshot* snapshot = nullptr) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
+        leveldb::ReadOptions options = readoptions;
+        if (snapshot) {
+            options.snapshot = snapshot->psnapshot;
+        }
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -293,6 +385,9 @@ public:
     // Get an estimate of LevelDB memory usage (in bytes).
     size_t DynamicMemoryUsage() const;
 
+    // Get the statistics of the database.
+    DBStats GetStats() const;
+
     // not available for LevelDB; provide for compatibility with BDB
     bool Flush()
     {
@@ -310,6 +405,14 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    /** Iterate over the database as of the given snapshot of it. */
+    CDBIterator *NewIterator(const CDBSnapshot& snapshot) const
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot.psnapshot;
+        return new CDBIterator(*this, pdb->NewIterator(options));
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
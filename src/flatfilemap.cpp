@@ -0,0 +1,116 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#include <flatfilemap.h>
+
+#include <logging.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FlatFileMapping::~FlatFileMapping()
+{
+#ifndef WIN32
+    munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+}
+
+std::unique_ptr<FlatFileMapping> FlatFileMapping::Map(const fs::path& path)
+{
+#ifdef WIN32
+    // A mapped view prevents the file from being truncated or deleted on
+    // Windows, which would break finalizing and pruning of block files.
+    return nullptr;
+#else
+    // Mapping whole block files is only sensible with a 64-bit address space.
+    if (sizeof(void*) < 8) return nullptr;
+
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    const size_t size = st.st_size;
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LogPrintf("Unable to map file %s\n", path.string());
+        return nullptr;
+    }
+    return std::unique_ptr<FlatFileMapping>(new FlatFileMapping(static_cast<const unsigned char*>(addr), size));
+#endif
+}
+
+FlatFileSpan::FlatFileSpan(std::vector<unsigned char>&& buffer)
+{
+    auto owned = std::make_shared<const std::vector<unsigned char>>(std::move(buffer));
+    m_data = Span<const unsigned char>(owned->data(), owned->size());
+    m_owner = std::move(owned);
+}
+
+bool FlatFileMapCache::Read(const fs::path& path, uint64_t offset, size_t size, FlatFileSpan& span)
+{
+    if (m_max_files == 0) return false;
+
+    std::shared_ptr<const FlatFileMapping> mapping;
+    {
+        LOCK(m_mutex);
+        auto it = m_index.find(path);
+        if (it != m_index.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            mapping = it->second->second;
+        }
+    }
+
+    if (!mapping || offset + size > mapping->size()) {
+        // Not mapped yet, or the file has grown since it was mapped.
+        mapping = FlatFileMapping::Map(path);
+        if (!mapping || offset + size > mapping->size()) return false;
+
+        LOCK(m_mutex);
+        auto it = m_index.find(path);
+        if (it != m_index.end()) {
+            it->second->second = mapping;
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+        } else {
+            m_lru.emplace_front(path, mapping);
+            m_index.emplace(path, m_lru.begin());
+            if (m_lru.size() > m_max_files) {
+                // Outstanding spans keep an evicted mapping alive until they are released.
+                m_index.erase(m_lru.back().first);
+                m_lru.pop_back();
+            }
+        }
+    }
+
+    span = FlatFileSpan(mapping, Span<const unsigned char>(mapping->data() + offset, size));
+    return true;
+}
+
+void FlatFileMapCache::Erase(const fs::path& path)
+{
+    LOCK(m_mutex);
+    auto it = m_index.find(path);
+    if (it == m_index.end()) return;
+    m_lru.erase(it->second);
+    m_index.erase(it);
+}
+
+size_t FlatFileMapCache::Size()
+{
+    LOCK(m_mutex);
+    return m_lru.size();
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATFILEMAP_H
+#define BITCOIN_FLATFILEMAP_H
+
+#include <fs.h>
+#include <span.h>
+#include <sync.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+/** A read-only memory mapping of a whole file. */
+class FlatFileMapping
+{
+private:
+    const unsigned char* m_data;
+    size_t m_size;
+
+    FlatFileMapping(const unsigned char* data, size_t size) : m_data(data), m_size(size) {}
+
+public:
+    FlatFileMapping(const FlatFileMapping&) = delete;
+    FlatFileMapping& operator=(const FlatFileMapping&) = delete;
+    ~FlatFileMapping();
+
+    /**
+     * Map the file at path as it currently exists. Returns nullptr if the file
+     * cannot be opened or mapped, or if mapping is not supported on this
+     * platform.
+     */
+    static std::unique_ptr<FlatFileMapping> Map(const fs::path& path);
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
+
+/**
+ * A read-only range of bytes that keeps its backing storage (a file mapping,
+ * or a plain buffer for callers that had to fall back to reading the file)
+ * alive for as long as the span is referenced.
+ */
+class FlatFileSpan
+{
+private:
+    std::shared_ptr<const void> m_owner;
+    Span<const unsigned char> m_data;
+
+public:
+    FlatFileSpan() {}
+    FlatFileSpan(std::shared_ptr<const void> owner, Span<const unsigned char> data) : m_owner(std::move(owner)), m_data(data) {}
+    explicit FlatFileSpan(std::vector<unsigned char>&& buffer);
+
+    const Span<const unsigned char>& Get() const { return m_data; }
+    const unsigned char* data() const { return m_data.data(); }
+    const unsigned char* begin() const { return m_data.begin(); }
+    const unsigned char* end() const { return m_data.end(); }
+    size_t size() const { return m_data.size(); }
+    bool empty() const { return m_data.size() == 0; }
+};
+
+/**
+ * Keeps the most recently used flat files mapped into memory, so that reads
+ * from them are plain memory accesses instead of an open/seek/read/close
+ * sequence per request.
+ *
+ * Files may keep growing while mapped: a read past the end of an existing
+ * mapping remaps the file. Files that are deleted must be dropped with
+ * Erase() so that their mapping is released.
+ */
+class FlatFileMapCache
+{
+private:
+    typedef std::list<std::pair<fs::path, std::shared_ptr<const FlatFileMapping>>> LruList;
+
+    const size_t m_max_files;
+
+    Mutex m_mutex;
+    LruList m_lru GUARDED_BY(m_mutex);
+    std::map<fs::path, LruList::iterator> m_index GUARDED_BY(m_mutex);
+
+public:
+    /** @param max_files Number of files kept mapped at once. Zero disables mapping. */
+    explicit FlatFileMapCache(size_t max_files) : m_max_files(max_files) {}
+
+    /**
+     * Get a span of size bytes starting at offset in the file at path.
+     * @return false if the range is not (yet) in the file, or the file could
+     *         not be mapped. Callers are expected to fall back to regular file
+     *         reads in that case.
+     */
+    bool Read(const fs::path& path, uint64_t offset, size_t size, FlatFileSpan& span);
+
+    /** Release the mapping of the file at path, if any. */
+    void Erase(const fs::path& path);
+
+    /** Number of files currently mapped. */
+    size_t Size();
+};
+
+#endif // BITCOIN_FLATFILEMAP_H
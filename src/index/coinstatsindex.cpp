@@ -0,0 +1,270 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/coinstatsindex.h>
+
+#include <chainparams.h>
+#include <streams.h>
+#include <undo.h>
+#include <util/system.h>
+#include <validation.h>
+#include <version.h>
+
+constexpr char DB_BLOCK_STATS = 's';
+constexpr char DB_STATE = 'M';
+
+std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+uint64_t GetBogoSize(const CScript& script_pub_key)
+{
+    return 32 /* txid */ +
+           4 /* vout index */ +
+           4 /* height + coinbase */ +
+           8 /* amount */ +
+           2 /* scriptPubKey len */ +
+           script_pub_key.size() /* scriptPubKey */;
+}
+
+static void TxOutSer(CDataStream& ss, const COutPoint& outpoint, const Coin& coin)
+{
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+}
+
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    TxOutSer(ss, outpoint, coin);
+    muhash.Insert(reinterpret_cast<const unsigned char*>(ss.data()), ss.size());
+}
+
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    TxOutSer(ss, outpoint, coin);
+    muhash.Remove(reinterpret_cast<const unsigned char*>(ss.data()), ss.size());
+}
+
+/**
+ * The coinbase transactions of two early mainnet blocks repeat the coinbase of
+ * an earlier block (see BIP30). Their outputs replaced those of the earlier
+ * coinbase in the UTXO set, instead of being added to it. Returns the height
+ * of the earlier block, or 0 for any other block.
+ */
+static int GetBIP30RepeatedHeight(const CBlockIndex* pindex)
+{
+    if (pindex->nHeight == 91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) return 91812;
+    if (pindex->nHeight == 91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")) return 91722;
+    return 0;
+}
+
+/**
+ * Access to the coinstats index database (indexes/coinstats/)
+ *
+ * Besides the block locator kept by every index, the database stores the
+ * statistics of the UTXO set as of each block that was indexed, keyed by
+ * block hash, and the running MuHash state together with the block it is as
+ * of. The running state is written in the same batch as the statistics of its
+ * block, so the two never disagree.
+ */
+class CoinStatsIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    /// Read the statistics as of the given block. Returns false if the block is not indexed.
+    bool ReadStats(const uint256& block_hash, CoinStats& stats) const;
+
+    /// Read the running state of the index. Returns false if there is none.
+    bool ReadState(uint256& block_hash, MuHash3072& muhash, CoinStats& stats) const;
+
+    /// Write the running state of the index, and, if write_block_stats is
+    /// set, the statistics of its block.
+    bool WriteState(const uint256& block_hash, const MuHash3072& muhash, const CoinStats& stats, bool write_block_stats);
+};
+
+CoinStatsIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "coinstats", n_cache_size, f_memory, f_wipe)
+{}
+
+bool CoinStatsIndex::DB::ReadStats(const uint256& block_hash, CoinStats& stats) const
+{
+    return Read(std::make_pair(DB_BLOCK_STATS, block_hash), stats);
+}
+
+bool CoinStatsIndex::DB::ReadState(uint256& block_hash, MuHash3072& muhash, CoinStats& stats) const
+{
+    std::pair<uint256, std::pair<MuHash3072, CoinStats>> state;
+    if (!Read(DB_STATE, state)) return false;
+    block_hash = state.first;
+    muhash = state.second.first;
+    stats = state.second.second;
+    return true;
+}
+
+bool CoinStatsIndex::DB::WriteState(const uint256& block_hash, const MuHash3072& muhash, const CoinStats& stats, bool write_block_stats)
+{
+    CDBBatch batch(*this);
+    if (write_block_stats) {
+        batch.Write(std::make_pair(DB_BLOCK_STATS, block_hash), stats);
+    }
+    batch.Write(DB_STATE, std::make_pair(block_hash, std::make_pair(muhash, stats)));
+    return WriteBatch(batch);
+}
+
+CoinStatsIndex::CoinStatsIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<CoinStatsIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+CoinStatsIndex::~CoinStatsIndex() {}
+
+bool CoinStatsIndex::Init()
+{
+    if (!m_db->ReadState(m_state_block, m_muhash, m_stats)) {
+        m_state_block.SetNull();
+        m_muhash = MuHash3072();
+        m_stats = CoinStats();
+    }
+    // The running state may be ahead of or behind the block locator, or on a
+    // different branch. WriteBlock moves it to wherever syncing resumes.
+    return BaseIndex::Init();
+}
+
+bool CoinStatsIndex::ApplyBlock(const CBlock& block, const CBlockIndex* pindex, bool revert)
+{
+    // The outputs of the genesis block are not part of the UTXO set.
+    if (pindex->nHeight > 0) {
+        CBlockUndo block_undo;
+        if (!UndoReadFromDisk(block_undo, pindex)) {
+            return error("%s: Failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (block_undo.vtxundo.size() + 1 != block.vtx.size()) {
+            return error("%s: Undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+        }
+
+        const int repeated_height = GetBIP30RepeatedHeight(pindex);
+        const int64_t sign = revert ? -1 : 1;
+        for (size_t i = 0; i < block.vtx.size(); ++i) {
+            const CTransaction& tx = *block.vtx[i];
+            const bool is_coinbase = tx.IsCoinBase();
+
+            for (uint32_t n = 0; n < tx.vout.size(); ++n) {
+                const CTxOut& out = tx.vout[n];
+                if (out.scriptPubKey.IsUnspendable()) continue;
+                const COutPoint outpoint(tx.GetHash(), n);
+                const Coin coin(out, pindex->nHeight, is_coinbase);
+                if (is_coinbase && repeated_height > 0) {
+                    // Replaces the output of the earlier coinbase: only the height changes.
+                    const Coin replaced(out, repeated_height, true);
+                    if (revert) {
+                        ApplyCoinHash(m_muhash, outpoint, replaced);
+                        RemoveCoinHash(m_muhash, outpoint, coin);
+                    } else {
+                        RemoveCoinHash(m_muhash, outpoint, replaced);
+                        ApplyCoinHash(m_muhash, outpoint, coin);
+                    }
+                    continue;
+                }
+                if (revert) {
+                    RemoveCoinHash(m_muhash, outpoint, coin);
+                } else {
+                    ApplyCoinHash(m_muhash, outpoint, coin);
+                }
+                m_stats.transaction_output_count += sign;
+                m_stats.bogo_size += sign * GetBogoSize(out.scriptPubKey);
+                m_stats.total_amount += sign * out.nValue;
+            }
+
+            if (is_coinbase) continue;
+
+            const CTxUndo& tx_undo = block_undo.vtxundo[i - 1];
+            if (tx_undo.vprevout.size() != tx.vin.size()) {
+                return error("%s: Undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+            }
+            for (size_t j = 0; j < tx.vin.size(); ++j) {
+                const Coin& coin = tx_undo.vprevout[j];
+                if (coin.nHeight == 0) {
+                    // Undo data written by versions before 0.15 does not
+                    // record the height of every spent output.
+                    return error("%s: Undo data of block %s is in a legacy format, a -reindex is required to build the index",
+                                 __func__, pindex->GetBlockHash().ToString());
+                }
+                if (revert) {
+                    ApplyCoinHash(m_muhash, tx.vin[j].prevout, coin);
+                } else {
+                    RemoveCoinHash(m_muhash, tx.vin[j].prevout, coin);
+                }
+                m_stats.transaction_output_count -= sign;
+                m_stats.bogo_size -= sign * GetBogoSize(coin.out.scriptPubKey);
+                m_stats.total_amount -= sign * coin.out.nValue;
+            }
+        }
+    }
+
+    const CBlockIndex* new_state_index = revert ? pindex->pprev : pindex;
+    m_state_block = new_state_index ? new_state_index->GetBlockHash() : uint256();
+
+    // Statistics of a block that is reverted to were written when it was connected.
+    if (!revert) m_muhash.Finalize(m_stats.muhash);
+    if (!m_db->WriteState(m_state_block, m_muhash, m_stats, !revert)) {
+        return error("%s: Failed to write state of block %s", __func__, m_state_block.ToString());
+    }
+    return true;
+}
+
+bool CoinStatsIndex::MoveStateTo(const CBlockIndex* target)
+{
+    const CBlockIndex* state_index = nullptr;
+    if (!m_state_block.IsNull()) {
+        LOCK(cs_main);
+        state_index = LookupBlockIndex(m_state_block);
+    }
+    if (!m_state_block.IsNull() && !state_index) {
+        return error("%s: Block %s of the index state is unknown", __func__, m_state_block.ToString());
+    }
+    if (state_index == target) return true;
+
+    const Consensus::Params& consensus_params = Params().GetConsensus();
+    const CBlockIndex* fork = (state_index && target) ? LastCommonAncestor(state_index, target) : nullptr;
+
+    // Unwind blocks that are not on the way to target...
+    while (state_index != fork) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, state_index, consensus_params)) {
+            return error("%s: Failed to read block %s from disk", __func__, state_index->GetBlockHash().ToString());
+        }
+        if (!ApplyBlock(block, state_index, true)) return false;
+        state_index = state_index->pprev;
+    }
+
+    // ...and replay those that are missing.
+    std::vector<const CBlockIndex*> to_apply;
+    for (const CBlockIndex* pindex = target; pindex != fork; pindex = pindex->pprev) {
+        to_apply.push_back(pindex);
+    }
+    for (auto it = to_apply.rbegin(); it != to_apply.rend(); ++it) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, *it, consensus_params)) {
+            return error("%s: Failed to read block %s from disk", __func__, (*it)->GetBlockHash().ToString());
+        }
+        if (!ApplyBlock(block, *it, false)) return false;
+    }
+    return true;
+}
+
+bool CoinStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // After a reorg, or when resuming from a block locator that is behind the
+    // running state, the state first has to be moved to the parent block.
+    if (!MoveStateTo(pindex->pprev)) return false;
+    return ApplyBlock(block, pindex, false);
+}
+
+BaseIndex::DB& CoinStatsIndex::GetDB() const { return *m_db; }
+
+bool CoinStatsIndex::LookUpStats(const CBlockIndex* block_index, CoinStats& stats) const
+{
+    return m_db->ReadStats(block_index->GetBlockHash(), stats);
+}
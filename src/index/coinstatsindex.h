@@ -0,0 +1,100 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_COINSTATSINDEX_H
+#define BITCOIN_INDEX_COINSTATSINDEX_H
+
+#include <amount.h>
+#include <chain.h>
+#include <coins.h>
+#include <crypto/muhash.h>
+#include <index/base.h>
+#include <serialize.h>
+#include <uint256.h>
+
+static const bool DEFAULT_COINSTATSINDEX = false;
+
+/** Statistics of the UTXO set as of a block. */
+struct CoinStats
+{
+    uint256 muhash;
+    uint64_t transaction_output_count;
+    uint64_t bogo_size;
+    CAmount total_amount;
+
+    CoinStats() : transaction_output_count(0), bogo_size(0), total_amount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(muhash);
+        READWRITE(transaction_output_count);
+        READWRITE(bogo_size);
+        READWRITE(total_amount);
+    }
+};
+
+/** Size of an unspent output as counted in the bogosize statistic. */
+uint64_t GetBogoSize(const CScript& script_pub_key);
+
+/** Add an unspent output to a MuHash of the UTXO set. */
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+
+/** Remove a spent output from a MuHash of the UTXO set. */
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+
+/**
+ * CoinStatsIndex maintains statistics on the UTXO set, including a rolling
+ * MuHash of its contents, as of every block of the chain. The statistics are
+ * updated incrementally from each connected block and its undo data, and are
+ * unwound again when blocks are disconnected, so that gettxoutsetinfo does
+ * not need to walk the chainstate.
+ */
+class CoinStatsIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+    /// Running state of the index, as of m_state_block (null before the genesis block).
+    uint256 m_state_block;
+    MuHash3072 m_muhash;
+    CoinStats m_stats;
+
+    /// Add the effects of a block to (or, if revert is set, remove them from)
+    /// the running state, and write the statistics of the resulting block.
+    bool ApplyBlock(const CBlock& block, const CBlockIndex* pindex, bool revert);
+
+    /// Rewind and replay blocks until the running state is as of target.
+    bool MoveStateTo(const CBlockIndex* target);
+
+protected:
+    bool Init() override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "coinstatsindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit CoinStatsIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~CoinStatsIndex() override;
+
+    /// Look up the statistics of the UTXO set as of a block. Returns false if
+    /// the index has not processed the block.
+    bool LookUpStats(const CBlockIndex* block_index, CoinStats& stats) const;
+};
+
+/// The global UTXO set statistics index. May be null.
+extern std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+#endif // BITCOIN_INDEX_COINSTATSINDEX_H
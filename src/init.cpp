@@ -21,6 +21,7 @@
 #include <httpserver.h>
 #include <httprpc.h>
 #include <interfaces/chain.h>
+#include <index/coinstatsindex.h>
 #include <index/txindex.h>
 #include <key.h>
 #include <validation.h>
@@ -189,6 +190,10 @@ void Interrupt()
     if (g_txindex) {
         g_txindex->Interrupt();
     }
+    if (g_coin_stats_index) {
+        g_coin_stats_index->Interrupt();
+    }
+    InterruptSnapshotValidation();
 }
 
 void Shutdown(InitInterfaces& interfaces)
@@ -220,6 +225,8 @@ void Shutdown(InitInterfaces& interfaces)
     if (peerLogic) UnregisterValidationInterface(peerLogic.get());
     if (g_connman) g_connman->Stop();
     if (g_txindex) g_txindex->Stop();
+    if (g_coin_stats_index) g_coin_stats_index->Stop();
+    StopSnapshotValidation();
 
     StopTorControl();
 
@@ -227,6 +234,9 @@ void Shutdown(InitInterfaces& interfaces)
     // CScheduler/checkqueue threadGroup
     threadGroup.interrupt_all();
     threadGroup.join_all();
+    StopScriptCheckThreads();
+    StopBlockPipeline();
+    StopUndoWriter();
 
     // After the threads that potentially access these pointers have been stopped,
     // destruct and reset all to nullptr.
@@ -234,6 +244,7 @@ void Shutdown(InitInterfaces& interfaces)
     g_connman.reset();
     g_banman.reset();
     g_txindex.reset();
+    g_coin_stats_index.reset();
 
     if (g_is_mempool_loaded && gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool();
@@ -270,9 +281,13 @@ void Shutdown(InitInterfaces& interfaces)
         LOCK(cs_main);
         if (pcoinsTip != nullptr) {
             FlushStateToDisk();
+            if (gArgs.GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCK_INDEX_SNAPSHOT)) {
+                WriteBlockIndexSnapshot();
+            }
         }
         pcoinsTip.reset();
         pcoinscatcher.reset();
+        pcoinsdbwriter.reset();
         pcoinsdbview.reset();
         pblocktree.reset();
     }
@@ -372,15 +387,24 @@ void SetupServerArgs()
 
     gArgs.AddArg("-version", "Print version and exit", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-alertnotify=<cmd>", "Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)", false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-assumeutxo=<height>:<hex>", "Accept UTXO snapshots of the UTXO set as of the block at this height with this MuHash, as reported by gettxoutsetinfo with hash_type muhash, for loadtxoutset. Can be specified multiple times", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-assumevalid=<hex>", strprintf("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)", defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()), false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-blockindexsnapshot", strprintf("Write the block index to a snapshot file at shutdown and load it from there at the next startup, as long as it matches the block index database (default: %u)", DEFAULT_BLOCK_INDEX_SNAPSHOT), true, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-blockpipelinedepth=<n>", strprintf("Number of blocks to read from disk and check ahead of the block being connected (0 to %d, default: %d)", MAX_BLOCK_PIPELINE_DEPTH, DEFAULT_BLOCK_PIPELINE_DEPTH), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksdir=<dir>", "Specify blocks directory (default: <datadir>/blocks)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocknotify=<cmd>", "Execute command when the best block changes (%s in cmd is replaced by block hash)", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blockreconstructionextratxn=<n>", strprintf("Extra transactions to keep in memory for compact block reconstructions (default: %u)", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksonly", strprintf("Whether to operate in a blocks only mode (default: %u)", DEFAULT_BLOCKSONLY), true, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-coinstatsindex", strprintf("Maintain statistics of the UTXO set as of every block, used by the gettxoutsetinfo RPC call with hash_type muhash (default: %u)", DEFAULT_COINSTATSINDEX), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-conf=<file>", strprintf("Specify configuration file. Relative paths will be prefixed by datadir location. (default: %s)", BITCOIN_CONF_FILENAME), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-datadir=<dir>", "Specify data directory", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize), true, OptionsCategory::OPTIONS);
     gArgs.AddArg("-dbcache=<n>", strprintf("Maximum database cache size <n> MiB (%d to %d, default: %d). In addition, unused mempool memory is shared for this cache (see -maxmempool).", nMinDbCache, nMaxDbCache, nDefaultDbCache), false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-dboption=<db>:<option>=<value>", "Tune the settings of a database. <db> is chainstate, index (blocks/index), txindex or coinstats. <option> is one of: "
+        "backend, leveldb or appendlog, an append-only log with an in-memory index of all keys, not supported for the chainstate (default: leveldb; changing it requires rebuilding the database); "
+        "blockcache and writebuffer, the share of the database's cache in percent used for the block cache and for each of up to two write buffers (default: 50 and 25; together at most 100); "
+        "bloombits, the bloom filter bits per key (0 to disable, default: 10); "
+        "compression, none or snappy (default: none; snappy takes effect only in builds configured --with-snappy). Can be specified multiple times", false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-debuglogfile=<file>", strprintf("Specify location of debug log file. Relative paths will be prefixed by a net-specific datadir location. (-nodebuglogfile to disable; default: %s)", DEFAULT_DEBUGLOGFILE), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER), true, OptionsCategory::OPTIONS);
     gArgs.AddArg("-includeconf=<file>", "Specify additional configuration file, relative to the -datadir path (only useable from configuration file, not command line)", false, OptionsCategory::OPTIONS);
@@ -389,11 +413,11 @@ void SetupServerArgs()
     gArgs.AddArg("-maxorphantx=<n>", strprintf("Keep at most <n> unconnectable transactions in memory (default: %u)", DEFAULT_MAX_ORPHAN_TRANSACTIONS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-mempoolexpiry=<n>", strprintf("Do not keep transactions in the mempool longer than <n> hours (default: %u)", DEFAULT_MEMPOOL_EXPIRY), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-minimumchainwork=<hex>", strprintf("Minimum work assumed to exist on a valid chain in hex (default: %s, testnet: %s)", defaultChainParams->GetConsensus().nMinimumChainWork.GetHex(), testnetChainParams->GetConsensus().nMinimumChainWork.GetHex()), true, OptionsCategory::OPTIONS);
-    gArgs.AddArg("-par=<n>", strprintf("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)",
-        -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS), false, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-par=<n>", strprintf("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d). Each thread besides the validation thread comes with an input prefetch thread. Can be changed at runtime with the setscriptcheckthreads RPC",
+        -GetNumCores(), GetMaxScriptCheckThreads(), DEFAULT_SCRIPTCHECK_THREADS), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-persistmempool", strprintf("Whether to save the mempool on shutdown and load on restart (default: %u)", DEFAULT_PERSIST_MEMPOOL), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-pid=<file>", strprintf("Specify pid file. Relative paths will be prefixed by a net-specific datadir location. (default: %s)", BITCOIN_PID_FILENAME), false, OptionsCategory::OPTIONS);
-    gArgs.AddArg("-prune=<n>", strprintf("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
+    gArgs.AddArg("-prune=<n>", strprintf("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex, -coinstatsindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >=%u = automatically prune block files to stay under the specified target size in MiB)", MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024), false, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex", "Rebuild chain state and block index from the blk*.dat files on disk", false, OptionsCategory::OPTIONS);
@@ -480,6 +504,7 @@ void SetupServerArgs()
         "each level includes the checks of the previous levels "
         "(0-4, default: %u)", DEFAULT_CHECKLEVEL), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. (default: %u, regtest: %u)", defaultChainParams->DefaultConsistencyChecks(), regtestChainParams->DefaultConsistencyChecks()), true, OptionsCategory::DEBUG_TEST);
+    gArgs.AddArg("-checkblocktemplates", strprintf("Connect the block templates created for getblocktemplate to check them, instead of only checking the rules that their transactions are not known to satisfy from mempool acceptance (default: %u)", DEFAULT_CHECK_BLOCK_TEMPLATES), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u, regtest: %u)", defaultChainParams->DefaultConsistencyChecks(), regtestChainParams->DefaultConsistencyChecks()), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-deprecatedrpc=<method>", "Allows deprecated RPC method(s) to be used", true, OptionsCategory::DEBUG_TEST);
@@ -490,6 +515,7 @@ void SetupServerArgs()
     gArgs.AddArg("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT), true, OptionsCategory::DEBUG_TEST);
+    gArgs.AddArg("-limitclustercount=<n>", strprintf("Do not accept transactions that would be part of a cluster of more than <n> connected in-mempool transactions (default: %u)", DEFAULT_CLUSTER_LIMIT), true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-addrmantest", "Allows to test address relay on localhost", true, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-debug=<category>", "Output debugging information (default: -nodebug, supplying <category> is optional). "
         "If <category> is not supplied or if <category> = 1, output all debugging information. <category> can be: " + ListLogCategories() + ".", false, OptionsCategory::DEBUG_TEST);
@@ -958,6 +984,8 @@ bool AppInitParameterInteraction()
     if (gArgs.GetArg("-prune", 0)) {
         if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX))
+            return InitError(_("Prune mode is incompatible with -coinstatsindex."));
     }
 
     // -bind and -whitebind can't be set when not listening
@@ -1023,6 +1051,21 @@ bool AppInitParameterInteraction()
     else
         LogPrintf("Validating signatures for all blocks.\n");
 
+    for (const std::string& arg : gArgs.GetArgs("-assumeutxo")) {
+        const size_t sep = arg.find(':');
+        int32_t height;
+        if (sep == std::string::npos || !ParseInt32(arg.substr(0, sep), &height) || height <= 0 || !IsHex(arg.substr(sep + 1)) || arg.size() - sep - 1 != 64) {
+            return InitError(strprintf(_("Invalid -assumeutxo value '%s', expected <height>:<muhash>"), arg));
+        }
+    }
+
+    {
+        std::string error;
+        if (!CheckDBOptions({"chainstate", "index", "txindex", "coinstats"}, error)) {
+            return InitError(error);
+        }
+    }
+
     if (gArgs.IsArgSet("-minimumchainwork")) {
         const std::string minChainWorkStr = gArgs.GetArg("-minimumchainwork", "");
         if (!IsHexNumber(minChainWorkStr)) {
@@ -1058,8 +1101,8 @@ bool AppInitParameterInteraction()
         nScriptCheckThreads += GetNumCores();
     if (nScriptCheckThreads <= 1)
         nScriptCheckThreads = 0;
-    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
-        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    else if (nScriptCheckThreads > GetMaxScriptCheckThreads())
+        nScriptCheckThreads = GetMaxScriptCheckThreads();
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
@@ -1272,10 +1315,9 @@ bool AppInitMain(InitInterfaces& interfaces)
     InitScriptExecutionCache();
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
-    if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
-            threadGroup.create_thread(&ThreadScriptCheck);
-    }
+    SetScriptCheckThreads(nScriptCheckThreads);
+    StartBlockPipeline(gArgs.GetArg("-blockpipelinedepth", DEFAULT_BLOCK_PIPELINE_DEPTH));
+    StartUndoWriter();
 
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = std::bind(&CScheduler::serviceQueue, &scheduler);
@@ -1472,11 +1514,18 @@ bool AppInitMain(InitInterfaces& interfaces)
 
         do {
             const int64_t load_block_index_start_time = GetTimeMillis();
+            int64_t phase_start_time = load_block_index_start_time;
+            auto end_phase = [&phase_start_time](const char* phase) {
+                const int64_t now = GetTimeMillis();
+                LogPrintf("Startup: %s took %dms\n", phase, now - phase_start_time);
+                phase_start_time = now;
+            };
             try {
                 UnloadBlockIndex();
                 pcoinsTip.reset();
-                pcoinsdbview.reset();
                 pcoinscatcher.reset();
+                pcoinsdbwriter.reset();
+                pcoinsdbview.reset();
                 // new CBlockTreeDB tries to delete the existing file, which
                 // fails if it's still open from the previous loop. Close it first:
                 pblocktree.reset();
@@ -1489,16 +1538,24 @@ bool AppInitMain(InitInterfaces& interfaces)
                         CleanupBlockRevFiles();
                 }
 
+                if (fReindexChainState) {
+                    // The rebuilt chainstate is not based on a UTXO snapshot.
+                    pblocktree->EraseSnapshot();
+                    pblocktree->WriteFlag("snapshotloading", false);
+                }
+
                 if (ShutdownRequested()) break;
 
                 // LoadBlockIndex will load fHavePruned if we've ever removed a
                 // block file from disk.
                 // Note that it also sets fReindex based on the disk flag!
                 // From here on out fReindex and fReset mean something different!
+                end_phase("opening the block index database");
                 if (!LoadBlockIndex(chainparams)) {
                     strLoadError = _("Error loading block database");
                     break;
                 }
+                end_phase("loading the block index");
 
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
@@ -1513,6 +1570,17 @@ bool AppInitMain(InitInterfaces& interfaces)
                     break;
                 }
 
+                bool snapshot_loading = false;
+                pblocktree->ReadFlag("snapshotloading", snapshot_loading);
+                if (snapshot_loading) {
+                    strLoadError = _("Loading a UTXO snapshot was interrupted. You need to rebuild the database using -reindex-chainstate");
+                    break;
+                }
+                if (g_snapshot_base && fPruneMode) {
+                    strLoadError = _("Prune mode is incompatible with a chainstate based on a UTXO snapshot that has not been validated yet");
+                    break;
+                }
+
                 // At this point blocktree args are consistent with what's on disk.
                 // If we're not mid-reindex (based on disk + args), add a genesis block on disk
                 // (otherwise we use the one already on disk).
@@ -1521,12 +1589,14 @@ bool AppInitMain(InitInterfaces& interfaces)
                     strLoadError = _("Error initializing block database");
                     break;
                 }
+                end_phase("checking the block index");
 
                 // At this point we're either in reindex or we've loaded a useful
                 // block tree into mapBlockIndex!
 
                 pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState));
-                pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
+                pcoinsdbwriter.reset(new CCoinsViewBackgroundWriter(pcoinsdbview.get(), nCoinCacheUsage / 100 * COINS_WRITE_PIECE_PERCENT));
+                pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbwriter.get()));
 
                 // If necessary, upgrade from older database format.
                 // This is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
@@ -1534,12 +1604,14 @@ bool AppInitMain(InitInterfaces& interfaces)
                     strLoadError = _("Error upgrading chainstate database");
                     break;
                 }
+                end_phase("opening the chainstate database");
 
                 // ReplayBlocks is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
                 if (!ReplayBlocks(chainparams, pcoinsdbview.get())) {
                     strLoadError = _("Unable to replay blocks. You will need to rebuild the database using -reindex-chainstate.");
                     break;
                 }
+                end_phase("replaying blocks");
 
                 // The on-disk coinsdb is now in a good state, create the cache
                 pcoinsTip.reset(new CCoinsViewCache(pcoinscatcher.get()));
@@ -1564,6 +1636,7 @@ bool AppInitMain(InitInterfaces& interfaces)
                         break;
                     }
                 }
+                end_phase("loading the chain tip and rewinding blocks");
 
                 if (!is_coinsview_empty) {
                     uiInterface.InitMessage(_("Verifying blocks..."));
@@ -1586,6 +1659,7 @@ bool AppInitMain(InitInterfaces& interfaces)
                         strLoadError = _("Corrupted block database detected");
                         break;
                     }
+                    end_phase("verifying blocks");
                 }
             } catch (const std::exception& e) {
                 LogPrintf("%s\n", e.what());
@@ -1625,6 +1699,15 @@ bool AppInitMain(InitInterfaces& interfaces)
         return false;
     }
 
+    // From here on, the chainstate is written to disk in the background.
+    bool snapshot_unvalidated;
+    {
+        LOCK(cs_main);
+        pcoinsdbwriter->Start();
+        snapshot_unvalidated = g_snapshot_base && !g_snapshot_validated;
+    }
+    StartSnapshotValidation();
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1633,11 +1716,19 @@ bool AppInitMain(InitInterfaces& interfaces)
     fFeeEstimatesInitialized = true;
 
     // ********************************************************* Step 8: start indexers
+    if (snapshot_unvalidated && (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) || gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX))) {
+        return InitError(_("-txindex and -coinstatsindex need the blocks below the UTXO snapshot, which are still being validated."));
+    }
     if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
         g_txindex = MakeUnique<TxIndex>(nTxIndexCache, false, fReindex);
         g_txindex->Start();
     }
 
+    if (gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX)) {
+        g_coin_stats_index = MakeUnique<CoinStatsIndex>(/* cache size */ 0, false, fReindex);
+        g_coin_stats_index->Start();
+    }
+
     // ********************************************************* Step 9: load wallet
     for (const auto& client : interfaces.chain_clients) {
         if (!client->load()) {
@@ -1658,6 +1749,12 @@ bool AppInitMain(InitInterfaces& interfaces)
         }
     }
 
+    // Blocks below a UTXO snapshot can only be served once they have been validated.
+    if (snapshot_unvalidated) {
+        LogPrintf("Unsetting NODE_NETWORK while the chain below the UTXO snapshot is validated\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
+
     if (chainparams.GetConsensus().vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout != 0) {
         // Only advertise witness capabilities if they have a reasonable start time.
         // This allows us to have the code merged without a defined softfork, by setting its
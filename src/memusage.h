@@ -6,6 +6,8 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include <indirectmap.h>
+#include <prevector.h>
+#include <support/allocators/pool.h>
 
 #include <stdlib.h>
 
@@ -165,6 +167,19 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+// Maps that take their nodes from a PoolResource use all the chunks of the
+// pool, including the memory that is free for reuse: the pool only returns it
+// to the system when it is destroyed. A bucket array that is small enough is
+// allocated from the pool too, so only a larger one is counted separately.
+template<typename X, typename Y, typename Z, typename P, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    const auto* resource = m.get_allocator().resource();
+    const size_t chunks = MallocUsage(resource->ChunkSizeBytes()) * resource->NumAllocatedChunks() + MallocUsage(sizeof(void*) * resource->NumAllocatedChunks());
+    const size_t bucket_bytes = sizeof(void*) * m.bucket_count();
+    return chunks + (bucket_bytes > MAX_BLOCK_SIZE_BYTES ? MallocUsage(bucket_bytes) : 0);
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
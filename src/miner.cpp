@@ -26,6 +26,8 @@
 #include <validationinterface.h>
 
 #include <algorithm>
+#include <functional>
+#include <numeric>
 #include <queue>
 #include <utility>
 
@@ -47,11 +49,13 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
+    fTestBlockValidity = true;
 }
 
 BlockAssembler::BlockAssembler(const CChainParams& params, const Options& options) : chainparams(params)
 {
     blockMinFeeRate = options.blockMinFeeRate;
+    fTestBlockValidity = options.fTestBlockValidity;
     // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
     nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
 }
@@ -85,12 +89,25 @@ void BlockAssembler::resetBlock()
     // These counters do not include coinbase tx
     nBlockTx = 0;
     nFees = 0;
+
+    lowestPackageFeeRate = CFeeRate(MAX_MONEY);
+    highestSkippedFeeRate = CFeeRate(0);
 }
 
 Optional<int64_t> BlockAssembler::m_last_block_num_txs{nullopt};
 Optional<int64_t> BlockAssembler::m_last_block_weight{nullopt};
 
 std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    return AssembleBlock(scriptPubKeyIn, nullptr, nullptr);
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, const std::vector<CTxMemPool::txiter>& included, const CTxMemPool::setEntries& candidates)
+{
+    return AssembleBlock(scriptPubKeyIn, &included, &candidates);
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::AssembleBlock(const CScript& scriptPubKeyIn, const std::vector<CTxMemPool::txiter>* included, const CTxMemPool::setEntries* candidates)
 {
     int64_t nTimeStart = GetTimeMicros();
 
@@ -136,9 +153,19 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     // transaction (which in most cases can be a no-op).
     fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
 
+    if (included) {
+        for (CTxMemPool::txiter it : *included) {
+            AddToBlock(it);
+        }
+    }
+
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    if (candidates) {
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated, *candidates);
+    } else {
+        addChunkTxs(nPackagesSelected);
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -167,8 +194,15 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
     CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    if (fTestBlockValidity) {
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
+    } else {
+        const int64_t nSigOpsCost = std::accumulate(pblocktemplate->vTxSigOpsCost.begin(), pblocktemplate->vTxSigOpsCost.end(), int64_t{0});
+        if (!TestBlockTemplateValidity(state, chainparams, *pblock, pindexPrev, nFees, nSigOpsCost)) {
+            throw std::runtime_error(strprintf("%s: TestBlockTemplateValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
     }
     int64_t nTime2 = GetTimeMicros();
 
@@ -261,19 +295,25 @@ int BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& already
     return nDescendantsUpdated;
 }
 
-// Skip entries in mapTx that are already in a block or are present
-// in mapModifiedTx (which implies that the mapTx ancestor state is
-// stale due to ancestor inclusion in the block)
-// Also skip transactions that we've already failed to add. This can happen if
-// we consider a transaction in mapModifiedTx and it fails: we can then
-// potentially consider it again while walking mapTx.  It's currently
-// guaranteed to fail again, but as a belt-and-suspenders check we put it in
-// failedTx and avoid re-evaluation, since the re-evaluation would be using
-// cached size/sigops/fee values that are not actually correct.
-bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
+void BlockAssembler::AddCandidatePackages(const CTxMemPool::setEntries& candidates, indexed_modified_transaction_set &mapModifiedTx)
 {
-    assert (it != mempool.mapTx.end());
-    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    for (CTxMemPool::txiter it : candidates) {
+        if (inBlock.count(it) || mapModifiedTx.count(it))
+            continue;
+        CTxMemPoolModifiedEntry modEntry(it);
+        CTxMemPool::setEntries ancestors;
+        mempool.CalculateMemPoolAncestors(*it, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        for (CTxMemPool::txiter anc : ancestors) {
+            if (!inBlock.count(anc))
+                continue;
+            modEntry.nSizeWithAncestors -= anc->GetTxSize();
+            modEntry.nModFeesWithAncestors -= anc->GetModifiedFee();
+            modEntry.nSigOpCostWithAncestors -= anc->GetSigOpCost();
+        }
+        mapModifiedTx.insert(modEntry);
+    }
 }
 
 void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries)
@@ -287,29 +327,85 @@ void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, std::ve
     std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
 }
 
-// This transaction selection algorithm orders the mempool based
+// The mempool's clusters are linearized and split into chunks of decreasing
+// feerate, each of which only depends on earlier chunks of its cluster. So
+// adding whole chunks in the order of the mempool's chunk index adds the
+// transactions with the best feerate first, accounting for both the
+// ancestors they need and the descendants that pay for them.
+void BlockAssembler::addChunkTxs(int &nPackagesSelected)
+{
+    // Clusters with a chunk that did not make it into the block; their later
+    // chunks depend on it.
+    std::set<uint64_t> skippedClusters;
+
+    // Limit the number of attempts to add chunks to the block when it is
+    // close to full; this is just a simple heuristic to finish quickly if the
+    // mempool has a lot of entries.
+    const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+    int64_t nConsecutiveFailed = 0;
+
+    for (const CTxMemPool::ChunkRef& chunk : mempool.setChunks) {
+        if (chunk.fee < blockMinFeeRate.GetFee(chunk.size)) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
+        if (skippedClusters.count(chunk.cluster)) {
+            continue;
+        }
+
+        const CTxMemPool::Cluster& cluster = mempool.mapClusters.at(chunk.cluster);
+        const size_t begin = chunk.index > 0 ? cluster.chunks[chunk.index - 1].end : 0;
+        const size_t end = cluster.chunks[chunk.index].end;
+        CTxMemPool::setEntries package;
+        int64_t packageSigOpsCost = 0;
+        for (size_t i = begin; i < end; ++i) {
+            assert(!inBlock.count(cluster.txs[i]));
+            package.insert(cluster.txs[i]);
+            packageSigOpsCost += cluster.txs[i]->GetSigOpCost();
+        }
+
+        if (!TestPackage(chunk.size, packageSigOpsCost) || !TestPackageTransactions(package)) {
+            highestSkippedFeeRate = std::max(highestSkippedFeeRate, CFeeRate(chunk.fee, chunk.size));
+            skippedClusters.insert(chunk.cluster);
+
+            ++nConsecutiveFailed;
+
+            if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockWeight >
+                    nBlockMaxWeight - 4000) {
+                // Give up if we're close to full and haven't succeeded in a while
+                break;
+            }
+            continue;
+        }
+
+        // This chunk will make it in; reset the failed counter.
+        nConsecutiveFailed = 0;
+
+        // The linearization is a valid order for the block.
+        for (size_t i = begin; i < end; ++i) {
+            AddToBlock(cluster.txs[i]);
+        }
+
+        ++nPackagesSelected;
+        lowestPackageFeeRate = std::min(lowestPackageFeeRate, CFeeRate(chunk.fee, chunk.size));
+    }
+}
+
+// This transaction selection algorithm orders the candidates based
 // on feerate of a transaction including all unconfirmed ancestors.
 // Since we don't remove transactions from the mempool as we select them
 // for block inclusion, we need an alternate method of updating the feerate
 // of a transaction with its not-yet-selected ancestors as we go.
-// This is accomplished by walking the in-mempool descendants of selected
-// transactions and storing a temporary modified state in mapModifiedTxs.
-// Each time through the loop, we compare the best transaction in
-// mapModifiedTxs with the next transaction in the mempool to decide what
-// transaction package to work on next.
-void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated)
+// This is accomplished by storing the candidates, and the in-mempool
+// descendants of selected transactions, with a temporary modified state in
+// mapModifiedTxs, and always working on the best of them next.
+void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, const CTxMemPool::setEntries& candidates)
 {
     // mapModifiedTx will store sorted packages after they are modified
     // because some of their txs are already in the block
     indexed_modified_transaction_set mapModifiedTx;
-    // Keep track of entries that failed inclusion, to avoid duplicate work
-    CTxMemPool::setEntries failedTx;
+    AddCandidatePackages(candidates, mapModifiedTx);
 
-    // Start by adding all descendants of previously added txs to mapModifiedTx
-    // and modifying them for their already included ancestors
-    UpdatePackagesForAdded(inBlock, mapModifiedTx);
-
-    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
     CTxMemPool::txiter iter;
 
     // Limit the number of attempts to add transactions to the block when it is
@@ -318,53 +414,17 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
     int64_t nConsecutiveFailed = 0;
 
-    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    while (!mapModifiedTx.empty())
     {
-        // First try to find a new transaction in mapTx to evaluate.
-        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
-                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
-            ++mi;
-            continue;
-        }
-
-        // Now that mi is not stale, determine which transaction to evaluate:
-        // the next entry from mapTx, or the best from mapModifiedTx?
-        bool fUsingModified = false;
-
         modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
-        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
-            // We're out of entries in mapTx; use the entry from mapModifiedTx
-            iter = modit->iter;
-            fUsingModified = true;
-        } else {
-            // Try to compare the mapTx entry to the mapModifiedTx entry
-            iter = mempool.mapTx.project<0>(mi);
-            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
-                    CompareTxMemPoolEntryByAncestorFee()(*modit, CTxMemPoolModifiedEntry(iter))) {
-                // The best entry in mapModifiedTx has higher score
-                // than the one from mapTx.
-                // Switch which transaction (package) to consider
-                iter = modit->iter;
-                fUsingModified = true;
-            } else {
-                // Either no entry in mapModifiedTx, or it's worse than mapTx.
-                // Increment mi for the next loop iteration.
-                ++mi;
-            }
-        }
+        iter = modit->iter;
 
-        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
-        // contain anything that is inBlock.
+        // mapModifiedTx shouldn't contain anything that is inBlock.
         assert(!inBlock.count(iter));
 
-        uint64_t packageSize = iter->GetSizeWithAncestors();
-        CAmount packageFees = iter->GetModFeesWithAncestors();
-        int64_t packageSigOpsCost = iter->GetSigOpCostWithAncestors();
-        if (fUsingModified) {
-            packageSize = modit->nSizeWithAncestors;
-            packageFees = modit->nModFeesWithAncestors;
-            packageSigOpsCost = modit->nSigOpCostWithAncestors;
-        }
+        uint64_t packageSize = modit->nSizeWithAncestors;
+        CAmount packageFees = modit->nModFeesWithAncestors;
+        int64_t packageSigOpsCost = modit->nSigOpCostWithAncestors;
 
         if (packageFees < blockMinFeeRate.GetFee(packageSize)) {
             // Everything else we might consider has a lower fee rate
@@ -372,13 +432,11 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         }
 
         if (!TestPackage(packageSize, packageSigOpsCost)) {
-            if (fUsingModified) {
-                // Since we always look at the best entry in mapModifiedTx,
-                // we must erase failed entries so that we can consider the
-                // next best entry on the next loop iteration
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
-            }
+            highestSkippedFeeRate = std::max(highestSkippedFeeRate, CFeeRate(packageFees, packageSize));
+            // Since we always look at the best entry in mapModifiedTx,
+            // we must erase failed entries so that we can consider the
+            // next best entry on the next loop iteration
+            mapModifiedTx.get<ancestor_score>().erase(modit);
 
             ++nConsecutiveFailed;
 
@@ -400,10 +458,7 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
 
         // Test if all tx's are Final
         if (!TestPackageTransactions(ancestors)) {
-            if (fUsingModified) {
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
-            }
+            mapModifiedTx.get<ancestor_score>().erase(modit);
             continue;
         }
 
@@ -421,12 +476,105 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         }
 
         ++nPackagesSelected;
+        lowestPackageFeeRate = std::min(lowestPackageFeeRate, CFeeRate(packageFees, packageSize));
 
         // Update transactions that depend on each of these
         nDescendantsUpdated += UpdatePackagesForAdded(ancestors, mapModifiedTx);
     }
 }
 
+// Templates are built from mempool transactions only, so unless asked to, do
+// not connect them to check them.
+static BlockAssembler::Options TemplateOptions()
+{
+    BlockAssembler::Options options = DefaultOptions();
+    options.fTestBlockValidity = gArgs.GetBoolArg("-checkblocktemplates", DEFAULT_CHECK_BLOCK_TEMPLATES);
+    return options;
+}
+
+BlockTemplateEngine::BlockTemplateEngine(const CChainParams& params) : chainparams(params)
+{
+    m_connection_added = mempool.NotifyEntryAdded.connect(std::bind(&BlockTemplateEngine::TransactionAdded, this, std::placeholders::_1));
+    m_connection_removed = mempool.NotifyEntryRemoved.connect(std::bind(&BlockTemplateEngine::TransactionRemoved, this, std::placeholders::_1, std::placeholders::_2));
+}
+
+void BlockTemplateEngine::TransactionAdded(CTransactionRef tx)
+{
+    LOCK(m_mutex);
+    m_added.insert(tx->GetHash());
+}
+
+void BlockTemplateEngine::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    // Removed transactions of the last template are noticed when the next
+    // one is built.
+    LOCK(m_mutex);
+    m_added.erase(tx->GetHash());
+}
+
+void BlockTemplateEngine::Invalidate()
+{
+    LOCK(m_mutex);
+    m_prev_block.SetNull();
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateEngine::CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(m_mutex);
+    const CBlockIndex* pindexPrev = chainActive.Tip();
+    assert(pindexPrev != nullptr);
+
+    // Clear m_prev_block so that the next call starts from scratch, should
+    // this one fail
+    const bool fIncremental = m_prev_block == pindexPrev->GetBlockHash();
+    m_prev_block.SetNull();
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    CFeeRate lowestPackageFeeRate;
+    std::vector<CTxMemPool::txiter> included;
+    if (fIncremental) {
+        included.reserve(m_selected.size());
+        for (const uint256& hash : m_selected) {
+            CTxMemPool::txiter it = mempool.mapTx.find(hash);
+            if (it != mempool.mapTx.end()) included.push_back(it);
+        }
+    }
+    // If transactions of the last template were replaced or expired, start
+    // from scratch: the space they leave may best be filled by transactions
+    // that were passed over before.
+    if (fIncremental && included.size() == m_selected.size()) {
+        CTxMemPool::setEntries candidates;
+        for (const uint256& hash : m_added) {
+            CTxMemPool::txiter it = mempool.mapTx.find(hash);
+            if (it != mempool.mapTx.end()) candidates.insert(it);
+        }
+
+        BlockAssembler assembler(chainparams, TemplateOptions());
+        pblocktemplate = assembler.CreateNewBlock(scriptPubKeyIn, included, candidates);
+        lowestPackageFeeRate = std::min(m_lowest_package_feerate, assembler.GetLowestPackageFeeRate());
+        if (assembler.GetHighestSkippedFeeRate() > lowestPackageFeeRate) {
+            // A new package should replace some of the selected ones
+            LogPrint(BCLog::BENCH, "%s: new package at %s outbids the template, rebuilding\n", __func__, assembler.GetHighestSkippedFeeRate().ToString());
+            pblocktemplate.reset();
+        }
+    }
+    if (!pblocktemplate) {
+        BlockAssembler assembler(chainparams, TemplateOptions());
+        pblocktemplate = assembler.CreateNewBlock(scriptPubKeyIn);
+        lowestPackageFeeRate = assembler.GetLowestPackageFeeRate();
+    }
+
+    m_prev_block = pindexPrev->GetBlockHash();
+    m_selected.clear();
+    for (size_t i = 1; i < pblocktemplate->block.vtx.size(); ++i) {
+        m_selected.push_back(pblocktemplate->block.vtx[i]->GetHash());
+    }
+    m_lowest_package_feerate = lowestPackageFeeRate;
+    m_added.clear();
+    return pblocktemplate;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -12,7 +12,9 @@
 #include <validation.h>
 
 #include <memory>
+#include <set>
 #include <stdint.h>
+#include <vector>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -24,6 +26,7 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+static const bool DEFAULT_CHECK_BLOCK_TEMPLATES = false;
 
 struct CBlockTemplate
 {
@@ -135,6 +138,7 @@ private:
     bool fIncludeWitness;
     unsigned int nBlockMaxWeight;
     CFeeRate blockMinFeeRate;
+    bool fTestBlockValidity;
 
     // Information on the current status of the block
     uint64_t nBlockWeight;
@@ -148,11 +152,20 @@ private:
     int64_t nLockTimeCutoff;
     const CChainParams& chainparams;
 
+    // Lowest feerate of the packages added to the block, and highest
+    // feerate of the packages it skipped because they did not fit
+    CFeeRate lowestPackageFeeRate;
+    CFeeRate highestSkippedFeeRate;
+
 public:
     struct Options {
         Options();
         size_t nBlockMaxWeight;
         CFeeRate blockMinFeeRate;
+        // Connect the block to check it (TestBlockValidity), or only check
+        // the rules its mempool transactions are not already known to satisfy
+        // (TestBlockTemplateValidity)
+        bool fTestBlockValidity;
     };
 
     explicit BlockAssembler(const CChainParams& params);
@@ -160,6 +173,14 @@ public:
 
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
+    /** Construct a new block template with coinbase to scriptPubKeyIn that
+      * starts with the given transactions, in that order, followed by the
+      * best packages of the candidate transactions. The given transactions
+      * must be preceded by all their in-mempool ancestors. */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, const std::vector<CTxMemPool::txiter>& included, const CTxMemPool::setEntries& candidates);
+
+    CFeeRate GetLowestPackageFeeRate() const { return lowestPackageFeeRate; }
+    CFeeRate GetHighestSkippedFeeRate() const { return highestSkippedFeeRate; }
 
     static Optional<int64_t> m_last_block_num_txs;
     static Optional<int64_t> m_last_block_weight;
@@ -170,12 +191,19 @@ private:
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    /** Assemble a block, optionally from a previous selection (see CreateNewBlock) */
+    std::unique_ptr<CBlockTemplate> AssembleBlock(const CScript& scriptPubKeyIn, const std::vector<CTxMemPool::txiter>* included, const CTxMemPool::setEntries* candidates);
 
     // Methods for how to add transactions to a block.
+    /** Add the mempool's chunks in order of decreasing feerate
+      * Increments nPackagesSelected with the number of chunks added. */
+    void addChunkTxs(int &nPackagesSelected) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
     /** Add transactions based on feerate including unconfirmed ancestors
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
-      * statistics from the package selection (for logging statistics). */
-    void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+      * statistics from the package selection (for logging statistics).
+      * Only packages of the candidate transactions (and of descendants of
+      * transactions added on the way) are considered. */
+    void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, const CTxMemPool::setEntries& candidates) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -187,15 +215,54 @@ private:
       * These checks should always succeed, and they're here
       * only as an extra check in case of suboptimal node configuration */
     bool TestPackageTransactions(const CTxMemPool::setEntries& package);
-    /** Return true if given transaction from mapTx has already been evaluated,
-      * or if the transaction's cached data in mapTx is incorrect. */
-    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
     /** Sort the package in an order that is valid to appear in a block */
     void SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries);
     /** Add descendants of given transactions to mapModifiedTx with ancestor
       * state updated assuming given transactions are inBlock. Returns number
       * of updated descendants. */
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+    /** Add the given transactions that are not inBlock to mapModifiedTx, with
+      * ancestor state updated for their inBlock ancestors. */
+    void AddCandidatePackages(const CTxMemPool::setEntries& candidates, indexed_modified_transaction_set &mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
+};
+
+/**
+ * Keeps the transaction selection of the last block template it created and
+ * follows the transactions entering and leaving the mempool, so that the next
+ * template only has to select among the transactions that arrived since.
+ *
+ * The selection is built from scratch after the tip changed, after
+ * Invalidate() (e.g. for changed fee deltas), and when a package of the new
+ * transactions did not fit although it pays a higher feerate than a package
+ * already selected.
+ */
+class BlockTemplateEngine
+{
+public:
+    explicit BlockTemplateEngine(const CChainParams& params);
+
+    /** Construct a new block template with coinbase to scriptPubKeyIn */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
+    /** Build the next template from scratch */
+    void Invalidate();
+
+private:
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+
+    const CChainParams& chainparams;
+    boost::signals2::scoped_connection m_connection_added;
+    boost::signals2::scoped_connection m_connection_removed;
+
+    Mutex m_mutex;
+    //! Block the selection was made on top of, null if it needs to be rebuilt
+    uint256 m_prev_block GUARDED_BY(m_mutex);
+    //! Transactions of the last template, in block order
+    std::vector<uint256> m_selected GUARDED_BY(m_mutex);
+    //! Lowest package feerate among the selected transactions
+    CFeeRate m_lowest_package_feerate GUARDED_BY(m_mutex);
+    //! Transactions added to the mempool since the last template
+    std::set<uint256> m_added GUARDED_BY(m_mutex);
 };
 
 /** Modify the extranonce in a block */
@@ -11,6 +11,7 @@
 #include <blockencodings.h>
 #include <chainparams.h>
 #include <consensus/validation.h>
+#include <flatfilemap.h>
 #include <hash.h>
 #include <validation.h>
 #include <merkleblock.h>
@@ -672,6 +673,41 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
     }
 }
 
+/** Add not-in-flight blocks below the base of an unvalidated UTXO snapshot, which are missing in the
+ *  active chain, to vBlocks, until it has at most count entries. Blocks are fetched in the order they
+ *  are validated in, at most BLOCK_DOWNLOAD_WINDOW ahead of snapshot validation. */
+static void FindHistoricalBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, const Consensus::Params& consensusParams) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (count <= vBlocks.size() || !g_snapshot_base || g_snapshot_validated)
+        return;
+
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+    if (state->pindexBestKnownBlock == nullptr || state->pindexBestKnownBlock->GetAncestor(g_snapshot_base->nHeight) != g_snapshot_base) {
+        // This peer may not have the blocks.
+        return;
+    }
+
+    const int nMaxHeight = std::min<int>(g_snapshot_base->nHeight, g_snapshot_validation_height + BLOCK_DOWNLOAD_WINDOW);
+    std::vector<const CBlockIndex*> vToFetch;
+    for (const CBlockIndex* pindex = g_snapshot_base->GetAncestor(nMaxHeight); pindex && pindex->nHeight > g_snapshot_validation_height; pindex = pindex->pprev) {
+        vToFetch.push_back(pindex);
+    }
+    for (auto it = vToFetch.rbegin(); it != vToFetch.rend(); ++it) {
+        const CBlockIndex* pindex = *it;
+        if (!State(nodeid)->fHaveWitness && IsWitnessEnabled(pindex->pprev, consensusParams)) {
+            // We wouldn't download this block or its descendants from this peer.
+            return;
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) && mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
+            vBlocks.push_back(pindex);
+            if (vBlocks.size() == count) {
+                return;
+            }
+        }
+    }
+}
+
 void EraseTxRequest(const uint256& txid) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     g_already_asked_for.erase(txid);
@@ -1320,23 +1356,49 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
     if (send && (pindex->nStatus & BLOCK_HAVE_DATA))
     {
         std::shared_ptr<const CBlock> pblock;
+        std::unique_ptr<const RawBlock> raw_block;
         if (a_recent_block && a_recent_block->GetHash() == pindex->GetBlockHash()) {
             pblock = a_recent_block;
-        } else if (inv.type == MSG_WITNESS_BLOCK) {
-            // Fast-path: in this case it is possible to serve the block directly from disk,
-            // as the network format matches the format on disk
-            std::vector<uint8_t> block_data;
-            if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
-                assert(!"cannot load block from disk");
-            }
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
-            // Don't set pblock as we've sent the block
-        } else {
-            // Send block from disk
+        } else if (inv.type == MSG_FILTERED_BLOCK) {
+            // Matching against the peer's bloom filter needs the deserialized transactions
             std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
             if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams))
                 assert(!"cannot load block from disk");
             pblock = pblockRead;
+        } else {
+            // Fast-path: serve the block from its on-disk format, which is the
+            // witness serialization. Other encodings are produced from the raw
+            // bytes without deserializing the block.
+            FlatFileSpan block_data;
+            if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
+                assert(!"cannot load block from disk");
+            }
+            if (inv.type == MSG_WITNESS_BLOCK) {
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block_data.Get()));
+                // Don't set pblock or raw_block as we've sent the block
+            } else {
+                try {
+                    raw_block.reset(new RawBlock(std::move(block_data)));
+                } catch (const std::ios_base::failure&) {
+                    assert(!"cannot load block from disk");
+                }
+            }
+        }
+        if (raw_block) {
+            if (inv.type == MSG_BLOCK) {
+                connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *raw_block));
+            } else if (inv.type == MSG_CMPCT_BLOCK) {
+                // Old blocks are sent in full, as explained below. A recent
+                // compact block would have come with a_recent_block.
+                bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+                if (CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                    CBlockHeaderAndShortTxIDs cmpctblock(*raw_block, fPeerWantsWitness);
+                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                } else {
+                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *raw_block));
+                }
+            }
         }
         if (pblock) {
             if (inv.type == MSG_BLOCK)
@@ -3861,6 +3923,10 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
             FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            // Limited peers do not serve the blocks below a UTXO snapshot.
+            if (!pto->m_limited_node) {
+                FindHistoricalBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, consensusParams);
+            }
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -101,3 +101,74 @@ TransactionError BroadcastTransaction(const CTransactionRef tx, uint256& hashTx,
 
     return TransactionError::OK;
 }
+
+void BroadcastTransactions(const std::vector<CTransactionRef>& txs, std::vector<TransactionError>& errors, std::vector<std::string>& err_strings, const CAmount& highfee)
+{
+    std::promise<void> promise;
+    errors.assign(txs.size(), TransactionError::OK);
+    err_strings.assign(txs.size(), std::string());
+
+    { // cs_main scope
+    LOCK(cs_main);
+    CCoinsViewCache &view = *pcoinsTip;
+    std::vector<CTransactionRef> to_accept;
+    std::vector<size_t> positions;
+    for (size_t i = 0; i < txs.size(); ++i) {
+        const uint256& hashTx = txs[i]->GetHash();
+        bool fHaveChain = false;
+        for (size_t o = 0; !fHaveChain && o < txs[i]->vout.size(); o++) {
+            const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+            fHaveChain = !existingCoin.IsSpent();
+        }
+        if (fHaveChain) {
+            errors[i] = TransactionError::ALREADY_IN_CHAIN;
+        } else if (!mempool.exists(hashTx)) {
+            to_accept.push_back(txs[i]);
+            positions.push_back(i);
+        }
+    }
+
+    // push to local node and sync with wallets
+    std::vector<bool> accepted;
+    std::vector<CValidationState> states;
+    std::vector<bool> missing_inputs;
+    AcceptToMemoryPoolBatch(mempool, to_accept, accepted, states, missing_inputs, false /* bypass_limits */, highfee);
+    for (size_t k = 0; k < to_accept.size(); ++k) {
+        if (accepted[k]) continue;
+        const size_t i = positions[k];
+        if (states[k].IsInvalid()) {
+            errors[i] = TransactionError::MEMPOOL_REJECTED;
+            err_strings[i] = FormatStateMessage(states[k]);
+        } else if (missing_inputs[k]) {
+            errors[i] = TransactionError::MISSING_INPUTS;
+        } else {
+            errors[i] = TransactionError::MEMPOOL_ERROR;
+            err_strings[i] = FormatStateMessage(states[k]);
+        }
+    }
+
+    // Wait for the wallets to learn about the new transactions, as in
+    // BroadcastTransaction. If none was added, this returns immediately.
+    CallFunctionInValidationInterfaceQueue([&promise] {
+        promise.set_value();
+    });
+
+    } // cs_main
+
+    promise.get_future().wait();
+
+    if (!g_connman) {
+        for (TransactionError& error : errors) {
+            if (error == TransactionError::OK) error = TransactionError::P2P_DISABLED;
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < txs.size(); ++i) {
+        if (errors[i] != TransactionError::OK) continue;
+        CInv inv(MSG_TX, txs[i]->GetHash());
+        g_connman->ForEachNode([&inv](CNode* pnode) {
+            pnode->PushInventory(inv);
+        });
+    }
+}
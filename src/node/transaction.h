@@ -9,6 +9,9 @@
 #include <primitives/transaction.h>
 #include <uint256.h>
 
+#include <string>
+#include <vector>
+
 enum class TransactionError {
     OK, //!< No error
     MISSING_INPUTS,
@@ -34,4 +37,15 @@ std::string TransactionErrorString(const TransactionError error);
  */
 NODISCARD TransactionError BroadcastTransaction(CTransactionRef tx, uint256& txid, std::string& err_string, const CAmount& highfee);
 
+/**
+ * Broadcast a batch of transactions, adding them to the mempool together
+ * (see AcceptToMemoryPoolBatch)
+ *
+ * @param[in]  txs the transactions to broadcast, in any order
+ * @param[out] &errors the error of each transaction, in the order of txs
+ * @param[out] &err_strings the error string of each transaction, if available
+ * @param[in]  highfee Reject txs with fees higher than this (if 0, accept any fee)
+ */
+void BroadcastTransactions(const std::vector<CTransactionRef>& txs, std::vector<TransactionError>& errors, std::vector<std::string>& err_strings, const CAmount& highfee);
+
 #endif // BITCOIN_NODE_TRANSACTION_H
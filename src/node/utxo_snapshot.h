@@ -0,0 +1,64 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_UTXO_SNAPSHOT_H
+#define BITCOIN_NODE_UTXO_SNAPSHOT_H
+
+#include <protocol.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <string.h>
+
+/**
+ * Metadata at the head of a UTXO snapshot file, which describes the chainstate
+ * the snapshot was taken from.
+ *
+ * A snapshot file consists of this metadata, the headers of blocks 1 up to
+ * and including the base block, and then m_coins_count pairs of COutPoint and
+ * Coin in the order of the coin database. All fields are of a fixed size, so
+ * the metadata can be rewritten in place once the coins have been written.
+ *
+ * The metadata is also kept in the block tree database while the chainstate
+ * is based on a snapshot that has not been validated yet.
+ */
+class SnapshotMetadata
+{
+public:
+    static const uint16_t CURRENT_VERSION = 1;
+
+    uint16_t m_version;
+    //! Network the snapshot was taken on
+    CMessageHeader::MessageStartChars m_network_magic;
+    //! The block the UTXO set is as of
+    uint256 m_base_blockhash;
+    int32_t m_base_height;
+    //! Number of transactions in the chain up to and including the base block
+    uint64_t m_chain_tx_count;
+    //! Number of coins in the snapshot
+    uint64_t m_coins_count;
+    //! MuHash3072 of the coins, as computed by the coinstats index
+    uint256 m_muhash;
+
+    SnapshotMetadata() : m_version(CURRENT_VERSION), m_base_height(0), m_chain_tx_count(0), m_coins_count(0)
+    {
+        memset(m_network_magic, 0, sizeof(m_network_magic));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(m_version);
+        READWRITE(m_network_magic);
+        READWRITE(m_base_blockhash);
+        READWRITE(m_base_height);
+        READWRITE(m_chain_tx_count);
+        READWRITE(m_coins_count);
+        READWRITE(m_muhash);
+    }
+};
+
+#endif // BITCOIN_NODE_UTXO_SNAPSHOT_H
@@ -77,6 +77,10 @@ public:
 
     // memory only
     mutable bool fChecked;
+    //! Witness merkle root, as computed by CheckBlock together with the merkle
+    //! root. Set and cleared together with fChecked, and null if the block
+    //! has no witness commitment.
+    mutable uint256 hashWitnessMerkleRoot;
 
     CBlock()
     {
@@ -102,6 +106,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         fChecked = false;
+        hashWitnessMerkleRoot.SetNull();
     }
 
     CBlockHeader GetBlockHeader() const
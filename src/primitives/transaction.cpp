@@ -75,10 +75,25 @@ uint256 CTransaction::ComputeWitnessHash() const
     return SerializeHash(*this, SER_GETHASH, 0);
 }
 
+unsigned int CTransaction::ComputeLegacySigOpCount() const
+{
+    unsigned int nSigOps = 0;
+    for (const auto& txin : vin) {
+        nSigOps += txin.scriptSig.GetSigOpCount(false);
+    }
+    for (const auto& txout : vout) {
+        nSigOps += txout.scriptPubKey.GetSigOpCount(false);
+    }
+    return nSigOps;
+}
+
 /* For backward compatibility, the hash is initialized to 0. TODO: remove the need for this default constructor entirely. */
-CTransaction::CTransaction() : vin(), vout(), nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), hash{}, m_witness_hash{} {}
-CTransaction::CTransaction(const CMutableTransaction& tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash{ComputeHash()}, m_witness_hash{ComputeWitnessHash()} {}
-CTransaction::CTransaction(CMutableTransaction&& tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash{ComputeHash()}, m_witness_hash{ComputeWitnessHash()} {}
+CTransaction::CTransaction() : vin(), vout(), nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), hash{}, m_witness_hash{},
+    m_total_size{(unsigned int)::GetSerializeSize(*this, PROTOCOL_VERSION)}, m_stripped_size{(unsigned int)::GetSerializeSize(*this, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)}, m_legacy_sigops{0} {}
+CTransaction::CTransaction(const CMutableTransaction& tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash{ComputeHash()}, m_witness_hash{ComputeWitnessHash()},
+    m_total_size{(unsigned int)::GetSerializeSize(*this, PROTOCOL_VERSION)}, m_stripped_size{(unsigned int)::GetSerializeSize(*this, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)}, m_legacy_sigops{ComputeLegacySigOpCount()} {}
+CTransaction::CTransaction(CMutableTransaction&& tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash{ComputeHash()}, m_witness_hash{ComputeWitnessHash()},
+    m_total_size{(unsigned int)::GetSerializeSize(*this, PROTOCOL_VERSION)}, m_stripped_size{(unsigned int)::GetSerializeSize(*this, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)}, m_legacy_sigops{ComputeLegacySigOpCount()} {}
 
 CAmount CTransaction::GetValueOut() const
 {
@@ -91,11 +106,6 @@ CAmount CTransaction::GetValueOut() const
     return nValueOut;
 }
 
-unsigned int CTransaction::GetTotalSize() const
-{
-    return ::GetSerializeSize(*this, PROTOCOL_VERSION);
-}
-
 std::string CTransaction::ToString() const
 {
     std::string str;
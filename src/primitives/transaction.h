@@ -289,9 +289,13 @@ private:
     /** Memory only. */
     const uint256 hash;
     const uint256 m_witness_hash;
+    const unsigned int m_total_size;
+    const unsigned int m_stripped_size;
+    const unsigned int m_legacy_sigops;
 
     uint256 ComputeHash() const;
     uint256 ComputeWitnessHash() const;
+    unsigned int ComputeLegacySigOpCount() const;
 
 public:
     /** Construct a CTransaction that qualifies as IsNull() */
@@ -328,7 +332,19 @@ public:
      * "Total Size" defined in BIP141 and BIP144.
      * @return Total transaction size in bytes
      */
-    unsigned int GetTotalSize() const;
+    unsigned int GetTotalSize() const { return m_total_size; }
+
+    /**
+     * Get the transaction size in bytes, excluding witness data.
+     * "Base transaction size" defined in BIP141.
+     */
+    unsigned int GetStrippedSize() const { return m_stripped_size; }
+
+    /**
+     * Count ECDSA signature operations the old-fashioned (pre-0.6) way,
+     * i.e. in the scriptSigs and scriptPubKeys, see GetLegacySigOpCount().
+     */
+    unsigned int GetLegacySigOpCount() const { return m_legacy_sigops; }
 
     bool IsCoinBase() const
     {
@@ -15,7 +15,7 @@
 #include <qt/optionsmodel.h>
 
 #include <interfaces/node.h>
-#include <validation.h> // for DEFAULT_SCRIPTCHECK_THREADS and MAX_SCRIPTCHECK_THREADS
+#include <validation.h> // for DEFAULT_SCRIPTCHECK_THREADS and GetMaxScriptCheckThreads
 #include <netbase.h>
 #include <txdb.h> // for -dbcache defaults
 
@@ -39,7 +39,7 @@ OptionsDialog::OptionsDialog(QWidget *parent, bool enableWallet) :
     ui->databaseCache->setMinimum(nMinDbCache);
     ui->databaseCache->setMaximum(nMaxDbCache);
     ui->threadsScriptVerif->setMinimum(-GetNumCores());
-    ui->threadsScriptVerif->setMaximum(MAX_SCRIPTCHECK_THREADS);
+    ui->threadsScriptVerif->setMaximum(GetMaxScriptCheckThreads());
     ui->pruneWarning->setVisible(false);
     ui->pruneWarning->setStyleSheet("QLabel { color: red; }");
 
@@ -7,6 +7,7 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <core_io.h>
+#include <flatfilemap.h>
 #include <httpserver.h>
 #include <index/txindex.h>
 #include <primitives/block.h>
@@ -204,7 +205,12 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    // The witness serialization of a block is identical to its format on disk,
+    // so binary and hex requests can be answered from the block file directly.
+    const bool raw = (rf == RetFormat::BINARY || rf == RetFormat::HEX) && RPCSerializationFlags() == 0;
+
     CBlock block;
+    FlatFileSpan block_data;
     CBlockIndex* pblockindex = nullptr;
     CBlockIndex* tip = nullptr;
     {
@@ -218,24 +224,38 @@ static bool rest_block(HTTPRequest* req,
         if (IsBlockPruned(pblockindex))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        if (raw) {
+            if (!ReadRawBlockFromDisk(block_data, pblockindex, Params().MessageStart()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        } else if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus())) {
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        }
     }
 
     switch (rf) {
     case RetFormat::BINARY: {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-        ssBlock << block;
-        std::string binaryBlock = ssBlock.str();
+        std::string binaryBlock;
+        if (raw) {
+            binaryBlock.assign(block_data.begin(), block_data.end());
+        } else {
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+            ssBlock << block;
+            binaryBlock = ssBlock.str();
+        }
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RetFormat::HEX: {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        std::string strHex;
+        if (raw) {
+            strHex = HexStr(block_data.begin(), block_data.end()) + "\n";
+        } else {
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+            ssBlock << block;
+            strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        }
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
@@ -14,8 +14,11 @@
 #include <consensus/validation.h>
 #include <core_io.h>
 #include <hash.h>
+#include <index/coinstatsindex.h>
 #include <index/txindex.h>
 #include <key_io.h>
+#include <node/utxo_snapshot.h>
+#include <optional.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
@@ -41,6 +44,7 @@
 
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
+#include <future>
 #include <memory>
 #include <mutex>
 #include <condition_variable>
@@ -122,8 +126,8 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIn
     const CBlockIndex* pnext;
     int confirmations = ComputeNextBlockAndDepth(tip, blockindex, pnext);
     result.pushKV("confirmations", confirmations);
-    result.pushKV("strippedsize", (int)::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
-    result.pushKV("size", (int)::GetSerializeSize(block, PROTOCOL_VERSION));
+    result.pushKV("strippedsize", (int)GetBlockStrippedSize(block));
+    result.pushKV("size", (int)GetBlockTotalSize(block));
     result.pushKV("weight", (int)::GetBlockWeight(block));
     result.pushKV("height", blockindex->nHeight);
     result.pushKV("version", block.nVersion);
@@ -909,6 +913,38 @@ static UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, chainActive.Tip(), pblockindex, verbosity >= 2);
 }
 
+//! Look up a block of the active chain by height, or by hash
+static CBlockIndex* ParseHashOrHeight(const UniValue& param) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+
+    CBlockIndex* pindex;
+    if (param.isNum()) {
+        const int height = param.get_int();
+        const int current_tip = chainActive.Height();
+        if (height < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
+        }
+        if (height > current_tip) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
+        }
+
+        pindex = chainActive[height];
+    } else {
+        const uint256 hash(ParseHashV(param, "hash_or_height"));
+        pindex = LookupBlockIndex(hash);
+        if (!pindex) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        if (!chainActive.Contains(pindex)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", Params().NetworkIDString()));
+        }
+    }
+
+    assert(pindex != nullptr);
+    return pindex;
+}
+
 struct CCoinsStats
 {
     int nHeight;
@@ -917,52 +953,79 @@ struct CCoinsStats
     uint64_t nTransactionOutputs;
     uint64_t nBogoSize;
     uint256 hashSerialized;
+    uint256 muhash;
     uint64_t nDiskSize;
     CAmount nTotalAmount;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
 };
 
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+enum class CoinStatsHashType {
+    HASH_SERIALIZED,
+    MUHASH,
+};
+
+static void ApplyStats(CCoinsStats &stats, CoinStatsHashType hash_type, CHashWriter& ss, MuHash3072& muhash, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
 {
     assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ? 1u : 0u);
+    if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+        ss << hash;
+        ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ? 1u : 0u);
+    }
     stats.nTransactions++;
     for (const auto& output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
+        if (hash_type == CoinStatsHashType::MUHASH) {
+            ApplyCoinHash(muhash, COutPoint(hash, output.first), output.second);
+        } else {
+            ss << VARINT(output.first + 1);
+            ss << output.second.out.scriptPubKey;
+            ss << VARINT(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
+        }
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
+    }
+    if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+        ss << VARINT(0u);
     }
-    ss << VARINT(0u);
 }
 
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+//! Maximum number of threads a scan of the UTXO set is split over
+static const int MAX_UTXO_SCAN_THREADS = 16;
+
+//! Number of ranges of the UTXO set to scan concurrently
+static int GetUTXOScanShards()
 {
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
+    return std::max(1, std::min(GetNumCores(), MAX_UTXO_SCAN_THREADS));
+}
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
+//! Run fn(shard) for every shard, each on a thread of its own. An exception
+//! thrown on any of them is rethrown here, once all shards are done.
+template <typename Fn>
+static void ForEachShard(int n_shards, Fn fn)
+{
+    std::vector<std::future<void>> shards;
+    for (int shard = 1; shard < n_shards; ++shard) {
+        shards.push_back(std::async(std::launch::async, fn, shard));
+    }
+    // The futures wait for their threads when destroyed, even if this throws.
+    fn(0);
+    for (std::future<void>& shard : shards) {
+        shard.get();
     }
-    ss << stats.hashBlock;
+}
+
+//! Add the coins of a cursor to the statistics, grouped by transaction
+static bool ApplyCursorStats(CCoinsViewCursor* pcursor, CCoinsStats& stats, CoinStatsHashType hash_type, CHashWriter& ss, MuHash3072& muhash)
+{
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
         COutPoint key;
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
             if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
+                ApplyStats(stats, hash_type, ss, muhash, prevkey, outputs);
                 outputs.clear();
             }
             prevkey = key.hash;
@@ -973,9 +1036,52 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         pcursor->Next();
     }
     if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+        ApplyStats(stats, hash_type, ss, muhash, prevkey, outputs);
+    }
+    return true;
+}
+
+//! Calculate statistics about the unspent transaction output set
+static bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, CoinStatsHashType hash_type)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    MuHash3072 muhash;
+    if (hash_type == CoinStatsHashType::MUHASH) {
+        // The MuHash of a set is the product of the MuHashes of any partition
+        // of it, so ranges of the coin database are hashed concurrently.
+        const int n_shards = GetUTXOScanShards();
+        std::vector<std::unique_ptr<CCoinsViewCursor>> cursors = view->ShardedCursors(n_shards);
+        stats.hashBlock = cursors[0]->GetBestBlock();
+        std::vector<CCoinsStats> shard_stats(n_shards);
+        std::vector<MuHash3072> shard_muhash(n_shards);
+        std::vector<char> shard_ok(n_shards);
+        ForEachShard(n_shards, [&](int shard) {
+            CHashWriter unused(SER_GETHASH, PROTOCOL_VERSION);
+            shard_ok[shard] = ApplyCursorStats(cursors[shard].get(), shard_stats[shard], hash_type, unused, shard_muhash[shard]);
+        });
+        for (int shard = 0; shard < n_shards; ++shard) {
+            if (!shard_ok[shard]) return false;
+            muhash *= shard_muhash[shard];
+            stats.nTransactions += shard_stats[shard].nTransactions;
+            stats.nTransactionOutputs += shard_stats[shard].nTransactionOutputs;
+            stats.nBogoSize += shard_stats[shard].nBogoSize;
+            stats.nTotalAmount += shard_stats[shard].nTotalAmount;
+        }
+        muhash.Finalize(stats.muhash);
+    } else {
+        // The serialized hash covers the coins in order, so it is computed
+        // on a single cursor.
+        std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+        assert(pcursor);
+        stats.hashBlock = pcursor->GetBestBlock();
+        ss << stats.hashBlock;
+        if (!ApplyCursorStats(pcursor.get(), stats, hash_type, ss, muhash)) return false;
+        stats.hashSerialized = ss.GetHash();
+    }
+    {
+        LOCK(cs_main);
+        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
     }
-    stats.hashSerialized = ss.GetHash();
     stats.nDiskSize = view->EstimateSize();
     return true;
 }
@@ -1035,41 +1141,89 @@ static UniValue pruneblockchain(const JSONRPCRequest& request)
 
 static UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
             RPCHelpMan{"gettxoutsetinfo",
                 "\nReturns statistics about the unspent transaction output set.\n"
-                "Note this call may take some time.\n",
-                {},
+                "Note this call may take some time, unless hash_type is muhash and the node runs with -coinstatsindex.\n",
+                {
+                    {"hash_type", RPCArg::Type::STR, /* default */ "hash_serialized_2", "Which UTXO set hash should be calculated. Options: 'hash_serialized_2' (the legacy algorithm), 'muhash'."},
+                    {"hash_or_height", RPCArg::Type::NUM, RPCArg::Optional::OMITTED_NAMED_ARG, "The block hash or height of the target height (only available with coinstatsindex and hash_type muhash)", "", {"", "string or numeric"}},
+                },
                 RPCResult{
             "{\n"
-            "  \"height\":n,     (numeric) The current block height (index)\n"
-            "  \"bestblock\": \"hex\",   (string) The hash of the block at the tip of the chain\n"
-            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"height\":n,     (numeric) The block height (index) the statistics are for\n"
+            "  \"bestblock\": \"hex\",   (string) The hash of the block the statistics are for\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs (not available from coinstatsindex)\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only present if 'hash_serialized_2' hash_type is chosen)\n"
+            "  \"muhash\": \"hash\",     (string) The MuHash of the UTXO set (only present if 'muhash' hash_type is chosen)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (not available from coinstatsindex)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
                 },
                 RPCExamples{
                     HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "muhash 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\", 1000")
                 },
             }.ToString());
 
+    CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED;
+    if (!request.params[0].isNull()) {
+        const std::string hash_type_str = request.params[0].get_str();
+        if (hash_type_str == "muhash") {
+            hash_type = CoinStatsHashType::MUHASH;
+        } else if (hash_type_str != "hash_serialized_2") {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", hash_type_str));
+        }
+    }
+
     UniValue ret(UniValue::VOBJ);
 
+    if (hash_type == CoinStatsHashType::MUHASH && g_coin_stats_index) {
+        // Served from the index, without touching the chainstate
+        g_coin_stats_index->BlockUntilSyncedToCurrentChain();
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = request.params[1].isNull() ? chainActive.Tip() : ParseHashOrHeight(request.params[1]);
+        }
+        CoinStats stats;
+        if (!g_coin_stats_index->LookUpStats(pindex, stats)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set statistics, coinstatsindex may still be syncing");
+        }
+        ret.pushKV("height", (int64_t)pindex->nHeight);
+        ret.pushKV("bestblock", pindex->GetBlockHash().GetHex());
+        ret.pushKV("txouts", (int64_t)stats.transaction_output_count);
+        ret.pushKV("bogosize", (int64_t)stats.bogo_size);
+        ret.pushKV("muhash", stats.muhash.GetHex());
+        ret.pushKV("total_amount", ValueFromAmount(stats.total_amount));
+        return ret;
+    }
+
+    if (!request.params[1].isNull()) {
+        if (hash_type == CoinStatsHashType::MUHASH) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Querying specific block heights requires coinstatsindex");
+        }
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "hash_serialized_2 hash type cannot be queried for a specific block");
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    if (GetUTXOStats(pcoinsdbview.get(), stats, hash_type)) {
         ret.pushKV("height", (int64_t)stats.nHeight);
         ret.pushKV("bestblock", stats.hashBlock.GetHex());
         ret.pushKV("transactions", (int64_t)stats.nTransactions);
         ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
         ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
-        ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+        if (hash_type == CoinStatsHashType::MUHASH) {
+            ret.pushKV("muhash", stats.muhash.GetHex());
+        } else {
+            ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+        }
         ret.pushKV("disk_size", stats.nDiskSize);
         ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
     } else {
@@ -1282,6 +1436,17 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"pruneheight\": xxxxxx,        (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
             "  \"automatic_pruning\": xx,      (boolean) whether automatic pruning is enabled (only present if pruning is enabled)\n"
             "  \"prune_target_size\": xxxxxx,  (numeric) the target size used by pruning (only present if automatic pruning is enabled)\n"
+            "  \"chainstate_write\": {         (object) progress of writing the coins cache to disk (only present while it is written in the background)\n"
+            "     \"coins_written\": xxxxxx,   (numeric) the number of changed coins written so far\n"
+            "     \"coins_total\": xxxxxx,     (numeric) the number of changed coins being written\n"
+            "     \"progress\": xxxx,          (numeric) the fraction written [0..1]\n"
+            "  },\n"
+            "  \"utxo_snapshot\": {            (object) the UTXO snapshot the chainstate was loaded from (only present if loaded from a snapshot that was validated after the last restart, or not yet)\n"
+            "     \"base_height\": xxxxxx,     (numeric) the height of the block the snapshot is as of\n"
+            "     \"base_hash\": \"...\",        (string) the hash of the block the snapshot is as of\n"
+            "     \"validated\": xx,           (boolean) whether the chain up to the block has been validated and matches the snapshot\n"
+            "     \"validation_height\": xxxx, (numeric) the height up to which the chain has been validated\n"
+            "  },\n"
             "  \"softforks\": [                (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",           (string) name of softfork\n"
@@ -1348,6 +1513,24 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
         }
     }
 
+    size_t coins_written, coins_total;
+    if (pcoinsdbwriter && pcoinsdbwriter->GetProgress(coins_written, coins_total)) {
+        UniValue write(UniValue::VOBJ);
+        write.pushKV("coins_written", (uint64_t)coins_written);
+        write.pushKV("coins_total", (uint64_t)coins_total);
+        write.pushKV("progress", coins_total ? (double)coins_written / coins_total : 1.0);
+        obj.pushKV("chainstate_write", write);
+    }
+
+    if (g_snapshot_base) {
+        UniValue snapshot(UniValue::VOBJ);
+        snapshot.pushKV("base_height", g_snapshot_base->nHeight);
+        snapshot.pushKV("base_hash", g_snapshot_base->GetBlockHash().GetHex());
+        snapshot.pushKV("validated", g_snapshot_validated);
+        snapshot.pushKV("validation_height", g_snapshot_validated ? g_snapshot_base->nHeight : g_snapshot_validation_height);
+        obj.pushKV("utxo_snapshot", snapshot);
+    }
+
     const Consensus::Params& consensusParams = Params().GetConsensus();
     UniValue softforks(UniValue::VARR);
     UniValue bip9_softforks(UniValue::VOBJ);
@@ -1841,30 +2024,7 @@ static UniValue getblockstats(const JSONRPCRequest& request)
 
     LOCK(cs_main);
 
-    CBlockIndex* pindex;
-    if (request.params[0].isNum()) {
-        const int height = request.params[0].get_int();
-        const int current_tip = chainActive.Height();
-        if (height < 0) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
-        }
-        if (height > current_tip) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
-        }
-
-        pindex = chainActive[height];
-    } else {
-        const uint256 hash(ParseHashV(request.params[0], "hash_or_height"));
-        pindex = LookupBlockIndex(hash);
-        if (!pindex) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-        }
-        if (!chainActive.Contains(pindex)) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block is not in chain %s", Params().NetworkIDString()));
-        }
-    }
-
-    assert(pindex != nullptr);
+    CBlockIndex* pindex = ParseHashOrHeight(request.params[0]);
 
     std::set<std::string> stats;
     if (!request.params[1].isNull()) {
@@ -2069,38 +2229,107 @@ static UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
-//! Search for a given set of pubkey scripts
-bool FindScriptPubKey(std::atomic<int>& scan_progress, const std::atomic<bool>& should_abort, int64_t& count, CCoinsViewCursor* cursor, const std::set<CScript>& needles, std::map<COutPoint, Coin>& out_results) {
-    scan_progress = 0;
+static UniValue getscriptcheckinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            RPCHelpMan{"getscriptcheckinfo",
+                "\nReturns details on the script verification threads, and on how they were used for the last connected block.\n",
+                {},
+                RPCResult{
+            "{\n"
+            "  \"threads\": xxxxx,           (numeric) Number of threads (including the validation thread) verifying scripts, 0 if disabled\n"
+            "  \"max_threads\": xxxxx,       (numeric) Maximum value accepted by setscriptcheckthreads\n"
+            "  \"lastblock\": {              (json object) Script verification of the last connected block\n"
+            "    \"height\": xxxxx,          (numeric) The height of the block\n"
+            "    \"threads_used\": xxxxx,    (numeric) Number of threads that verified scripts for the block\n"
+            "    \"busy_time\": xxxxx,       (numeric) Time spent verifying scripts in ms, summed over all threads\n"
+            "    \"wall_time\": xxxxx        (numeric) Time from the first input check to the last verified script in ms\n"
+            "  }\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("getscriptcheckinfo", "")
+            + HelpExampleRpc("getscriptcheckinfo", "")
+                },
+            }.ToString());
+
+    const ScriptCheckStats stats = GetLastBlockScriptCheckStats();
+    UniValue lastblock(UniValue::VOBJ);
+    lastblock.pushKV("height", stats.height);
+    lastblock.pushKV("threads_used", (uint64_t)stats.threads_used);
+    lastblock.pushKV("busy_time", stats.busy_time / 1000.0);
+    lastblock.pushKV("wall_time", stats.wall_time / 1000.0);
+
+    UniValue ret(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        ret.pushKV("threads", nScriptCheckThreads);
+    }
+    ret.pushKV("max_threads", GetMaxScriptCheckThreads());
+    ret.pushKV("lastblock", lastblock);
+    return ret;
+}
+
+static UniValue setscriptcheckthreads(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            RPCHelpMan{"setscriptcheckthreads",
+                "\nChange the number of script verification threads. Takes effect from the next block validated.\n",
+                {
+                    {"threads", RPCArg::Type::NUM, RPCArg::Optional::NO, "Number of threads, including the validation thread (0 = auto, <0 = leave that many cores free, 1 = no parallel verification)"},
+                },
+                RPCResult{
+            "n    (numeric) The resulting number of threads, 0 if parallel verification is disabled\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("setscriptcheckthreads", "32")
+            + HelpExampleRpc("setscriptcheckthreads", "32")
+                },
+            }.ToString());
+
+    int threads = request.params[0].get_int();
+    if (threads <= 0) {
+        threads += GetNumCores();
+    }
+    return SetScriptCheckThreads(threads);
+}
+
+//! Search a range of the UTXO set for a given set of pubkey scripts
+static bool FindScriptPubKey(std::atomic<uint32_t>& scan_position, const std::atomic<bool>& should_abort, int64_t& count, CCoinsViewCursor* cursor, const std::set<CScript>& needles, std::map<COutPoint, Coin>& out_results) {
     count = 0;
+    // Position of this cursor in the txid space (the first two bytes of the
+    // txid), as far as it has been added to scan_position.
+    Optional<uint32_t> position;
     while (cursor->Valid()) {
         COutPoint key;
         Coin coin;
         if (!cursor->GetKey(key) || !cursor->GetValue(coin)) return false;
         if (++count % 8192 == 0) {
-            boost::this_thread::interruption_point();
             if (should_abort) {
                 // allow to abort the scan via the abort reference
                 return false;
             }
         }
-        if (count % 256 == 0) {
+        if (count % 256 == 1) {
             // update progress reference every 256 item
             uint32_t high = 0x100 * *key.hash.begin() + *(key.hash.begin() + 1);
-            scan_progress = (int)(high * 100.0 / 65536.0 + 0.5);
+            if (position) scan_position += high - *position;
+            position = high;
         }
         if (needles.count(coin.out.scriptPubKey)) {
             out_results.emplace(key, coin);
         }
         cursor->Next();
     }
-    scan_progress = 100;
     return true;
 }
 
 /** RAII object to prevent concurrency issue when scanning the txout set */
 static std::mutex g_utxosetscan;
-static std::atomic<int> g_scan_progress;
+//! Progress of the current scan, in positions of the 65536 txid prefixes
+static std::atomic<uint32_t> g_scan_position;
 static std::atomic<bool> g_scan_in_progress;
 static std::atomic<bool> g_should_abort_scan;
 class CoinsViewScanReserver
@@ -2193,7 +2422,7 @@ UniValue scantxoutset(const JSONRPCRequest& request)
             // no scan in progress
             return NullUniValue;
         }
-        result.pushKV("progress", g_scan_progress);
+        result.pushKV("progress", (int)(g_scan_position * 100.0 / 65536.0 + 0.5));
         return result;
     } else if (request.params[0].get_str() == "abort") {
         CoinsViewScanReserver reserver;
@@ -2259,16 +2488,28 @@ UniValue scantxoutset(const JSONRPCRequest& request)
         std::vector<CTxOut> input_txos;
         std::map<COutPoint, Coin> coins;
         g_should_abort_scan = false;
-        g_scan_progress = 0;
-        int64_t count = 0;
-        std::unique_ptr<CCoinsViewCursor> pcursor;
+        g_scan_position = 0;
+        const int n_shards = GetUTXOScanShards();
+        std::vector<std::unique_ptr<CCoinsViewCursor>> cursors;
         {
             LOCK(cs_main);
             FlushStateToDisk();
-            pcursor = std::unique_ptr<CCoinsViewCursor>(pcoinsdbview->Cursor());
-            assert(pcursor);
+            cursors = pcoinsdbview->ShardedCursors(n_shards);
+        }
+        // Ranges of the UTXO set are searched concurrently.
+        std::vector<int64_t> shard_count(n_shards);
+        std::vector<std::map<COutPoint, Coin>> shard_coins(n_shards);
+        std::vector<char> shard_ok(n_shards);
+        ForEachShard(n_shards, [&](int shard) {
+            shard_ok[shard] = FindScriptPubKey(g_scan_position, g_should_abort_scan, shard_count[shard], cursors[shard].get(), needles, shard_coins[shard]);
+        });
+        bool res = true;
+        int64_t count = 0;
+        for (int shard = 0; shard < n_shards; ++shard) {
+            res &= shard_ok[shard];
+            count += shard_count[shard];
+            coins.insert(shard_coins[shard].begin(), shard_coins[shard].end());
         }
-        bool res = FindScriptPubKey(g_scan_progress, g_should_abort_scan, count, pcursor.get(), needles, coins);
         result.pushKV("success", res);
         result.pushKV("searched_items", count);
 
@@ -2298,6 +2539,93 @@ UniValue scantxoutset(const JSONRPCRequest& request)
 }
 
 // clang-format off
+static UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            RPCHelpMan{"dumptxoutset",
+                "\nWrite the UTXO set as of the chain tip, along with the block headers up to the tip, to a snapshot file that loadtxoutset can start a new node from.\n",
+                {
+                    {"path", RPCArg::Type::STR, RPCArg::Optional::NO, "The path of the file to write, relative to the data directory if not absolute. It must not exist."},
+                },
+                RPCResult{
+            "{\n"
+            "  \"coins_written\": n,      (numeric) the number of coins written\n"
+            "  \"base_hash\": \"hash\",     (string) the hash of the block the UTXO set is as of\n"
+            "  \"base_height\": n,        (numeric) the height of the block the UTXO set is as of\n"
+            "  \"muhash\": \"hash\",        (string) the MuHash of the UTXO set, to be passed to -assumeutxo on the loading node\n"
+            "  \"path\": \"...\"            (string) the absolute path the snapshot was written to\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+                },
+            }.ToString());
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    }
+
+    SnapshotMetadata metadata;
+    std::string error;
+    if (!DumpUTXOSnapshot(path, metadata, error)) {
+        throw JSONRPCError(RPC_MISC_ERROR, error);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("coins_written", metadata.m_coins_count);
+    ret.pushKV("base_hash", metadata.m_base_blockhash.GetHex());
+    ret.pushKV("base_height", metadata.m_base_height);
+    ret.pushKV("muhash", metadata.m_muhash.GetHex());
+    ret.pushKV("path", path.string());
+    return ret;
+}
+
+static UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            RPCHelpMan{"loadtxoutset",
+                "\nStart the node from a UTXO snapshot written by dumptxoutset. The block headers and UTXO set of the snapshot are loaded, "
+                "and its block becomes the tip. The blocks below it are then downloaded and validated in the background, and the node shuts down "
+                "if they do not lead to the UTXO set of the snapshot.\n"
+                "Only possible before any block but the genesis block is connected, and only for snapshots whose height and MuHash were given with -assumeutxo.\n",
+                {
+                    {"path", RPCArg::Type::STR, RPCArg::Optional::NO, "The path of the snapshot file, relative to the data directory if not absolute."},
+                },
+                RPCResult{
+            "{\n"
+            "  \"coins_loaded\": n,       (numeric) the number of coins loaded\n"
+            "  \"base_hash\": \"hash\",     (string) the hash of the block the snapshot is as of, the new tip\n"
+            "  \"base_height\": n,        (numeric) the height of the block the snapshot is as of\n"
+            "  \"path\": \"...\"            (string) the absolute path the snapshot was loaded from\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+                },
+            }.ToString());
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+
+    SnapshotMetadata metadata;
+    std::string error;
+    if (!LoadUTXOSnapshot(path, metadata, error)) {
+        throw JSONRPCError(RPC_MISC_ERROR, error);
+    }
+    StartSnapshotValidation();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("coins_loaded", metadata.m_coins_count);
+    ret.pushKV("base_hash", metadata.m_base_blockhash.GetHex());
+    ret.pushKV("base_height", metadata.m_base_height);
+    ret.pushKV("path", path.string());
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -2317,13 +2645,17 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type", "hash_or_height"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
+    { "blockchain",         "getscriptcheckinfo",     &getscriptcheckinfo,     {} },
+    { "blockchain",         "setscriptcheckthreads",  &setscriptcheckthreads,  {"threads"} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
     { "blockchain",         "scantxoutset",           &scantxoutset,           {"action", "scanobjects"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           {"path"} },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        {"blockhash"} },
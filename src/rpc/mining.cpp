@@ -227,6 +227,13 @@ static UniValue getmininginfo(const JSONRPCRequest& request)
 
 
 // NOTE: Unlike wallet RPC (which use BTC values), mining RPCs follow GBT (BIP 22) in using satoshi amounts
+//! Keeps the selection of the templates returned by getblocktemplate up to date
+static BlockTemplateEngine& GetBlockTemplateEngine()
+{
+    static BlockTemplateEngine engine(Params());
+    return engine;
+}
+
 static UniValue prioritisetransaction(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 3)
@@ -261,6 +268,7 @@ static UniValue prioritisetransaction(const JSONRPCRequest& request)
     }
 
     mempool.PrioritiseTransaction(hash, nAmount);
+    GetBlockTemplateEngine().Invalidate();
     return true;
 }
 
@@ -505,10 +513,9 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
 
     // Update block
     static CBlockIndex* pindexPrev;
-    static int64_t nStart;
     static std::unique_ptr<CBlockTemplate> pblocktemplate;
     if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+        mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast)
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = nullptr;
@@ -516,11 +523,10 @@ static UniValue getblocktemplate(const JSONRPCRequest& request)
         // Store the pindexBest used before CreateNewBlock, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
 
         // Create new block
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
+        pblocktemplate = GetBlockTemplateEngine().CreateNewBlock(scriptDummy);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -7,6 +7,7 @@
 #include <clientversion.h>
 #include <core_io.h>
 #include <crypto/ripemd160.h>
+#include <dbwrapper.h>
 #include <key_io.h>
 #include <validation.h>
 #include <httpserver.h>
@@ -489,6 +490,79 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
     }
 }
 
+static UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            RPCHelpMan{"getdbstats",
+                "\nReturns the settings and statistics of the open databases, see -dboption. The block cache and level\n"
+                "statistics are only reported for the leveldb backend.\n",
+                {},
+                RPCResult{
+            "[\n"
+            "  {\n"
+            "    \"name\": \"xxxx\",              (string) The name of the database (chainstate, index, txindex or coinstats)\n"
+            "    \"backend\": \"xxxx\",           (string) The backend of the database (leveldb or appendlog)\n"
+            "    \"cache_size\": xxxxx,           (numeric) The cache size of the database in bytes\n"
+            "    \"block_cache_size\": xxxxx,     (numeric) The size of the block cache in bytes\n"
+            "    \"write_buffer_size\": xxxxx,    (numeric) The size of a write buffer in bytes\n"
+            "    \"bloom_bits\": n,               (numeric) The bloom filter bits per key, 0 if there is no filter\n"
+            "    \"compression\": \"xxxx\",       (string) The compression of table blocks (none or snappy)\n"
+            "    \"memory_usage\": xxxxx,         (numeric) The approximate memory usage of the database in bytes\n"
+            "    \"cache_hits\": xxxxx,           (numeric) The number of block cache lookups that found a block\n"
+            "    \"cache_misses\": xxxxx,         (numeric) The number of block cache lookups that did not find a block\n"
+            "    \"cache_hit_rate\": x.xxx,       (numeric) The share of block cache lookups that found a block\n"
+            "    \"levels\": [                    (array) The levels of the database that have files or were compacted\n"
+            "      {\n"
+            "        \"level\": n,                (numeric) The level\n"
+            "        \"files\": n,                (numeric) The number of table files at the level\n"
+            "        \"size_mb\": n,              (numeric) The size of the level in MiB\n"
+            "        \"compaction_time\": n,      (numeric) The time spent compacting into the level in seconds\n"
+            "        \"compaction_read_mb\": n,   (numeric) The data read by compactions into the level in MiB\n"
+            "        \"compaction_write_mb\": n,  (numeric) The data written by compactions into the level in MiB\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+                },
+            }.ToString());
+
+    UniValue ret(UniValue::VARR);
+    for (const DBStats& stats : GetDBStats()) {
+        UniValue db(UniValue::VOBJ);
+        db.pushKV("name", stats.name);
+        db.pushKV("backend", stats.options.append_log ? "appendlog" : "leveldb");
+        db.pushKV("cache_size", (uint64_t)stats.cache_size);
+        db.pushKV("block_cache_size", (uint64_t)(stats.cache_size / 100 * stats.options.block_cache_percent));
+        db.pushKV("write_buffer_size", (uint64_t)(stats.cache_size / 100 * stats.options.write_buffer_percent));
+        db.pushKV("bloom_bits", stats.options.bloom_bits);
+        db.pushKV("compression", stats.options.compression ? "snappy" : "none");
+        db.pushKV("memory_usage", (uint64_t)stats.memory_usage);
+        db.pushKV("cache_hits", stats.cache_hits);
+        db.pushKV("cache_misses", stats.cache_misses);
+        const uint64_t lookups = stats.cache_hits + stats.cache_misses;
+        db.pushKV("cache_hit_rate", lookups ? (double)stats.cache_hits / lookups : 0.0);
+        UniValue levels(UniValue::VARR);
+        for (const DBStats::Level& level : stats.levels) {
+            UniValue obj(UniValue::VOBJ);
+            obj.pushKV("level", level.level);
+            obj.pushKV("files", level.files);
+            obj.pushKV("size_mb", level.size_mb);
+            obj.pushKV("compaction_time", level.compaction_time);
+            obj.pushKV("compaction_read_mb", level.compaction_read_mb);
+            obj.pushKV("compaction_write_mb", level.compaction_write_mb);
+            levels.push_back(obj);
+        }
+        db.pushKV("levels", levels);
+        ret.push_back(db);
+    }
+    return ret;
+}
+
 static void EnableOrDisableLogCategories(UniValue cats, bool enable) {
     cats = cats.get_array();
     for (unsigned int i = 0; i < cats.size(); ++i) {
@@ -600,6 +674,7 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
+    { "control",            "getdbstats",             &getdbstats,             {} },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
     { "util",               "validateaddress",        &validateaddress,        {"address"} },
     { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys","address_type"} },
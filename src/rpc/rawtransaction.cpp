@@ -1077,6 +1077,70 @@ static UniValue sendrawtransaction(const JSONRPCRequest& request)
     return txid.GetHex();
 }
 
+static UniValue sendrawtransactions(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            RPCHelpMan{"sendrawtransactions",
+                "\nSubmits raw transactions (serialized, hex-encoded) to local node and network.\n"
+                "\nThe transactions are added to the mempool together, after the transactions of the batch they spend,\n"
+                "so they can be given in any order. This is faster than calling sendrawtransaction for each of them.\n"
+                "\nSee sendrawtransaction call.\n",
+                {
+                    {"hexstrings", RPCArg::Type::ARR, RPCArg::Optional::NO, "An array of hex strings of raw transactions.",
+                        {
+                            {"hexstring", RPCArg::Type::STR_HEX, RPCArg::Optional::OMITTED, ""},
+                        },
+                        },
+                    {"allowhighfees", RPCArg::Type::BOOL, /* default */ "false", "Allow high fees"},
+                },
+                RPCResult{
+            "[                   (array) The result for each raw transaction in the input array.\n"
+            " {\n"
+            "  \"txid\"           (string) The transaction hash in hex\n"
+            "  \"error\"          (string) Why the transaction was not submitted (only present if it was not)\n"
+            " }\n"
+            "]\n"
+                },
+                RPCExamples{
+            "\nSend two signed transactions\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex1\\\",\\\"signedhex2\\\"]\"") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex1\",\"signedhex2\"]")
+                },
+            }.ToString());
+
+    RPCTypeCheck(request.params, {UniValue::VARR, UniValue::VBOOL});
+
+    const UniValue& hexstrings = request.params[0].get_array();
+    std::vector<CTransactionRef> txs;
+    txs.reserve(hexstrings.size());
+    for (size_t i = 0; i < hexstrings.size(); ++i) {
+        CMutableTransaction mtx;
+        if (!DecodeHexTx(mtx, hexstrings[i].get_str()))
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed for transaction %u", i));
+        txs.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+
+    bool allowhighfees = false;
+    if (!request.params[1].isNull()) allowhighfees = request.params[1].get_bool();
+    const CAmount highfee{allowhighfees ? 0 : ::maxTxFee};
+    std::vector<TransactionError> errors;
+    std::vector<std::string> err_strings;
+    BroadcastTransactions(txs, errors, err_strings, highfee);
+
+    UniValue result(UniValue::VARR);
+    for (size_t i = 0; i < txs.size(); ++i) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("txid", txs[i]->GetHash().GetHex());
+        if (errors[i] != TransactionError::OK) {
+            entry.pushKV("error", err_strings[i].empty() ? TransactionErrorString(errors[i]) : err_strings[i]);
+        }
+        result.push_back(std::move(entry));
+    }
+    return result;
+}
+
 static UniValue testmempoolaccept(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
@@ -2049,6 +2113,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",         &decoderawtransaction,      {"hexstring","iswitness"} },
     { "rawtransactions",    "decodescript",                 &decodescript,              {"hexstring"} },
     { "rawtransactions",    "sendrawtransaction",           &sendrawtransaction,        {"hexstring","allowhighfees"} },
+    { "rawtransactions",    "sendrawtransactions",          &sendrawtransactions,       {"hexstrings","allowhighfees"} },
     { "rawtransactions",    "combinerawtransaction",        &combinerawtransaction,     {"txs"} },
     { "hidden",             "signrawtransaction",           &signrawtransaction,        {"hexstring","prevtxs","privkeys","sighashtype"} },
     { "rawtransactions",    "signrawtransactionwithkey",    &signrawtransactionwithkey, {"hexstring","privkeys","prevtxs","sighashtype"} },
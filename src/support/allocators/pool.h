@@ -0,0 +1,202 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * A memory resource for node based containers such as std::unordered_map.
+ *
+ * Memory is taken from the system in large chunks, and handed out in blocks
+ * that are a multiple of ALIGN_BYTES. Freed blocks are kept in one free list
+ * per block size and reused by later allocations of the same size, so that
+ * every node of a container costs exactly its (aligned) size: there is no
+ * per-allocation malloc overhead, and nodes allocated after each other end up
+ * next to each other in memory.
+ *
+ * Allocations larger than MAX_BLOCK_SIZE_BYTES, or with an alignment larger
+ * than ALIGN_BYTES, are passed on to operator new.
+ *
+ * Memory is only returned to the system when the resource is destroyed, and
+ * the resource must outlive every container that uses it. It is not thread
+ * safe.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ALIGN_BYTES >= sizeof(void*), "ALIGN_BYTES must be able to hold a free list pointer");
+    static_assert(MAX_BLOCK_SIZE_BYTES > 0, "MAX_BLOCK_SIZE_BYTES must not be zero");
+
+    /** A free block, linked to the next free block of the same size. */
+    struct ListNode {
+        ListNode* m_next;
+    };
+
+    /** Number of ALIGN_BYTES units needed to hold bytes. Empty allocations still take a unit. */
+    static constexpr std::size_t NumUnits(std::size_t bytes)
+    {
+        return bytes == 0 ? 1 : (bytes + ALIGN_BYTES - 1) / ALIGN_BYTES;
+    }
+
+    const std::size_t m_chunk_size_bytes;
+
+    /** Free lists, indexed by block size in ALIGN_BYTES units. */
+    std::vector<ListNode*> m_free_lists;
+
+    /** Chunks obtained from the system, released on destruction. */
+    std::vector<void*> m_chunks;
+
+    /** Part of the most recent chunk that has not been handed out yet. */
+    char* m_available_begin = nullptr;
+    char* m_available_end = nullptr;
+
+    /** Bytes held in the free lists. */
+    std::size_t m_free_bytes = 0;
+
+    bool IsPoolable(std::size_t bytes, std::size_t alignment) const
+    {
+        return bytes <= MAX_BLOCK_SIZE_BYTES && alignment <= ALIGN_BYTES;
+    }
+
+    void PushFree(void* p, std::size_t units)
+    {
+        ListNode* node = new (p) ListNode{m_free_lists[units]};
+        m_free_lists[units] = node;
+        m_free_bytes += units * ALIGN_BYTES;
+    }
+
+    void AllocateChunk()
+    {
+        // Do not waste the tail of the previous chunk: it is always a whole
+        // number of units, and no larger than the largest block size.
+        const std::size_t tail_units = (m_available_end - m_available_begin) / ALIGN_BYTES;
+        if (tail_units > 0) {
+            PushFree(m_available_begin, tail_units);
+        }
+        m_chunks.reserve(m_chunks.size() + 1);
+        m_available_begin = static_cast<char*>(::operator new(m_chunk_size_bytes));
+        m_available_end = m_available_begin + m_chunk_size_bytes;
+        m_chunks.push_back(m_available_begin);
+    }
+
+public:
+    /** @param chunk_size_bytes Size of the chunks taken from the system. Rounded to a whole number of blocks. */
+    explicit PoolResource(std::size_t chunk_size_bytes)
+        : m_chunk_size_bytes(NumUnits(chunk_size_bytes < MAX_BLOCK_SIZE_BYTES ? MAX_BLOCK_SIZE_BYTES : chunk_size_bytes) * ALIGN_BYTES),
+          m_free_lists(NumUnits(MAX_BLOCK_SIZE_BYTES) + 1, nullptr)
+    {
+    }
+
+    PoolResource() : PoolResource(262144) {}
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (void* chunk : m_chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsPoolable(bytes, alignment)) {
+            return ::operator new(bytes);
+        }
+        const std::size_t units = NumUnits(bytes);
+        if (ListNode* node = m_free_lists[units]) {
+            m_free_lists[units] = node->m_next;
+            m_free_bytes -= units * ALIGN_BYTES;
+            node->~ListNode();
+            return node;
+        }
+        if (static_cast<std::size_t>(m_available_end - m_available_begin) < units * ALIGN_BYTES) {
+            AllocateChunk();
+        }
+        void* p = m_available_begin;
+        m_available_begin += units * ALIGN_BYTES;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsPoolable(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, NumUnits(bytes));
+    }
+
+    std::size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+    std::size_t NumAllocatedChunks() const { return m_chunks.size(); }
+
+    /** Memory taken from the system that is available for reuse without allocating a new chunk. */
+    std::size_t FreeBytes() const
+    {
+        return m_free_bytes + (m_available_end - m_available_begin);
+    }
+};
+
+/**
+ * Allocator that takes its memory from a PoolResource. Containers using it
+ * must be constructed with a pointer to the resource.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* resource) noexcept : m_resource(resource) {}
+    PoolAllocator(const PoolAllocator& other) noexcept = default;
+    PoolAllocator& operator=(const PoolAllocator& other) noexcept = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.resource())
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return m_resource; }
+
+private:
+    ResourceType* m_resource;
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -4,6 +4,7 @@
 
 #include <util/system.h>
 
+#include <support/allocators/pool.h>
 #include <support/allocators/secure.h>
 #include <test/test_bitcoin.h>
 
@@ -233,4 +234,51 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Blocks are rounded up to the alignment, and handed out back to back.
+    void* a = resource.Allocate(20, 4);
+    void* b = resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 24);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 1024U - 48U);
+
+    // A freed block is reused by the next allocation of the same size only.
+    resource.Deallocate(a, 20, 4);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 1024U - 24U);
+    void* c = resource.Allocate(8, 8);
+    BOOST_CHECK(c != a);
+    void* d = resource.Allocate(24, 8);
+    BOOST_CHECK(d == a);
+
+    // Large or overaligned allocations do not come from the pool.
+    const size_t free_bytes = resource.FreeBytes();
+    void* e = resource.Allocate(65, 8);
+    void* f = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), free_bytes);
+    resource.Deallocate(e, 65, 8);
+    resource.Deallocate(f, 8, 16);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), free_bytes);
+
+    // The tail of a chunk is kept for reuse when a new chunk is needed.
+    std::vector<void*> blocks;
+    while (resource.NumAllocatedChunks() == 1) {
+        blocks.push_back(resource.Allocate(64, 8));
+    }
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 1024U - 64U + 1024U - 56U - 64U * (blocks.size() - 1));
+    void* tail = resource.Allocate(8, 8);
+    BOOST_CHECK(tail > c && tail < static_cast<char*>(a) + 1024);
+
+    for (void* block : blocks) resource.Deallocate(block, 64, 8);
+    resource.Deallocate(b, 24, 8);
+    resource.Deallocate(c, 8, 8);
+    resource.Deallocate(d, 24, 8);
+    resource.Deallocate(tail, 8, 8);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 2048U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
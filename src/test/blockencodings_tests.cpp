@@ -156,6 +156,63 @@ public:
     }
 };
 
+BOOST_AUTO_TEST_CASE(RawBlockTest)
+{
+    CBlock block(BuildBlockTestCase());
+    // Give one transaction witness data, and add one with no inputs and outputs.
+    CMutableTransaction witness_tx(*block.vtx[2]);
+    witness_tx.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(73, 0x42));
+    block.vtx[2] = MakeTransactionRef(witness_tx);
+    block.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+
+    CDataStream stream(SER_DISK, PROTOCOL_VERSION);
+    stream << block;
+    const std::vector<unsigned char> data(stream.begin(), stream.end());
+    const RawBlock raw_block{FlatFileSpan(std::vector<unsigned char>(data))};
+
+    BOOST_CHECK(raw_block.GetHeader().GetHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(raw_block.TxCount(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(raw_block.HasWitness(i), block.vtx[i]->HasWitness());
+        BOOST_CHECK(raw_block.GetTxHash(i) == block.vtx[i]->GetHash());
+        BOOST_CHECK(raw_block.GetWitnessHash(i) == block.vtx[i]->GetWitnessHash());
+        BOOST_CHECK(*raw_block.GetTransaction(i) == *block.vtx[i]);
+    }
+    BOOST_CHECK(raw_block.HasWitness(2));
+
+    // Both serializations match those of the decoded block.
+    CDataStream expected(SER_NETWORK, PROTOCOL_VERSION);
+    CDataStream actual(SER_NETWORK, PROTOCOL_VERSION);
+    expected << block;
+    actual << raw_block;
+    BOOST_CHECK(expected.str() == actual.str());
+    expected = CDataStream(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    actual = CDataStream(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    expected << block;
+    actual << raw_block;
+    BOOST_CHECK(expected.str() == actual.str());
+    BOOST_CHECK(actual.size() < data.size());
+
+    // Compact blocks built from the raw block use the same short ids.
+    for (bool use_wtxid : {false, true}) {
+        TestHeaderAndShortIDs cmpctblock{CBlockHeaderAndShortTxIDs(raw_block, use_wtxid)};
+        BOOST_CHECK(cmpctblock.header.GetHash() == block.GetHash());
+        BOOST_REQUIRE_EQUAL(cmpctblock.prefilledtxn.size(), 1U);
+        BOOST_CHECK(cmpctblock.prefilledtxn[0].tx->GetHash() == block.vtx[0]->GetHash());
+        BOOST_REQUIRE_EQUAL(cmpctblock.shorttxids.size(), block.vtx.size() - 1);
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            const uint256& hash = use_wtxid ? block.vtx[i]->GetWitnessHash() : block.vtx[i]->GetHash();
+            BOOST_CHECK_EQUAL(cmpctblock.shorttxids[i - 1], cmpctblock.GetShortID(hash));
+        }
+    }
+
+    // Truncated or padded data is rejected.
+    BOOST_CHECK_THROW(RawBlock(FlatFileSpan(std::vector<unsigned char>(data.begin(), data.end() - 1))), std::ios_base::failure);
+    std::vector<unsigned char> padded(data);
+    padded.push_back(0);
+    BOOST_CHECK_THROW(RawBlock(FlatFileSpan(std::move(padded))), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_CASE(NonCoinbasePreforwardRTTest)
 {
     CTxMemPool pool;
@@ -0,0 +1,108 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+//! The fields of a block index entry that are loaded from disk or derived from them
+struct Entry {
+    int height;
+    uint256 prev;
+    uint32_t status;
+    unsigned int tx;
+    unsigned int chain_tx;
+    arith_uint256 chain_work;
+    int file;
+    unsigned int data_pos;
+
+    bool operator==(const Entry& other) const
+    {
+        return height == other.height && prev == other.prev && status == other.status && tx == other.tx &&
+               chain_tx == other.chain_tx && chain_work == other.chain_work && file == other.file && data_pos == other.data_pos;
+    }
+};
+
+std::map<uint256, Entry> GetBlockIndex() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    std::map<uint256, Entry> entries;
+    for (const BlockMap::value_type& item : mapBlockIndex) {
+        const CBlockIndex* pindex = item.second;
+        entries[item.first] = Entry{pindex->nHeight, pindex->pprev ? pindex->pprev->GetBlockHash() : uint256(),
+                                    pindex->nStatus, pindex->nTx, pindex->nChainTx, pindex->nChainWork, pindex->nFile, pindex->nDataPos};
+    }
+    return entries;
+}
+
+void ReloadBlockIndex()
+{
+    StopUndoWriter();
+    {
+        LOCK(cs_main);
+        UnloadBlockIndex();
+        BOOST_REQUIRE(LoadBlockIndex(Params()));
+        BOOST_REQUIRE(LoadChainTip(Params()));
+    }
+    StartUndoWriter();
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(blockindex_snapshot_tests)
+
+BOOST_FIXTURE_TEST_CASE(blockindex_snapshot_load, TestChain100Setup)
+{
+    FlushStateToDisk();
+    std::map<uint256, Entry> expected;
+    {
+        LOCK(cs_main);
+        expected = GetBlockIndex();
+    }
+    BOOST_REQUIRE(WriteBlockIndexSnapshot());
+
+    // The entries are loaded from the snapshot, which allocates them together in height order.
+    ReloadBlockIndex();
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(GetBlockIndex() == expected);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 100);
+        BOOST_CHECK(chainActive[1] == chainActive[0] + 1);
+        BOOST_CHECK(chainActive.Tip() == chainActive[0] + 100);
+    }
+    // A snapshot is only loaded once.
+    uint64_t stamp;
+    BOOST_CHECK(!pblocktree->ReadBlockIndexSnapshotStamp(stamp));
+
+    // Writing block index entries makes the snapshot stale.
+    FlushStateToDisk();
+    BOOST_REQUIRE(WriteBlockIndexSnapshot());
+    BOOST_CHECK(pblocktree->ReadBlockIndexSnapshotStamp(stamp));
+    const CScript script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock({}, script_pub_key);
+    FlushStateToDisk();
+    BOOST_CHECK(!pblocktree->ReadBlockIndexSnapshotStamp(stamp));
+    {
+        LOCK(cs_main);
+        expected = GetBlockIndex();
+    }
+    ReloadBlockIndex();
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(GetBlockIndex() == expected);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    }
+
+    // shutdown sequence (c.f. Shutdown() in init.cpp)
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -209,6 +209,27 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Random)
     Correct_Queue_range(range);
 }
 
+/** Test that checks are all run when there are more workers than per-worker
+ * deques, so that some workers share a deque.
+ */
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_SharedSlots)
+{
+    auto small_queue = MakeUnique<Correct_Queue>(QUEUE_BATCH_SIZE);
+    boost::thread_group tg;
+    for (auto x = 0; x < 100; ++x) {
+       tg.create_thread([&]{small_queue->Thread();});
+    }
+    for (size_t i = 0; i < 100; ++i) {
+        FakeCheckCheckCompletion::n_calls = 0;
+        CCheckQueueControl<FakeCheckCheckCompletion> control(small_queue.get());
+        std::vector<FakeCheckCheckCompletion> vChecks(i * 10);
+        control.Add(vChecks);
+        BOOST_REQUIRE(control.Wait());
+        BOOST_REQUIRE_EQUAL(FakeCheckCheckCompletion::n_calls, i * 10);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
 
 /** Test that failing checks are caught */
 BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
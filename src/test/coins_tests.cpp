@@ -7,12 +7,14 @@
 #include <consensus/validation.h>
 #include <script/standard.h>
 #include <test/test_bitcoin.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
 #include <util/strencodings.h>
 #include <validation.h>
 
 #include <map>
+#include <set>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -53,7 +55,7 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool erase = true) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -64,7 +66,11 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (erase) {
+                mapCoins.erase(it++);
+            } else {
+                ++it;
+            }
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -208,10 +214,17 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         }
 
         if (InsecureRandRange(100) == 0) {
-            // Every 100 iterations, flush an intermediate cache
+            // Every 100 iterations, flush or sync an intermediate cache
             if (stack.size() > 1 && InsecureRandBool() == 0) {
                 unsigned int flushIndex = InsecureRandRange(stack.size() - 1);
-                BOOST_CHECK(stack[flushIndex]->Flush());
+                if (InsecureRandBool()) {
+                    BOOST_CHECK(stack[flushIndex]->Flush());
+                } else {
+                    BOOST_CHECK(stack[flushIndex]->Sync());
+                    if (InsecureRandBool()) {
+                        stack[flushIndex]->Trim(stack[flushIndex]->DynamicMemoryUsage() / 2);
+                    }
+                }
             }
         }
         if (InsecureRandRange(100) == 0) {
@@ -443,10 +456,17 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
         }
 
         if (InsecureRandRange(100) == 0) {
-            // Every 100 iterations, flush an intermediate cache
+            // Every 100 iterations, flush or sync an intermediate cache
             if (stack.size() > 1 && InsecureRandBool() == 0) {
                 unsigned int flushIndex = InsecureRandRange(stack.size() - 1);
-                BOOST_CHECK(stack[flushIndex]->Flush());
+                if (InsecureRandBool()) {
+                    BOOST_CHECK(stack[flushIndex]->Flush());
+                } else {
+                    BOOST_CHECK(stack[flushIndex]->Sync());
+                    if (InsecureRandBool()) {
+                        stack[flushIndex]->Trim(stack[flushIndex]->DynamicMemoryUsage() / 2);
+                    }
+                }
             }
         }
         if (InsecureRandRange(100) == 0) {
@@ -589,7 +609,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
     InsertCoinsMapEntry(map, value, flags);
     BOOST_CHECK(view.BatchWrite(map, {}));
 }
@@ -858,4 +879,395 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+
+BOOST_AUTO_TEST_CASE(prefetch_block_inputs)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    // Three coins in the backing view, created by a single funding transaction.
+    CMutableTransaction funding;
+    funding.vin.resize(1);
+    funding.vout.resize(3);
+    for (CTxOut& out : funding.vout) {
+        out.nValue = 10 * COIN;
+        out.scriptPubKey = CScript() << OP_TRUE;
+    }
+    const CTransaction funding_tx(funding);
+    {
+        CCoinsViewCacheTest writer(&base);
+        AddCoins(writer, funding_tx, 1);
+        BOOST_CHECK(writer.Flush());
+    }
+    const COutPoint out0(funding_tx.GetHash(), 0), out1(funding_tx.GetHash(), 1), out2(funding_tx.GetHash(), 2);
+
+    // The cache already knows out2 was spent; prefetching must not resurrect it.
+    BOOST_CHECK(cache.AccessCoin(out2).out.nValue == 10 * COIN);
+    BOOST_CHECK(cache.SpendCoin(out2));
+    BOOST_CHECK(cache.map().count(out2));
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+    CMutableTransaction spend1;
+    spend1.vin.resize(3);
+    spend1.vin[0].prevout = out0;
+    spend1.vin[1].prevout = out1;
+    spend1.vin[2].prevout = out2;
+    spend1.vout.resize(1);
+    const CTransaction spend1_tx(spend1);
+    // Spends an output created within the block, which must not be looked up.
+    CMutableTransaction spend2;
+    spend2.vin.resize(1);
+    spend2.vin[0].prevout = COutPoint(spend1_tx.GetHash(), 0);
+    spend2.vout.resize(1);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    block.vtx.push_back(MakeTransactionRef(spend1_tx));
+    block.vtx.push_back(MakeTransactionRef(std::move(spend2)));
+
+    PrefetchBlockInputs(block, cache, base);
+
+    BOOST_CHECK(cache.HaveCoinInCache(out0));
+    BOOST_CHECK(cache.HaveCoinInCache(out1));
+    BOOST_CHECK(!cache.HaveCoinInCache(out2));
+    BOOST_CHECK_EQUAL(cache.map().at(out0).flags, 0);
+    BOOST_CHECK_EQUAL(cache.map().count(COutPoint(spend1_tx.GetHash(), 0)), 0U);
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sync_and_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    // Coins created in three different blocks.
+    std::vector<COutPoint> outpoints;
+    for (int block = 0; block < 3; ++block) {
+        CCoinsViewCacheTest view(&cache);
+        for (uint32_t i = 0; i < 100; ++i) {
+            outpoints.emplace_back(InsecureRand256(), i);
+            view.AddCoin(outpoints.back(), Coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false), false);
+        }
+        view.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(view.Flush());
+    }
+    // A coin of the first block is used again by the last one, and one is spent.
+    {
+        CCoinsViewCacheTest view(&cache);
+        BOOST_CHECK(view.HaveCoin(outpoints[0]));
+        BOOST_CHECK(view.SpendCoin(outpoints[1]));
+        BOOST_CHECK(view.Flush());
+    }
+    // The spent coin was FRESH, so it is gone already.
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size() - 1);
+
+    // Syncing writes everything to the base, and keeps the unspent coins.
+    BOOST_CHECK(cache.Sync());
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size() - 1);
+    for (const auto& entry : cache.map()) {
+        BOOST_CHECK_EQUAL(entry.second.flags, 0);
+        Coin coin;
+        BOOST_CHECK(base.GetCoin(entry.first, coin));
+        BOOST_CHECK(coin == entry.second.coin);
+    }
+    BOOST_CHECK(cache.GetBestBlock() == base.GetBestBlock());
+
+    // Modified entries are never trimmed.
+    {
+        CCoinsViewCacheTest view(&cache);
+        BOOST_CHECK(view.SpendCoin(outpoints[2]));
+        BOOST_CHECK(view.Flush());
+    }
+    BOOST_CHECK_EQUAL(cache.map().at(outpoints[2]).flags, CCoinsCacheEntry::DIRTY);
+
+    // Trimming drops the least recently used entries first: the coins of the
+    // first block, but not the one that was used again.
+    const size_t usage = cache.DynamicMemoryUsage();
+    cache.Trim(usage - 1);
+    cache.SelfTest();
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[0]));
+    BOOST_CHECK_EQUAL(cache.map().count(outpoints[2]), 1U);
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[3]));
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[99]));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[100]));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[299]));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 200U + 2U);
+
+    // Trimming to nothing keeps only the modified entry.
+    cache.Trim(0);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.AccessCoin(outpoints[2]).IsSpent());
+    BOOST_CHECK(!cache.AccessCoin(outpoints[3]).IsSpent());
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_background_writer)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewBackgroundWriter writer(&db, 1 << 30);
+    writer.Start();
+    CCoinsViewCacheTest cache(&writer);
+
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false), false);
+    }
+    const uint256 block1 = InsecureRand256();
+    cache.SetBestBlock(block1);
+    BOOST_CHECK(cache.Sync());
+
+    // Whether or not the batch is on disk yet, the writer serves its coins.
+    BOOST_CHECK(writer.GetBestBlock() == block1);
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(writer.HaveCoin(outpoint));
+    }
+    BOOST_CHECK(writer.Wait());
+    size_t written, total;
+    BOOST_CHECK(!writer.GetProgress(written, total));
+    BOOST_CHECK(db.GetBestBlock() == block1);
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(db.HaveCoin(outpoint));
+    }
+
+    // Spending a coin hides it right away, and removes it from disk later.
+    BOOST_CHECK(cache.SpendCoin(outpoints[0]));
+    const uint256 block2 = InsecureRand256();
+    cache.SetBestBlock(block2);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!writer.HaveCoin(outpoints[0]));
+    BOOST_CHECK(writer.HaveCoin(outpoints[1]));
+    std::unique_ptr<CCoinsViewCursor> cursor(writer.Cursor());
+    BOOST_CHECK(cursor->GetBestBlock() == block2);
+    BOOST_CHECK(!db.HaveCoin(outpoints[0]));
+
+    // Once stopped, writes are synchronous.
+    writer.Stop();
+    cache.AddCoin(outpoints[0], Coin(CTxOut(COIN, CScript() << OP_TRUE), 2, false), false);
+    cache.SetBestBlock(block1);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.HaveCoin(outpoints[0]));
+    BOOST_CHECK(db.GetBestBlock() == block1);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_write_pieces)
+{
+    CCoinsViewDB db(1 << 20, true);
+    const uint256 block1 = InsecureRand256();
+    const uint256 block2 = InsecureRand256();
+    CCoinsMapMemoryResource resource;
+    CCoinsMap coins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    const COutPoint outpoint1(InsecureRand256(), 0), outpoint2(InsecureRand256(), 0);
+    coins[outpoint1].coin = Coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false);
+    coins[outpoint1].flags = CCoinsCacheEntry::DIRTY;
+    BOOST_CHECK(db.BatchWrite(coins, block1));
+
+    // Until the last piece, the database is marked as moving to block2.
+    coins[outpoint2].coin = Coin(CTxOut(COIN, CScript() << OP_TRUE), 2, false);
+    coins[outpoint2].flags = CCoinsCacheEntry::DIRTY;
+    BOOST_CHECK(db.BatchWritePart(coins, block2, true, false));
+    BOOST_CHECK(db.HaveCoin(outpoint2));
+    BOOST_CHECK(db.GetBestBlock().IsNull());
+    BOOST_CHECK(db.GetHeadBlocks() == std::vector<uint256>({block2, block1}));
+    BOOST_CHECK(db.BatchWritePart(coins, block2, true, false));
+    BOOST_CHECK(db.GetHeadBlocks() == std::vector<uint256>({block2, block1}));
+    BOOST_CHECK(db.BatchWritePart(coins, block2, true, true));
+    BOOST_CHECK(db.GetBestBlock() == block2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_background_writer_pieces)
+{
+    CCoinsViewDB db(1 << 20, true);
+    // Every piece holds a single coin, as the first one already exceeds the limit.
+    CCoinsViewBackgroundWriter writer(&db, 1);
+    writer.Start();
+    CCoinsViewCacheTest cache(&writer);
+
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 100; ++i) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false), false);
+    }
+    const uint256 block1 = InsecureRand256();
+    cache.SetBestBlock(block1);
+    BOOST_CHECK(cache.Sync());
+
+    // Only the last piece can still be in memory.
+    BOOST_CHECK_LE(writer.DynamicMemoryUsage(), memusage::DynamicUsage(cache.map()));
+    BOOST_CHECK(writer.GetBestBlock() == block1);
+    bool notified = false;
+    writer.NotifyWhenWritten([&notified, &db, &block1] {
+        BOOST_CHECK(db.GetBestBlock() == block1);
+        notified = true;
+    });
+    BOOST_CHECK(writer.Wait());
+    BOOST_CHECK(notified);
+    BOOST_CHECK_EQUAL(writer.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == block1);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(db.HaveCoin(outpoint));
+    }
+
+    // With nothing left to write, the notification is immediate.
+    notified = false;
+    writer.NotifyWhenWritten([&notified] { notified = true; });
+    BOOST_CHECK(notified);
+    writer.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sharded_cursors)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewCacheTest cache(&db);
+
+    std::set<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        const COutPoint outpoint(InsecureRand256(), i % 3);
+        outpoints.insert(outpoint);
+        cache.AddCoin(outpoint, Coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false), false);
+    }
+    const uint256 block1 = InsecureRand256();
+    cache.SetBestBlock(block1);
+    BOOST_CHECK(cache.Flush());
+
+    for (int n_shards : {1, 3, 16, 0x10000}) {
+        std::vector<std::unique_ptr<CCoinsViewCursor>> cursors = db.ShardedCursors(n_shards);
+        BOOST_CHECK_EQUAL(cursors.size(), (size_t)n_shards);
+
+        // Coins written after the cursors were created are not visited.
+        CCoinsViewCacheTest writer(&db);
+        writer.AddCoin(COutPoint(InsecureRand256(), 0), Coin(CTxOut(COIN, CScript() << OP_TRUE), 2, false), false);
+        writer.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(writer.Flush());
+
+        // Every coin is visited once, by consecutive shards in key order.
+        std::set<COutPoint> visited;
+        Optional<COutPoint> last;
+        for (const auto& cursor : cursors) {
+            BOOST_CHECK(cursor->GetBestBlock() == block1);
+            for (; cursor->Valid(); cursor->Next()) {
+                COutPoint key;
+                Coin coin;
+                BOOST_CHECK(cursor->GetKey(key) && cursor->GetValue(coin));
+                BOOST_CHECK(!last || *last < key);
+                last = key;
+                visited.insert(key);
+            }
+        }
+        BOOST_CHECK(visited == outpoints);
+
+        // Reset the database for the next round.
+        std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+        for (; cursor->Valid(); cursor->Next()) {
+            COutPoint key;
+            BOOST_CHECK(cursor->GetKey(key));
+            if (!outpoints.count(key)) BOOST_CHECK(writer.SpendCoin(key));
+        }
+        writer.SetBestBlock(block1);
+        BOOST_CHECK(writer.Flush());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_cache_pool_usage)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCacheTest writer(&base);
+        // Enough coins that the unused rest of the last chunk does not matter.
+        for (uint32_t i = 0; i < 50000; ++i) {
+            outpoints.emplace_back(InsecureRand256(), i);
+            writer.AddCoin(outpoints.back(), Coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false), false);
+        }
+        BOOST_CHECK(writer.Flush());
+    }
+
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(!cache.AccessCoin(outpoint).IsSpent());
+    }
+    cache.SelfTest();
+    const size_t usage = cache.DynamicMemoryUsage();
+    // All chunks of the pool are counted. They are filled with nodes, except
+    // for what is left of the last one.
+    const size_t chunk_bytes = CCoinsMapMemoryResource().ChunkSizeBytes();
+    const size_t node_bytes = sizeof(memusage::unordered_node<CCoinsMap::value_type>) * outpoints.size();
+    const size_t bucket_usage = memusage::MallocUsage(sizeof(void*) * cache.map().bucket_count());
+    BOOST_CHECK_GE(usage, node_bytes + bucket_usage);
+    BOOST_CHECK_LT(usage, node_bytes * 5 / 4 + chunk_bytes + bucket_usage);
+    // Nodes come from the pool without a malloc overhead each.
+    const size_t malloc_usage = memusage::MallocUsage(sizeof(memusage::unordered_node<CCoinsMap::value_type>)) * outpoints.size();
+    BOOST_CHECK_LT(usage, malloc_usage + bucket_usage);
+
+    // Freed nodes stay with the pool, and are reused before it grows.
+    for (const COutPoint& outpoint : outpoints) {
+        cache.Uncache(outpoint);
+    }
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), usage);
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(!cache.AccessCoin(outpoint).IsSpent());
+    }
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), usage);
+    cache.SelfTest();
+
+    // Flushing gives the memory back.
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_LE(cache.DynamicMemoryUsage(), memusage::MallocUsage(sizeof(void*)));
+
+    // A small bucket array is allocated from the pool, and is not counted twice.
+    CCoinsViewCacheTest small(&base);
+    BOOST_CHECK(!small.AccessCoin(outpoints[0]).IsSpent());
+    BOOST_CHECK_LE(sizeof(void*) * small.map().bucket_count(), sizeof(CCoinsMap::value_type) + sizeof(void*) * 4);
+    BOOST_CHECK_EQUAL(small.DynamicMemoryUsage(), memusage::MallocUsage(chunk_bytes) + memusage::MallocUsage(sizeof(void*)));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_upgrade_script_compression)
+{
+    const fs::path path = SetDataDir("ccoins_upgrade_script_compression") / "chainstate";
+    const std::vector<unsigned char> hash20(20, 0x42), hash32(32, 0x43);
+    const std::vector<CScript> scripts{
+        CScript() << OP_DUP << OP_HASH160 << hash20 << OP_EQUALVERIFY << OP_CHECKSIG,
+        CScript() << OP_0 << hash20,
+        CScript() << OP_0 << hash32,
+        CScript() << OP_TRUE,
+    };
+
+    // Write coins as 0.15..0.18 did: under 'C', with the original script compression.
+    std::map<COutPoint, Coin> coins;
+    {
+        CDBWrapper legacy(path, 1 << 20, false, true, true);
+        for (uint32_t n = 0; n < scripts.size(); ++n) {
+            const COutPoint outpoint(InsecureRand256(), n);
+            const Coin coin(CTxOut(COIN, scripts[n]), 100 + n, n == 0);
+            BOOST_CHECK(legacy.Write(std::make_pair('C', std::make_pair(outpoint.hash, (unsigned char)n)), coin));
+            coins.emplace(outpoint, coin);
+        }
+    }
+
+    CCoinsViewDB db(path, 1 << 20, false, false);
+    BOOST_CHECK(db.Upgrade());
+    for (const auto& expected : coins) {
+        Coin coin;
+        BOOST_CHECK(db.GetCoin(expected.first, coin));
+        BOOST_CHECK(coin.out == expected.second.out);
+        BOOST_CHECK_EQUAL(coin.nHeight, expected.second.nHeight);
+        BOOST_CHECK_EQUAL(coin.fCoinBase, expected.second.fCoinBase);
+    }
+    size_t count = 0;
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    for (; cursor->Valid(); cursor->Next()) ++count;
+    BOOST_CHECK_EQUAL(count, coins.size());
+
+    // Upgrading again finds nothing to do.
+    BOOST_CHECK(db.Upgrade());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,144 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/coinstatsindex.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinstatsindex_tests)
+
+// Compute the statistics of the current UTXO set the slow way, by walking the chainstate.
+static CoinStats ScanUTXOSet()
+{
+    FlushStateToDisk();
+    CoinStats stats;
+    MuHash3072 muhash;
+    std::unique_ptr<CCoinsViewCursor> cursor(pcoinsdbview->Cursor());
+    while (cursor->Valid()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_REQUIRE(cursor->GetKey(key) && cursor->GetValue(coin));
+        ApplyCoinHash(muhash, key, coin);
+        stats.transaction_output_count++;
+        stats.bogo_size += GetBogoSize(coin.out.scriptPubKey);
+        stats.total_amount += coin.out.nValue;
+        cursor->Next();
+    }
+    muhash.Finalize(stats.muhash);
+    return stats;
+}
+
+static void CheckIndexMatchesChainstate(const CoinStatsIndex& index)
+{
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    CoinStats indexed;
+    BOOST_REQUIRE(index.LookUpStats(tip, indexed));
+    const CoinStats scanned = ScanUTXOSet();
+    BOOST_CHECK(indexed.muhash == scanned.muhash);
+    BOOST_CHECK_EQUAL(indexed.transaction_output_count, scanned.transaction_output_count);
+    BOOST_CHECK_EQUAL(indexed.bogo_size, scanned.bogo_size);
+    BOOST_CHECK_EQUAL(indexed.total_amount, scanned.total_amount);
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_initial_sync, TestChain100Setup)
+{
+    CoinStatsIndex coin_stats_index(1 << 20, true);
+
+    const CBlockIndex* block_index;
+    {
+        LOCK(cs_main);
+        block_index = chainActive.Tip();
+    }
+
+    // Nothing is found before the index is started.
+    CoinStats stats;
+    BOOST_CHECK(!coin_stats_index.LookUpStats(block_index, stats));
+    BOOST_CHECK(!coin_stats_index.BlockUntilSyncedToCurrentChain());
+
+    coin_stats_index.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!coin_stats_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // The genesis block does not add to the UTXO set.
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(coin_stats_index.LookUpStats(chainActive.Genesis(), stats));
+    }
+    BOOST_CHECK_EQUAL(stats.transaction_output_count, 0U);
+    BOOST_CHECK_EQUAL(stats.total_amount, 0);
+
+    CheckIndexMatchesChainstate(coin_stats_index);
+
+    // Spend a coinbase output in a new block.
+    const CScript coinbase_script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = coinbase_script_pub_key;
+    spend.vout[1].nValue = 0;
+    spend.vout[1].scriptPubKey = CScript() << OP_RETURN;
+    std::vector<unsigned char> sig;
+    uint256 hash = SignatureHash(coinbase_script_pub_key, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, sig));
+    sig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << sig;
+
+    const CBlock spend_block = CreateAndProcessBlock({spend}, coinbase_script_pub_key);
+    BOOST_CHECK(coin_stats_index.BlockUntilSyncedToCurrentChain());
+    CheckIndexMatchesChainstate(coin_stats_index);
+
+    CoinStats spend_block_stats;
+    const CBlockIndex* spend_block_index;
+    {
+        LOCK(cs_main);
+        spend_block_index = chainActive.Tip();
+    }
+    BOOST_REQUIRE(coin_stats_index.LookUpStats(spend_block_index, spend_block_stats));
+
+    // Replace the block with one that does not spend anything: the index
+    // unwinds the spend and keeps the statistics of the stale block.
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    const CScript other_script_pub_key = GetScriptForDestination(coinbaseKey.GetPubKey().GetID());
+    CreateAndProcessBlock({}, other_script_pub_key);
+    CreateAndProcessBlock({}, other_script_pub_key);
+    BOOST_CHECK(coin_stats_index.BlockUntilSyncedToCurrentChain());
+    CheckIndexMatchesChainstate(coin_stats_index);
+
+    BOOST_REQUIRE(coin_stats_index.LookUpStats(spend_block_index, stats));
+    BOOST_CHECK(stats.muhash == spend_block_stats.muhash);
+
+    // shutdown sequence (c.f. Shutdown() in init.cpp)
+    coin_stats_index.Stop();
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    // Rest of shutdown sequence and destructors happen in ~TestingSetup()
+}
+
+BOOST_AUTO_TEST_SUITE_END()
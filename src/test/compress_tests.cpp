@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <compressor.h>
+#include <streams.h>
 #include <util/system.h>
 #include <test/test_bitcoin.h>
 
@@ -62,4 +63,47 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+//! Size of the script's compressed serialization, checking that it round-trips
+static size_t CompressedScriptSize(CScript script, bool extended)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << CScriptCompressor(script, extended);
+    const size_t size = ss.size();
+    CScript decompressed;
+    CScriptCompressor decompressor(decompressed, extended);
+    ss >> decompressor;
+    BOOST_CHECK(decompressed == script);
+    BOOST_CHECK(ss.empty());
+    return size;
+}
+
+BOOST_AUTO_TEST_CASE(compress_scripts_extended)
+{
+    const std::vector<unsigned char> hash20(20, 0x42), hash32(32, 0x43);
+    const CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << hash20 << OP_EQUALVERIFY << OP_CHECKSIG;
+    const CScript p2wpkh = CScript() << OP_0 << hash20;
+    const CScript p2wsh = CScript() << OP_0 << hash32;
+    const CScript v1 = CScript() << OP_1 << hash32;
+
+    // Both encodings share the original special cases.
+    BOOST_CHECK_EQUAL(CompressedScriptSize(p2pkh, false), 21U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(p2pkh, true), 21U);
+
+    // Witness programs only have special cases in the extended encoding.
+    BOOST_CHECK_EQUAL(CompressedScriptSize(p2wpkh, false), 23U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(p2wpkh, true), 21U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(p2wsh, false), 35U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(p2wsh, true), 33U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(v1, false), 35U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(v1, true), 33U);
+
+    // Other witness programs and scripts are stored with their size.
+    BOOST_CHECK_EQUAL(CompressedScriptSize(CScript() << OP_1 << hash20, true), 23U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(CScript() << OP_2 << hash32, true), 35U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(CScript() << OP_TRUE, true), 2U);
+    const std::vector<unsigned char> nops(119, OP_NOP);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(CScript(nops.begin(), nops.end() - 1), true), 119U);
+    BOOST_CHECK_EQUAL(CompressedScriptSize(CScript(nops.begin(), nops.end()), true), 121U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
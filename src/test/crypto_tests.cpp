@@ -10,7 +10,9 @@
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
 #include <random.h>
+#include <streams.h>
 #include <util/strencodings.h>
 #include <test/test_bitcoin.h>
 
@@ -562,4 +564,99 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+static MuHash3072 FromInt(unsigned char i)
+{
+    unsigned char tmp[32] = {i, 0};
+    return MuHash3072(tmp, 32);
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // The empty set hashes to the SHA256 of the 384-byte little endian encoding of 1.
+    uint256 out;
+    MuHash3072().Finalize(out);
+    BOOST_CHECK_EQUAL(out.GetHex(), "dd5ad2a105c2d29495f577245c357409002329b9f4d6182c0af3dc2f462555c8");
+
+    // Known answers for non-empty sets, including one with a removed element.
+    MuHash3072 kat = FromInt(0);
+    kat *= FromInt(1);
+    kat *= FromInt(2);
+    kat.Finalize(out);
+    BOOST_CHECK_EQUAL(out.GetHex(), "70d4451572d6a57f5befe9613ee8e1fae10c7c3dea81fd7b0b270436a6ed5e6b");
+    kat = FromInt(0);
+    kat *= FromInt(1);
+    kat /= FromInt(2);
+    kat.Finalize(out);
+    BOOST_CHECK_EQUAL(out.GetHex(), "10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863");
+
+    // The hash of a set does not depend on the order in which elements are
+    // added and removed, or on how it was combined from other sets.
+    for (int iter = 0; iter < 10; ++iter) {
+        uint256 res;
+        int table[4];
+        for (int i = 0; i < 4; ++i) {
+            table[i] = InsecureRandBits(3);
+        }
+        for (int order = 0; order < 4; ++order) {
+            MuHash3072 acc;
+            for (int i = 0; i < 4; ++i) {
+                int t = table[i ^ order];
+                if (t & 4) {
+                    acc /= FromInt(t & 3);
+                } else {
+                    acc *= FromInt(t & 3);
+                }
+            }
+            uint256 x;
+            acc.Finalize(x);
+            if (order == 0) {
+                res = x;
+            } else {
+                BOOST_CHECK(res == x);
+            }
+        }
+
+        MuHash3072 z = FromInt(InsecureRandBits(3) & 3); // Set z = {x}
+        MuHash3072 y = z;
+        z *= FromInt(1); // Set z = {x, 1}
+        z /= FromInt(1); // Set z = {x}
+        uint256 out2;
+        z.Finalize(out);
+        y.Finalize(out2);
+        BOOST_CHECK(out == out2);
+    }
+
+    unsigned char data[32] = {1};
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(2);
+    MuHash3072 acc2 = FromInt(0);
+    acc2.Insert(data, 32);
+    data[0] = 2;
+    acc2.Insert(data, 32);
+    acc2.Remove(data, 32);
+    data[0] = 1;
+    acc2.Remove(data, 32);
+    acc2.Insert(data, 32);
+    data[0] = 2;
+    acc2.Insert(data, 32);
+    data[0] = 1;
+    acc2.Remove(data, 32);
+    uint256 out2;
+    acc.Finalize(out);
+    acc2.Finalize(out2);
+    BOOST_CHECK(out == out2);
+
+    // The state survives serialization, including an unfinalized fraction.
+    MuHash3072 serchk = FromInt(1);
+    serchk /= FromInt(2);
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << serchk;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 deserchk;
+    ss >> deserchk;
+    serchk.Finalize(out);
+    deserchk.Finalize(out2);
+    BOOST_CHECK(out == out2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,11 +2,18 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <appendlogdb.h>
 #include <dbwrapper.h>
 #include <uint256.h>
 #include <random.h>
 #include <test/test_bitcoin.h>
 
+#include <leveldb/db.h>
+#include <leveldb/iterator.h>
+
+#include <fstream>
+#include <iterator>
+#include <map>
 #include <memory>
 
 #include <boost/test/unit_test.hpp>
@@ -319,4 +326,276 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options_and_stats)
+{
+    DBOptions options;
+    std::string error;
+    for (const char* arg : {"dboptions", "dboptions:bloombits", "dboptions:bloombits=x", "dboptions:blockcache=101", "dboptions:compression=zlib", "dboptions:unknown=1", "dboptions:writebuffer=30"}) {
+        gArgs.ForceSetArg("-dboption", arg);
+        BOOST_CHECK(!GetDBOptions("dboptions", options, error));
+    }
+
+    // The block cache and two write buffers must fit in the cache size.
+    gArgs.ForceSetArg("-dboption", "dboptions:blockcache=60");
+    BOOST_CHECK(!CheckDBOptions({"dboptions"}, error));
+    gArgs.ForceSetArg("-dboption", "dboptions:blockcache=40");
+    BOOST_CHECK(CheckDBOptions({"dboptions"}, error));
+
+    // At startup, settings for unknown databases are rejected.
+    gArgs.ForceSetArg("-dboption", "other:bloombits=0");
+    BOOST_CHECK(!CheckDBOptions({"dboptions"}, error));
+    BOOST_CHECK(CheckDBOptions({"dboptions", "other"}, error));
+
+    // Settings only apply to the database they name.
+    gArgs.ForceSetArg("-dboption", "dboptions:bloombits=0");
+    options = DBOptions();
+    BOOST_CHECK(GetDBOptions("other", options, error));
+    BOOST_CHECK_EQUAL(options.bloom_bits, 10);
+    BOOST_CHECK(GetDBOptions("dboptions", options, error));
+    BOOST_CHECK_EQUAL(options.bloom_bits, 0);
+
+    fs::path ph = SetDataDir("dboptions");
+    std::unique_ptr<CDBWrapper> dbw = MakeUnique<CDBWrapper>(ph, (1 << 20), false, false, false);
+    for (int i = 0; i < 100; ++i) {
+        BOOST_CHECK(dbw->Write(i, InsecureRand256()));
+    }
+    // Reopening writes the log to a table, which reads then go through the block cache for.
+    dbw.reset();
+    dbw = MakeUnique<CDBWrapper>(ph, (1 << 20), false, false, false);
+    uint256 res;
+    for (int i = 0; i < 100; ++i) {
+        BOOST_CHECK(dbw->Read(i, res));
+    }
+
+    bool found = false;
+    for (const DBStats& stats : GetDBStats()) {
+        if (stats.name != "dboptions") continue;
+        found = true;
+        BOOST_CHECK_EQUAL(stats.options.bloom_bits, 0);
+        BOOST_CHECK_EQUAL(stats.cache_size, 1U << 20);
+        BOOST_CHECK_GT(stats.cache_hits + stats.cache_misses, 0U);
+        BOOST_CHECK(!stats.levels.empty());
+    }
+    BOOST_CHECK(found);
+
+    dbw.reset();
+    for (const DBStats& stats : GetDBStats()) {
+        BOOST_CHECK(stats.name != "dboptions");
+    }
+    gArgs.ForceSetArg("-dboption", "");
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_appendlog)
+{
+    gArgs.ForceSetArg("-dboption", "appendlog:backend=appendlog");
+    fs::path ph = SetDataDir("appendlog");
+    std::unique_ptr<CDBWrapper> dbw = MakeUnique<CDBWrapper>(ph, (1 << 20), false, true, false);
+    BOOST_CHECK(fs::exists(ph / CAppendLogDB::FILENAME));
+
+    std::map<int, uint256> expected;
+    for (int i = 0; i < 100; ++i) {
+        expected[i] = InsecureRand256();
+        BOOST_CHECK(dbw->Write(i, expected[i]));
+    }
+    CDBBatch batch(*dbw);
+    for (int i = 0; i < 100; i += 2) {
+        batch.Erase(i);
+        expected.erase(i);
+    }
+    const uint256 old_seven = expected[7];
+    expected[7] = InsecureRand256();
+    batch.Write(7, expected[7]);
+
+    // A snapshot keeps the state from before the batch.
+    std::unique_ptr<CDBSnapshot> snapshot = MakeUnique<CDBSnapshot>(*dbw);
+    BOOST_CHECK(dbw->WriteBatch(batch, true));
+    uint256 res;
+    BOOST_CHECK(dbw->Read(0, res, snapshot.get()));
+    BOOST_CHECK(!dbw->Read(0, res));
+    snapshot.reset();
+    BOOST_CHECK(dbw->Read(7, res));
+    BOOST_CHECK(res == expected[7] && res != old_seven);
+
+    // Keys are iterated in order, both ways.
+    std::unique_ptr<CDBIterator> it(dbw->NewIterator());
+    it->Seek(50);
+    int key;
+    BOOST_REQUIRE(it->Valid() && it->GetKey(key));
+    BOOST_CHECK_EQUAL(key, 51);
+    it.reset();
+
+    // The log is replayed when the database is reopened, also after it was rewritten.
+    for (int round = 0; round < 2; ++round) {
+        dbw.reset();
+        dbw = MakeUnique<CDBWrapper>(ph, (1 << 20), false, false, false);
+        size_t count = 0;
+        it.reset(dbw->NewIterator());
+        for (it->Seek(1); it->Valid(); it->Next()) {
+            BOOST_REQUIRE(it->GetKey(key) && it->GetValue(res));
+            BOOST_CHECK(expected.count(key) && expected[key] == res);
+            ++count;
+        }
+        it.reset();
+        BOOST_CHECK_EQUAL(count, expected.size());
+        dbw->CompactRange(0, 100);
+    }
+    dbw.reset();
+
+    // A database of one backend is not opened with the other.
+    gArgs.ForceSetArg("-dboption", "");
+    BOOST_CHECK_THROW(CDBWrapper(ph, (1 << 20), false, false, false), dbwrapper_error);
+
+    // The chainstate is too large for its keys to be held in memory.
+    gArgs.ForceSetArg("-dboption", "chainstate:backend=appendlog");
+    DBOptions options;
+    std::string error;
+    BOOST_CHECK(!GetDBOptions("chainstate", options, error));
+    gArgs.ForceSetArg("-dboption", "");
+}
+
+static std::unique_ptr<leveldb::DB> OpenAppendLog(const fs::path& path, leveldb::Status& status)
+{
+    leveldb::DB* db;
+    status = CAppendLogDB::Open(path, &db);
+    return std::unique_ptr<leveldb::DB>(status.ok() ? db : nullptr);
+}
+
+static std::string ReadValue(leveldb::DB& db, const std::string& key, const leveldb::Snapshot* snapshot = nullptr)
+{
+    leveldb::ReadOptions options;
+    options.snapshot = snapshot;
+    std::string value;
+    return db.Get(options, key, &value).ok() ? value : "";
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_appendlog_snapshots)
+{
+    leveldb::Status status;
+    std::unique_ptr<leveldb::DB> db = OpenAppendLog(SetDataDir("appendlog_snapshots"), status);
+    BOOST_REQUIRE(status.ok());
+    const leveldb::WriteOptions write_options;
+    const leveldb::ReadOptions read_options;
+    for (const char* key : {"a", "b", "c", "d", "e"}) {
+        BOOST_CHECK(db->Put(write_options, key, "1").ok());
+    }
+
+    const leveldb::Snapshot* snapshot = db->GetSnapshot();
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(read_options));
+    it->Seek("c");
+    BOOST_REQUIRE(it->Valid());
+    BOOST_CHECK_EQUAL(it->key().ToString(), "c");
+
+    // Writes while they are open, including to the key the iterator is at.
+    BOOST_CHECK(db->Delete(write_options, "c").ok());
+    BOOST_CHECK(db->Delete(write_options, "e").ok());
+    BOOST_CHECK(db->Put(write_options, "b", "2").ok());
+    BOOST_CHECK(db->Put(write_options, "b", "3").ok());
+    BOOST_CHECK(db->Put(write_options, "f", "2").ok());
+    BOOST_CHECK_EQUAL(ReadValue(*db, "b"), "3");
+    BOOST_CHECK_EQUAL(ReadValue(*db, "c"), "");
+
+    // The iterator sees the keys as they were when it was created, both ways.
+    std::string keys;
+    for (it->SeekToLast(); it->Valid(); it->Prev()) {
+        keys += it->key().ToString();
+        BOOST_CHECK_EQUAL(it->value().ToString(), "1");
+    }
+    BOOST_CHECK_EQUAL(keys, "edcba");
+    it->Seek("c");
+    it->Prev();
+    BOOST_REQUIRE(it->Valid());
+    BOOST_CHECK_EQUAL(it->key().ToString(), "b");
+    it->Next();
+    it->Next();
+    BOOST_REQUIRE(it->Valid());
+    BOOST_CHECK_EQUAL(it->key().ToString(), "d");
+    BOOST_CHECK(it->status().ok());
+    it.reset();
+
+    // So does the snapshot, also after the iterator is gone.
+    BOOST_CHECK_EQUAL(ReadValue(*db, "b", snapshot), "1");
+    BOOST_CHECK_EQUAL(ReadValue(*db, "c", snapshot), "1");
+    BOOST_CHECK_EQUAL(ReadValue(*db, "f", snapshot), "");
+    leveldb::ReadOptions snapshot_options;
+    snapshot_options.snapshot = snapshot;
+    keys.clear();
+    it.reset(db->NewIterator(snapshot_options));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        keys += it->key().ToString();
+    }
+    BOOST_CHECK_EQUAL(keys, "abcde");
+    db->ReleaseSnapshot(snapshot);
+    BOOST_CHECK_EQUAL(ReadValue(*db, "c", nullptr), "");
+    it.reset();
+
+    // Once all are released, only the latest state is left.
+    keys.clear();
+    it.reset(db->NewIterator(read_options));
+    for (it->SeekToLast(); it->Valid(); it->Prev()) {
+        keys += it->key().ToString() + it->value().ToString();
+    }
+    BOOST_CHECK_EQUAL(keys, "f2d1b3a1");
+    it.reset();
+    db.reset();
+}
+
+static std::string ReadLog(const fs::path& path)
+{
+    std::ifstream file(path.string(), std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static void WriteLog(const fs::path& path, const std::string& data)
+{
+    std::ofstream file(path.string(), std::ios::binary | std::ios::trunc);
+    file << data;
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_appendlog_replay)
+{
+    const fs::path ph = SetDataDir("appendlog_replay");
+    const fs::path log_path = ph / CAppendLogDB::FILENAME;
+    leveldb::Status status;
+    std::unique_ptr<leveldb::DB> db = OpenAppendLog(ph, status);
+    BOOST_REQUIRE(status.ok());
+    for (const char* key : {"a", "b", "c"}) {
+        BOOST_CHECK(db->Put(leveldb::WriteOptions(), key, key).ok());
+    }
+    db.reset();
+    const std::string log = ReadLog(log_path);
+
+    // A record torn off at the end of the log is dropped: a partial header,
+    // or a header of a record that does not fit in the log.
+    for (const std::string& tail : {std::string("\x10\x00", 2), std::string("\x10\x00\x00\x00\x00\x00\x00\x00\x01", 9)}) {
+        WriteLog(log_path, log + tail);
+        db = OpenAppendLog(ph, status);
+        BOOST_REQUIRE(status.ok());
+        BOOST_CHECK_EQUAL(ReadValue(*db, "c"), "c");
+        db.reset();
+        BOOST_CHECK_EQUAL(ReadLog(log_path), log);
+    }
+
+    // A bad record that the log holds entirely is corruption, and nothing is dropped.
+    std::string corrupt = log;
+    corrupt[corrupt.size() - 1] ^= 1;
+    WriteLog(log_path, corrupt);
+    db = OpenAppendLog(ph, status);
+    BOOST_CHECK(status.IsCorruption());
+    BOOST_CHECK_EQUAL(ReadLog(log_path), corrupt);
+
+    // So is an oversized record, whatever follows it.
+    corrupt = log;
+    corrupt[3] = '\x7f';
+    WriteLog(log_path, corrupt);
+    db = OpenAppendLog(ph, status);
+    BOOST_CHECK(status.IsCorruption());
+    BOOST_CHECK_EQUAL(ReadLog(log_path), corrupt);
+
+    WriteLog(log_path, log);
+    db = OpenAppendLog(ph, status);
+    BOOST_REQUIRE(status.ok());
+    BOOST_CHECK_EQUAL(ReadValue(*db, "a"), "a");
+    db.reset();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
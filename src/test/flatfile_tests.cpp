@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <flatfile.h>
+#include <flatfilemap.h>
 #include <test/test_bitcoin.h>
 
 #include <boost/test/unit_test.hpp>
@@ -120,4 +121,73 @@ BOOST_AUTO_TEST_CASE(flatfile_flush)
     BOOST_CHECK_EQUAL(fs::file_size(seq.FileName(FlatFilePos(0, 1))), 1);
 }
 
+static void AppendToFile(FlatFileSeq& seq, const FlatFilePos& pos, const std::string& data)
+{
+    FILE* file = seq.Open(pos);
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+}
+
+static std::string ToString(const FlatFileSpan& span)
+{
+    return std::string(span.begin(), span.end());
+}
+
+BOOST_AUTO_TEST_CASE(flatfile_map)
+{
+    auto data_dir = SetDataDir("flatfile_test");
+    FlatFileSeq seq(data_dir, "a", 100);
+    const fs::path path0 = seq.FileName(FlatFilePos(0, 0));
+
+    FlatFileMapCache cache(2);
+    FlatFileSpan span;
+
+    // Missing files cannot be mapped.
+    BOOST_CHECK(!cache.Read(path0, 0, 1, span));
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+
+    AppendToFile(seq, FlatFilePos(0, 0), "hello");
+    if (!FlatFileMapping::Map(path0)) {
+        // Mapping is not supported on this platform, readers always fall back to file reads.
+        BOOST_CHECK(!cache.Read(path0, 0, 5, span));
+        return;
+    }
+    BOOST_CHECK(cache.Read(path0, 1, 3, span));
+    BOOST_CHECK_EQUAL(ToString(span), "ell");
+    BOOST_CHECK(!cache.Read(path0, 3, 5, span));
+    BOOST_CHECK_EQUAL(ToString(span), "ell");
+
+    // Reading past the end of the mapping remaps the grown file. Spans handed
+    // out before stay valid.
+    FlatFileSpan first = span;
+    AppendToFile(seq, FlatFilePos(0, 5), " world");
+    BOOST_CHECK(cache.Read(path0, 5, 6, span));
+    BOOST_CHECK_EQUAL(ToString(span), " world");
+    BOOST_CHECK_EQUAL(ToString(first), "ell");
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+
+    // Least recently used files are unmapped first.
+    AppendToFile(seq, FlatFilePos(1, 0), "one");
+    AppendToFile(seq, FlatFilePos(2, 0), "two");
+    BOOST_CHECK(cache.Read(seq.FileName(FlatFilePos(1, 0)), 0, 3, span));
+    BOOST_CHECK(cache.Read(path0, 0, 5, span));
+    BOOST_CHECK(cache.Read(seq.FileName(FlatFilePos(2, 0)), 0, 3, span));
+    BOOST_CHECK_EQUAL(ToString(span), "two");
+    BOOST_CHECK_EQUAL(cache.Size(), 2U);
+
+    cache.Erase(path0);
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+    cache.Erase(path0);
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+
+    // Buffers read by other means can be handed out the same way.
+    span = FlatFileSpan(std::vector<unsigned char>{'a', 'b'});
+    BOOST_CHECK_EQUAL(ToString(span), "ab");
+
+    // A cache without room for any file never maps.
+    FlatFileMapCache disabled(0);
+    BOOST_CHECK(!disabled.Read(path0, 0, 1, span));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
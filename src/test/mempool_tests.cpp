@@ -749,4 +749,111 @@ BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
     BOOST_CHECK_EQUAL(descendants, 6ULL);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolClusterTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // tx1 has two children, tx2 and tx3, both spent by tx4. tx5 is unrelated.
+    CTransactionRef tx1 = make_tx(/* output_values */ {10 * COIN, 10 * COIN});
+    CTransactionRef tx2 = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {tx1}, /* input_indices */ {0});
+    CTransactionRef tx3 = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {tx1}, /* input_indices */ {1});
+    CTransactionRef tx4 = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {tx2, tx3});
+    CTransactionRef tx5 = make_tx(/* output_values */ {10 * COIN});
+    pool.addUnchecked(entry.Fee(7000LL).FromTx(tx1));
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(tx2));
+    pool.addUnchecked(entry.Fee(1100LL).FromTx(tx3));
+    pool.addUnchecked(entry.Fee(9000LL).FromTx(tx4));
+    pool.addUnchecked(entry.Fee(5000LL).FromTx(tx5));
+
+    const uint64_t cluster_id = pool.mapTx.find(tx1->GetHash())->nClusterId;
+    for (const CTransactionRef& tx : {tx2, tx3, tx4}) {
+        BOOST_CHECK_EQUAL(pool.mapTx.find(tx->GetHash())->nClusterId, cluster_id);
+    }
+    BOOST_CHECK_EQUAL(pool.mapClusters.size(), 2U);
+
+    // tx4 pays for tx2 and tx3, which are chunked together after tx1.
+    const CTxMemPool::Cluster& cluster = pool.mapClusters.at(cluster_id);
+    BOOST_CHECK(cluster.txs.front()->GetTx().GetHash() == tx1->GetHash());
+    BOOST_CHECK(cluster.txs.back()->GetTx().GetHash() == tx4->GetHash());
+    BOOST_REQUIRE_EQUAL(cluster.chunks.size(), 2U);
+    BOOST_CHECK_EQUAL(cluster.chunks[0].end, 1U);
+    BOOST_CHECK_EQUAL(cluster.chunks[1].fee, 11100);
+    BOOST_CHECK_EQUAL(pool.setChunks.size(), 3U);
+    BOOST_CHECK_EQUAL(pool.setChunks.begin()->cluster, pool.mapTx.find(tx5->GetHash())->nClusterId);
+    BOOST_CHECK_EQUAL(pool.setChunks.rbegin()->cluster, cluster_id);
+
+    // A transaction spending tx4 and tx5 would connect both clusters.
+    CTransactionRef tx6 = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {tx4, tx5});
+    CTxMemPool::setEntries ancestors;
+    std::string dummy;
+    BOOST_REQUIRE(pool.CalculateMemPoolAncestors(entry.FromTx(tx6), ancestors, 100, 1000000, 1000, 1000000, dummy));
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize(ancestors), 6U);
+
+    // Without its fee, tx4 is no longer worth mining with its parents.
+    pool.PrioritiseTransaction(tx4->GetHash(), -9000);
+    BOOST_REQUIRE_EQUAL(cluster.chunks.size(), 4U);
+    BOOST_CHECK(cluster.txs[1]->GetTx().GetHash() == tx3->GetHash());
+    BOOST_CHECK(cluster.txs[2]->GetTx().GetHash() == tx2->GetHash());
+    BOOST_CHECK(cluster.txs[3]->GetTx().GetHash() == tx4->GetHash());
+
+    // Eviction starts at the end of the lowest feerate chunk.
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx4->GetHash()));
+    BOOST_CHECK(pool.exists(tx3->GetHash()));
+    BOOST_CHECK_EQUAL(pool.mapClusters.at(pool.mapTx.find(tx1->GetHash())->nClusterId).txs.size(), 3U);
+
+    // Removing tx1 splits its cluster.
+    pool.removeForBlock({tx1}, 1);
+    BOOST_CHECK_EQUAL(pool.mapClusters.size(), 3U);
+    BOOST_CHECK_EQUAL(pool.setChunks.size(), 3U);
+    BOOST_CHECK(pool.mapTx.find(tx2->GetHash())->nClusterId != pool.mapTx.find(tx3->GetHash())->nClusterId);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterUpdateTest)
+{
+    CTxMemPool pool;
+    LOCK2(cs_main, pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    // tx3 spends tx1 and tx2, which are not connected otherwise.
+    CTransactionRef tx1 = make_tx(/* output_values */ {10 * COIN});
+    CTransactionRef tx2 = make_tx(/* output_values */ {10 * COIN, 10 * COIN});
+    CTransactionRef tx3 = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {tx1, tx2});
+    CTransactionRef tx4 = make_tx(/* output_values */ {10 * COIN}, /* inputs */ {tx2}, /* input_indices */ {1});
+    pool.addUnchecked(entry.Fee(1000LL).FromTx(tx1));
+    pool.addUnchecked(entry.Fee(5000LL).FromTx(tx2));
+    BOOST_CHECK_EQUAL(pool.mapClusters.size(), 2U);
+
+    // Merging the clusters takes their chunks in order of feerate, and the
+    // new transaction goes after the chunks with a higher feerate.
+    pool.addUnchecked(entry.Fee(100LL).FromTx(tx3));
+    BOOST_REQUIRE_EQUAL(pool.mapClusters.size(), 1U);
+    const CTxMemPool::Cluster* cluster = &pool.mapClusters.begin()->second;
+    BOOST_REQUIRE_EQUAL(cluster->txs.size(), 3U);
+    BOOST_CHECK(cluster->txs[0]->GetTx().GetHash() == tx2->GetHash());
+    BOOST_CHECK(cluster->txs[1]->GetTx().GetHash() == tx1->GetHash());
+    BOOST_CHECK(cluster->txs[2]->GetTx().GetHash() == tx3->GetHash());
+    BOOST_CHECK_EQUAL(cluster->chunks.size(), 3U);
+
+    // A child paying more than its parent goes right after it, in its chunk.
+    pool.addUnchecked(entry.Fee(20000LL).FromTx(tx4));
+    BOOST_REQUIRE_EQUAL(cluster->txs.size(), 4U);
+    BOOST_CHECK(cluster->txs[1]->GetTx().GetHash() == tx4->GetHash());
+    BOOST_REQUIRE_EQUAL(cluster->chunks.size(), 3U);
+    BOOST_CHECK_EQUAL(cluster->chunks[0].fee, 25000);
+    BOOST_CHECK_EQUAL(cluster->chunks[0].end, 2U);
+    BOOST_CHECK_EQUAL(pool.setChunks.size(), 3U);
+
+    // The rest of the cluster keeps its order when tx2 and tx4 are mined.
+    pool.removeForBlock({tx2, tx4}, 1);
+    BOOST_REQUIRE_EQUAL(pool.mapClusters.size(), 1U);
+    cluster = &pool.mapClusters.begin()->second;
+    BOOST_REQUIRE_EQUAL(cluster->txs.size(), 2U);
+    BOOST_CHECK(cluster->txs[0]->GetTx().GetHash() == tx1->GetHash());
+    BOOST_CHECK(cluster->txs[1]->GetTx().GetHash() == tx3->GetHash());
+    BOOST_CHECK_EQUAL(pool.setChunks.size(), 2U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -231,6 +231,14 @@ BOOST_AUTO_TEST_CASE(merkle_test)
             BOOST_CHECK((newRoot == uint256()) == (ntx == 0));
             BOOST_CHECK(oldMutated == newMutated);
             BOOST_CHECK(newMutated == !!mutate);
+            // Compute both roots in one pass.
+            if (ntx > 0) {
+                bool batchMutated = false;
+                uint256 batchWitnessRoot;
+                BOOST_CHECK(BlockMerkleRoots(block, batchWitnessRoot, &batchMutated) == newRoot);
+                BOOST_CHECK(batchWitnessRoot == BlockWitnessMerkleRoot(block));
+                BOOST_CHECK(batchMutated == newMutated);
+            }
             // If no mutation was done (once for every ntx value), try up to 16 branches.
             if (mutate == 0) {
                 for (int loop = 0; loop < std::min(ntx, 16); loop++) {
@@ -249,4 +257,31 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_roots_batched_test)
+{
+    // Trees of various sizes, including empty and single-leaf ones, some of
+    // them with a duplicated last pair of leaves.
+    std::vector<std::vector<uint256>> trees;
+    for (int i = 0; i < 20; i++) {
+        const size_t size = (i < 10) ? i : InsecureRandRange(3000);
+        std::vector<uint256> leaves(size);
+        for (auto& leaf : leaves) {
+            leaf = InsecureRand256();
+        }
+        if (size >= 2 && size % 2 == 0 && InsecureRandBool()) {
+            leaves[size - 1] = leaves[size - 2];
+        }
+        trees.push_back(std::move(leaves));
+    }
+    std::vector<bool> mutated;
+    const std::vector<uint256> roots = ComputeMerkleRoots(trees, &mutated);
+    BOOST_REQUIRE_EQUAL(roots.size(), trees.size());
+    BOOST_REQUIRE_EQUAL(mutated.size(), trees.size());
+    for (size_t t = 0; t < trees.size(); t++) {
+        bool expected_mutated = false;
+        BOOST_CHECK(roots[t] == ComputeMerkleRoot(trees[t], &expected_mutated));
+        BOOST_CHECK(mutated[t] == expected_mutated);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
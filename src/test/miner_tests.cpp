@@ -21,6 +21,7 @@
 #include <test/test_bitcoin.h>
 
 #include <memory>
+#include <numeric>
 
 #include <boost/test/unit_test.hpp>
 
@@ -521,4 +522,126 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+static CTransactionRef SpendToKey(const CKey& key, const CTransactionRef& prev, uint32_t n, CAmount fee, int outputs = 1)
+{
+    const CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(prev->GetHash(), n);
+    for (int i = 0; i < outputs; ++i) {
+        tx.vout.emplace_back((prev->vout[n].nValue - fee) / outputs, scriptPubKey);
+    }
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(prev->vout[n].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return MakeTransactionRef(tx);
+}
+
+static bool ToMemPool(const CTransactionRef& tx)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    return AcceptToMemoryPool(mempool, state, tx, nullptr /* pfMissingInputs */,
+                              nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
+}
+
+static std::vector<uint256> TemplateTxids(const CBlockTemplate& tmpl)
+{
+    std::vector<uint256> txids;
+    for (size_t i = 1; i < tmpl.block.vtx.size(); ++i) {
+        txids.push_back(tmpl.block.vtx[i]->GetHash());
+    }
+    return txids;
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateEngine_incremental, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    BlockTemplateEngine engine(chainparams);
+
+    // Confirm a transaction with several outputs to spend from
+    CTransactionRef funding = SpendToKey(coinbaseKey, m_coinbase_txns[0], 0, 10000, 4);
+    CreateAndProcessBlock({CMutableTransaction(*funding)}, scriptPubKey);
+    BOOST_CHECK_EQUAL(TemplateTxids(*engine.CreateNewBlock(scriptPubKey)).size(), 0U);
+
+    CTransactionRef tx_a = SpendToKey(coinbaseKey, funding, 0, 10000);
+    CTransactionRef tx_b = SpendToKey(coinbaseKey, funding, 1, 20000);
+    CTransactionRef tx_c = SpendToKey(coinbaseKey, funding, 2, 30000);
+    BOOST_CHECK(ToMemPool(tx_a));
+    std::unique_ptr<CBlockTemplate> tmpl = engine.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(TemplateTxids(*tmpl) == std::vector<uint256>({tx_a->GetHash()}));
+
+    // New transactions are selected after the ones already in the template,
+    // in order of their feerate
+    BOOST_CHECK(ToMemPool(tx_b));
+    BOOST_CHECK(ToMemPool(tx_c));
+    tmpl = engine.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(TemplateTxids(*tmpl) == std::vector<uint256>({tx_a->GetHash(), tx_c->GetHash(), tx_b->GetHash()}));
+
+    // A child follows its parent
+    CTransactionRef tx_d = SpendToKey(coinbaseKey, tx_a, 0, 80000);
+    BOOST_CHECK(ToMemPool(tx_d));
+    tmpl = engine.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(TemplateTxids(*tmpl) == std::vector<uint256>({tx_a->GetHash(), tx_c->GetHash(), tx_b->GetHash(), tx_d->GetHash()}));
+    BOOST_CHECK_EQUAL(tmpl->vTxFees[4], 80000);
+
+    // Removing transactions of the template, and changing fee deltas, make it
+    // select from scratch
+    mempool.removeRecursive(*tx_b, MemPoolRemovalReason::CONFLICT);
+    tmpl = engine.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(TemplateTxids(*tmpl) == TemplateTxids(*BlockAssembler(chainparams).CreateNewBlock(scriptPubKey)));
+    BOOST_CHECK(TemplateTxids(*tmpl) == std::vector<uint256>({tx_a->GetHash(), tx_d->GetHash(), tx_c->GetHash()}));
+    mempool.PrioritiseTransaction(tx_c->GetHash(), 100000);
+    engine.Invalidate();
+    tmpl = engine.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(TemplateTxids(*tmpl) == std::vector<uint256>({tx_c->GetHash(), tx_a->GetHash(), tx_d->GetHash()}));
+
+    // So does a new tip
+    std::vector<CMutableTransaction> txns;
+    for (const CTransactionRef& tx : std::vector<CTransactionRef>(tmpl->block.vtx.begin() + 1, tmpl->block.vtx.end())) {
+        txns.emplace_back(*tx);
+    }
+    CreateAndProcessBlock(txns, scriptPubKey);
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+    BOOST_CHECK_EQUAL(TemplateTxids(*engine.CreateNewBlock(scriptPubKey)).size(), 0U);
+}
+
+BOOST_FIXTURE_TEST_CASE(TestBlockTemplateValidity_rules, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CTransactionRef tx = SpendToKey(coinbaseKey, m_coinbase_txns[0], 0, 10000);
+    BOOST_CHECK(ToMemPool(tx));
+
+    BlockAssembler::Options options;
+    options.fTestBlockValidity = false;
+    std::unique_ptr<CBlockTemplate> tmpl = BlockAssembler(chainparams, options).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(TemplateTxids(*tmpl) == std::vector<uint256>({tx->GetHash()}));
+
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    const int64_t sigops = std::accumulate(tmpl->vTxSigOpsCost.begin(), tmpl->vTxSigOpsCost.end(), int64_t{0});
+    CValidationState state;
+    BOOST_CHECK(TestBlockTemplateValidity(state, chainparams, tmpl->block, pindexPrev, 10000, sigops));
+
+    // The coinbase may only claim the fees given for the transactions
+    BOOST_CHECK(!TestBlockTemplateValidity(state, chainparams, tmpl->block, pindexPrev, 9999, 0));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-cb-amount");
+
+    state = CValidationState();
+    BOOST_CHECK(!TestBlockTemplateValidity(state, chainparams, tmpl->block, pindexPrev, 10000, MAX_BLOCK_SIGOPS_COST + 1));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-blk-sigops");
+
+    // A template without a coinbase
+    CBlock block = tmpl->block;
+    block.vtx.erase(block.vtx.begin());
+    state = CValidationState();
+    BOOST_CHECK(!TestBlockTemplateValidity(state, chainparams, block, pindexPrev, 10000, 0));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-cb-missing");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
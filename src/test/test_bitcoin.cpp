@@ -18,6 +18,7 @@
 #include <rpc/server.h>
 #include <script/sigcache.h>
 #include <streams.h>
+#include <txdb.h>
 #include <ui_interface.h>
 #include <validation.h>
 
@@ -80,7 +81,10 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         mempool.setSanityCheck(1.0);
         pblocktree.reset(new CBlockTreeDB(1 << 20, true));
         pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
-        pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+        // Write the chainstate in the background, as the node does.
+        pcoinsdbwriter.reset(new CCoinsViewBackgroundWriter(pcoinsdbview.get(), (1 << 23) / 100 * COINS_WRITE_PIECE_PERCENT));
+        pcoinsdbwriter->Start();
+        pcoinsTip.reset(new CCoinsViewCache(pcoinsdbwriter.get()));
         if (!LoadGenesisBlock(chainparams)) {
             throw std::runtime_error("LoadGenesisBlock failed.");
         }
@@ -90,9 +94,9 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
                 throw std::runtime_error(strprintf("ActivateBestChain failed. (%s)", FormatStateMessage(state)));
             }
         }
-        nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
-            threadGroup.create_thread(&ThreadScriptCheck);
+        SetScriptCheckThreads(3);
+        StartBlockPipeline(DEFAULT_BLOCK_PIPELINE_DEPTH);
+        StartUndoWriter();
 
         g_banman = MakeUnique<BanMan>(GetDataDir() / "banlist.dat", nullptr, DEFAULT_MISBEHAVING_BANTIME);
         g_connman = MakeUnique<CConnman>(0x1337, 0x1337); // Deterministic randomness for tests.
@@ -102,12 +106,16 @@ TestingSetup::~TestingSetup()
 {
     threadGroup.interrupt_all();
     threadGroup.join_all();
+    StopScriptCheckThreads();
+    StopBlockPipeline();
+    StopUndoWriter();
     GetMainSignals().FlushBackgroundCallbacks();
     GetMainSignals().UnregisterBackgroundSignalScheduler();
     g_connman.reset();
     g_banman.reset();
     UnloadBlockIndex();
     pcoinsTip.reset();
+    pcoinsdbwriter.reset();
     pcoinsdbview.reset();
     pblocktree.reset();
 }
@@ -133,6 +141,14 @@ CBlock
 TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey)
 {
     const CChainParams& chainparams = Params();
+    // The regtest genesis block's difficulty is above the proof of work limit,
+    // which a block only drops to when it is mined more than twice the target
+    // spacing after its parent. Mock the time accordingly, so that mining
+    // stays cheap and the tip stays recent.
+    {
+        LOCK(cs_main);
+        SetMockTime(std::max(GetTime(), chainActive.Tip()->GetBlockTime() + 2 * chainparams.GetConsensus().nPowTargetSpacing + 1));
+    }
     std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
     CBlock& block = pblocktemplate->block;
 
@@ -158,6 +174,7 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
 
 TestChain100Setup::~TestChain100Setup()
 {
+    SetMockTime(0);
 }
 
 
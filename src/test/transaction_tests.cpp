@@ -768,4 +768,41 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(CTransaction(t), reason));
 }
 
+BOOST_AUTO_TEST_CASE(cached_sizes_and_sigops)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CMutableTransaction t;
+    t.vin.resize(2);
+    t.vin[0].scriptSig = CScript() << OP_CHECKSIG << OP_CHECKMULTISIG;
+    t.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 0x30));
+    t.vin[1].scriptWitness.stack.push_back(ToByteVector(key.GetPubKey()));
+    t.vout.resize(2);
+    t.vout[0].nValue = 90 * CENT;
+    t.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    t.vout[1].nValue = 10 * CENT;
+    t.vout[1].scriptPubKey = GetScriptForMultisig(1, {key.GetPubKey(), key.GetPubKey()});
+
+    for (const CTransaction& tx : {CTransaction(t), CTransaction(CMutableTransaction(t)), CTransaction()}) {
+        const unsigned int total_size = ::GetSerializeSize(tx, PROTOCOL_VERSION);
+        const unsigned int stripped_size = ::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+        BOOST_CHECK_EQUAL(tx.GetTotalSize(), total_size);
+        BOOST_CHECK_EQUAL(tx.GetStrippedSize(), stripped_size);
+        BOOST_CHECK_EQUAL(GetTransactionWeight(tx), stripped_size * (WITNESS_SCALE_FACTOR - 1) + total_size);
+    }
+
+    const CTransaction tx(t);
+    BOOST_CHECK(tx.GetTotalSize() > tx.GetStrippedSize());
+    // 1 (OP_CHECKSIG) + 20 (OP_CHECKMULTISIG) + 1 (P2PKH) + 20 (bare multisig, legacy counting)
+    BOOST_CHECK_EQUAL(GetLegacySigOpCount(tx), 42U);
+
+    // Block-wide sizes are summed from the cached transaction sizes.
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(t));
+    block.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+    BOOST_CHECK_EQUAL(GetBlockStrippedSize(block), (int64_t)::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
+    BOOST_CHECK_EQUAL(GetBlockTotalSize(block), (int64_t)::GetSerializeSize(block, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(GetBlockWeight(block), (int64_t)(::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * (WITNESS_SCALE_FACTOR - 1) + ::GetSerializeSize(block, PROTOCOL_VERSION)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
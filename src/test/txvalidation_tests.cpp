@@ -6,7 +6,9 @@
 #include <txmempool.h>
 #include <amount.h>
 #include <consensus/validation.h>
+#include <key.h>
 #include <primitives/transaction.h>
+#include <script/interpreter.h>
 #include <script/script.h>
 #include <test/test_bitcoin.h>
 
@@ -58,4 +60,82 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK_EQUAL(nDoS, 100);
 }
 
+static void SignInput(CMutableTransaction& tx, unsigned int n, const CScript& prev_script_pub_key, const CKey& key)
+{
+    std::vector<unsigned char> vchSig;
+    const uint256 hash = SignatureHash(prev_script_pub_key, tx, n, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[n].scriptSig = CScript() << vchSig;
+}
+
+/**
+ * Ensure that a batch of transactions is accepted in dependency order, and
+ * that the invalid transactions of the batch are told apart.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_batch, TestChain100Setup)
+{
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CKey other_key;
+    other_key.MakeNewKey(true);
+
+    CMutableTransaction parent;
+    parent.nVersion = 1;
+    parent.vin.resize(1);
+    parent.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    parent.vout.resize(2);
+    parent.vout[0].nValue = m_coinbase_txns[0]->vout[0].nValue / 2;
+    parent.vout[0].scriptPubKey = scriptPubKey;
+    parent.vout[1].nValue = m_coinbase_txns[0]->vout[0].nValue / 2 - 10000;
+    parent.vout[1].scriptPubKey = scriptPubKey;
+    SignInput(parent, 0, m_coinbase_txns[0]->vout[0].scriptPubKey, coinbaseKey);
+
+    // Spends the first output of parent
+    CMutableTransaction child;
+    child.nVersion = 1;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+    child.vout.resize(1);
+    child.vout[0].nValue = parent.vout[0].nValue - 10000;
+    child.vout[0].scriptPubKey = scriptPubKey;
+    SignInput(child, 0, scriptPubKey, coinbaseKey);
+
+    // Spends the second output of parent with a signature of the wrong key
+    CMutableTransaction bad_child = child;
+    bad_child.vin[0].prevout.n = 1;
+    bad_child.vout[0].nValue = parent.vout[1].nValue - 10000;
+    SignInput(bad_child, 0, scriptPubKey, other_key);
+
+    // Spends an unknown transaction
+    CMutableTransaction orphan = child;
+    orphan.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+
+    LOCK(cs_main);
+    unsigned int initialPoolSize = mempool.size();
+
+    const std::vector<CTransactionRef> txs{MakeTransactionRef(child), MakeTransactionRef(bad_child), MakeTransactionRef(parent), MakeTransactionRef(orphan)};
+    std::vector<bool> accepted;
+    std::vector<CValidationState> states;
+    std::vector<bool> missing_inputs;
+    AcceptToMemoryPoolBatch(mempool, txs, accepted, states, missing_inputs, false /* bypass_limits */, 0 /* nAbsurdFee */);
+
+    BOOST_CHECK(accepted == std::vector<bool>({true, false, true, false}));
+    BOOST_CHECK(states[1].IsInvalid());
+    BOOST_CHECK(!missing_inputs[1]);
+    BOOST_CHECK(!states[3].IsInvalid());
+    BOOST_CHECK(missing_inputs[3]);
+    BOOST_CHECK_EQUAL(mempool.size(), initialPoolSize + 2);
+    BOOST_CHECK(mempool.exists(parent.GetHash()));
+    BOOST_CHECK(mempool.exists(child.GetHash()));
+
+    // A batch in which all scripts are valid
+    CMutableTransaction grandchild = child;
+    grandchild.vin[0].prevout = COutPoint(child.GetHash(), 0);
+    grandchild.vout[0].nValue = child.vout[0].nValue - 10000;
+    SignInput(grandchild, 0, scriptPubKey, coinbaseKey);
+    AcceptToMemoryPoolBatch(mempool, {MakeTransactionRef(grandchild)}, accepted, states, missing_inputs, false /* bypass_limits */, 0 /* nAbsurdFee */);
+    BOOST_CHECK(accepted == std::vector<bool>({true}));
+    BOOST_CHECK(mempool.exists(grandchild.GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <chainparams.h>
 #include <consensus/validation.h>
 #include <key.h>
 #include <validation.h>
@@ -20,6 +21,7 @@
 #include <boost/test/unit_test.hpp>
 
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks);
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& chainparams);
 
 BOOST_AUTO_TEST_SUITE(tx_validationcache_tests)
 
@@ -91,6 +93,79 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0U);
 }
 
+BOOST_FIXTURE_TEST_CASE(reorg_reuses_script_results, TestChain100Setup)
+{
+    // Outside of initial block download, connecting a block keeps the script
+    // execution results of its transactions cached, so that they are not
+    // verified again when a reorg returns them to the mempool or connects
+    // them again.
+    {
+        LOCK(cs_main);
+        InitScriptExecutionCache();
+        BOOST_CHECK(!IsInitialBlockDownload());
+    }
+
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = m_coinbase_txns[0]->GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    const CTransaction tx(spend);
+    const Coin coin(m_coinbase_txns[0]->vout[0], 1, true);
+
+    // Whether tx's scripts are cached as valid under flags, i.e. whether
+    // CheckInputs, as called by ConnectBlock, would skip running them. The
+    // spent coin is restored in a view on top of the tip while tx is mined.
+    auto cached = [&](unsigned int flags) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+        CCoinsViewCache view(pcoinsTip.get());
+        if (!view.HaveCoin(spend.vin[0].prevout)) {
+            view.AddCoin(spend.vin[0].prevout, Coin(coin), true);
+        }
+        CValidationState state;
+        PrecomputedTransactionData txdata(tx);
+        std::vector<CScriptCheck> scriptchecks;
+        BOOST_CHECK(CheckInputs(tx, state, view, true, flags, true, true, txdata, &scriptchecks));
+        return scriptchecks.empty();
+    };
+
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(!cached(GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus())));
+    }
+
+    // tx never was in the mempool, so connecting the block cached its result.
+    CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Tip();
+    BOOST_CHECK(pindex->GetBlockHash() == block.GetHash());
+    const unsigned int flags = GetBlockScriptFlags(pindex, Params().GetConsensus());
+    BOOST_CHECK(cached(flags));
+
+    // Disconnecting the block returns tx to the mempool, which finds the
+    // result cached and keeps it.
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), pindex));
+    BOOST_CHECK(chainActive.Tip() == pindex->pprev);
+    BOOST_CHECK(mempool.exists(tx.GetHash()));
+    BOOST_CHECK(cached(flags));
+
+    // Connecting the block again hits the cache, and still keeps the result.
+    ResetBlockFailureFlags(pindex);
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK(chainActive.Tip() == pindex);
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+    BOOST_CHECK(cached(flags));
+}
+
 // Run CheckInputs (using pcoinsTip) on the given transaction, for all script
 // flags.  Test that CheckInputs passes for all flags that don't overlap with
 // the failing_flags argument, but otherwise fails.
@@ -0,0 +1,227 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arith_uint256.h>
+#include <undo.h>
+#include <undostore.h>
+#include <test/test_bitcoin.h>
+#include <util/memory.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** Records the writes of an UndoStore instead of writing rev files, optionally holding them back. */
+struct TestUndoWriter {
+    struct Write {
+        size_t size; //!< Number of transactions in the undo data
+        uint256 prev_hash;
+        FlatFilePos pos;
+    };
+
+    std::mutex mutex;
+    std::vector<Write> writes;
+    std::set<int> flushed;
+    int failures = 0;
+    bool fail = false;
+    std::promise<void> release;
+    std::shared_future<void> gate;
+
+    TestUndoWriter() : gate(release.get_future().share()) { release.set_value(); }
+
+    void Hold()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = std::promise<void>();
+        gate = release.get_future().share();
+    }
+
+    std::vector<Write> Writes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return writes;
+    }
+
+    std::unique_ptr<UndoStore> MakeStore()
+    {
+        return MakeUnique<UndoStore>(
+            [this](const CBlockUndo& undo, const uint256& prev_hash, const FlatFilePos& pos) {
+                std::shared_future<void> wait;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    wait = gate;
+                }
+                wait.wait();
+                std::lock_guard<std::mutex> lock(mutex);
+                writes.push_back({undo.vtxundo.size(), prev_hash, pos});
+                return !fail;
+            },
+            [this](int file) {
+                std::lock_guard<std::mutex> lock(mutex);
+                flushed.insert(file);
+                return true;
+            },
+            [this]() {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++failures;
+            });
+    }
+};
+
+uint256 BlockHash(size_t i)
+{
+    return ArithToUint256(arith_uint256(i + 1));
+}
+
+FlatFilePos UndoPos(size_t i)
+{
+    return FlatFilePos(i / 4, 8 + 1000 * (i % 4));
+}
+
+CBlockUndo MakeUndo(size_t i)
+{
+    CBlockUndo undo;
+    undo.vtxundo.resize(i + 1);
+    return undo;
+}
+
+bool Add(UndoStore& store, size_t i)
+{
+    return store.Add(BlockHash(i), i ? BlockHash(i - 1) : uint256(), UndoPos(i), MakeUndo(i));
+}
+
+bool Cached(UndoStore& store, size_t i)
+{
+    CBlockUndo undo;
+    if (!store.Get(BlockHash(i), UndoPos(i), undo)) return false;
+    BOOST_CHECK_EQUAL(undo.vtxundo.size(), i + 1);
+    return true;
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(undostore_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(undostore_write_behind_order)
+{
+    TestUndoWriter writer;
+    const auto store_ptr = writer.MakeStore();
+    UndoStore& store = *store_ptr;
+    store.Start();
+
+    const size_t count = 2 * UNDO_CACHE_BLOCKS;
+    for (size_t i = 0; i < count; ++i) {
+        BOOST_CHECK(Add(store, i));
+    }
+    BOOST_CHECK(store.Sync());
+
+    // Undo data is written in the order blocks were connected, at the reserved positions
+    const auto writes = writer.Writes();
+    BOOST_REQUIRE_EQUAL(writes.size(), count);
+    for (size_t i = 0; i < count; ++i) {
+        BOOST_CHECK_EQUAL(writes[i].size, i + 1);
+        BOOST_CHECK(writes[i].prev_hash == (i ? BlockHash(i - 1) : uint256()));
+        BOOST_CHECK(writes[i].pos == UndoPos(i));
+    }
+    BOOST_CHECK(writer.flushed == std::set<int>({0, 1, 2, 3, 4, 5, 6, 7}));
+    BOOST_CHECK_EQUAL(writer.failures, 0);
+
+    // Once written, only the most recent blocks stay cached
+    BOOST_CHECK(!Cached(store, 0));
+    BOOST_CHECK(!Cached(store, count - UNDO_CACHE_BLOCKS - 1));
+    BOOST_CHECK(Cached(store, count - UNDO_CACHE_BLOCKS));
+    BOOST_CHECK(Cached(store, count - 1));
+    store.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(undostore_read_before_write)
+{
+    TestUndoWriter writer;
+    const auto store_ptr = writer.MakeStore();
+    UndoStore& store = *store_ptr;
+    store.Start();
+
+    // Hold back the writes of more blocks than are normally cached
+    writer.Hold();
+    const size_t count = UNDO_CACHE_BLOCKS + 4;
+    for (size_t i = 0; i < count; ++i) {
+        BOOST_CHECK(Add(store, i));
+    }
+
+    // Undo data that is not written yet is never evicted, and can be read back
+    for (size_t i = 0; i < count; ++i) {
+        BOOST_CHECK(Cached(store, i));
+    }
+    CBlockUndo undo;
+    BOOST_CHECK(!store.Get(BlockHash(0), UndoPos(1), undo));
+    BOOST_CHECK(!store.Get(BlockHash(count), UndoPos(count), undo));
+    BOOST_CHECK(writer.Writes().empty());
+
+    writer.release.set_value();
+    BOOST_CHECK(store.Sync());
+    BOOST_CHECK_EQUAL(writer.Writes().size(), count);
+    BOOST_CHECK(!Cached(store, 0));
+    BOOST_CHECK(Cached(store, count - 1));
+    store.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(undostore_stop_drains)
+{
+    TestUndoWriter writer;
+    const auto store_ptr = writer.MakeStore();
+    UndoStore& store = *store_ptr;
+    store.Start();
+
+    writer.Hold();
+    const size_t count = 8;
+    for (size_t i = 0; i < count; ++i) {
+        BOOST_CHECK(Add(store, i));
+    }
+
+    // Stopping waits for all queued undo data to be written
+    std::future<void> stopped = std::async(std::launch::async, [&store] { store.Stop(); });
+    BOOST_CHECK(stopped.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    writer.release.set_value();
+    stopped.get();
+    const auto writes = writer.Writes();
+    BOOST_REQUIRE_EQUAL(writes.size(), count);
+    for (size_t i = 0; i < count; ++i) {
+        BOOST_CHECK(writes[i].pos == UndoPos(i));
+    }
+
+    // The cache is emptied, and later writes are synchronous
+    BOOST_CHECK(!Cached(store, count - 1));
+    BOOST_CHECK(Add(store, count));
+    BOOST_CHECK_EQUAL(writer.Writes().size(), count + 1);
+    BOOST_CHECK(Cached(store, count));
+}
+
+BOOST_AUTO_TEST_CASE(undostore_write_failure)
+{
+    TestUndoWriter writer;
+    writer.fail = true;
+    const auto store_ptr = writer.MakeStore();
+    UndoStore& store = *store_ptr;
+    store.Start();
+
+    BOOST_CHECK(Add(store, 0));
+    BOOST_CHECK(!store.Sync());
+    BOOST_CHECK_EQUAL(writer.failures, 1);
+    // Undo data that failed to be written stays cached
+    BOOST_CHECK(Cached(store, 0));
+    store.Stop();
+
+    // Synchronous writes report the failure to the caller
+    BOOST_CHECK(!Add(store, 1));
+    BOOST_CHECK(!Cached(store, 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
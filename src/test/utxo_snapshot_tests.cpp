@@ -0,0 +1,168 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <node/utxo_snapshot.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(utxo_snapshot_tests)
+
+BOOST_FIXTURE_TEST_CASE(utxo_snapshot_load_and_validate, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    const fs::path snapshot_path = GetDataDir() / "utxo.dat";
+
+    SnapshotMetadata metadata;
+    std::string error;
+    BOOST_REQUIRE_MESSAGE(DumpUTXOSnapshot(snapshot_path, metadata, error), error);
+    BOOST_CHECK_EQUAL(metadata.m_base_height, 100);
+    BOOST_CHECK_EQUAL(metadata.m_coins_count, 100U);
+    BOOST_CHECK_EQUAL(metadata.m_chain_tx_count, 101U);
+
+    // Keep the blocks around to feed them to the node again later.
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(metadata.m_base_blockhash == chainActive.Tip()->GetBlockHash());
+        for (int height = 1; height <= chainActive.Height(); ++height) {
+            auto block = std::make_shared<CBlock>();
+            BOOST_REQUIRE(ReadBlockFromDisk(*block, chainActive[height], chainparams.GetConsensus()));
+            blocks.push_back(block);
+        }
+    }
+
+    // Start over from a chainstate that only has the genesis block.
+    StopUndoWriter();
+    {
+        LOCK(cs_main);
+        UnloadBlockIndex();
+        pcoinsTip.reset();
+        pcoinsdbwriter.reset();
+        pcoinsdbview.reset();
+        pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+        pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+        pcoinsdbwriter.reset(new CCoinsViewBackgroundWriter(pcoinsdbview.get(), (1 << 23) / 100 * COINS_WRITE_PIECE_PERCENT));
+        pcoinsdbwriter->Start();
+        pcoinsTip.reset(new CCoinsViewCache(pcoinsdbwriter.get()));
+    }
+    BOOST_REQUIRE(LoadGenesisBlock(chainparams));
+    {
+        CValidationState state;
+        BOOST_REQUIRE(ActivateBestChain(state, chainparams));
+    }
+    StartUndoWriter();
+
+    // A snapshot is only loaded if -assumeutxo vouches for its UTXO set.
+    SnapshotMetadata loaded;
+    BOOST_CHECK(!LoadUTXOSnapshot(snapshot_path, loaded, error));
+    gArgs.ForceSetArg("-assumeutxo", strprintf("100:%s", uint256().GetHex()));
+    BOOST_CHECK(!LoadUTXOSnapshot(snapshot_path, loaded, error));
+    gArgs.ForceSetArg("-assumeutxo", strprintf("100:%s", metadata.m_muhash.GetHex()));
+
+    // Coins that do not hash to the vouched for UTXO set are taken out again.
+    const fs::path corrupt_path = GetDataDir() / "utxo_corrupt.dat";
+    {
+        std::ifstream in(snapshot_path.string(), std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        data.back() ^= 1;
+        std::ofstream out(corrupt_path.string(), std::ios::binary);
+        out << data;
+    }
+    BOOST_CHECK(!LoadUTXOSnapshot(corrupt_path, loaded, error));
+    BOOST_CHECK(error.find("MuHash") != std::string::npos);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+        BOOST_CHECK(!g_snapshot_base);
+        BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(m_coinbase_txns[0]->GetHash(), 0)));
+        std::unique_ptr<CCoinsViewCursor> cursor(pcoinsdbview->Cursor());
+        BOOST_CHECK(!cursor->Valid());
+        bool loading = true;
+        BOOST_CHECK(pblocktree->ReadFlag("snapshotloading", loading));
+        BOOST_CHECK(!loading);
+    }
+
+    BOOST_REQUIRE_MESSAGE(LoadUTXOSnapshot(snapshot_path, loaded, error), error);
+    BOOST_CHECK(loaded.m_base_blockhash == metadata.m_base_blockhash);
+    BOOST_CHECK_EQUAL(loaded.m_coins_count, metadata.m_coins_count);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 100);
+        BOOST_CHECK(chainActive.Tip() == g_snapshot_base);
+        BOOST_CHECK_EQUAL(chainActive.Tip()->nChainTx, metadata.m_chain_tx_count);
+        BOOST_CHECK(!g_snapshot_validated);
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(m_coinbase_txns[0]->GetHash(), 0)));
+    }
+
+    // Only a single snapshot can be loaded.
+    BOOST_CHECK(!LoadUTXOSnapshot(snapshot_path, loaded, error));
+
+    // Coins of the snapshot can be spent before the chain below it is validated.
+    const CScript coinbase_script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = coinbase_script_pub_key;
+    std::vector<unsigned char> sig;
+    uint256 hash = SignatureHash(coinbase_script_pub_key, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, sig));
+    sig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << sig;
+    CreateAndProcessBlock({spend}, coinbase_script_pub_key);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+        BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(m_coinbase_txns[0]->GetHash(), 0)));
+    }
+
+    // The background validation connects the historical blocks as they arrive.
+    StartSnapshotValidation();
+    for (const auto& block : blocks) {
+        BOOST_CHECK(ProcessNewBlock(chainparams, block, true, nullptr));
+    }
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (time_start + timeout_ms > GetTimeMillis()) {
+        {
+            LOCK(cs_main);
+            if (g_snapshot_validated) break;
+        }
+        MilliSleep(100);
+    }
+    StopSnapshotValidation();
+
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(g_snapshot_validated);
+        BOOST_CHECK_EQUAL(g_snapshot_validation_height, 100);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+        SnapshotMetadata record;
+        BOOST_CHECK(!pblocktree->ReadSnapshot(record));
+    }
+    BOOST_CHECK(!fs::exists(GetDataDir() / "chainstate_snapshot_validation"));
+
+    gArgs.ForceSetArg("-assumeutxo", "");
+
+    // shutdown sequence (c.f. Shutdown() in init.cpp)
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    // Rest of shutdown sequence and destructors happen in ~TestingSetup()
+}
+
+BOOST_AUTO_TEST_SUITE_END()
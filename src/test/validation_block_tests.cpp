@@ -11,6 +11,7 @@
 #include <pow.h>
 #include <random.h>
 #include <test/test_bitcoin.h>
+#include <txdb.h>
 #include <validation.h>
 #include <validationinterface.h>
 
@@ -184,4 +185,34 @@ BOOST_AUTO_TEST_CASE(processnewblock_signals_ordering)
     BOOST_CHECK_EQUAL(sub.m_expected_tip, chainActive.Tip()->GetBlockHash());
 }
 
+struct FlushSubscriber : public CValidationInterface {
+    std::vector<uint256> m_flushed;
+
+    void ChainStateFlushed(const CBlockLocator& locator) override
+    {
+        // The chainstate is on disk by the time it is reported as flushed,
+        // although it is written in the background.
+        BOOST_CHECK_EQUAL(pcoinsdbview->GetBestBlock(), locator.vHave.front());
+        m_flushed.push_back(locator.vHave.front());
+    }
+};
+
+BOOST_AUTO_TEST_CASE(chainstate_flushed_after_write)
+{
+    uint256 tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip()->GetBlockHash();
+    }
+    FlushSubscriber sub;
+    RegisterValidationInterface(&sub);
+    FlushStateToDisk();
+    SyncWithValidationInterfaceQueue();
+    UnregisterValidationInterface(&sub);
+
+    BOOST_REQUIRE_EQUAL(sub.m_flushed.size(), 1U);
+    BOOST_CHECK_EQUAL(sub.m_flushed[0], tip);
+    BOOST_CHECK_EQUAL(pcoinsdbview->GetBestBlock(), tip);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
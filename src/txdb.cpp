@@ -7,6 +7,7 @@
 
 #include <chainparams.h>
 #include <hash.h>
+#include <node/utxo_snapshot.h>
 #include <random.h>
 #include <pow.h>
 #include <shutdown.h>
@@ -18,7 +19,10 @@
 
 #include <boost/thread.hpp>
 
-static const char DB_COIN = 'C';
+//! Coins with the extended script compression (see CoinValue)
+static const char DB_COIN = 'D';
+//! Coins with the original script compression (0.15..0.18)
+static const char DB_LEGACY_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_BLOCK_INDEX = 'b';
@@ -28,6 +32,8 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_UTXO_SNAPSHOT = 'U';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'S';
 
 namespace {
 
@@ -51,14 +57,42 @@ struct CoinEntry {
     }
 };
 
+/** A coin as stored under DB_COIN: as Coin serializes it, but with the extended script compression. */
+struct CoinValue {
+    Coin* coin;
+    explicit CoinValue(const Coin* ptr) : coin(const_cast<Coin*>(ptr)) {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        assert(!coin->IsSpent());
+        uint32_t code = coin->nHeight * 2 + coin->fCoinBase;
+        ::Serialize(s, VARINT(code));
+        ::Serialize(s, CTxOutCompressor(coin->out, true));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        uint32_t code = 0;
+        ::Unserialize(s, VARINT(code));
+        coin->nHeight = code >> 1;
+        coin->fCoinBase = code & 1;
+        ::Unserialize(s, CTxOutCompressor(coin->out, true));
+    }
+};
+
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : CCoinsViewDB(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+{
+}
+
+CCoinsViewDB::CCoinsViewDB(const fs::path& ldb_path, size_t nCacheSize, bool fMemory, bool fWipe) : db(ldb_path, nCacheSize, fMemory, fWipe, true)
 {
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
-    return db.Read(CoinEntry(&outpoint), coin);
+    CoinValue value(&coin);
+    return db.Read(CoinEntry(&outpoint), value);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
@@ -80,7 +114,11 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase) {
+    return BatchWritePart(mapCoins, hashBlock, erase, /* last */ true);
+}
+
+bool CCoinsViewDB::BatchWritePart(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase, bool last) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -88,6 +126,8 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
+    m_write_progress = 0;
+
     uint256 old_tip = GetBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
@@ -111,16 +151,16 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             if (it->second.coin.IsSpent())
                 batch.Erase(entry);
             else
-                batch.Write(entry, it->second.coin);
+                batch.Write(entry, CoinValue(&it->second.coin));
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        it = erase ? mapCoins.erase(it) : std::next(it);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
             batch.Clear();
+            m_write_progress = changed;
             if (crash_simulate) {
                 static FastRandomContext rng;
                 if (rng.randrange(crash_simulate) == 0) {
@@ -131,16 +171,223 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         }
     }
 
-    // In the last batch, mark the database as consistent with hashBlock again.
-    batch.Erase(DB_HEAD_BLOCKS);
-    batch.Write(DB_BEST_BLOCK, hashBlock);
+    // In the last batch of the last piece, mark the database as consistent
+    // with hashBlock again.
+    if (last) {
+        batch.Erase(DB_HEAD_BLOCKS);
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+    }
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    m_write_progress = 0;
     return ret;
 }
 
+CCoinsViewBackgroundWriter::CCoinsViewBackgroundWriter(CCoinsViewDB* db, size_t max_pending_bytes) : CCoinsViewBacked(db), m_db(db),
+    m_max_pending_bytes(max_pending_bytes),
+    m_pending(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &m_pending_resource) {}
+
+CCoinsViewBackgroundWriter::~CCoinsViewBackgroundWriter()
+{
+    Stop();
+}
+
+bool CCoinsViewBackgroundWriter::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    {
+        LOCK(m_mutex);
+        CCoinsMap::const_iterator it = m_pending.find(outpoint);
+        if (it != m_pending.end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewBackgroundWriter::HaveCoin(const COutPoint &outpoint) const
+{
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
+
+uint256 CCoinsViewBackgroundWriter::GetBestBlock() const
+{
+    {
+        LOCK(m_mutex);
+        if (!m_pending_block.IsNull()) return m_pending_block;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundWriter::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase)
+{
+    {
+        WAIT_LOCK(m_mutex, lock);
+        m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return !m_writing; });
+        if (m_failed) return false;
+        if (m_running) {
+            assert(m_pending.empty() && m_pending_block.IsNull());
+            m_pending_block = hashBlock;
+            m_pending_changed = 0;
+            m_pending_written = 0;
+            for (const auto& item : mapCoins) {
+                if (item.second.flags & CCoinsCacheEntry::DIRTY) ++m_pending_changed;
+            }
+            CCoinsMap::iterator it = mapCoins.begin();
+            while (true) {
+                while (it != mapCoins.end() && (m_pending.empty() || memusage::DynamicUsage(m_pending) + m_pending_coins_usage < m_max_pending_bytes)) {
+                    if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                        CCoinsCacheEntry& entry = m_pending[it->first];
+                        if (erase) {
+                            entry.coin = std::move(it->second.coin);
+                        } else {
+                            entry.coin = it->second.coin;
+                        }
+                        entry.flags = CCoinsCacheEntry::DIRTY;
+                        m_pending_coins_usage += entry.coin.DynamicMemoryUsage();
+                    }
+                    it = erase ? mapCoins.erase(it) : std::next(it);
+                }
+                m_pending_last = it == mapCoins.end();
+                m_writing = true;
+                m_cond.notify_all();
+                if (m_pending_last) return true;
+                // The next piece is copied once this one is on disk.
+                m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return !m_writing; });
+                if (m_failed) return false;
+            }
+        }
+    }
+    return base->BatchWrite(mapCoins, hashBlock, erase);
+}
+
+CCoinsViewCursor *CCoinsViewBackgroundWriter::Cursor() const
+{
+    Wait();
+    return base->Cursor();
+}
+
+void CCoinsViewBackgroundWriter::ResetPending()
+{
+    // Start over with an empty pool, so the memory of the piece is released.
+    m_pending.~CCoinsMap();
+    m_pending_resource.~CCoinsMapMemoryResource();
+    ::new (&m_pending_resource) CCoinsMapMemoryResource();
+    ::new (&m_pending) CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &m_pending_resource);
+    m_pending_coins_usage = 0;
+}
+
+void CCoinsViewBackgroundWriter::ThreadWrite()
+{
+    while (true) {
+        uint256 block;
+        bool last;
+        {
+            WAIT_LOCK(m_mutex, lock);
+            m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_stop || (m_writing && !m_failed); });
+            // A piece that was handed over is written before stopping
+            if (!m_writing || m_failed) return;
+            block = m_pending_block;
+            last = m_pending_last;
+        }
+
+        bool ok = false;
+        try {
+            ok = m_db->BatchWritePart(m_pending, block, /* erase */ false, last);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+
+        std::function<void()> on_written;
+        {
+            LOCK(m_mutex);
+            if (ok) {
+                m_pending_written += m_pending.size();
+                ResetPending();
+                if (last) {
+                    m_pending_block.SetNull();
+                    on_written.swap(m_on_written);
+                }
+            } else {
+                // Keep serving the piece from memory; no further batches are accepted.
+                m_failed = true;
+            }
+        }
+        // Notify before Wait() returns, so that callers can rely on it.
+        if (on_written) on_written();
+        {
+            LOCK(m_mutex);
+            m_writing = false;
+        }
+        m_cond.notify_all();
+
+        if (!ok) {
+            LogPrintf("Error: Failed to write to coin database, shutting down\n");
+            uiInterface.ThreadSafeMessageBox(_("Error: Failed to write to coin database"), "", CClientUIInterface::MSG_ERROR);
+            StartShutdown();
+        }
+    }
+}
+
+void CCoinsViewBackgroundWriter::Start()
+{
+    LOCK(m_mutex);
+    if (m_running) return;
+    m_running = true;
+    m_thread = std::thread(&TraceThread<std::function<void()>>, "coinswrite", std::function<void()>(std::bind(&CCoinsViewBackgroundWriter::ThreadWrite, this)));
+}
+
+void CCoinsViewBackgroundWriter::Stop()
+{
+    {
+        LOCK(m_mutex);
+        if (!m_running) return;
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+    LOCK(m_mutex);
+    m_running = false;
+    m_stop = false;
+}
+
+bool CCoinsViewBackgroundWriter::Wait() const
+{
+    WAIT_LOCK(m_mutex, lock);
+    m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return (!m_writing && m_pending_block.IsNull()) || m_failed; });
+    return !m_failed;
+}
+
+bool CCoinsViewBackgroundWriter::GetProgress(size_t& written, size_t& total) const
+{
+    LOCK(m_mutex);
+    if (m_pending_block.IsNull()) return false;
+    total = m_pending_changed;
+    written = std::min(m_pending_written + (m_writing ? m_db->GetWriteProgress() : 0), total);
+    return true;
+}
+
+size_t CCoinsViewBackgroundWriter::DynamicMemoryUsage() const
+{
+    LOCK(m_mutex);
+    return memusage::DynamicUsage(m_pending) + m_pending_coins_usage;
+}
+
+void CCoinsViewBackgroundWriter::NotifyWhenWritten(std::function<void()> notify)
+{
+    {
+        LOCK(m_mutex);
+        if (!m_pending_block.IsNull()) {
+            if (!m_failed) m_on_written = std::move(notify);
+            return;
+        }
+    }
+    notify();
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
@@ -176,14 +423,50 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
        that restriction.  */
     i->pcursor->Seek(DB_COIN);
     // Cache key of first record
-    if (i->pcursor->Valid()) {
-        CoinEntry entry(&i->keyTmp.second);
-        i->pcursor->GetKey(entry);
-        i->keyTmp.first = entry.key;
+    i->CacheKey();
+    return i;
+}
+
+std::vector<std::unique_ptr<CCoinsViewCursor>> CCoinsViewDB::ShardedCursors(int n_shards) const
+{
+    // Shards are split on the first two bytes of the txid, which is where
+    // coin keys start after the DB_COIN prefix.
+    assert(n_shards > 0 && n_shards <= 0x10000);
+    auto snapshot = std::make_shared<const CDBSnapshot>(db);
+    uint256 hash_block;
+    if (!db.Read(DB_BEST_BLOCK, hash_block, snapshot.get())) {
+        hash_block.SetNull();
+    }
+
+    std::vector<std::unique_ptr<CCoinsViewCursor>> cursors;
+    for (int shard = 0; shard < n_shards; ++shard) {
+        uint256 begin;
+        const uint32_t begin_prefix = shard * 0x10000 / n_shards;
+        *begin.begin() = begin_prefix >> 8;
+        *(begin.begin() + 1) = begin_prefix & 0xff;
+        Optional<uint256> end;
+        if (shard + 1 < n_shards) {
+            const uint32_t end_prefix = (shard + 1) * 0x10000 / n_shards;
+            end = uint256();
+            *end->begin() = end_prefix >> 8;
+            *(end->begin() + 1) = end_prefix & 0xff;
+        }
+        CCoinsViewDBCursor *i = new CCoinsViewDBCursor(db.NewIterator(*snapshot), snapshot, hash_block, end);
+        i->pcursor->Seek(std::make_pair(DB_COIN, begin));
+        i->CacheKey();
+        cursors.emplace_back(i);
+    }
+    return cursors;
+}
+
+void CCoinsViewDBCursor::CacheKey()
+{
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) || (end && !(keyTmp.second.hash < *end))) {
+        keyTmp.first = 0; // Make sure Valid() and GetKey() return false
     } else {
-        i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
+        keyTmp.first = entry.key;
     }
-    return i;
 }
 
 bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
@@ -198,7 +481,8 @@ bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 
 bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coin);
+    CoinValue value(&coin);
+    return pcursor->GetValue(value);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -214,12 +498,7 @@ bool CCoinsViewDBCursor::Valid() const
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    CoinEntry entry(&keyTmp.second);
-    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
-        keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
-    } else {
-        keyTmp.first = entry.key;
-    }
+    CacheKey(); // Invalidates the cached key after the last record, so that Valid() and GetKey() return false
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -231,6 +510,8 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // The block index snapshot no longer matches.
+    batch.Erase(DB_BLOCK_INDEX_SNAPSHOT);
     return WriteBatch(batch, true);
 }
 
@@ -246,6 +527,30 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshot(const SnapshotMetadata& metadata) {
+    return Write(DB_UTXO_SNAPSHOT, metadata, true);
+}
+
+bool CBlockTreeDB::ReadSnapshot(SnapshotMetadata& metadata) {
+    return Read(DB_UTXO_SNAPSHOT, metadata);
+}
+
+bool CBlockTreeDB::EraseSnapshot() {
+    return Erase(DB_UTXO_SNAPSHOT, true);
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshotStamp(uint64_t stamp) {
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, stamp, true);
+}
+
+bool CBlockTreeDB::ReadBlockIndexSnapshotStamp(uint64_t& stamp) {
+    return Read(DB_BLOCK_INDEX_SNAPSHOT, stamp);
+}
+
+bool CBlockTreeDB::EraseBlockIndexSnapshotStamp() {
+    return Erase(DB_BLOCK_INDEX_SNAPSHOT, true);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
@@ -344,11 +649,29 @@ public:
 
 }
 
+/** Report the progress of an upgrade that has reached the coins of txid. */
+static void ReportUpgradeProgress(const uint256& txid, int& reportDone)
+{
+    uint32_t high = 0x100 * *txid.begin() + *(txid.begin() + 1);
+    int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone, true);
+    if (reportDone < percentageDone/10) {
+        // report max. every 10% step
+        LogPrintf("[%d%%]...", percentageDone); /* Continued */
+        reportDone = percentageDone/10;
+    }
+}
+
 /** Upgrade the database from older formats.
  *
- * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout.
+ * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout,
+ * and from the original script compression (0.15..0.18) to the extended one.
  */
 bool CCoinsViewDB::Upgrade() {
+    return UpgradePerTxCoins() && UpgradeScriptCompression();
+}
+
+bool CCoinsViewDB::UpgradePerTxCoins() {
     std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
     pcursor->Seek(std::make_pair(DB_COINS, uint256()));
     if (!pcursor->Valid()) {
@@ -371,14 +694,7 @@ bool CCoinsViewDB::Upgrade() {
         }
         if (pcursor->GetKey(key) && key.first == DB_COINS) {
             if (count++ % 256 == 0) {
-                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
-                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
-                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone, true);
-                if (reportDone < percentageDone/10) {
-                    // report max. every 10% step
-                    LogPrintf("[%d%%]...", percentageDone); /* Continued */
-                    reportDone = percentageDone/10;
-                }
+                ReportUpgradeProgress(key.second, reportDone);
             }
             CCoins old_coins;
             if (!pcursor->GetValue(old_coins)) {
@@ -390,7 +706,7 @@ bool CCoinsViewDB::Upgrade() {
                     Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase);
                     outpoint.n = i;
                     CoinEntry entry(&outpoint);
-                    batch.Write(entry, newcoin);
+                    batch.Write(entry, CoinValue(&newcoin));
                 }
             }
             batch.Erase(key);
@@ -411,3 +727,52 @@ bool CCoinsViewDB::Upgrade() {
     LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
     return !ShutdownRequested();
 }
+
+bool CCoinsViewDB::UpgradeScriptCompression() {
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    pcursor->Seek(DB_LEGACY_COIN);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) || entry.key != DB_LEGACY_COIN) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database to the extended script compression...\n");
+    LogPrintf("[0%%]..."); /* Continued */
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0, true);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    // Every batch moves coins from DB_LEGACY_COIN to DB_COIN, so an
+    // interrupted upgrade continues where it stopped.
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (!pcursor->GetKey(entry) || entry.key != DB_LEGACY_COIN) {
+            break;
+        }
+        if (count++ % 256 == 0) {
+            ReportUpgradeProgress(outpoint.hash, reportDone);
+        }
+        Coin coin;
+        if (!pcursor->GetValue(coin)) {
+            return error("%s: cannot parse coin record", __func__);
+        }
+        batch.Erase(entry);
+        entry.key = DB_COIN;
+        batch.Write(entry, CoinValue(&coin));
+        if (batch.SizeEstimate() > batch_size) {
+            db.WriteBatch(batch);
+            batch.Clear();
+        }
+        pcursor->Next();
+    }
+    db.WriteBatch(batch);
+    db.CompactRange(DB_LEGACY_COIN, (char)(DB_LEGACY_COIN + 1));
+    uiInterface.ShowProgress("", 100, false);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
@@ -9,16 +9,23 @@
 #include <coins.h>
 #include <dbwrapper.h>
 #include <chain.h>
+#include <optional.h>
 #include <primitives/block.h>
+#include <sync.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
+class SnapshotMetadata;
 class uint256;
 
 //! No need to periodic flush if at least this much space still available.
@@ -27,6 +34,8 @@ static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 static const int64_t nDefaultDbCache = 450;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! Share of the coins cache budget that a piece of a background chainstate write may take (percent)
+static const int COINS_WRITE_PIECE_PERCENT = 25;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -45,19 +54,117 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Changed coins committed to the database by the BatchWrite in progress
+    std::atomic<size_t> m_write_progress{0};
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    //! Open a coin database in a directory other than chainstate/
+    CCoinsViewDB(const fs::path& ldb_path, size_t nCacheSize, bool fMemory, bool fWipe);
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
+    /**
+     * Write one piece of the changes up to hashBlock. Until the last piece is
+     * written, the database is marked as being in the middle of the
+     * transition to hashBlock, as within a single BatchWrite.
+     */
+    bool BatchWritePart(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase, bool last);
     CCoinsViewCursor *Cursor() const override;
+    /**
+     * Split the coin database into n_shards cursors over disjoint ranges of
+     * txids, which together visit every coin once. All cursors read from the
+     * same snapshot of the database, so they can be used on different threads
+     * at the same time, while the database is written to.
+     */
+    std::vector<std::unique_ptr<CCoinsViewCursor>> ShardedCursors(int n_shards) const;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    //! Number of changed coins that the BatchWrite in progress has committed so far.
+    size_t GetWriteProgress() const { return m_write_progress; }
+
+private:
+    bool UpgradePerTxCoins();
+    bool UpgradeScriptCompression();
+};
+
+/**
+ * CCoinsView in front of the coin database that, once started, writes the
+ * batches it is given from a background thread, so that writing a large
+ * coins cache does not stall validation.
+ *
+ * The changed coins of a batch are copied in pieces of at most
+ * max_pending_bytes. BatchWrite waits for each piece to be written before
+ * copying the next one, and returns once the last piece is handed over, so
+ * at most one piece is held in memory besides the cache. Until a piece is
+ * written, its coins are served from memory. The pieces of a batch are
+ * written by CCoinsViewDB::BatchWritePart, so an interrupted write is still
+ * recovered from the database's head blocks marker. A new batch waits for
+ * the previous one.
+ */
+class CCoinsViewBackgroundWriter final : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB* const m_db;
+
+    mutable Mutex m_mutex;
+    mutable std::condition_variable m_cond;
+    const size_t m_max_pending_bytes;
+    //! The piece being written. Only modified while no piece is being
+    //! written, so the writer thread reads it without the lock.
+    CCoinsMapMemoryResource m_pending_resource;
+    CCoinsMap m_pending;
+    //! Memory used by the coins in m_pending, besides the map itself
+    size_t m_pending_coins_usage GUARDED_BY(m_mutex) = 0;
+    //! Whether m_pending is the last piece of its batch
+    bool m_pending_last GUARDED_BY(m_mutex) = false;
+    //! Block of the batch being written, null if there is none
+    uint256 m_pending_block GUARDED_BY(m_mutex);
+    //! Changed coins of the batch being written, and those in earlier pieces
+    size_t m_pending_changed GUARDED_BY(m_mutex) = 0;
+    size_t m_pending_written GUARDED_BY(m_mutex) = 0;
+    //! Called once the batch being written is on disk
+    std::function<void()> m_on_written GUARDED_BY(m_mutex);
+    bool m_writing GUARDED_BY(m_mutex) = false;
+    bool m_failed GUARDED_BY(m_mutex) = false;
+    bool m_running GUARDED_BY(m_mutex) = false;
+    bool m_stop GUARDED_BY(m_mutex) = false;
+    std::thread m_thread;
+
+    void ResetPending() EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    void ThreadWrite();
+
+public:
+    CCoinsViewBackgroundWriter(CCoinsViewDB* db, size_t max_pending_bytes);
+    ~CCoinsViewBackgroundWriter();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool erase = true) override;
+    CCoinsViewCursor *Cursor() const override;
+
+    //! Start writing batches on a background thread.
+    void Start();
+    //! Finish the batch being written and stop the thread. Later batches are written synchronously.
+    void Stop();
+    //! Wait until the batch being written, if any, is on disk. Returns false if writing it failed.
+    bool Wait() const;
+    //! Changed coins of the batch being written that are on disk, and in total. Returns false if no batch is being written.
+    bool GetProgress(size_t& written, size_t& total) const;
+    //! Memory held by the piece being written.
+    size_t DynamicMemoryUsage() const;
+    /**
+     * Call notify once the last batch handed to BatchWrite is on disk: on the
+     * writer thread before Wait() returns, or right away if it already is.
+     * It is not called if writing the batch fails.
+     */
+    void NotifyWhenWritten(std::function<void()> notify);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -76,8 +183,17 @@ public:
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
         CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, std::shared_ptr<const CDBSnapshot> snapshotIn, const uint256 &hashBlockIn, const Optional<uint256>& endIn):
+        CCoinsViewCursor(hashBlockIn), snapshot(std::move(snapshotIn)), pcursor(pcursorIn), end(endIn) {}
+    //! Cache the key of the current record, or invalidate the cursor past the last coin of its range
+    void CacheKey();
+
+    //! Snapshot the iterator reads from, if any; shared by the cursors of a ShardedCursors() call
+    std::shared_ptr<const CDBSnapshot> snapshot;
     std::unique_ptr<CDBIterator> pcursor;
     std::pair<char, COutPoint> keyTmp;
+    //! First txid past the range of this cursor, if it does not run to the end
+    Optional<uint256> end;
 
     friend class CCoinsViewDB;
 };
@@ -95,6 +211,15 @@ public:
     void ReadReindexing(bool &fReindexing);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    //! The UTXO snapshot the chainstate is based on, while it has not been validated.
+    bool WriteSnapshot(const SnapshotMetadata& metadata);
+    bool ReadSnapshot(SnapshotMetadata& metadata);
+    bool EraseSnapshot();
+    //! The stamp of the block index snapshot file that matches the block index
+    //! entries. It is erased once the snapshot is loaded, and by every WriteBatchSync.
+    bool WriteBlockIndexSnapshotStamp(uint64_t stamp);
+    bool ReadBlockIndexSnapshotStamp(uint64_t& stamp);
+    bool EraseBlockIndexSnapshotStamp();
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
@@ -34,6 +34,9 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+
+    nClusterId = 0;
+    m_epoch = 0;
 }
 
 void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
@@ -142,13 +145,24 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
                 UpdateParent(childIter, it, true);
             }
         }
+        if (!setChildren.empty()) {
+            // The transaction has to go before its children, so the cluster
+            // they are merged into is linearized from scratch.
+            std::vector<uint64_t> ids{it->nClusterId};
+            for (txiter child : setChildren) {
+                if (std::find(ids.begin(), ids.end(), child->nClusterId) == ids.end()) ids.push_back(child->nClusterId);
+            }
+            LinearizeCluster(ids.size() == 1 ? ids[0] : MergeClusters(ids));
+        }
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
     }
 }
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
 {
-    setEntries parentHashes;
+    // Entries still to be walked; each is staged only once per epoch.
+    EpochGuard epoch(*this);
+    vecEntries parentHashes;
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -157,8 +171,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             boost::optional<txiter> piter = GetIter(tx.vin[i].prevout.hash);
-            if (piter) {
-                parentHashes.insert(*piter);
+            if (piter && !visited(*piter)) {
+                parentHashes.push_back(*piter);
                 if (parentHashes.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
@@ -169,16 +183,19 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        visited(it);
+        for (txiter piter : GetMemPoolParents(it)) {
+            if (!visited(piter)) parentHashes.push_back(piter);
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
     while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
+        txiter stageit = parentHashes.back();
 
         setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
+        parentHashes.pop_back();
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -195,8 +212,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
         for (txiter phash : setMemPoolParents) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (setAncestors.count(phash) == 0 && !visited(phash)) {
+                parentHashes.push_back(phash);
             }
             if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
@@ -208,9 +225,9 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
     return true;
 }
 
-void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
+void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, const vecEntries &ancestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    const setEntries &parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
     for (txiter piter : parentIters) {
         UpdateChild(piter, it, add);
@@ -218,18 +235,18 @@ void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors
     const int64_t updateCount = (add ? 1 : -1);
     const int64_t updateSize = updateCount * it->GetTxSize();
     const CAmount updateFee = updateCount * it->GetModifiedFee();
-    for (txiter ancestorIt : setAncestors) {
+    for (txiter ancestorIt : ancestors) {
         mapTx.modify(ancestorIt, update_descendant_state(updateSize, updateFee, updateCount));
     }
 }
 
-void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncestors)
+void CTxMemPool::UpdateEntryForAncestors(txiter it, const vecEntries &ancestors)
 {
-    int64_t updateCount = setAncestors.size();
+    int64_t updateCount = ancestors.size();
     int64_t updateSize = 0;
     CAmount updateFee = 0;
     int64_t updateSigOpsCost = 0;
-    for (txiter ancestorIt : setAncestors) {
+    for (txiter ancestorIt : ancestors) {
         updateSize += ancestorIt->GetTxSize();
         updateFee += ancestorIt->GetModifiedFee();
         updateSigOpsCost += ancestorIt->GetSigOpCost();
@@ -249,7 +266,7 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
 {
     // For each entry, walk back all ancestors and decrement size associated with this
     // transaction
-    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    vecEntries entries;
     if (updateDescendants) {
         // updateDescendants should be true whenever we're not recursively
         // removing a tx and all its descendants, eg when a transaction is
@@ -258,25 +275,20 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // we need to preserve until we're finished with all operations that
         // need to traverse the mempool).
         for (txiter removeIt : entriesToRemove) {
-            setEntries setDescendants;
-            CalculateDescendants(removeIt, setDescendants);
-            setDescendants.erase(removeIt); // don't update state for self
+            WalkDescendants(removeIt, entries);
             int64_t modifySize = -((int64_t)removeIt->GetTxSize());
             CAmount modifyFee = -removeIt->GetModifiedFee();
             int modifySigOps = -removeIt->GetSigOpCost();
-            for (txiter dit : setDescendants) {
+            for (txiter dit : entries) {
                 mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
             }
         }
     }
     for (txiter removeIt : entriesToRemove) {
-        setEntries setAncestors;
-        const CTxMemPoolEntry &entry = *removeIt;
-        std::string dummy;
-        // Since this is a tx that is already in the mempool, we can call CMPA
-        // with fSearchForParents = false.  If the mempool is in a consistent
-        // state, then using true or false should both be correct, though false
-        // should be a bit faster.
+        // Since this is a tx that is already in the mempool, we can walk its
+        // ancestors through mapLinks instead of searching for its parents.
+        // If the mempool is in a consistent state, then both should be
+        // correct, though walking mapLinks is faster.
         // However, if we happen to be in the middle of processing a reorg, then
         // the mempool can be in an inconsistent state.  In this case, the set
         // of ancestors reachable via mapLinks will be the same as the set of
@@ -290,10 +302,10 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // differ from the set of mempool parents we'd calculate by searching,
         // and it's important that we use the mapLinks[] notion of ancestor
         // transactions as the set of things to update for removal.
-        CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        WalkAncestors(removeIt, entries);
         // Note that UpdateAncestorsOf severs the child links that point to
         // removeIt in the entries for the parents of removeIt.
-        UpdateAncestorsOf(false, removeIt, setAncestors);
+        UpdateAncestorsOf(false, removeIt, entries);
     }
     // After updating all the ancestor sizes, we can now sever the link between each
     // transaction being removed and any mempool children (ie, update setMemPoolParents
@@ -323,8 +335,13 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
     assert(int(nSigOpCostWithAncestors) >= 0);
 }
 
+static size_t ClusterUsage(const CTxMemPool::Cluster& cluster)
+{
+    return memusage::DynamicUsage(cluster.txs) + memusage::DynamicUsage(cluster.chunks);
+}
+
 CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
-    nTransactionsUpdated(0), minerPolicyEstimator(estimator)
+    nTransactionsUpdated(0), minerPolicyEstimator(estimator), m_epoch(0), m_has_epoch_guard(false), nNextClusterId(1)
 {
     _clear(); //lock free clear
 
@@ -376,24 +393,31 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, setEntries &setAnces
     cachedInnerUsage += entry.DynamicMemoryUsage();
 
     const CTransaction& tx = newit->GetTx();
-    std::set<uint256> setParentTransactions;
-    for (unsigned int i = 0; i < tx.vin.size(); i++) {
-        mapNextTx.insert(std::make_pair(&tx.vin[i].prevout, &tx));
-        setParentTransactions.insert(tx.vin[i].prevout.hash);
-    }
     // Don't bother worrying about child transactions of this one.
     // Normal case of a new transaction arriving is that there can't be any
     // children, because such children would be orphans.
     // An exception to that is if a transaction enters that used to be in a block.
     // In that case, our disconnect block logic will call UpdateTransactionsFromBlock
     // to clean up the mess we're leaving here.
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        mapNextTx.insert(std::make_pair(&tx.vin[i].prevout, &tx));
+        // Linking a parent spent by several inputs again is a no-op.
+        boost::optional<txiter> pit = GetIter(tx.vin[i].prevout.hash);
+        if (pit) {
+            UpdateParent(newit, *pit, true);
+        }
+    }
 
     // Update ancestors with information about this tx
-    for (const auto& pit : GetIterSet(setParentTransactions)) {
-            UpdateParent(newit, pit, true);
+    vecEntries ancestors;
+    ancestors.reserve(setAncestors.size());
+    for (txiter ancestorIt : setAncestors) {
+        ancestors.push_back(ancestorIt);
     }
-    UpdateAncestorsOf(true, newit, setAncestors);
-    UpdateEntryForAncestors(newit, setAncestors);
+    UpdateAncestorsOf(true, newit, ancestors);
+    UpdateEntryForAncestors(newit, ancestors);
+
+    AddToCluster(newit);
 
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
@@ -436,27 +460,82 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 // can save time by not iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit, setEntries& setDescendants) const
 {
-    setEntries stage;
-    if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
+    EpochGuard epoch(*this);
+    vecEntries stage;
+    if (setDescendants.count(entryit) == 0 && !visited(entryit)) {
+        stage.push_back(entryit);
     }
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have either
     // already been walked, or will be walked in this iteration).
     while (!stage.empty()) {
-        txiter it = *stage.begin();
+        txiter it = stage.back();
         setDescendants.insert(it);
-        stage.erase(it);
+        stage.pop_back();
 
         const setEntries &setChildren = GetMemPoolChildren(it);
         for (txiter childiter : setChildren) {
-            if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+            if (!setDescendants.count(childiter) && !visited(childiter)) {
+                stage.push_back(childiter);
             }
         }
     }
 }
 
+void CTxMemPool::WalkAncestors(txiter entryit, vecEntries& ancestors) const
+{
+    EpochGuard epoch(*this);
+    ancestors.clear();
+    visited(entryit);
+    for (txiter parent : GetMemPoolParents(entryit)) {
+        if (!visited(parent)) ancestors.push_back(parent);
+    }
+    // The entries found so far double as the queue of entries to walk.
+    for (size_t i = 0; i < ancestors.size(); ++i) {
+        for (txiter parent : GetMemPoolParents(ancestors[i])) {
+            if (!visited(parent)) ancestors.push_back(parent);
+        }
+    }
+}
+
+void CTxMemPool::WalkDescendants(txiter entryit, vecEntries& descendants) const
+{
+    EpochGuard epoch(*this);
+    descendants.clear();
+    visited(entryit);
+    for (txiter child : GetMemPoolChildren(entryit)) {
+        if (!visited(child)) descendants.push_back(child);
+    }
+    for (size_t i = 0; i < descendants.size(); ++i) {
+        for (txiter child : GetMemPoolChildren(descendants[i])) {
+            if (!visited(child)) descendants.push_back(child);
+        }
+    }
+}
+
+CTxMemPool::EpochGuard::EpochGuard(const CTxMemPool& in) : pool(in)
+{
+    AssertLockHeld(pool.cs);
+    assert(!pool.m_has_epoch_guard);
+    ++pool.m_epoch;
+    pool.m_has_epoch_guard = true;
+}
+
+CTxMemPool::EpochGuard::~EpochGuard()
+{
+    // Entries marked during the traversal must not count as visited by the next one
+    ++pool.m_epoch;
+    pool.m_has_epoch_guard = false;
+}
+
+bool CTxMemPool::visited(txiter it) const
+{
+    assert(m_has_epoch_guard);
+    const bool ret = it->m_epoch >= m_epoch;
+    it->m_epoch = std::max(it->m_epoch, m_epoch);
+    return ret;
+}
+
 void CTxMemPool::removeRecursive(const CTransaction &origTx, MemPoolRemovalReason reason)
 {
     // Remove transaction from memory pool
@@ -489,6 +568,20 @@ void CTxMemPool::removeRecursive(const CTransaction &origTx, MemPoolRemovalReaso
     }
 }
 
+/**
+ * Whether tx has an absolute or relative lock time, i.e. whether it may stop
+ * being final when the chain tip moves back.
+ */
+static bool HasTimeLock(const CTransaction& tx)
+{
+    if (tx.nLockTime != 0) return true;
+    if (tx.nVersion < 2) return false;
+    for (const CTxIn& txin : tx.vin) {
+        if (!(txin.nSequence & CTxIn::SEQUENCE_LOCKTIME_DISABLE_FLAG)) return true;
+    }
+    return false;
+}
+
 void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags)
 {
     // Remove transactions spending a coinbase which are now immature and no-longer-final transactions
@@ -496,6 +589,10 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
     setEntries txToRemove;
     for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         const CTransaction& tx = it->GetTx();
+        // Transactions without lock times that spend no coinbase outputs
+        // cannot be invalidated by the tip moving back, so skip the
+        // (expensive) lock checks for them.
+        if (!it->GetSpendsCoinbase() && !HasTimeLock(tx)) continue;
         LockPoints lp = it->GetLockPoints();
         bool validLP =  TestLockPointValidity(&lp);
         if (!CheckFinalTx(tx, flags) || !CheckSequenceLocks(*this, tx, flags, &lp, validLP)) {
@@ -577,6 +674,9 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 
 void CTxMemPool::_clear()
 {
+    mapClusters.clear();
+    setChunks.clear();
+    cachedClusterUsage = 0;
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
@@ -717,6 +817,33 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
+
+    // Every transaction is in its cluster, after its parents, and the chunks
+    // of all clusters are indexed.
+    size_t nClusterTxs = 0;
+    size_t nChunks = 0;
+    size_t clusterUsage = 0;
+    for (const auto& item : mapClusters) {
+        const Cluster& cluster = item.second;
+        setEntries seen;
+        for (txiter it : cluster.txs) {
+            assert(it->nClusterId == item.first);
+            for (txiter parent : GetMemPoolParents(it)) {
+                assert(seen.count(parent));
+            }
+            seen.insert(it);
+        }
+        assert(!cluster.chunks.empty() && cluster.chunks.back().end == cluster.txs.size());
+        for (size_t i = 0; i < cluster.chunks.size(); ++i) {
+            assert(setChunks.count(ChunkRef{cluster.chunks[i].fee, cluster.chunks[i].size, item.first, i}));
+        }
+        nClusterTxs += cluster.txs.size();
+        nChunks += cluster.chunks.size();
+        clusterUsage += ClusterUsage(cluster);
+    }
+    assert(nClusterTxs == mapTx.size());
+    assert(nChunks == setChunks.size());
+    assert(clusterUsage == cachedClusterUsage);
 }
 
 bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb)
@@ -837,6 +964,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
             for (txiter descendantIt : setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
+            LinearizeCluster(it->nClusterId);
             ++nTransactionsUpdated;
         }
     }
@@ -911,15 +1039,317 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + memusage::DynamicUsage(mapClusters) + memusage::DynamicUsage(setChunks) + cachedClusterUsage + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
     AssertLockHeld(cs);
+    // Take the clusters of the removed transactions apart while their
+    // iterators are valid; what remains of them is split up afterwards.
+    std::set<uint64_t> clusters;
+    for (txiter it : stage) {
+        clusters.insert(it->nClusterId);
+    }
+    std::vector<std::vector<txiter>> remaining;
+    for (uint64_t id : clusters) {
+        std::vector<txiter> txs;
+        for (txiter it : mapClusters.at(id).txs) {
+            if (!stage.count(it)) txs.push_back(it);
+        }
+        if (!txs.empty()) remaining.push_back(std::move(txs));
+        EraseCluster(id);
+    }
+
     UpdateForRemoveFromMempool(stage, updateDescendants);
     for (txiter it : stage) {
         removeUnchecked(it, reason);
     }
+    for (const std::vector<txiter>& txs : remaining) {
+        SplitCluster(txs);
+    }
+}
+
+// Clusters up to this size are linearized by repeatedly picking the
+// transaction with the highest feerate including its ancestors not picked
+// yet, like the ancestor feerate based block assembly. Larger ones, which only
+// arise when a reorg returns transactions to the mempool despite
+// -limitclustercount, are only sorted topologically, as that takes quadratic
+// time and memory.
+static const size_t MAX_CLUSTER_LINEARIZE = 500;
+
+static std::vector<CTxMemPool::txiter> LinearizeTransactions(const CTxMemPool& pool, const std::vector<CTxMemPool::txiter>& txs) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
+{
+    const size_t n = txs.size();
+    std::map<CTxMemPool::txiter, size_t, CTxMemPool::CompareIteratorByHash> index;
+    for (size_t i = 0; i < n; ++i) {
+        index[txs[i]] = i;
+    }
+
+    // Sort topologically, starting from the transactions without parents
+    std::vector<size_t> missing(n);
+    std::vector<size_t> topo;
+    topo.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        missing[i] = pool.GetMemPoolParents(txs[i]).size();
+        if (missing[i] == 0) topo.push_back(i);
+    }
+    for (size_t k = 0; k < topo.size(); ++k) {
+        for (CTxMemPool::txiter child : pool.GetMemPoolChildren(txs[topo[k]])) {
+            const size_t c = index.at(child);
+            if (--missing[c] == 0) topo.push_back(c);
+        }
+    }
+    assert(topo.size() == n);
+
+    std::vector<CTxMemPool::txiter> result;
+    result.reserve(n);
+    if (n > MAX_CLUSTER_LINEARIZE) {
+        for (size_t i : topo) {
+            result.push_back(txs[i]);
+        }
+        return result;
+    }
+
+    // From here on transactions are referred to by their topological position
+    std::vector<size_t> pos(n);
+    for (size_t k = 0; k < n; ++k) {
+        pos[topo[k]] = k;
+    }
+    std::vector<std::vector<bool>> ancestors(n, std::vector<bool>(n));
+    std::vector<std::vector<size_t>> descendants(n);
+    std::vector<CAmount> fee(n), ancestor_fee(n);
+    std::vector<int64_t> size(n), ancestor_size(n);
+    for (size_t k = 0; k < n; ++k) {
+        const CTxMemPool::txiter it = txs[topo[k]];
+        for (CTxMemPool::txiter parent : pool.GetMemPoolParents(it)) {
+            const size_t j = pos[index.at(parent)];
+            ancestors[k][j] = true;
+            for (size_t a = 0; a < j; ++a) {
+                if (ancestors[j][a]) ancestors[k][a] = true;
+            }
+        }
+        fee[k] = ancestor_fee[k] = it->GetModifiedFee();
+        size[k] = ancestor_size[k] = it->GetTxSize();
+        for (size_t a = 0; a < k; ++a) {
+            if (!ancestors[k][a]) continue;
+            ancestor_fee[k] += fee[a];
+            ancestor_size[k] += size[a];
+            descendants[a].push_back(k);
+        }
+    }
+
+    std::vector<bool> done(n);
+    while (result.size() < n) {
+        size_t best = n;
+        for (size_t k = 0; k < n; ++k) {
+            if (done[k]) continue;
+            if (best == n || (double)ancestor_fee[k] * ancestor_size[best] > (double)ancestor_fee[best] * ancestor_size[k]) {
+                best = k;
+            }
+        }
+        // Append it after its remaining ancestors, in topological order
+        for (size_t j = 0; j <= best; ++j) {
+            if (done[j] || (j != best && !ancestors[best][j])) continue;
+            done[j] = true;
+            result.push_back(txs[topo[j]]);
+            for (size_t d : descendants[j]) {
+                ancestor_fee[d] -= fee[j];
+                ancestor_size[d] -= size[j];
+            }
+        }
+    }
+    return result;
+}
+
+uint64_t CTxMemPool::CalculateClusterSize(const setEntries& setAncestors) const
+{
+    AssertLockHeld(cs);
+    std::set<uint64_t> clusters;
+    uint64_t size = 1;
+    for (txiter it : setAncestors) {
+        if (clusters.insert(it->nClusterId).second) {
+            size += mapClusters.at(it->nClusterId).txs.size();
+        }
+    }
+    return size;
+}
+
+void CTxMemPool::AddToCluster(txiter entry)
+{
+    AssertLockHeld(cs);
+    const setEntries& parents = GetMemPoolParents(entry);
+    std::vector<uint64_t> ids;
+    for (txiter parent : parents) {
+        if (std::find(ids.begin(), ids.end(), parent->nClusterId) == ids.end()) ids.push_back(parent->nClusterId);
+    }
+    uint64_t id;
+    if (ids.empty()) {
+        id = nNextClusterId++;
+        mapClusters.emplace(id, Cluster());
+    } else {
+        id = ids.size() == 1 ? ids[0] : MergeClusters(ids);
+    }
+    Cluster& cluster = mapClusters.at(id);
+    cachedClusterUsage -= ClusterUsage(cluster);
+
+    size_t pos = 0;
+    for (const ClusterChunk& chunk : cluster.chunks) {
+        if ((double)chunk.fee * entry->GetTxSize() < (double)entry->GetModifiedFee() * chunk.size) break;
+        pos = chunk.end;
+    }
+    for (size_t i = cluster.txs.size(); i > pos; --i) {
+        if (parents.count(cluster.txs[i - 1])) {
+            pos = i;
+            break;
+        }
+    }
+    entry->nClusterId = id;
+    cluster.txs.reserve(cluster.txs.size() + 1);
+    cluster.txs.insert(cluster.txs.begin() + pos, entry);
+
+    size_t first = 0;
+    while (first < cluster.chunks.size() && cluster.chunks[first].end <= pos) {
+        ++first;
+    }
+    ChunkCluster(id, first);
+    cachedClusterUsage += ClusterUsage(cluster);
+}
+
+uint64_t CTxMemPool::MergeClusters(const std::vector<uint64_t>& ids)
+{
+    AssertLockHeld(cs);
+    const uint64_t id = nNextClusterId++;
+    Cluster& cluster = mapClusters[id];
+    std::vector<const Cluster*> merged;
+    size_t count = 0;
+    for (uint64_t old_id : ids) {
+        merged.push_back(&mapClusters.at(old_id));
+        count += merged.back()->txs.size();
+    }
+    cluster.txs.reserve(count);
+
+    // The clusters are not connected, so taking their chunks highest feerate
+    // first keeps every transaction after its parents, and keeps the chunks.
+    std::vector<size_t> next(merged.size());
+    while (cluster.txs.size() < count) {
+        size_t best = merged.size();
+        for (size_t k = 0; k < merged.size(); ++k) {
+            if (next[k] == merged[k]->chunks.size()) continue;
+            const ClusterChunk& chunk = merged[k]->chunks[next[k]];
+            if (best == merged.size() || (double)chunk.fee * merged[best]->chunks[next[best]].size > (double)merged[best]->chunks[next[best]].fee * chunk.size) {
+                best = k;
+            }
+        }
+        const auto& chunks = merged[best]->chunks;
+        for (size_t i = next[best] ? chunks[next[best] - 1].end : 0; i < chunks[next[best]].end; ++i) {
+            merged[best]->txs[i]->nClusterId = id;
+            cluster.txs.push_back(merged[best]->txs[i]);
+        }
+        ++next[best];
+    }
+
+    for (uint64_t old_id : ids) {
+        EraseCluster(old_id);
+    }
+    ChunkCluster(id, 0);
+    cachedClusterUsage += ClusterUsage(cluster);
+    return id;
+}
+
+void CTxMemPool::EraseCluster(uint64_t id)
+{
+    AssertLockHeld(cs);
+    std::map<uint64_t, Cluster>::iterator cluster = mapClusters.find(id);
+    for (size_t i = 0; i < cluster->second.chunks.size(); ++i) {
+        const ClusterChunk& chunk = cluster->second.chunks[i];
+        setChunks.erase(ChunkRef{chunk.fee, chunk.size, id, i});
+    }
+    cachedClusterUsage -= ClusterUsage(cluster->second);
+    mapClusters.erase(cluster);
+}
+
+void CTxMemPool::SplitCluster(const std::vector<txiter>& remaining)
+{
+    AssertLockHeld(cs);
+    for (txiter it : remaining) {
+        it->nClusterId = 0;
+    }
+    // Walk the transactions connected to each one not yet assigned a cluster
+    std::vector<uint64_t> ids;
+    std::vector<txiter> todo;
+    for (txiter start : remaining) {
+        if (start->nClusterId != 0) continue;
+        const uint64_t id = nNextClusterId++;
+        ids.push_back(id);
+        start->nClusterId = id;
+        todo.push_back(start);
+        while (!todo.empty()) {
+            const txiter next = todo.back();
+            todo.pop_back();
+            for (const setEntries* links : {&GetMemPoolParents(next), &GetMemPoolChildren(next)}) {
+                for (txiter it : *links) {
+                    if (it->nClusterId == id) continue;
+                    it->nClusterId = id;
+                    todo.push_back(it);
+                }
+            }
+        }
+    }
+
+    // What is left of the linearization is still in topological order
+    for (txiter it : remaining) {
+        mapClusters[it->nClusterId].txs.push_back(it);
+    }
+    for (uint64_t id : ids) {
+        Cluster& cluster = mapClusters.at(id);
+        cluster.txs.shrink_to_fit();
+        ChunkCluster(id, 0);
+        cachedClusterUsage += ClusterUsage(cluster);
+    }
+}
+
+void CTxMemPool::ChunkCluster(uint64_t id, size_t first)
+{
+    AssertLockHeld(cs);
+    Cluster& cluster = mapClusters.at(id);
+    for (size_t i = first; i < cluster.chunks.size(); ++i) {
+        setChunks.erase(ChunkRef{cluster.chunks[i].fee, cluster.chunks[i].size, id, i});
+    }
+    cluster.chunks.erase(cluster.chunks.begin() + first, cluster.chunks.end());
+
+    // Each transaction starts a new chunk, which is merged with the chunks
+    // before it as long as it has a higher feerate than them. Chunks before
+    // first are only taken out of setChunks when they are merged.
+    size_t indexed = first;
+    for (size_t i = first ? cluster.chunks[first - 1].end : 0; i < cluster.txs.size(); ++i) {
+        ClusterChunk chunk{cluster.txs[i]->GetModifiedFee(), (int32_t)cluster.txs[i]->GetTxSize(), (uint32_t)(i + 1)};
+        while (!cluster.chunks.empty() && (double)chunk.fee * cluster.chunks.back().size > (double)cluster.chunks.back().fee * chunk.size) {
+            if (cluster.chunks.size() <= indexed) {
+                indexed = cluster.chunks.size() - 1;
+                setChunks.erase(ChunkRef{cluster.chunks.back().fee, cluster.chunks.back().size, id, indexed});
+            }
+            chunk.fee += cluster.chunks.back().fee;
+            chunk.size += cluster.chunks.back().size;
+            cluster.chunks.pop_back();
+        }
+        cluster.chunks.push_back(chunk);
+    }
+    cluster.chunks.shrink_to_fit();
+
+    for (size_t i = indexed; i < cluster.chunks.size(); ++i) {
+        setChunks.insert(ChunkRef{cluster.chunks[i].fee, cluster.chunks[i].size, id, i});
+    }
+}
+
+void CTxMemPool::LinearizeCluster(uint64_t id)
+{
+    AssertLockHeld(cs);
+    Cluster& cluster = mapClusters.at(id);
+    cachedClusterUsage -= ClusterUsage(cluster);
+    const std::vector<txiter> linearization = LinearizeTransactions(*this, std::vector<txiter>(cluster.txs.begin(), cluster.txs.end()));
+    cluster.txs.assign(linearization.begin(), linearization.end());
+    ChunkCluster(id, 0);
+    cachedClusterUsage += ClusterUsage(cluster);
 }
 
 int CTxMemPool::Expire(int64_t time) {
@@ -1021,19 +1451,24 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
-
-        // We set the new mempool min fee to the feerate of the removed set, plus the
+        // Evict the last transaction of the lowest feerate chunk. That is the
+        // end of its cluster's linearization, so it has no descendants.
+        const ChunkRef& chunk = *setChunks.rbegin();
+        const Cluster& cluster = mapClusters.at(chunk.cluster);
+        assert(chunk.index + 1 == cluster.chunks.size());
+        txiter it = cluster.txs.back();
+
+        // We set the new mempool min fee to the feerate of the removed chunk, plus the
         // "minimum reasonable fee rate" (ie some value under which we consider txn
         // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
         // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        CFeeRate removed(chunk.fee, chunk.size);
         removed += incrementalRelayFee;
         trackPackageRemoved(removed);
         maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
 
         setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
+        stage.insert(it);
         nTxnRemoved += stage.size();
 
         std::vector<CTransaction> txn;
@@ -18,6 +18,7 @@
 #include <crypto/siphash.h>
 #include <indirectmap.h>
 #include <policy/feerate.h>
+#include <prevector.h>
 #include <primitives/transaction.h>
 #include <sync.h>
 #include <random.h>
@@ -130,6 +131,8 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t nClusterId; //!< Key of the entry's cluster in mempool's mapClusters
+    mutable uint64_t m_epoch; //!< Last mempool traversal (epoch) that visited this entry
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -533,10 +536,57 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    /** Entries collected by a traversal, stored inline for small packages. */
+    typedef prevector<8, txiter> vecEntries;
 
     const setEntries & GetMemPoolParents(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
     const setEntries & GetMemPoolChildren(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
     uint64_t CalculateDescendantMaximum(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    /** A consecutive part of a cluster's linearization. Its transactions are
+     *  mined and evicted together, at the feerate of their sum. */
+    struct ClusterChunk {
+        CAmount fee;   //!< Sum of the modified fees
+        int32_t size;  //!< Sum of the virtual sizes
+        uint32_t end;  //!< Position in Cluster::txs after the chunk's last transaction
+    };
+
+    /** A connected component of the mempool's transactions, where spending an
+     *  output connects two transactions. The transactions are kept in an order
+     *  in which they can appear in a block and which picks the highest feerate
+     *  sets of transactions first (their linearization). The linearization is
+     *  split into chunks of non-increasing feerate. Most clusters have one or
+     *  two transactions, which are kept inline. */
+    struct Cluster {
+        prevector<2, txiter> txs;
+        prevector<2, ClusterChunk> chunks;
+    };
+
+    /** Entry of setChunks, pointing at the chunk of a cluster */
+    struct ChunkRef {
+        CAmount fee;
+        int64_t size;
+        uint64_t cluster; //!< Key in mapClusters
+        size_t index;     //!< Index in Cluster::chunks
+    };
+
+    /** Sort chunks by decreasing feerate; the chunks of a cluster keep their order */
+    struct CompareChunkRefByFeeRate {
+        bool operator()(const ChunkRef& a, const ChunkRef& b) const
+        {
+            double f1 = (double)a.fee * b.size;
+            double f2 = (double)b.fee * a.size;
+            if (f1 != f2) return f1 > f2;
+            if (a.cluster != b.cluster) return a.cluster < b.cluster;
+            return a.index < b.index;
+        }
+    };
+
+    std::map<uint64_t, Cluster> mapClusters GUARDED_BY(cs);
+    //! The chunks of all clusters, highest feerate first: the order in which
+    //! they are mined, and in reverse, evicted.
+    std::set<ChunkRef, CompareChunkRefByFeeRate> setChunks GUARDED_BY(cs);
+
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
@@ -649,6 +699,10 @@ public:
      *  already in it.  */
     void CalculateDescendants(txiter it, setEntries& setDescendants) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
+    /** Number of transactions in the cluster a new transaction with the given
+     *  in-mempool ancestors would be part of, including itself. */
+    uint64_t CalculateClusterSize(const setEntries& setAncestors) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
     /** The minimum fee to get into the mempool, which may itself not be enough
       *  for larger-sized transactions.
       *  The incrementalRelayFee policy variable is used to bound the time it
@@ -717,9 +771,9 @@ private:
             cacheMap &cachedDescendants,
             const std::set<uint256> &setExclude) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
-    void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void UpdateAncestorsOf(bool add, txiter hash, const vecEntries &ancestors) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Set ancestor state for an entry */
-    void UpdateEntryForAncestors(txiter it, const setEntries &setAncestors) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void UpdateEntryForAncestors(txiter it, const vecEntries &ancestors) EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** For each transaction being removed, update ancestors and any direct children.
       * If updateDescendants is true, then also update in-mempool descendants'
       * ancestor state. */
@@ -736,6 +790,52 @@ private:
      *  removal.
      */
     void removeUnchecked(txiter entry, MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN) EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    /** Traversals of mapLinks mark the entries they visit with the current
+     *  epoch instead of collecting them in a setEntries. An EpochGuard starts
+     *  a new epoch for the duration of one traversal; traversals cannot
+     *  nest. */
+    mutable uint64_t m_epoch GUARDED_BY(cs);
+    mutable bool m_has_epoch_guard GUARDED_BY(cs);
+
+    class EpochGuard {
+        const CTxMemPool& pool;
+    public:
+        explicit EpochGuard(const CTxMemPool& in);
+        ~EpochGuard();
+    };
+    /** Mark the entry as visited in the current epoch. Returns whether it
+     *  was visited before. Requires an EpochGuard. */
+    bool visited(txiter it) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Add the in-mempool ancestors of it, according to mapLinks, to ancestors */
+    void WalkAncestors(txiter it, vecEntries &ancestors) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Add the in-mempool descendants of it to descendants */
+    void WalkDescendants(txiter it, vecEntries &descendants) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    uint64_t nNextClusterId GUARDED_BY(cs);
+    size_t cachedClusterUsage GUARDED_BY(cs); //!< Dynamic memory usage of the clusters' vectors
+
+    /** Add a new transaction, which has no in-mempool children, to the
+     *  cluster of its parents, merging their clusters if there are several.
+     *  It is placed after its parents and after the chunks with at least its
+     *  feerate; only the chunks from there on are computed again. */
+    void AddToCluster(txiter entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Replace the given clusters by one, whose linearization takes their
+     *  chunks in order of feerate, and return its key. */
+    uint64_t MergeClusters(const std::vector<uint64_t>& ids) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Erase a cluster from mapClusters and its chunks from setChunks */
+    void EraseCluster(uint64_t id) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Put the given transactions, the rest of a cluster transactions were
+     *  removed from, into new clusters, one per connected component. They
+     *  keep their order, so only the chunks are computed again. */
+    void SplitCluster(const std::vector<txiter>& remaining) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Compute the chunks of a cluster again from the one at index first on,
+     *  and index them in setChunks. The caller accounts for the memory usage
+     *  of the cluster. */
+    void ChunkCluster(uint64_t id, size_t first) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Compute the linearization and chunks of a cluster from scratch, which
+     *  takes quadratic time in its size. */
+    void LinearizeCluster(uint64_t id) EXCLUSIVE_LOCKS_REQUIRED(cs);
 };
 
 /**
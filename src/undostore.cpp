@@ -0,0 +1,141 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <undostore.h>
+
+#include <undo.h>
+#include <util/system.h>
+
+#include <set>
+#include <vector>
+
+UndoStore::UndoStore(WriteFunction write, FlushFunction flush, FailureFunction on_failure) :
+    m_write(std::move(write)), m_flush(std::move(flush)), m_on_failure(std::move(on_failure)) {}
+
+UndoStore::~UndoStore()
+{
+    Stop();
+}
+
+void UndoStore::Evict()
+{
+    for (auto it = m_order.begin(); m_order.size() > UNDO_CACHE_BLOCKS && it != m_order.end(); ) {
+        auto entry = m_entries.find(*it);
+        if (entry != m_entries.end() && !entry->second.written) {
+            ++it;
+            continue;
+        }
+        if (entry != m_entries.end()) m_entries.erase(entry);
+        it = m_order.erase(it);
+    }
+}
+
+void UndoStore::ThreadWrite()
+{
+    while (true) {
+        std::vector<std::pair<uint256, Entry>> batch;
+        {
+            WAIT_LOCK(m_mutex, lock);
+            m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_stop || !m_queue.empty(); });
+            // Pending writes are finished before stopping
+            if (m_queue.empty()) return;
+            for (const uint256& hash : m_queue) {
+                batch.emplace_back(hash, m_entries.at(hash));
+            }
+            m_queue.clear();
+            m_writing = true;
+        }
+
+        bool ok = true;
+        std::set<int> files;
+        for (const auto& item : batch) {
+            ok = ok && m_write(*item.second.undo, item.second.prev_hash, item.second.pos);
+            files.insert(item.second.pos.nFile);
+        }
+        for (int file : files) {
+            ok = ok && m_flush(file);
+        }
+
+        // Report a failure before Sync() can return
+        if (!ok) {
+            m_on_failure();
+        }
+        {
+            LOCK(m_mutex);
+            for (const auto& item : batch) {
+                m_entries.at(item.first).written = ok;
+            }
+            m_failed |= !ok;
+            m_writing = false;
+            Evict();
+        }
+        m_cond.notify_all();
+    }
+}
+
+void UndoStore::Start()
+{
+    LOCK(m_mutex);
+    if (m_running) return;
+    m_running = true;
+    m_thread = std::thread(&TraceThread<std::function<void()>>, "undowrite", std::function<void()>(std::bind(&UndoStore::ThreadWrite, this)));
+}
+
+void UndoStore::Stop()
+{
+    {
+        LOCK(m_mutex);
+        if (!m_running) return;
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+    LOCK(m_mutex);
+    m_running = false;
+    m_stop = false;
+    m_entries.clear();
+    m_order.clear();
+}
+
+bool UndoStore::Add(const uint256& hash, const uint256& prev_hash, const FlatFilePos& pos, CBlockUndo&& undo)
+{
+    Entry entry{std::make_shared<const CBlockUndo>(std::move(undo)), prev_hash, pos, false};
+    {
+        LOCK(m_mutex);
+        if (m_running) {
+            if (!m_entries.count(hash)) m_order.push_back(hash);
+            m_entries[hash] = std::move(entry);
+            m_queue.push_back(hash);
+            m_cond.notify_all();
+            return true;
+        }
+    }
+    if (!m_write(*entry.undo, entry.prev_hash, entry.pos)) return false;
+    entry.written = true;
+    LOCK(m_mutex);
+    if (!m_entries.count(hash)) m_order.push_back(hash);
+    m_entries[hash] = std::move(entry);
+    Evict();
+    return true;
+}
+
+bool UndoStore::Get(const uint256& hash, const FlatFilePos& pos, CBlockUndo& undo)
+{
+    std::shared_ptr<const CBlockUndo> cached;
+    {
+        LOCK(m_mutex);
+        auto it = m_entries.find(hash);
+        if (it == m_entries.end() || it->second.pos != pos) return false;
+        cached = it->second.undo;
+    }
+    undo = *cached;
+    return true;
+}
+
+bool UndoStore::Sync()
+{
+    WAIT_LOCK(m_mutex, lock);
+    m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_queue.empty() && !m_writing; });
+    return !m_failed;
+}
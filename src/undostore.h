@@ -0,0 +1,89 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UNDOSTORE_H
+#define BITCOIN_UNDOSTORE_H
+
+#include <flatfile.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+
+class CBlockUndo;
+
+/** Number of recently connected blocks whose undo data is kept in memory */
+static const size_t UNDO_CACHE_BLOCKS = 16;
+
+/**
+ * Keeps the undo data of recently connected blocks in memory, and writes it
+ * to the rev files on a background thread once started.
+ *
+ * Space in the rev files is reserved when a block is connected, so the block
+ * index can point to undo data before it has been written. Undo data stays
+ * cached at least until it has been written, so it can always be read back.
+ * Writes are committed to disk in batches, and FlushStateToDisk calls Sync()
+ * before writing the block index, so the index on disk never refers to undo
+ * data that is not.
+ */
+class UndoStore
+{
+public:
+    /** Write the undo data of a block, whose parent is prev_hash, at pos (after its record header). */
+    typedef std::function<bool(const CBlockUndo& undo, const uint256& prev_hash, const FlatFilePos& pos)> WriteFunction;
+    /** Commit the writes made to a rev file to disk. */
+    typedef std::function<bool(int file)> FlushFunction;
+    /** Called on the writer thread after a batch failed to be written. */
+    typedef std::function<void()> FailureFunction;
+
+private:
+    struct Entry {
+        std::shared_ptr<const CBlockUndo> undo;
+        uint256 prev_hash;
+        FlatFilePos pos; //!< Position of the undo data, after its record header
+        bool written;
+    };
+
+    const WriteFunction m_write;
+    const FlushFunction m_flush;
+    const FailureFunction m_on_failure;
+
+    Mutex m_mutex;
+    std::condition_variable m_cond;
+    //! Cached undo data by block hash, and the order it was added in
+    std::map<uint256, Entry> m_entries GUARDED_BY(m_mutex);
+    std::deque<uint256> m_order GUARDED_BY(m_mutex);
+    //! Blocks whose undo data is yet to be written
+    std::deque<uint256> m_queue GUARDED_BY(m_mutex);
+    bool m_writing GUARDED_BY(m_mutex) = false;
+    bool m_failed GUARDED_BY(m_mutex) = false;
+    bool m_running GUARDED_BY(m_mutex) = false;
+    bool m_stop GUARDED_BY(m_mutex) = false;
+    std::thread m_thread;
+
+    void Evict() EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    void ThreadWrite();
+
+public:
+    UndoStore(WriteFunction write, FlushFunction flush, FailureFunction on_failure);
+    ~UndoStore();
+
+    /** Start the writer thread. Until then, Add() writes synchronously. */
+    void Start();
+    /** Stop the writer thread after it has written all queued undo data, and empty the cache. Later writes are synchronous. */
+    void Stop();
+    /** Store the undo data of a block at the reserved position pos, and cache it. */
+    bool Add(const uint256& hash, const uint256& prev_hash, const FlatFilePos& pos, CBlockUndo&& undo);
+    /** Copy the cached undo data of a block stored at pos, if any. */
+    bool Get(const uint256& hash, const FlatFilePos& pos, CBlockUndo& undo);
+    /** Wait for all undo data queued so far to be written and committed to disk. */
+    bool Sync();
+};
+
+#endif // BITCOIN_UNDOSTORE_H
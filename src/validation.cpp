@@ -14,10 +14,15 @@
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
+#include <crypto/siphash.h>
 #include <cuckoocache.h>
 #include <flatfile.h>
+#include <flatfilemap.h>
 #include <hash.h>
+#include <index/coinstatsindex.h>
 #include <index/txindex.h>
+#include <node/utxo_snapshot.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
@@ -30,18 +35,21 @@
 #include <script/sigcache.h>
 #include <script/standard.h>
 #include <shutdown.h>
+#include <threadinterrupt.h>
 #include <timedata.h>
 #include <tinyformat.h>
 #include <txdb.h>
 #include <txmempool.h>
 #include <ui_interface.h>
 #include <undo.h>
+#include <undostore.h>
 #include <util/system.h>
 #include <util/moneystr.h>
 #include <util/strencodings.h>
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <array>
 #include <future>
 #include <sstream>
 
@@ -187,6 +195,13 @@ public:
 
     void PruneBlockIndexCandidates();
 
+    /**
+     * Make pindex, the base block of a UTXO snapshot that was loaded into
+     * pcoinsTip, the tip of the active chain. Its ancestors remain without
+     * data until they are downloaded.
+     */
+    void ActivateSnapshotBase(CBlockIndex* pindex, uint64_t chain_tx_count) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     void UnloadBlockIndex();
 
 private:
@@ -196,6 +211,11 @@ private:
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /** Create a new block index entry for a given block hash */
     CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /**
+     * Load the block index entries from the block index snapshot, if it
+     * matches the block tree database. Appends them to entries, parents first.
+     */
+    bool LoadBlockIndexSnapshot(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree, std::vector<CBlockIndex*>& entries) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /**
      * Make various assertions about the state of the block index.
      *
@@ -230,6 +250,7 @@ Mutex g_best_block_mutex;
 std::condition_variable g_best_block_cv;
 uint256 g_best_block;
 int nScriptCheckThreads = 0;
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fHavePruned = false;
@@ -281,6 +302,9 @@ namespace {
 
     /** Dirty block file entries. */
     std::set<int> setDirtyFileInfo;
+
+    /** Block index entries loaded from a block index snapshot, which are allocated and freed together. */
+    std::vector<CBlockIndex> g_block_index_arena;
 } // anon namespace
 
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
@@ -303,9 +327,16 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewBackgroundWriter> pcoinsdbwriter;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
+CBlockIndex* g_snapshot_base = nullptr;
+bool g_snapshot_validated = false;
+int g_snapshot_validation_height = -1;
+/** Metadata of the snapshot g_snapshot_base is the base block of */
+static SnapshotMetadata g_snapshot_metadata GUARDED_BY(cs_main);
+
 enum class FlushStateMode {
     NONE,
     IF_NEEDED,
@@ -318,6 +349,7 @@ static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
+static void CacheScriptExecution(const CTransaction& tx, unsigned int flags) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 static FILE* OpenUndoFile(const FlatFilePos &pos, bool fReadOnly = false);
 static FlatFileSeq BlockFileSeq();
 static FlatFileSeq UndoFileSeq();
@@ -445,7 +477,8 @@ bool CheckSequenceLocks(const CTxMemPool& pool, const CTransaction& tx, int flag
 }
 
 // Returns the script flags which should be checked for a given block
-static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& chainparams);
+// Non-static (and re-declared) in src/test/txvalidationcache_tests.cpp
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& chainparams);
 
 static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     int expired = pool.Expire(GetTime() - age);
@@ -595,7 +628,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     // Do not work on transactions that are too small.
     // A transaction with 1 segwit input and 1 P2WPHK output has non-witness size of 82 bytes.
     // Transactions smaller than this are not relayed to reduce unnecessary malloc overhead.
-    if (::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) < MIN_STANDARD_TX_NONWITNESS_SIZE)
+    if (tx.GetStrippedSize() < MIN_STANDARD_TX_NONWITNESS_SIZE)
         return state.DoS(0, false, REJECT_NONSTANDARD, "tx-size-small");
 
     // Only accept nLockTime-using transactions that can be mined in the next
@@ -762,6 +795,15 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
         }
 
+        // The linearization of a cluster is kept up to date on every change,
+        // which gets more expensive the larger it is.
+        const uint64_t nLimitCluster = gArgs.GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT);
+        const uint64_t nClusterSize = pool.CalculateClusterSize(setAncestors);
+        if (nClusterSize > nLimitCluster) {
+            return state.DoS(0, false, REJECT_NONSTANDARD, "too-large-mempool-cluster", false,
+                             strprintf("cluster would have %u transactions [limit: %u]", nClusterSize, nLimitCluster));
+        }
+
         // A transaction that spends outputs that would be replaced by it is invalid. Now
         // that we have the set of all ancestors we can detect this
         // pathological case by making sure setConflicts and setAncestors don't
@@ -1001,6 +1043,108 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee, test_accept);
 }
 
+void AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& txs, std::vector<bool>& accepted,
+                             std::vector<CValidationState>& states, std::vector<bool>& missing_inputs,
+                             bool bypass_limits, const CAmount nAbsurdFee)
+{
+    AssertLockHeld(cs_main);
+    const CChainParams& chainparams = Params();
+    LOCK(pool.cs);
+    const size_t n = txs.size();
+    accepted.assign(n, false);
+    states.assign(n, CValidationState());
+    missing_inputs.assign(n, false);
+
+    // Order the batch so that every transaction comes after the transactions
+    // of the batch that it spends.
+    std::map<uint256, size_t> positions;
+    for (size_t i = 0; i < n; ++i) {
+        positions.emplace(txs[i]->GetHash(), i);
+    }
+    std::vector<std::vector<size_t>> children(n);
+    std::vector<size_t> num_parents(n);
+    for (size_t i = 0; i < n; ++i) {
+        std::set<size_t> parents;
+        for (const CTxIn& txin : txs[i]->vin) {
+            auto it = positions.find(txin.prevout.hash);
+            if (it != positions.end() && it->second != i) parents.insert(it->second);
+        }
+        for (size_t parent : parents) {
+            children[parent].push_back(i);
+        }
+        num_parents[i] = parents.size();
+    }
+    std::vector<size_t> order;
+    order.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (num_parents[i] == 0) order.push_back(i);
+    }
+    for (size_t k = 0; k < order.size(); ++k) {
+        for (size_t child : children[order[k]]) {
+            if (--num_parents[child] == 0) order.push_back(child);
+        }
+    }
+    assert(order.size() == n);
+
+    std::vector<std::vector<COutPoint>> coins_to_uncache(n);
+    if (nScriptCheckThreads) {
+        // Fetch the coins spent by the batch into one view, and verify the
+        // scripts of all its transactions on the script check threads. If they
+        // are all valid, the result is stored in the script execution cache,
+        // so that accepting the transactions below does not verify them
+        // again. Otherwise they are verified again one by one, to tell which
+        // of them are invalid.
+        CCoinsView dummy;
+        CCoinsViewCache view(&dummy);
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+        view.SetBackend(viewMemPool);
+        std::vector<PrecomputedTransactionData> txdata;
+        txdata.reserve(n);
+        std::vector<const CTransaction*> verified;
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        for (size_t i : order) {
+            const CTransaction& tx = *txs[i];
+            if (tx.IsCoinBase()) continue;
+            bool have_inputs = true;
+            for (const CTxIn& txin : tx.vin) {
+                if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                    coins_to_uncache[i].push_back(txin.prevout);
+                }
+                have_inputs = have_inputs && view.HaveCoin(txin.prevout);
+            }
+            if (!have_inputs) continue;
+
+            txdata.emplace_back(tx);
+            std::vector<CScriptCheck> checks;
+            CValidationState stateDummy;
+            if (!CheckInputs(tx, stateDummy, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, true, txdata.back(), &checks)) continue;
+            control.Add(checks);
+            verified.push_back(&tx);
+            // Make the outputs available to the transactions of the batch spending them
+            AddCoins(view, tx, MEMPOOL_HEIGHT, true);
+        }
+        if (control.Wait()) {
+            for (const CTransaction* tx : verified) {
+                CacheScriptExecution(*tx, STANDARD_SCRIPT_VERIFY_FLAGS);
+            }
+        }
+    }
+
+    for (size_t i : order) {
+        bool fMissingInputs;
+        accepted[i] = AcceptToMemoryPoolWorker(chainparams, pool, states[i], txs[i], &fMissingInputs, GetTime(), nullptr /* plTxnReplaced */,
+                                               bypass_limits, nAbsurdFee, coins_to_uncache[i], false /* test_accept */);
+        missing_inputs[i] = fMissingInputs;
+        if (!accepted[i]) {
+            for (const COutPoint& hashTx : coins_to_uncache[i])
+                pcoinsTip->Uncache(hashTx);
+        }
+    }
+    // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
+    CValidationState stateDummy;
+    FlushStateToDisk(chainparams, stateDummy, FlushStateMode::PERIODIC);
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -1066,21 +1210,56 @@ static bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos, const CMessa
     return true;
 }
 
+/** Number of block files kept memory mapped for reading blocks. */
+static const size_t BLOCK_FILE_MAPS = 16;
+static FlatFileMapCache g_block_file_maps(BLOCK_FILE_MAPS);
+
+/**
+ * Get the bytes of the block stored at pos from a mapping of its block file,
+ * sized by the record header that precedes the block. If message_start is
+ * given, the network magic of the record must match it. Returns false if the
+ * block could not be mapped; callers then fall back to reading the file,
+ * which also reports any error.
+ */
+static bool MapBlockFromDisk(FlatFileSpan& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars* message_start)
+{
+    if (pos.IsNull() || pos.nPos < 8) return false;
+    const fs::path path = BlockFileSeq().FileName(pos);
+
+    FlatFileSpan header;
+    if (!g_block_file_maps.Read(path, pos.nPos - 8, 8, header)) return false;
+    if (message_start && memcmp(header.data(), *message_start, CMessageHeader::MESSAGE_START_SIZE)) return false;
+    const uint32_t blk_size = ReadLE32(header.data() + CMessageHeader::MESSAGE_START_SIZE);
+    if (blk_size > MAX_SIZE) return false;
+
+    return g_block_file_maps.Read(path, pos.nPos, blk_size, block);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    FlatFileSpan block_data;
+    if (MapBlockFromDisk(block_data, pos, nullptr)) {
+        try {
+            SpanReader(SER_DISK, CLIENT_VERSION, block_data.Get()) >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1152,6 +1331,25 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex
     return ReadRawBlockFromDisk(block, block_pos, message_start);
 }
 
+bool ReadRawBlockFromDisk(FlatFileSpan& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+{
+    FlatFilePos block_pos;
+    {
+        LOCK(cs_main);
+        block_pos = pindex->GetBlockPos();
+    }
+
+    if (MapBlockFromDisk(block, block_pos, &message_start)) {
+        return true;
+    }
+    std::vector<uint8_t> block_data;
+    if (!ReadRawBlockFromDisk(block_data, block_pos, message_start)) {
+        return false;
+    }
+    block = FlatFileSpan(std::move(block_data));
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1370,6 +1568,24 @@ void InitScriptExecutionCache() {
  *
  * Non-static (and re-declared) in src/test/txvalidationcache_tests.cpp
  */
+/** Key of the script execution cache entry recording that tx's scripts are valid under flags */
+static uint256 ScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    // We only use the first 19 bytes of nonce to avoid a second SHA
+    // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
+/** Record that the scripts of tx were verified under flags, when their checks were deferred to pvChecks */
+static void CacheScriptExecution(const CTransaction& tx, unsigned int flags)
+{
+    AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
+    scriptExecutionCache.insert(ScriptExecutionCacheEntry(tx, flags));
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     if (!tx.IsCoinBase())
@@ -1392,11 +1608,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             // correct (ie that the transaction hash which is in tx's prevouts
             // properly commits to the scriptPubKey in the inputs view of that
             // transaction).
-            uint256 hashCacheEntry;
-            // We only use the first 19 bytes of nonce to avoid a second SHA
-            // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
-            static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
-            CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+            const uint256 hashCacheEntry = ScriptExecutionCacheEntry(tx, flags);
             AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
             if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
                 return true;
@@ -1482,13 +1694,46 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint25
     return true;
 }
 
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+/** Abort with a message */
+static bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
+{
+    SetMiscWarning(strMessage);
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(
+        userMessage.empty() ? _("Error: A fatal internal error occurred, see debug.log for details") : userMessage,
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+    return false;
+}
+
+static bool AbortNode(CValidationState& state, const std::string& strMessage, const std::string& userMessage="")
+{
+    AbortNode(strMessage, userMessage);
+    return state.Error(strMessage);
+}
+
+static UndoStore g_undo_store(
+    [](const CBlockUndo& undo, const uint256& prev_hash, const FlatFilePos& pos) {
+        FlatFilePos header_pos(pos.nFile, pos.nPos - 8);
+        return UndoWriteToDisk(undo, header_pos, prev_hash, Params().MessageStart()) && header_pos == pos;
+    },
+    [](int file) { return UndoFileSeq().Flush(FlatFilePos(file, 0)); },
+    []() { AbortNode("Failed to write undo data"); });
+
+} // namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
 {
     FlatFilePos pos = pindex->GetUndoPos();
     if (pos.IsNull()) {
         return error("%s: no undo data available", __func__);
     }
 
+    // Recently connected blocks, including those whose undo data is still being written
+    if (g_undo_store.Get(pindex->GetBlockHash(), pos, blockundo)) {
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1513,26 +1758,6 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
     return true;
 }
 
-/** Abort with a message */
-static bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
-{
-    SetMiscWarning(strMessage);
-    LogPrintf("*** %s\n", strMessage);
-    uiInterface.ThreadSafeMessageBox(
-        userMessage.empty() ? _("Error: A fatal internal error occurred, see debug.log for details") : userMessage,
-        "", CClientUIInterface::MSG_ERROR);
-    StartShutdown();
-    return false;
-}
-
-static bool AbortNode(CValidationState& state, const std::string& strMessage, const std::string& userMessage="")
-{
-    AbortNode(strMessage, userMessage);
-    return state.Error(strMessage);
-}
-
-} // namespace
-
 /**
  * Restore the UTXO in a Coin at a given COutPoint
  * @param undo The Coin to be restored.
@@ -1643,14 +1868,16 @@ void static FlushBlockFile(bool fFinalize = false)
 
 static bool FindUndoPos(CValidationState &state, int nFile, FlatFilePos &pos, unsigned int nAddSize);
 
-static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams)
+static bool WriteUndoDataForBlock(CBlockUndo&& blockundo, CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams)
 {
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull()) {
         FlatFilePos _pos;
         if (!FindUndoPos(state, pindex->nFile, _pos, ::GetSerializeSize(blockundo, CLIENT_VERSION) + 40))
             return error("ConnectBlock(): FindUndoPos failed");
-        if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+        // The undo data follows the record header (network magic and size)
+        _pos.nPos += 8;
+        if (!g_undo_store.Add(pindex->GetBlockHash(), pindex->pprev->GetBlockHash(), _pos, std::move(blockundo)))
             return AbortNode(state, "Failed to write undo data");
 
         // update nUndoPos in block index
@@ -1662,13 +1889,324 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
     return true;
 }
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
-
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+namespace {
+
+/** Number of (key-ordered) outpoints looked up by a single prefetch job */
+static const size_t PREFETCH_JOB_SIZE = 16;
+
+/**
+ * Closure representing the lookup of a contiguous run of outpoints in a
+ * thread-safe CCoinsView. Results are written to caller-owned storage;
+ * outpoints that are not found are left as spent coins.
+ */
+class CCoinsPrefetchJob
+{
+private:
+    const CCoinsView* view;
+    const COutPoint* outpoints;
+    Coin* coins;
+    size_t count;
+
+public:
+    CCoinsPrefetchJob() : view(nullptr), outpoints(nullptr), coins(nullptr), count(0) {}
+    CCoinsPrefetchJob(const CCoinsView* viewIn, const COutPoint* outpointsIn, Coin* coinsIn, size_t countIn) :
+        view(viewIn), outpoints(outpointsIn), coins(coinsIn), count(countIn) {}
+
+    bool operator()() {
+        for (size_t i = 0; i < count; i++) {
+            try {
+                view->GetCoin(outpoints[i], coins[i]);
+            } catch (const std::exception&) {
+                // Leave the entry empty: the serial pass in ConnectBlock will
+                // repeat the lookup through the regular (error handling) path.
+                coins[i].Clear();
+            }
+        }
+        return true;
+    }
+
+    void swap(CCoinsPrefetchJob& job) {
+        std::swap(view, job.view);
+        std::swap(outpoints, job.outpoints);
+        std::swap(coins, job.coins);
+        std::swap(count, job.count);
+    }
+};
+
+} // namespace
+
+static CCheckQueue<CCoinsPrefetchJob> coinsprefetchqueue(8);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcoin-coinspf");
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Validation worker threads, each entry being a script check thread and a
+ * coins prefetch thread. Both kinds of work are never in progress at the
+ * same time (inputs of a block are prefetched before its scripts are queued),
+ * so every entry makes one more core available to either stage.
+ */
+static std::vector<std::pair<std::unique_ptr<boost::thread>, std::unique_ptr<boost::thread>>> g_validation_threads GUARDED_BY(cs_main);
+
+static ScriptCheckStats g_last_block_script_check_stats GUARDED_BY(cs_main);
+
+int GetMaxScriptCheckThreads()
+{
+    // Threads beyond the number of cores only add contention, and each of
+    // them brings a prefetch thread along.
+    return std::min(MAX_SCRIPTCHECK_THREADS, std::max(MIN_MAX_SCRIPTCHECK_THREADS, 2 * GetNumCores()));
+}
+
+int SetScriptCheckThreads(int nThreads)
+{
+    const int nMaxThreads = GetMaxScriptCheckThreads();
+    LOCK(cs_main);
+    if (nThreads <= 1) {
+        nThreads = 0;
+    } else if (nThreads > nMaxThreads) {
+        nThreads = nMaxThreads;
+    }
+    // Holding cs_main guarantees that no block is being validated, so
+    // surplus workers are idle and exit as soon as they are interrupted.
+    const size_t nWorkers = nThreads ? nThreads - 1 : 0;
+    while (g_validation_threads.size() > nWorkers) {
+        auto& workers = g_validation_threads.back();
+        workers.first->interrupt();
+        workers.second->interrupt();
+        workers.first->join();
+        workers.second->join();
+        g_validation_threads.pop_back();
+    }
+    while (g_validation_threads.size() < nWorkers) {
+        g_validation_threads.emplace_back(MakeUnique<boost::thread>(&ThreadScriptCheck), MakeUnique<boost::thread>(&ThreadCoinsPrefetch));
+    }
+    nScriptCheckThreads = nThreads;
+    return nThreads;
+}
+
+void StopScriptCheckThreads()
+{
+    SetScriptCheckThreads(0);
+}
+
+ScriptCheckStats GetLastBlockScriptCheckStats()
+{
+    LOCK(cs_main);
+    return g_last_block_script_check_stats;
+}
+
+namespace {
+
+/**
+ * Loads blocks that are about to be connected ahead of the connect cursor.
+ *
+ * ActivateBestChainStep announces the blocks it is going to connect next;
+ * up to m_depth of them are read from disk and checked with CheckBlock on
+ * the pipeline threads, outside of cs_main. ConnectTip then picks up the
+ * loaded block instead of reading it itself, and ConnectBlock's CheckBlock
+ * call is a no-op for it. A block that fails to load or check is simply not
+ * handed out, so that ConnectTip repeats (and reports) the failure itself.
+ */
+class BlockPipeline
+{
+private:
+    typedef std::shared_future<std::shared_ptr<const CBlock>> BlockFuture;
+
+    Mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<std::function<void()>> m_jobs GUARDED_BY(m_mutex);
+    bool m_stop GUARDED_BY(m_mutex) = false;
+    std::vector<std::thread> m_threads;
+
+    //! Blocks scheduled for loading, by hash
+    std::map<uint256, BlockFuture> m_loading GUARDED_BY(cs_main);
+    int m_depth GUARDED_BY(cs_main) = 0;
+
+    void ThreadLoad()
+    {
+        while (true) {
+            std::function<void()> job;
+            {
+                WAIT_LOCK(m_mutex, lock);
+                m_cond.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(m_mutex) { return m_stop || !m_jobs.empty(); });
+                if (m_stop) return;
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    static std::shared_ptr<const CBlock> LoadBlock(const FlatFilePos& pos, const uint256& hash, const Consensus::Params& params)
+    {
+        std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+        try {
+            if (!ReadBlockFromDisk(*block, pos, params) || block->GetHash() != hash) return nullptr;
+        } catch (const std::exception&) {
+            return nullptr;
+        }
+        CValidationState state;
+        if (!CheckBlock(*block, state, params)) return nullptr;
+        return block;
+    }
+
+public:
+    void Start(int depth)
+    {
+        {
+            LOCK(cs_main);
+            m_depth = depth;
+        }
+        if (depth <= 0) return;
+        const int threads = std::max(1, std::min(depth, GetNumCores()));
+        for (int i = 0; i < threads; i++) {
+            m_threads.emplace_back(&TraceThread<std::function<void()>>, "blockload", std::function<void()>(std::bind(&BlockPipeline::ThreadLoad, this)));
+        }
+    }
+
+    void Stop()
+    {
+        {
+            LOCK(m_mutex);
+            m_stop = true;
+            m_jobs.clear();
+        }
+        m_cond.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+        m_threads.clear();
+        LOCK(cs_main);
+        m_loading.clear();
+        m_depth = 0;
+        LOCK(m_mutex);
+        m_stop = false;
+    }
+
+    /** Schedule loading of the first blocks of vpindex (in connect order), dropping blocks outside of it. */
+    void Prime(const std::vector<CBlockIndex*>& vpindex, const Consensus::Params& params) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+    {
+        if (m_depth <= 0) return;
+        std::map<uint256, BlockFuture> loading;
+        std::vector<std::function<void()>> jobs;
+        for (CBlockIndex* pindex : vpindex) {
+            if ((int)loading.size() >= m_depth) break;
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA)) break;
+            const uint256 hash = pindex->GetBlockHash();
+            auto it = m_loading.find(hash);
+            if (it != m_loading.end()) {
+                loading.emplace(hash, std::move(it->second));
+                continue;
+            }
+            auto promise = std::make_shared<std::promise<std::shared_ptr<const CBlock>>>();
+            loading.emplace(hash, promise->get_future().share());
+            const FlatFilePos pos = pindex->GetBlockPos();
+            jobs.emplace_back([promise, pos, hash, &params]() { promise->set_value(LoadBlock(pos, hash, params)); });
+        }
+        m_loading.swap(loading);
+        if (jobs.empty()) return;
+        {
+            LOCK(m_mutex);
+            if (m_stop) return;
+            for (auto& job : jobs) {
+                m_jobs.push_back(std::move(job));
+            }
+        }
+        m_cond.notify_all();
+    }
+
+    /** Return the block for pindex if it was loaded and checked ahead of time, waiting for it if needed. */
+    std::shared_ptr<const CBlock> Take(const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+    {
+        auto it = m_loading.find(pindex->GetBlockHash());
+        if (it == m_loading.end()) return nullptr;
+        BlockFuture future = std::move(it->second);
+        m_loading.erase(it);
+        try {
+            return future.get();
+        } catch (const std::future_error&) {
+            // The job was dropped by Stop()
+            return nullptr;
+        }
+    }
+};
+
+} // namespace
+
+static BlockPipeline g_block_pipeline;
+
+void StartBlockPipeline(int depth)
+{
+    g_block_pipeline.Start(std::min(depth, MAX_BLOCK_PIPELINE_DEPTH));
+}
+
+void StopBlockPipeline()
+{
+    g_block_pipeline.Stop();
+}
+
+void StartUndoWriter()
+{
+    g_undo_store.Start();
+}
+
+void StopUndoWriter()
+{
+    g_undo_store.Stop();
+}
+
+void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache, const CCoinsView& db)
+{
+    // Outputs created within the block cannot be found in the backing store.
+    std::vector<uint256> block_txids;
+    block_txids.reserve(block.vtx.size());
+    for (const auto& tx : block.vtx) {
+        block_txids.push_back(tx->GetHash());
+    }
+    std::sort(block_txids.begin(), block_txids.end());
+
+    std::vector<COutPoint> outpoints;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase()) continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (std::binary_search(block_txids.begin(), block_txids.end(), txin.prevout.hash)) continue;
+            if (cache.HaveCoinInCache(txin.prevout)) continue;
+            outpoints.push_back(txin.prevout);
+        }
+    }
+    if (outpoints.empty()) return;
+
+    // Sorting by outpoint matches the order of the DB_COIN keys, so every job
+    // reads a narrow key range of the database.
+    std::sort(outpoints.begin(), outpoints.end());
+    outpoints.erase(std::unique(outpoints.begin(), outpoints.end()), outpoints.end());
+
+    std::vector<Coin> coins(outpoints.size());
+    {
+        CCheckQueueControl<CCoinsPrefetchJob> control(&coinsprefetchqueue);
+        std::vector<CCoinsPrefetchJob> jobs;
+        jobs.reserve((outpoints.size() + PREFETCH_JOB_SIZE - 1) / PREFETCH_JOB_SIZE);
+        for (size_t i = 0; i < outpoints.size(); i += PREFETCH_JOB_SIZE) {
+            jobs.emplace_back(&db, &outpoints[i], &coins[i], std::min(PREFETCH_JOB_SIZE, outpoints.size() - i));
+        }
+        control.Add(jobs);
+        control.Wait();
+    }
+
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (!coins[i].IsSpent()) {
+            cache.InsertFetchedCoin(outpoints[i], std::move(coins[i]));
+        }
+    }
+}
+
 VersionBitsCache versionbitscache GUARDED_BY(cs_main);
 
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
@@ -1721,7 +2259,7 @@ static bool IsScriptWitnessEnabled(const Consensus::Params& params)
     return params.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout != 0;
 }
 
-static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
     AssertLockHeld(cs_main);
 
     unsigned int flags = SCRIPT_VERIFY_NONE;
@@ -1770,6 +2308,7 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -1953,9 +2492,26 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // Get the script flags for this block
     unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
 
+    // Near the tip, keep (and add) the script execution results of the block's
+    // transactions in the cache instead of consuming them, so that they need
+    // not be verified again if a reorg returns them to the mempool.
+    const bool fRetainScriptResults = fScriptChecks && !fJustCheck && !IsInitialBlockDownload();
+
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
 
+    // Resolve the block's inputs into the coins tip cache on the prefetch
+    // threads, so that the serial pass below does not wait on the database
+    // for every input. This only helps when view sits on the tip cache;
+    // blocks connected on other views (VerifyDB, blocks below the base of
+    // a UTXO snapshot) would only fill the tip cache with unrelated coins.
+    if (!fJustCheck && nScriptCheckThreads && pcoinsTip && pcoinsdbview && view.GetBackend() == pcoinsTip.get()) {
+        // Coins that are still being written are only visible through the writer.
+        PrefetchBlockInputs(block, *pcoinsTip, pcoinsdbwriter ? static_cast<const CCoinsView&>(*pcoinsdbwriter) : *pcoinsdbview);
+    }
+    int64_t nTime2p = GetTimeMicros(); nTimePrefetch += nTime2p - nTime2;
+    LogPrint(BCLog::BENCH, "    - Prefetch inputs: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2p - nTime2), nTimePrefetch * MICRO, nTimePrefetch * MILLI / nBlocksTotal);
+
     CBlockUndo blockundo;
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
@@ -2013,7 +2569,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         {
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults || fRetainScriptResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -2037,13 +2593,35 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 
     if (!control.Wait())
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
+    if (fRetainScriptResults) {
+        for (const auto& tx : block.vtx) {
+            if (!tx->IsCoinBase()) CacheScriptExecution(*tx, flags);
+        }
+    }
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
 
+    if (!fJustCheck) {
+        ScriptCheckStats& stats = g_last_block_script_check_stats;
+        stats.height = pindex->nHeight;
+        stats.wall_time = nTime4 - nTime2p;
+        if (!fScriptChecks) {
+            stats.threads_used = 0;
+            stats.busy_time = 0;
+        } else if (nScriptCheckThreads) {
+            scriptcheckqueue.GetLastRoundStats(stats.threads_used, stats.busy_time);
+        } else {
+            // Scripts were verified inline by CheckInputs
+            stats.threads_used = 1;
+            stats.busy_time = stats.wall_time;
+        }
+        LogPrint(BCLog::BENCH, "    - Script check threads: %u used, %.2fms busy in %.2fms\n", stats.threads_used, MILLI * stats.busy_time, MILLI * stats.wall_time);
+    }
+
     if (fJustCheck)
         return true;
 
-    if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
+    if (!WriteUndoDataForBlock(std::move(blockundo), state, pindex, chainparams))
         return false;
 
     if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
@@ -2064,6 +2642,41 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     return true;
 }
 
+/**
+ * Write the block and undo data and the dirty block index entries to disk,
+ * without the chainstate.
+ */
+static bool WriteBlockIndex(CValidationState& state) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    LOCK(cs_LastBlockFile);
+    // Depend on nMinDiskSpace to ensure we can write block index
+    if (!CheckDiskSpace(GetBlocksDir())) {
+        return AbortNode(state, "Disk space is low!", _("Error: Disk space is low!"));
+    }
+    // First make sure all block and undo data is flushed to disk.
+    if (!g_undo_store.Sync()) {
+        return AbortNode(state, "Failed to write undo data");
+    }
+    FlushBlockFile();
+    // Then update all block file information (which may refer to block and undo files).
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    vFiles.reserve(setDirtyFileInfo.size());
+    for (std::set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
+        vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
+        setDirtyFileInfo.erase(it++);
+    }
+    std::vector<const CBlockIndex*> vBlocks;
+    vBlocks.reserve(setDirtyBlockIndex.size());
+    for (std::set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
+        vBlocks.push_back(*it);
+        setDirtyBlockIndex.erase(it++);
+    }
+    if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+        return AbortNode(state, "Failed to write to block index database");
+    }
+    return true;
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -2109,7 +2722,8 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             nLastFlush = nNow;
         }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // The piece of an earlier flush that is still being written counts against the budget too.
+        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() + (pcoinsdbwriter ? pcoinsdbwriter->DynamicMemoryUsage() : 0);
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FlushStateMode::PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
@@ -2119,37 +2733,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         bool fPeriodicWrite = mode == FlushStateMode::PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
         bool fPeriodicFlush = mode == FlushStateMode::PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
-        // Combine all conditions that result in a full cache flush.
+        // Combine all conditions that result in writing the cache.
         fDoFullFlush = (mode == FlushStateMode::ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
         // Write blocks and block index to disk.
         if (fDoFullFlush || fPeriodicWrite) {
-            // Depend on nMinDiskSpace to ensure we can write block index
-            if (!CheckDiskSpace(GetBlocksDir())) {
-                return AbortNode(state, "Disk space is low!", _("Error: Disk space is low!"));
-            }
-            // First make sure all block and undo data is flushed to disk.
-            FlushBlockFile();
-            // Then update all block file information (which may refer to block and undo files).
-            {
-                std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
-                vFiles.reserve(setDirtyFileInfo.size());
-                for (std::set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
-                    vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
-                    setDirtyFileInfo.erase(it++);
-                }
-                std::vector<const CBlockIndex*> vBlocks;
-                vBlocks.reserve(setDirtyBlockIndex.size());
-                for (std::set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                    vBlocks.push_back(*it);
-                    setDirtyBlockIndex.erase(it++);
-                }
-                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
-                    return AbortNode(state, "Failed to write to block index database");
-                }
+            if (!WriteBlockIndex(state)) {
+                return false;
             }
-            // Finally remove any pruned files
-            if (fFlushForPrune)
-                UnlinkPrunedFiles(setFilesToPrune);
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2162,16 +2752,37 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(GetDataDir(), 48 * 2 * 2 * pcoinsTip->GetCacheSize())) {
                 return AbortNode(state, "Disk space is low!", _("Error: Disk space is low!"));
             }
-            // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Write the chainstate (which may refer to block index entries).
+            // The cache stays warm: only when it has outgrown its budget, its
+            // least recently used entries are dropped.
+            if (!pcoinsTip->Sync())
                 return AbortNode(state, "Failed to write to coin database");
+            if (fCacheLarge || fCacheCritical) {
+                pcoinsTip->Trim(nTotalSpace / 100 * COINS_CACHE_TRIM_PERCENT);
+                LogPrint(BCLog::COINDB, "Trimmed coins cache from %.1f MiB to %.1f MiB\n", cacheSize * (1.0 / (1 << 20)), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)));
+            }
             nLastFlush = nNow;
             full_flush_completed = true;
         }
+        // Finally remove any pruned files. The chainstate must be on disk
+        // first, as a restart may need to replay blocks from them until then.
+        if (fFlushForPrune) {
+            if (pcoinsdbwriter && !pcoinsdbwriter->Wait()) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
+            UnlinkPrunedFiles(setFilesToPrune);
+        }
     }
     if (full_flush_completed) {
-        // Update best block in wallet (so we can detect restored wallets).
-        GetMainSignals().ChainStateFlushed(chainActive.GetLocator());
+        // Update best block in wallet (so we can detect restored wallets),
+        // once the chainstate is on disk.
+        const CBlockLocator locator = chainActive.GetLocator();
+        std::function<void()> notify = [locator] { GetMainSignals().ChainStateFlushed(locator); };
+        if (pcoinsdbwriter) {
+            pcoinsdbwriter->NotifyWhenWritten(std::move(notify));
+        } else {
+            notify();
+        }
     }
     } catch (const std::runtime_error& e) {
         return AbortNode(state, std::string("System error while flushing: ") + e.what());
@@ -2185,6 +2796,10 @@ void FlushStateToDisk() {
     if (!FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS)) {
         LogPrintf("%s: failed to flush state (%s)\n", __func__, FormatStateMessage(state));
     }
+    // Callers rely on the chainstate being on disk afterwards.
+    if (pcoinsdbwriter && !pcoinsdbwriter->Wait()) {
+        LogPrintf("%s: failed to write the coin database\n", __func__);
+    }
 }
 
 void PruneAndFlush() {
@@ -2400,11 +3015,14 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime1 = GetTimeMicros();
     std::shared_ptr<const CBlock> pthisBlock;
     if (!pblock) {
+        pthisBlock = g_block_pipeline.Take(pindexNew);
+    }
+    if (!pblock && !pthisBlock) {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
         pthisBlock = pblockNew;
-    } else {
+    } else if (pblock) {
         pthisBlock = pblock;
     }
     const CBlock& blockConnecting = *pthisBlock;
@@ -2518,6 +3136,20 @@ void CChainState::PruneBlockIndexCandidates() {
     assert(!setBlockIndexCandidates.empty());
 }
 
+void CChainState::ActivateSnapshotBase(CBlockIndex* pindex, uint64_t chain_tx_count)
+{
+    AssertLockHeld(cs_main);
+    pindex->nChainTx = chain_tx_count;
+    // The snapshot stands in for the validation of the base block and its ancestors.
+    if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+    }
+    chainActive.SetTip(pindex);
+    setBlockIndexCandidates.insert(pindex);
+    PruneBlockIndexCandidates();
+}
+
 /**
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either nullptr or a pointer to a CBlock corresponding to pindexMostWork.
@@ -2559,6 +3191,17 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
         }
         nHeight = nTargetHeight;
 
+        // Have the upcoming blocks read and checked on the pipeline threads,
+        // overlapping with the connection of the ones before them.
+        {
+            std::vector<CBlockIndex*> vpindexAhead;
+            for (CBlockIndex *pindexAhead : reverse_iterate(vpindexToConnect)) {
+                if (pindexAhead == pindexMostWork && pblock) break;
+                vpindexAhead.push_back(pindexAhead);
+            }
+            g_block_pipeline.Prime(vpindexAhead, chainparams.GetConsensus());
+        }
+
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
             if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
@@ -2916,8 +3559,10 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 void CChainState::ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pindexNew, const FlatFilePos& pos, const Consensus::Params& consensusParams)
 {
+    // The chain transaction count of a snapshot base block is known before its ancestors are.
+    const bool is_snapshot_base = pindexNew == g_snapshot_base;
     pindexNew->nTx = block.vtx.size();
-    pindexNew->nChainTx = 0;
+    if (!is_snapshot_base) pindexNew->nChainTx = 0;
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
@@ -2953,7 +3598,7 @@ void CChainState::ReceivedBlockTransactions(const CBlock& block, CBlockIndex* pi
                 mapBlocksUnlinked.erase(it);
             }
         }
-    } else {
+    } else if (!is_snapshot_base) {
         if (pindexNew->pprev && pindexNew->pprev->IsValid(BLOCK_VALID_TREE)) {
             mapBlocksUnlinked.insert(std::make_pair(pindexNew->pprev, pindexNew));
         }
@@ -3040,6 +3685,21 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     return true;
 }
 
+// Compute at which vout of the block's coinbase transaction the witness
+// commitment occurs, or -1 if not found.
+static int GetWitnessCommitmentIndex(const CBlock& block)
+{
+    int commitpos = -1;
+    if (!block.vtx.empty()) {
+        for (size_t o = 0; o < block.vtx[0]->vout.size(); o++) {
+            if (block.vtx[0]->vout[o].scriptPubKey.size() >= 38 && block.vtx[0]->vout[o].scriptPubKey[0] == OP_RETURN && block.vtx[0]->vout[o].scriptPubKey[1] == 0x24 && block.vtx[0]->vout[o].scriptPubKey[2] == 0xaa && block.vtx[0]->vout[o].scriptPubKey[3] == 0x21 && block.vtx[0]->vout[o].scriptPubKey[4] == 0xa9 && block.vtx[0]->vout[o].scriptPubKey[5] == 0xed) {
+                commitpos = o;
+            }
+        }
+    }
+    return commitpos;
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -3053,9 +3713,17 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
         return false;
 
     // Check the merkle root.
+    uint256 hashWitnessMerkleRoot;
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+        uint256 hashMerkleRoot2;
+        if (GetWitnessCommitmentIndex(block) != -1) {
+            // The witness root will be needed by ContextualCheckBlock; build
+            // both trees in one pass.
+            hashMerkleRoot2 = BlockMerkleRoots(block, hashWitnessMerkleRoot, &mutated);
+        } else {
+            hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+        }
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
 
@@ -3073,7 +3741,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     // checks that use witness data may be performed here.
 
     // Size limits
-    if (block.vtx.empty() || block.vtx.size() * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT || ::GetSerializeSize(block, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT)
+    if (block.vtx.empty() || block.vtx.size() * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT || GetBlockStrippedSize(block) * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-length", false, "size limits failed");
 
     // First transaction must be coinbase, the rest must not be
@@ -3097,8 +3765,12 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
 
-    if (fCheckPOW && fCheckMerkleRoot)
+    // The witness root is only kept for a fully checked block, so that it
+    // is never used for transactions other than the ones it was built from.
+    if (fCheckPOW && fCheckMerkleRoot) {
         block.fChecked = true;
+        block.hashWitnessMerkleRoot = hashWitnessMerkleRoot;
+    }
 
     return true;
 }
@@ -3115,21 +3787,6 @@ bool IsNullDummyEnabled(const CBlockIndex* pindexPrev, const Consensus::Params&
     return (VersionBitsState(pindexPrev, params, Consensus::DEPLOYMENT_SEGWIT, versionbitscache) == ThresholdState::ACTIVE);
 }
 
-// Compute at which vout of the block's coinbase transaction the witness
-// commitment occurs, or -1 if not found.
-static int GetWitnessCommitmentIndex(const CBlock& block)
-{
-    int commitpos = -1;
-    if (!block.vtx.empty()) {
-        for (size_t o = 0; o < block.vtx[0]->vout.size(); o++) {
-            if (block.vtx[0]->vout[o].scriptPubKey.size() >= 38 && block.vtx[0]->vout[o].scriptPubKey[0] == OP_RETURN && block.vtx[0]->vout[o].scriptPubKey[1] == 0x24 && block.vtx[0]->vout[o].scriptPubKey[2] == 0xaa && block.vtx[0]->vout[o].scriptPubKey[3] == 0x21 && block.vtx[0]->vout[o].scriptPubKey[4] == 0xa9 && block.vtx[0]->vout[o].scriptPubKey[5] == 0xed) {
-                commitpos = o;
-            }
-        }
-    }
-    return commitpos;
-}
-
 void UpdateUncommittedBlockStructures(CBlock& block, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams)
 {
     int commitpos = GetWitnessCommitmentIndex(block);
@@ -3271,7 +3928,8 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
         int commitpos = GetWitnessCommitmentIndex(block);
         if (commitpos != -1) {
             bool malleated = false;
-            uint256 hashWitness = BlockWitnessMerkleRoot(block, &malleated);
+            // Use the witness root computed by CheckBlock, if it was run.
+            uint256 hashWitness = block.fChecked && !block.hashWitnessMerkleRoot.IsNull() ? block.hashWitnessMerkleRoot : BlockWitnessMerkleRoot(block, &malleated);
             // The malleation check is ignored; as the transaction tree itself
             // already does not permit it, it is impossible to trigger in the
             // witness tree.
@@ -3569,6 +4227,43 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
     return true;
 }
 
+bool TestBlockTemplateValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, const CBlockIndex* pindexPrev, CAmount nFees, int64_t nSigOpsCost)
+{
+    AssertLockHeld(cs_main);
+    assert(pindexPrev && pindexPrev == chainActive.Tip());
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+
+    if (!ContextualCheckBlockHeader(block, state, chainparams, pindexPrev, GetAdjustedTime()))
+        return error("%s: Consensus::ContextualCheckBlockHeader: %s", __func__, FormatStateMessage(state));
+
+    // The checks of CheckBlock that concern the block rather than its
+    // transactions
+    if (block.vtx.empty() || block.vtx.size() * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT || GetBlockStrippedSize(block) * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT)
+        return state.DoS(100, error("%s: size limits failed", __func__), REJECT_INVALID, "bad-blk-length");
+    if (!block.vtx[0]->IsCoinBase())
+        return state.DoS(100, error("%s: first tx is not coinbase", __func__), REJECT_INVALID, "bad-cb-missing");
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        if (block.vtx[i]->IsCoinBase())
+            return state.DoS(100, error("%s: more than one coinbase", __func__), REJECT_INVALID, "bad-cb-multiple");
+    if (!CheckTransaction(*block.vtx[0], state, true))
+        return error("%s: coinbase check failed: %s", __func__, FormatStateMessage(state));
+
+    // The other transactions passed ConnectBlock's checks on mempool
+    // acceptance, against the same chain tip; only their totals remain.
+    if (nSigOpsCost > MAX_BLOCK_SIGOPS_COST)
+        return state.DoS(100, error("%s: too many sigops", __func__), REJECT_INVALID, "bad-blk-sigops");
+    CAmount blockReward = nFees + GetBlockSubsidy(pindexPrev->nHeight + 1, consensusParams);
+    if (block.vtx[0]->GetValueOut() > blockReward)
+        return state.DoS(100, error("%s: coinbase pays too much (actual=%d vs limit=%d)", __func__, block.vtx[0]->GetValueOut(), blockReward), REJECT_INVALID, "bad-cb-amount");
+
+    // Finality, block weight and the witness commitment
+    if (!ContextualCheckBlock(block, state, consensusParams, pindexPrev))
+        return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
+    assert(state.IsValid());
+
+    return true;
+}
+
 /**
  * BLOCK PRUNING CODE
  */
@@ -3624,6 +4319,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         FlatFilePos pos(*it, 0);
+        g_block_file_maps.Erase(BlockFileSeq().FileName(pos));
         fs::remove(BlockFileSeq().FileName(pos));
         fs::remove(UndoFileSeq().FileName(pos));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3777,28 +4473,233 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
     return pindexNew;
 }
 
+/**
+ * The block index snapshot holds all block index entries, parents first, with
+ * the fields stored in the block tree database and their chain work:
+ *
+ * - header: magic, version, stamp and number of entries
+ * - per entry: hash, position of the parent entry, nHeight, nFile, nDataPos,
+ *   nUndoPos, nVersion, hashMerkleRoot, nTime, nBits, nNonce, nStatus, nTx
+ *   and nChainWork
+ * - checksum of the above
+ *
+ * It is only used while the block tree database holds the same stamp, which
+ * every write of block index entries erases.
+ */
+static const char* const BLOCK_INDEX_SNAPSHOT_FILENAME = "blockindex.dat";
+static const uint32_t BLOCK_INDEX_SNAPSHOT_MAGIC = 0x78646962; // "bidx"
+static const uint32_t BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+static const size_t BLOCK_INDEX_SNAPSHOT_HEADER_SIZE = 20;
+static const size_t BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE = 140;
+static const size_t BLOCK_INDEX_SNAPSHOT_CHECKSUM_SIZE = 8;
+static const uint32_t BLOCK_INDEX_SNAPSHOT_NO_PARENT = 0xffffffff;
+
+static fs::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / BLOCK_INDEX_SNAPSHOT_FILENAME;
+}
+
+static uint64_t BlockIndexSnapshotChecksum(const unsigned char* data, size_t size)
+{
+    return CSipHasher(0, 0).Write(data, size).Finalize();
+}
+
+static bool InBlockIndexArena(const CBlockIndex* pindex)
+{
+    return !g_block_index_arena.empty() && !std::less<const CBlockIndex*>()(pindex, &g_block_index_arena.front()) &&
+           !std::less<const CBlockIndex*>()(&g_block_index_arena.back(), pindex);
+}
+
+bool CChainState::LoadBlockIndexSnapshot(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree, std::vector<CBlockIndex*>& entries)
+{
+    uint64_t stamp;
+    if (!gArgs.GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCK_INDEX_SNAPSHOT) || !blocktree.ReadBlockIndexSnapshotStamp(stamp)) {
+        return false;
+    }
+    const fs::path path = GetBlockIndexSnapshotPath();
+    std::unique_ptr<FlatFileMapping> mapping = FlatFileMapping::Map(path);
+    if (!mapping) {
+        LogPrintf("%s: cannot map %s\n", __func__, path.string());
+        return false;
+    }
+    const unsigned char* data = mapping->data();
+    const size_t size = mapping->size();
+    if (size < BLOCK_INDEX_SNAPSHOT_HEADER_SIZE + BLOCK_INDEX_SNAPSHOT_CHECKSUM_SIZE ||
+        ReadLE32(data) != BLOCK_INDEX_SNAPSHOT_MAGIC || ReadLE32(data + 4) != BLOCK_INDEX_SNAPSHOT_VERSION ||
+        ReadLE64(data + 8) != stamp) {
+        LogPrintf("%s: %s does not match the block index database\n", __func__, path.string());
+        return false;
+    }
+    const uint32_t count = ReadLE32(data + 16);
+    if (size != BLOCK_INDEX_SNAPSHOT_HEADER_SIZE + (uint64_t)count * BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE + BLOCK_INDEX_SNAPSHOT_CHECKSUM_SIZE ||
+        ReadLE64(data + size - BLOCK_INDEX_SNAPSHOT_CHECKSUM_SIZE) != BlockIndexSnapshotChecksum(data, size - BLOCK_INDEX_SNAPSHOT_CHECKSUM_SIZE)) {
+        LogPrintf("%s: %s is corrupt\n", __func__, path.string());
+        return false;
+    }
+
+    // Leave the block index empty for the block tree database if the snapshot turns out to be bad.
+    auto discard = [&]() EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+        mapBlockIndex.clear();
+        g_block_index_arena.clear();
+        entries.clear();
+    };
+    assert(mapBlockIndex.empty() && g_block_index_arena.empty());
+    g_block_index_arena.resize(count);
+    mapBlockIndex.reserve(count);
+    entries.reserve(count);
+    const unsigned char* pos = data + BLOCK_INDEX_SNAPSHOT_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; ++i, pos += BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE) {
+        CBlockIndex* pindex = &g_block_index_arena[i];
+        uint256 hash;
+        memcpy(hash.begin(), pos, 32);
+        const auto inserted = mapBlockIndex.emplace(hash, pindex);
+        const uint32_t parent = ReadLE32(pos + 32);
+        if (!inserted.second || (parent != BLOCK_INDEX_SNAPSHOT_NO_PARENT && parent >= i)) {
+            discard();
+            return error("%s: bad entry %u in %s", __func__, i, path.string());
+        }
+        pindex->phashBlock = &inserted.first->first;
+        pindex->pprev = parent == BLOCK_INDEX_SNAPSHOT_NO_PARENT ? nullptr : &g_block_index_arena[parent];
+        pindex->nHeight = ReadLE32(pos + 36);
+        pindex->nFile = ReadLE32(pos + 40);
+        pindex->nDataPos = ReadLE32(pos + 44);
+        pindex->nUndoPos = ReadLE32(pos + 48);
+        pindex->nVersion = ReadLE32(pos + 52);
+        memcpy(pindex->hashMerkleRoot.begin(), pos + 56, 32);
+        pindex->nTime = ReadLE32(pos + 88);
+        pindex->nBits = ReadLE32(pos + 92);
+        pindex->nNonce = ReadLE32(pos + 96);
+        pindex->nStatus = ReadLE32(pos + 100);
+        pindex->nTx = ReadLE32(pos + 104);
+        uint256 chain_work;
+        memcpy(chain_work.begin(), pos + 108, 32);
+        pindex->nChainWork = UintToArith256(chain_work);
+
+        if (!CheckProofOfWork(pindex->GetBlockHash(), pindex->nBits, consensus_params)) {
+            discard();
+            return error("%s: CheckProofOfWork failed for entry %u in %s", __func__, i, path.string());
+        }
+        entries.push_back(pindex);
+    }
+
+    // Whatever happens to the block index from here on, a later startup loads it from the database.
+    if (!blocktree.EraseBlockIndexSnapshotStamp()) {
+        discard();
+        return error("%s: failed to write to the block index database", __func__);
+    }
+    return true;
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+    if (!setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty()) {
+        LogPrintf("%s: the block index has not been written to disk\n", __func__);
+        return false;
+    }
+    const int64_t start_time = GetTimeMillis();
+
+    std::vector<const CBlockIndex*> entries;
+    entries.reserve(mapBlockIndex.size());
+    for (const BlockMap::value_type& entry : mapBlockIndex) {
+        entries.push_back(entry.second);
+    }
+    std::sort(entries.begin(), entries.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+
+    const uint64_t stamp = GetRand(std::numeric_limits<uint64_t>::max());
+    std::vector<unsigned char> data(BLOCK_INDEX_SNAPSHOT_HEADER_SIZE + entries.size() * BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE + BLOCK_INDEX_SNAPSHOT_CHECKSUM_SIZE);
+    WriteLE32(&data[0], BLOCK_INDEX_SNAPSHOT_MAGIC);
+    WriteLE32(&data[4], BLOCK_INDEX_SNAPSHOT_VERSION);
+    WriteLE64(&data[8], stamp);
+    WriteLE32(&data[16], entries.size());
+    std::unordered_map<const CBlockIndex*, uint32_t> positions;
+    positions.reserve(entries.size());
+    unsigned char* pos = &data[BLOCK_INDEX_SNAPSHOT_HEADER_SIZE];
+    for (const CBlockIndex* pindex : entries) {
+        memcpy(pos, pindex->GetBlockHash().begin(), 32);
+        WriteLE32(pos + 32, pindex->pprev ? positions.at(pindex->pprev) : BLOCK_INDEX_SNAPSHOT_NO_PARENT);
+        WriteLE32(pos + 36, pindex->nHeight);
+        WriteLE32(pos + 40, pindex->nFile);
+        WriteLE32(pos + 44, pindex->nDataPos);
+        WriteLE32(pos + 48, pindex->nUndoPos);
+        WriteLE32(pos + 52, pindex->nVersion);
+        memcpy(pos + 56, pindex->hashMerkleRoot.begin(), 32);
+        WriteLE32(pos + 88, pindex->nTime);
+        WriteLE32(pos + 92, pindex->nBits);
+        WriteLE32(pos + 96, pindex->nNonce);
+        WriteLE32(pos + 100, pindex->nStatus);
+        WriteLE32(pos + 104, pindex->nTx);
+        const uint256 chain_work = ArithToUint256(pindex->nChainWork);
+        memcpy(pos + 108, chain_work.begin(), 32);
+        const uint32_t position = positions.size();
+        positions.emplace(pindex, position);
+        pos += BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE;
+    }
+    WriteLE64(pos, BlockIndexSnapshotChecksum(data.data(), pos - data.data()));
+
+    // Replace the file before the stamp, so that a crash in between leaves a stale snapshot.
+    const fs::path path = GetBlockIndexSnapshotPath();
+    const fs::path path_new = path.string() + ".new";
+    FILE* file = fsbridge::fopen(path_new, "wb");
+    if (!file) {
+        return error("%s: failed to create %s", __func__, path_new.string());
+    }
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size() && FileCommit(file);
+    fclose(file);
+    if (!written || !RenameOver(path_new, path)) {
+        return error("%s: failed to write %s", __func__, path.string());
+    }
+    if (!pblocktree->WriteBlockIndexSnapshotStamp(stamp)) {
+        return error("%s: failed to write to block index database", __func__);
+    }
+    LogPrintf("Wrote a block index snapshot of %u entries in %dms\n", entries.size(), GetTimeMillis() - start_time);
+    return true;
+}
+
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
-    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
+    const int64_t load_start_time = GetTimeMillis();
+    std::vector<CBlockIndex*> sorted_by_height;
+    const bool from_snapshot = LoadBlockIndexSnapshot(consensus_params, blocktree, sorted_by_height);
+    if (!from_snapshot && !blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
         return false;
+    LogPrintf("%s: loaded %u block index entries from the %s in %dms\n", __func__, mapBlockIndex.size(),
+        from_snapshot ? "block index snapshot" : "block tree database", GetTimeMillis() - load_start_time);
+
+    // While the chainstate is based on a UTXO snapshot that has not been
+    // validated, the ancestors of its base block may be missing, so the
+    // base block's nChainTx comes from the snapshot.
+    SnapshotMetadata snapshot;
+    CBlockIndex* snapshot_base = nullptr;
+    if (blocktree.ReadSnapshot(snapshot)) {
+        BlockMap::const_iterator it = mapBlockIndex.find(snapshot.m_base_blockhash);
+        if (it == mapBlockIndex.end()) {
+            return error("%s: base block %s of the UTXO snapshot is missing", __func__, snapshot.m_base_blockhash.ToString());
+        }
+        snapshot_base = it->second;
+    }
 
-    // Calculate nChainWork
-    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+    // Calculate nChainWork, unless the snapshot had it. The snapshot's entries
+    // are already ordered parents first.
+    const int64_t link_start_time = GetTimeMillis();
+    if (!from_snapshot) {
+        sorted_by_height.reserve(mapBlockIndex.size());
+        for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex) {
+            sorted_by_height.push_back(item.second);
+        }
+        std::sort(sorted_by_height.begin(), sorted_by_height.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
+    for (CBlockIndex* pindex : sorted_by_height)
     {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        if (!from_snapshot) {
+            pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        }
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
-        if (pindex->nTx > 0) {
+        if (pindex == snapshot_base && !pindex->pprev->HaveTxsDownloaded()) {
+            pindex->nChainTx = snapshot.m_chain_tx_count;
+        } else if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->HaveTxsDownloaded()) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -3824,6 +4725,16 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
             pindexBestHeader = pindex;
     }
 
+    LogPrintf("%s: linked the block index in %dms\n", __func__, GetTimeMillis() - link_start_time);
+
+    if (snapshot_base) {
+        g_snapshot_base = snapshot_base;
+        g_snapshot_metadata = snapshot;
+        g_snapshot_validated = false;
+        LogPrintf("%s: chainstate is based on the UTXO snapshot at block %s (height %d), which has not been validated yet\n",
+            __func__, snapshot_base->GetBlockHash().ToString(), snapshot_base->nHeight);
+    }
+
     return true;
 }
 
@@ -3851,6 +4762,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
 
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
+    const int64_t check_start_time = GetTimeMillis();
     std::set<int> setBlkDataFiles;
     for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
     {
@@ -3866,6 +4778,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
             return false;
         }
     }
+    LogPrintf("%s: checked %u blk files in %dms\n", __func__, setBlkDataFiles.size(), GetTimeMillis() - check_start_time);
 
     // Check whether we have ever pruned block & undo files
     pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
@@ -3957,6 +4870,11 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
+        if (g_snapshot_base && !g_snapshot_validated && pindex->nHeight <= g_snapshot_base->nHeight) {
+            // Blocks below an unvalidated UTXO snapshot have no undo data yet.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (UTXO snapshot base)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -4122,6 +5040,12 @@ bool CChainState::RewindBlockIndex(const CChainParams& params)
 
     int nHeight = 1;
     while (nHeight <= chainActive.Height()) {
+        // Blocks below a UTXO snapshot that have not been downloaded yet are
+        // validated with witnesses once they are.
+        if (g_snapshot_base && nHeight <= g_snapshot_base->nHeight && !(chainActive[nHeight]->nStatus & BLOCK_HAVE_DATA)) {
+            nHeight++;
+            continue;
+        }
         // Although SCRIPT_VERIFY_WITNESS is now generally enforced on all
         // blocks in ConnectBlock, we don't need to go back and
         // re-download/re-verify blocks from before segwit actually activated.
@@ -4251,10 +5175,16 @@ void UnloadBlockIndex()
     }
 
     for (const BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
+        if (!InBlockIndexArena(entry.second)) delete entry.second;
     }
     mapBlockIndex.clear();
+    g_block_index_arena.clear();
+    g_block_index_arena.shrink_to_fit();
     fHavePruned = false;
+    g_snapshot_base = nullptr;
+    g_snapshot_validated = false;
+    g_snapshot_validation_height = -1;
+    g_snapshot_metadata = SnapshotMetadata();
 
     g_chainstate.UnloadBlockIndex();
 }
@@ -4474,6 +5404,10 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
     CBlockIndex* pindexFirstNotTransactionsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+    // The UTXO snapshot stands in for the blocks below its base: the base and
+    // its descendants are checked as if those had all been received and
+    // validated. The values from below the base are restored when leaving it.
+    std::array<CBlockIndex*, 5> below_snapshot_base{};
     while (pindex != nullptr) {
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
@@ -4483,6 +5417,10 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindex->pprev != nullptr && pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        if (pindex == g_snapshot_base) {
+            below_snapshot_base = {pindexFirstMissing, pindexFirstNeverProcessed, pindexFirstNotTransactionsValid, pindexFirstNotChainValid, pindexFirstNotScriptsValid};
+            pindexFirstMissing = pindexFirstNeverProcessed = pindexFirstNotTransactionsValid = pindexFirstNotChainValid = pindexFirstNotScriptsValid = nullptr;
+        }
 
         // Begin: actual consistency checks.
         if (pindex->pprev == nullptr) {
@@ -4502,7 +5440,8 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
         }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+        // This is pruning-independent. The snapshot base is valid before its data is received.
+        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0) || (pindex == g_snapshot_base && pindex->nTx == 0));
         // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to HaveTxsDownloaded().
         assert((pindexFirstNeverProcessed == nullptr) == pindex->HaveTxsDownloaded());
         assert((pindexFirstNotTransactionsValid == nullptr) == pindex->HaveTxsDownloaded());
@@ -4590,6 +5529,13 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = nullptr;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = nullptr;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = nullptr;
+            if (pindex == g_snapshot_base) {
+                pindexFirstMissing = below_snapshot_base[0];
+                pindexFirstNeverProcessed = below_snapshot_base[1];
+                pindexFirstNotTransactionsValid = below_snapshot_base[2];
+                pindexFirstNotChainValid = below_snapshot_base[3];
+                pindexFirstNotScriptsValid = below_snapshot_base[4];
+            }
             // Find our parent.
             CBlockIndex* pindexPar = pindex->pprev;
             // Find which child we just visited.
@@ -4779,6 +5725,460 @@ bool DumpMempool()
     return true;
 }
 
+/** Directory, relative to the data directory, of the coin database that the chain below a UTXO snapshot is validated with */
+static const char* const SNAPSHOT_VALIDATION_DIR = "chainstate_snapshot_validation";
+
+/** Whether -assumeutxo vouches for a UTXO set with the given MuHash as of the given height. */
+static bool IsAssumedUTXOSet(int height, const uint256& muhash)
+{
+    for (const std::string& arg : gArgs.GetArgs("-assumeutxo")) {
+        const size_t sep = arg.find(':');
+        int32_t arg_height;
+        if (sep == std::string::npos || !ParseInt32(arg.substr(0, sep), &arg_height)) continue;
+        if (arg_height == height && uint256S(arg.substr(sep + 1)) == muhash) return true;
+    }
+    return false;
+}
+
+bool DumpUTXOSnapshot(const fs::path& path, SnapshotMetadata& metadata, std::string& error)
+{
+    int64_t start = GetTimeMicros();
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    std::vector<const CBlockIndex*> chain;
+    {
+        LOCK(cs_main);
+        // The cursor sees the coin database as it is now, so the chain can
+        // move on while the coins are written.
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        const CBlockIndex* base = LookupBlockIndex(pcursor->GetBestBlock());
+        assert(base);
+
+        metadata = SnapshotMetadata();
+        memcpy(metadata.m_network_magic, Params().MessageStart(), sizeof(metadata.m_network_magic));
+        metadata.m_base_blockhash = base->GetBlockHash();
+        metadata.m_base_height = base->nHeight;
+        metadata.m_chain_tx_count = base->nChainTx;
+
+        chain.reserve(base->nHeight);
+        for (const CBlockIndex* pindex = base; pindex->pprev; pindex = pindex->pprev) {
+            chain.push_back(pindex);
+        }
+        std::reverse(chain.begin(), chain.end());
+    }
+
+    const fs::path temp_path = path.string() + ".incomplete";
+    try {
+        CAutoFile file(fsbridge::fopen(temp_path, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            error = strprintf("Unable to open %s for writing", temp_path.string());
+            return false;
+        }
+
+        file << metadata;
+        for (const CBlockIndex* pindex : chain) {
+            file << pindex->GetBlockHeader();
+        }
+
+        MuHash3072 muhash;
+        while (pcursor->Valid()) {
+            if (ShutdownRequested()) {
+                error = "Shutting down";
+                return false;
+            }
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                error = "Unable to read the UTXO set";
+                return false;
+            }
+            file << key << coin;
+            ApplyCoinHash(muhash, key, coin);
+            metadata.m_coins_count++;
+            pcursor->Next();
+        }
+        muhash.Finalize(metadata.m_muhash);
+
+        // All fields of the metadata have a fixed size, so it is filled in in place.
+        if (fseek(file.Get(), 0, SEEK_SET) != 0) {
+            throw std::ios_base::failure("fseek failed");
+        }
+        file << metadata;
+        if (!FileCommit(file.Get())) {
+            throw std::ios_base::failure("FileCommit failed");
+        }
+        file.fclose();
+    } catch (const std::exception& e) {
+        error = strprintf("Failed to write %s: %s", temp_path.string(), e.what());
+        return false;
+    }
+    if (!RenameOver(temp_path, path)) {
+        error = strprintf("Unable to rename %s to %s", temp_path.string(), path.string());
+        return false;
+    }
+
+    LogPrintf("Dumped UTXO snapshot of block %s (height %d, %u coins) to %s: %gs\n", metadata.m_base_blockhash.ToString(),
+        metadata.m_base_height, metadata.m_coins_count, path.string(), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+/** Number of coins of a snapshot added to the chainstate at a time */
+static const size_t SNAPSHOT_LOAD_BATCH = 10000;
+
+/**
+ * Take the coins of a snapshot that failed to load out of the chainstate
+ * again. Before the snapshot, only the genesis block was connected, whose
+ * output is not part of the UTXO set, so every coin goes.
+ */
+static bool UnloadSnapshotCoins()
+{
+    const CChainParams& chainparams = Params();
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        if (!FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS) || (pcoinsdbwriter && !pcoinsdbwriter->Wait())) {
+            return false;
+        }
+    }
+    std::unique_ptr<CCoinsViewCursor> cursor(pcoinsdbview->Cursor());
+    while (cursor->Valid()) {
+        LOCK(cs_main);
+        for (size_t i = 0; i < SNAPSHOT_LOAD_BATCH && cursor->Valid(); ++i, cursor->Next()) {
+            COutPoint outpoint;
+            if (!cursor->GetKey(outpoint)) return false;
+            pcoinsTip->SpendCoin(outpoint);
+        }
+        if (!FlushStateToDisk(chainparams, state, FlushStateMode::IF_NEEDED)) return false;
+    }
+    LOCK(cs_main);
+    // The coins are gone from disk before the flag is cleared
+    if (!FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS) || (pcoinsdbwriter && !pcoinsdbwriter->Wait()) ||
+        !pblocktree->WriteFlag("snapshotloading", false)) {
+        return false;
+    }
+    LogPrintf("Removed the coins of the UTXO snapshot from the chainstate\n");
+    return true;
+}
+
+bool LoadUTXOSnapshot(const fs::path& path, SnapshotMetadata& metadata, std::string& error)
+{
+    int64_t start = GetTimeMicros();
+    const CChainParams& chainparams = Params();
+
+    static Mutex load_mutex;
+    LOCK(load_mutex);
+
+    {
+        LOCK(cs_main);
+        if (fPruneMode) {
+            error = "Loading a UTXO snapshot is not supported in prune mode";
+            return false;
+        }
+        if (g_txindex || g_coin_stats_index) {
+            error = "Loading a UTXO snapshot is not supported with -txindex or -coinstatsindex";
+            return false;
+        }
+        if (g_snapshot_base) {
+            error = "The chainstate is already based on a UTXO snapshot";
+            return false;
+        }
+        if (chainActive.Height() != 0) {
+            error = "A UTXO snapshot can only be loaded before any block but the genesis block is connected";
+            return false;
+        }
+    }
+
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        error = strprintf("Unable to open %s", path.string());
+        return false;
+    }
+    const CBlockIndex* base = nullptr;
+    try {
+        file >> metadata;
+        if (metadata.m_version != SnapshotMetadata::CURRENT_VERSION) {
+            error = strprintf("Unsupported snapshot version %d", metadata.m_version);
+            return false;
+        }
+        if (memcmp(metadata.m_network_magic, chainparams.MessageStart(), sizeof(metadata.m_network_magic)) != 0) {
+            error = "The snapshot was taken on a different network";
+            return false;
+        }
+        if (metadata.m_base_height <= 0) {
+            error = "The snapshot is not based on a block after the genesis block";
+            return false;
+        }
+        if (!IsAssumedUTXOSet(metadata.m_base_height, metadata.m_muhash)) {
+            error = strprintf("The UTXO set of the snapshot (height %d, MuHash %s) is not vouched for by -assumeutxo",
+                metadata.m_base_height, metadata.m_muhash.GetHex());
+            return false;
+        }
+
+        // The headers of the chain, in the batches peers send them in.
+        std::vector<CBlockHeader> headers;
+        for (int height = 1; height <= metadata.m_base_height; height += headers.size()) {
+            headers.resize(std::min(2000, metadata.m_base_height - height + 1));
+            for (CBlockHeader& header : headers) {
+                file >> header;
+            }
+            CValidationState state;
+            if (!ProcessNewBlockHeaders(headers, state, chainparams, &base)) {
+                error = strprintf("Invalid block header in the snapshot: %s", FormatStateMessage(state));
+                return false;
+            }
+        }
+        if (!base || base->GetBlockHash() != metadata.m_base_blockhash) {
+            error = "The block headers of the snapshot do not lead to its base block";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        error = strprintf("Unable to read %s: %s", path.string(), e.what());
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0) {
+            error = "A UTXO snapshot can only be loaded before any block but the genesis block is connected";
+            return false;
+        }
+        if (base->nStatus & BLOCK_FAILED_MASK) {
+            error = "The base block of the snapshot is invalid";
+            return false;
+        }
+        // Until it is complete, a restart must not go on with a partial UTXO set.
+        if (!pblocktree->WriteFlag("snapshotloading", true)) {
+            error = "Failed to write to the block index database";
+            return false;
+        }
+    }
+    // Left over from an earlier snapshot, if any.
+    fs::remove_all(GetDataDir() / SNAPSHOT_VALIDATION_DIR);
+
+    // Add the coins to the chainstate while hashing them, so that what is
+    // checked is exactly what is loaded.
+    try {
+        MuHash3072 muhash;
+        std::vector<std::pair<COutPoint, Coin>> coins;
+        for (uint64_t coins_left = metadata.m_coins_count; coins_left > 0; coins_left -= coins.size()) {
+            if (ShutdownRequested()) {
+                throw std::runtime_error("shutting down");
+            }
+            coins.resize(std::min<uint64_t>(coins_left, SNAPSHOT_LOAD_BATCH));
+            for (auto& entry : coins) {
+                file >> entry.first >> entry.second;
+                if (entry.second.IsSpent() || entry.second.nHeight > (uint32_t)metadata.m_base_height) {
+                    throw std::runtime_error(strprintf("invalid coin %s", entry.first.ToString()));
+                }
+                ApplyCoinHash(muhash, entry.first, entry.second);
+            }
+            LOCK(cs_main);
+            for (auto& entry : coins) {
+                pcoinsTip->AddCoin(entry.first, std::move(entry.second), false);
+            }
+            CValidationState state;
+            if (!FlushStateToDisk(chainparams, state, FlushStateMode::IF_NEEDED)) {
+                error = strprintf("Failed to write the chainstate: %s. Restart with -reindex-chainstate to recover.", FormatStateMessage(state));
+                return false;
+            }
+        }
+        uint256 muhash_final;
+        muhash.Finalize(muhash_final);
+        if (muhash_final != metadata.m_muhash) {
+            throw std::runtime_error(strprintf("the MuHash of its coins is %s, not %s", muhash_final.GetHex(), metadata.m_muhash.GetHex()));
+        }
+    } catch (const std::exception& e) {
+        error = strprintf("Unable to load the coins of %s: %s", path.string(), e.what());
+        if (!UnloadSnapshotCoins()) {
+            error += ". Restart with -reindex-chainstate to recover.";
+        }
+        return false;
+    }
+    file.fclose();
+
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindex = LookupBlockIndex(metadata.m_base_blockhash);
+        pcoinsTip->SetBestBlock(pindex->GetBlockHash());
+        g_chainstate.ActivateSnapshotBase(pindex, metadata.m_chain_tx_count);
+        g_snapshot_base = pindex;
+        g_snapshot_metadata = metadata;
+        g_snapshot_validated = false;
+        g_snapshot_validation_height = -1;
+
+        CValidationState state;
+        if (!pblocktree->WriteSnapshot(metadata) || !FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS) ||
+            !pblocktree->WriteFlag("snapshotloading", false)) {
+            error = "Failed to write the chainstate. Restart with -reindex-chainstate to recover.";
+            return false;
+        }
+    }
+    uiInterface.NotifyBlockTip(IsInitialBlockDownload(), base);
+
+    LogPrintf("Loaded UTXO snapshot of block %s (height %d, %u coins) from %s: %gs\n", metadata.m_base_blockhash.ToString(),
+        metadata.m_base_height, metadata.m_coins_count, path.string(), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+namespace {
+
+CThreadInterrupt g_snapshot_validation_interrupt;
+std::thread g_snapshot_validation_thread;
+
+/**
+ * Write the progress of snapshot validation to disk, after the undo data and
+ * block index it relies on. The chainstate of the tip is left alone.
+ */
+bool FlushSnapshotValidation(CCoinsViewCache& view)
+{
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        if (!WriteBlockIndex(state)) return false;
+    }
+    if (!view.Flush()) {
+        return AbortNode("Failed to write the snapshot validation database");
+    }
+    return true;
+}
+
+/**
+ * Connect the blocks up to the base of the UTXO snapshot the chainstate is
+ * based on to a coin database of their own, as they are downloaded, and
+ * compare the resulting UTXO set to the snapshot. The node is shut down if
+ * they differ.
+ */
+void ThreadValidateSnapshot()
+{
+    const CChainParams& chainparams = Params();
+    const fs::path db_path = GetDataDir() / SNAPSHOT_VALIDATION_DIR;
+    CBlockIndex* base;
+    SnapshotMetadata metadata;
+    {
+        LOCK(cs_main);
+        base = g_snapshot_base;
+        metadata = g_snapshot_metadata;
+    }
+
+    {
+        CCoinsViewDB db(db_path, nMaxCoinsDBCache << 20, false, false);
+        CCoinsViewCache view(&db);
+
+        int height = 0;
+        {
+            LOCK(cs_main);
+            const uint256 best_block = view.GetBestBlock();
+            if (!best_block.IsNull()) {
+                const CBlockIndex* pindex = LookupBlockIndex(best_block);
+                if (!pindex || base->GetAncestor(pindex->nHeight) != pindex) {
+                    AbortNode("The snapshot validation database does not match the UTXO snapshot");
+                    return;
+                }
+                height = pindex->nHeight + 1;
+            }
+            g_snapshot_validation_height = height - 1;
+        }
+        LogPrintf("Validating the chain up to the UTXO snapshot base %s, from height %d\n", base->GetBlockHash().ToString(), height);
+
+        while (height <= base->nHeight && !g_snapshot_validation_interrupt) {
+            CBlockIndex* pindex = base->GetAncestor(height);
+            bool have_data;
+            {
+                LOCK(cs_main);
+                have_data = pindex->nStatus & BLOCK_HAVE_DATA;
+            }
+            if (!have_data) {
+                // Wait for the block to be downloaded.
+                g_snapshot_validation_interrupt.sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+                AbortNode(strprintf("Failed to read block %s from disk", pindex->GetBlockHash().ToString()));
+                return;
+            }
+            {
+                LOCK(cs_main);
+                CValidationState state;
+                if (!g_chainstate.ConnectBlock(block, state, pindex, view, chainparams)) {
+                    AbortNode(strprintf("Block %s below the UTXO snapshot failed to connect: %s", pindex->GetBlockHash().ToString(), FormatStateMessage(state)),
+                        _("The UTXO snapshot could not be validated. Restart with -reindex-chainstate to validate the chain from scratch."));
+                    return;
+                }
+                g_snapshot_validation_height = height;
+            }
+            ++height;
+
+            if (view.DynamicMemoryUsage() > nCoinCacheUsage / 4 && !FlushSnapshotValidation(view)) return;
+        }
+        if (!FlushSnapshotValidation(view)) return;
+        if (height <= base->nHeight) return;
+
+        MuHash3072 muhash;
+        uint64_t coins_count = 0;
+        std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+        for (; pcursor->Valid(); pcursor->Next()) {
+            if (g_snapshot_validation_interrupt) return;
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                AbortNode("Failed to read the snapshot validation database");
+                return;
+            }
+            ApplyCoinHash(muhash, key, coin);
+            coins_count++;
+        }
+        uint256 muhash_final;
+        muhash.Finalize(muhash_final);
+
+        LOCK(cs_main);
+        const uint64_t chain_tx_count = base->pprev->nChainTx + base->nTx;
+        if (muhash_final != metadata.m_muhash || coins_count != metadata.m_coins_count || chain_tx_count != metadata.m_chain_tx_count) {
+            AbortNode(strprintf("The UTXO set as of block %s (MuHash %s, %u coins, %u transactions) does not match the UTXO snapshot (MuHash %s, %u coins, %u transactions)",
+                          base->GetBlockHash().ToString(), muhash_final.GetHex(), coins_count, chain_tx_count,
+                          metadata.m_muhash.GetHex(), metadata.m_coins_count, metadata.m_chain_tx_count),
+                _("The UTXO snapshot is invalid. Restart with -reindex-chainstate to validate the chain from scratch."));
+            return;
+        }
+        if (!pblocktree->EraseSnapshot()) {
+            AbortNode("Failed to write to the block index database");
+            return;
+        }
+        g_snapshot_validated = true;
+    }
+
+    fs::remove_all(db_path);
+    LogPrintf("UTXO snapshot at block %s validated\n", base->GetBlockHash().ToString());
+}
+
+} // namespace
+
+void StartSnapshotValidation()
+{
+    {
+        LOCK(cs_main);
+        if (!g_snapshot_base || g_snapshot_validated) return;
+    }
+    if (g_snapshot_validation_thread.joinable()) return;
+    g_snapshot_validation_interrupt.reset();
+    g_snapshot_validation_thread = std::thread(&TraceThread<std::function<void()>>, "snapshotcheck", std::function<void()>(&ThreadValidateSnapshot));
+}
+
+void InterruptSnapshotValidation()
+{
+    g_snapshot_validation_interrupt();
+}
+
+void StopSnapshotValidation()
+{
+    InterruptSnapshotValidation();
+    if (g_snapshot_validation_thread.joinable()) {
+        g_snapshot_validation_thread.join();
+    }
+}
+
 //! Guess how far we are in the verification process at the given block index
 //! require cs_main if pindex has not been validated yet (because nChainTx might be unset)
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
@@ -35,6 +35,8 @@
 class CBlockIndex;
 class CBlockTreeDB;
 class CChainParams;
+class CBlockUndo;
+class CCoinsViewBackgroundWriter;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
@@ -42,6 +44,8 @@ class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
+class FlatFileSpan;
+class SnapshotMetadata;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -67,6 +71,8 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitclustercount, max number of transactions in a cluster of connected in-mempool transactions */
+static const unsigned int DEFAULT_CLUSTER_LIMIT = 100;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
 /** Maximum kilobytes for transactions to store for processing during reorg */
@@ -78,10 +84,21 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
-/** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+/**
+ * Maximum number of script-checking threads allowed. The effective limit is
+ * lower on machines with few cores, see GetMaxScriptCheckThreads. Every
+ * script-checking thread but the validating one is paired with a coins
+ * prefetch thread (bitcoin-coinspf), so -par=N runs 2 * (N - 1) workers.
+ */
+static const int MAX_SCRIPTCHECK_THREADS = 64;
+/** Number of script-checking threads that is always allowed, regardless of the number of cores */
+static const int MIN_MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -blockpipelinedepth default (number of blocks loaded and checked ahead of the chain tip being connected, 0 = disabled) */
+static const int DEFAULT_BLOCK_PIPELINE_DEPTH = 8;
+/** Maximum value of -blockpipelinedepth */
+static const int MAX_BLOCK_PIPELINE_DEPTH = 64;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -103,6 +120,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Percentage of the coins cache budget that stays in memory after writing a full cache. */
+static const int COINS_CACHE_TRIM_PERCENT = 50;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Block download timeout base, expressed in millionths of the block interval (i.e. 10 min) */
@@ -195,6 +214,8 @@ static const unsigned int NODE_NETWORK_LIMITED_MIN_BLOCKS = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+/** Default for -blockindexsnapshot, whether the block index is loaded from a snapshot written at shutdown */
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = true;
 
 // Require that user allocate at least 550 MiB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
@@ -253,12 +274,73 @@ bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
  * initializing state if we're running with -reindex. */
 bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/**
+ * Write all block index entries to the block index snapshot, which the next
+ * LoadBlockIndex loads instead of reading them from the block tree database.
+ * The block index must have been written to disk.
+ */
+bool WriteBlockIndexSnapshot();
 /** Update the chain tip based on database information. */
 bool LoadChainTip(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the coins prefetching thread */
+void ThreadCoinsPrefetch();
+/**
+ * Resize the pool of validation worker threads, which verify scripts and
+ * prefetch block inputs, so that nThreads threads (including the validating
+ * thread itself) take part in block validation. Values below 2 disable
+ * parallel validation; values above GetMaxScriptCheckThreads() are clamped.
+ * Can be called at any time; returns the resulting number of threads.
+ */
+int SetScriptCheckThreads(int nThreads) LOCKS_EXCLUDED(cs_main);
+/**
+ * Maximum number of script-checking threads on this machine: twice the number
+ * of cores, at least MIN_MAX_SCRIPTCHECK_THREADS and at most
+ * MAX_SCRIPTCHECK_THREADS.
+ */
+int GetMaxScriptCheckThreads();
+/** Stop all validation worker threads */
+void StopScriptCheckThreads() LOCKS_EXCLUDED(cs_main);
+
+/** How script verification for the last connected block was carried out */
+struct ScriptCheckStats {
+    //! Height of the block
+    int height{-1};
+    //! Number of threads (including the validating thread) that verified scripts
+    unsigned int threads_used{0};
+    //! Time spent verifying scripts, summed over all threads (in microseconds)
+    int64_t busy_time{0};
+    //! Wall-clock time from the first input check to the last script verified (in microseconds)
+    int64_t wall_time{0};
+};
+
+/** Return how script verification for the last connected block was carried out */
+ScriptCheckStats GetLastBlockScriptCheckStats() LOCKS_EXCLUDED(cs_main);
+
+/**
+ * Start the block pipeline: while connecting blocks, up to depth blocks
+ * ahead of the one being connected are read from disk and run through
+ * CheckBlock on background threads. 0 disables the pipeline.
+ */
+void StartBlockPipeline(int depth);
+/** Stop the block pipeline threads and drop all blocks loaded ahead */
+void StopBlockPipeline() LOCKS_EXCLUDED(cs_main);
+/**
+ * Start writing undo data of connected blocks to disk on a background thread.
+ * Without it, undo data is written synchronously by ConnectBlock.
+ */
+void StartUndoWriter();
+/** Write out all pending undo data and stop the undo writer thread */
+void StopUndoWriter();
+/**
+ * Warm cache with the coins spent by block, looking up those missing from it
+ * in db on the coins prefetch threads. db must be cache's (thread-safe)
+ * backing store.
+ */
+void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache, const CCoinsView& db);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -301,6 +383,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, const CAmount nAbsurdFee, bool test_accept=false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/** (try to) add a batch of transactions to memory pool, taking the locks
+ * once. Transactions are added after the transactions of the batch they
+ * spend, whatever their order in txs, and the scripts of the whole batch are
+ * verified in parallel on the script check threads. The results are returned
+ * in accepted, states and missing_inputs, in the order of txs. **/
+void AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& txs, std::vector<bool>& accepted,
+                             std::vector<CValidationState>& states, std::vector<bool>& missing_inputs,
+                             bool bypass_limits, const CAmount nAbsurdFee) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -388,8 +479,12 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the undo data of a connected block, from the undo cache or from disk. */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+/** Get the on-disk (witness serialized) bytes of a block, without copying them out of the block file where possible. */
+bool ReadRawBlockFromDisk(FlatFileSpan& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -399,6 +494,14 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 /** Check a block is completely valid from start to finish (only works on top of our current best block) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/** Check the block-level rules for a block template built on top of our
+ *  current best block from mempool transactions only: its size, weight and
+ *  total sigop cost, its coinbase and witness commitment, and the finality of
+ *  its transactions. The transactions are not validated again; nFees and
+ *  nSigOpsCost are their totals as accounted on mempool acceptance (with the
+ *  coinbase's sigop cost included). */
+bool TestBlockTemplateValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, const CBlockIndex* pindexPrev, CAmount nFees, int64_t nSigOpsCost) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** Check whether witness commitments are required for block. */
 bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params);
 
@@ -454,12 +557,24 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Global variable that points to the view writing to the coins database in the background, if any (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewBackgroundWriter> pcoinsdbwriter;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern std::unique_ptr<CBlockTreeDB> pblocktree;
 
+/** Base block of the UTXO snapshot the chainstate is based on, if any (protected by cs_main) */
+extern CBlockIndex* g_snapshot_base;
+
+/** Whether the chain up to g_snapshot_base has been validated and matches the snapshot (protected by cs_main) */
+extern bool g_snapshot_validated;
+
+/** Height up to which the chain below g_snapshot_base has been validated, -1 if none (protected by cs_main) */
+extern int g_snapshot_validation_height;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -491,6 +606,29 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/**
+ * Write the UTXO set as of the chain tip to a snapshot file at path, along
+ * with the headers of the chain up to the tip, and set metadata to describe
+ * it.
+ */
+bool DumpUTXOSnapshot(const fs::path& path, SnapshotMetadata& metadata, std::string& error) LOCKS_EXCLUDED(cs_main);
+
+/**
+ * Load the UTXO set of a snapshot file into the chainstate and make the
+ * snapshot's base block the tip of the active chain. The chainstate must be
+ * at the genesis block, and the snapshot's MuHash must be given with
+ * -assumeutxo. The chain below the base block is validated once
+ * StartSnapshotValidation is called.
+ */
+bool LoadUTXOSnapshot(const fs::path& path, SnapshotMetadata& metadata, std::string& error) LOCKS_EXCLUDED(cs_main);
+
+/** Start validating the chain below g_snapshot_base on a background thread, if it has not been validated yet. */
+void StartSnapshotValidation();
+/** Interrupt snapshot validation, which resumes where it left off once started again. */
+void InterruptSnapshotValidation();
+/** Interrupt snapshot validation and wait for its thread to exit. */
+void StopSnapshotValidation();
+
 //! Check whether the block associated with this index entry is pruned or not.
 inline bool IsBlockPruned(const CBlockIndex* pblockindex)
 {
@@ -60,6 +60,7 @@ class BlockchainTest(BitcoinTestFramework):
         self._test_getblockheader()
         self._test_getdifficulty()
         self._test_getnetworkhashps()
+        self._test_scriptcheckthreads()
         self._test_stopatheight()
         self._test_waitforblockheight()
         assert self.nodes[0].verifychain(4, 0)
@@ -253,6 +254,23 @@ class BlockchainTest(BitcoinTestFramework):
         # This should be 2 hashes every 10 minutes or 1/300
         assert abs(hashes_per_second * 300 - 1) < 0.0001
 
+    def _test_scriptcheckthreads(self):
+        self.log.info("Test setscriptcheckthreads/getscriptcheckinfo")
+        node = self.nodes[0]
+        assert_equal(node.setscriptcheckthreads(4), 4)
+        info = node.getscriptcheckinfo()
+        assert_equal(info['threads'], 4)
+        assert_equal(sorted(info['lastblock'].keys()), ['busy_time', 'height', 'threads_used', 'wall_time'])
+        # One thread means no parallel verification at all
+        assert_equal(node.setscriptcheckthreads(1), 0)
+        assert_equal(node.getscriptcheckinfo()['threads'], 0)
+        assert_equal(node.setscriptcheckthreads(2), 2)
+        # Too many threads are clamped to the limit, which grows with the number of cores
+        max_threads = node.getscriptcheckinfo()['max_threads']
+        assert 16 <= max_threads <= 64
+        assert_equal(node.setscriptcheckthreads(max_threads + 1), max_threads)
+        assert_equal(node.setscriptcheckthreads(2), 2)
+
     def _test_stopatheight(self):
         assert_equal(self.nodes[0].getblockcount(), 200)
         self.nodes[0].generatetoaddress(6, self.nodes[0].get_deterministic_priv_key().address)
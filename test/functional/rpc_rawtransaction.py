@@ -8,6 +8,7 @@ Test the following RPCs:
    - createrawtransaction
    - signrawtransactionwithwallet
    - sendrawtransaction
+   - sendrawtransactions
    - decoderawtransaction
    - getrawtransaction
 """
@@ -201,6 +202,10 @@ class RawTransactionsTest(BitcoinTestFramework):
         # This will raise an exception since there are missing inputs
         assert_raises_rpc_error(-25, "Missing inputs", self.nodes[2].sendrawtransaction, rawtx['hex'])
 
+        # A batch reports the error for each transaction instead
+        txid = self.nodes[2].decoderawtransaction(rawtx['hex'])['txid']
+        assert_equal(self.nodes[2].sendrawtransactions([rawtx['hex']]), [{'txid': txid, 'error': "Missing inputs"}])
+
         #####################################
         # getrawtransaction with block hash #
         #####################################